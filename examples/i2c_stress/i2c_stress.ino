@@ -0,0 +1,165 @@
+/*
+  I2C load generator for the Mega slave (examples/mega_slave_i2c)
+
+  Runs on a second board wired as the only I2C master (a spare NodeMCU or
+  any Arduino). It drives the slave at increasing command rates with a mix
+  of relay, batched relay, door, select and malformed packets, some framed
+  with '\n' and some not, a few two to a transmission (I2cStressMix.h; the
+  native test test_i2c_stress runs the same mix against a host model of
+  the slave). After every step it reads "rxstats" and the status frame and
+  checks that:
+  - the Mega saw exactly the packets that were sent, in order (count and
+    order-sensitive hash, see SlaveRxStats)
+  - the bad-packet count matches the malformed packets sent
+  - the relay outputs match a local model of the commands
+
+  One line per step on Serial (115200):
+    rate/s  sent/s  packets  nack  dropped  drop%  hash  state  isr_avg  isr_max  hold_max
+  rate 0 is back to back. hold_max is the longest endTransmission() seen
+  here: the Mega stretches SCL while receiveEvent() runs, so this is the
+  time a real master is held on the bus.
+
+  Use a bench Mega, not an installed one: relays 1..STRESS_RELAYS and the
+  front door relay switch during the run.
+*/
+#include <Arduino.h>
+#include <Wire.h>
+#include <SlaveStatus.h>
+#include <I2cStressMix.h>
+
+#ifndef STRESS_SLAVE_ADDR
+#define STRESS_SLAVE_ADDR 0x08
+#endif
+#ifndef STRESS_I2C_HZ
+#define STRESS_I2C_HZ 100000
+#endif
+#ifndef STRESS_STEP_COMMANDS
+#define STRESS_STEP_COMMANDS 1000
+#endif
+const uint8_t STRESS_RELAYS = 8;  // must not exceed the Mega's max_relays
+const uint16_t RATES[] = {50, 100, 200, 400, 800, 1600, 3200, 0};
+const uint8_t RATE_COUNT = sizeof(RATES) / sizeof(RATES[0]);
+
+struct StepResult {
+  uint32_t sent;       // transmissions acknowledged
+  uint32_t nacks;      // transmissions the slave refused (not in the model)
+  uint32_t elapsedUs;
+  uint32_t holdMaxUs;
+};
+
+I2cStressMix mix(STRESS_RELAYS, 0x2545F491);
+
+// One transmission; returns Wire's status, the time it held us in holdUs
+uint8_t transmit(const char *msg, size_t len, uint32_t &holdUs) {
+  uint32_t start = micros();
+  Wire.beginTransmission(STRESS_SLAVE_ADDR);
+  Wire.write((const uint8_t *)msg, len);
+  uint8_t rc = Wire.endTransmission();
+  holdUs = micros() - start;
+  return rc;
+}
+
+// Control packets are excluded from the slave's counters
+bool control(const char *cmd) {
+  uint32_t holdUs;
+  return transmit(cmd, strlen(cmd), holdUs) == 0;
+}
+
+bool readRxStats(SlaveRxStats &st) {
+  if (!control("rxstats")) return false;
+  if (Wire.requestFrom(STRESS_SLAVE_ADDR, (int)sizeof(st)) != sizeof(st)) return false;
+  Wire.readBytes((uint8_t *)&st, sizeof(st));
+  return st.magic == SLAVE_RX_MAGIC && st.crc == slaveRxCrc(st);
+}
+
+bool readStatus(SlaveStatus &st) {
+  if (Wire.requestFrom(STRESS_SLAVE_ADDR, (int)sizeof(st)) != sizeof(st)) return false;
+  Wire.readBytes((uint8_t *)&st, sizeof(st));
+  return slaveStatusValid(st);
+}
+
+StepResult runStep(uint16_t rate) {
+  StepResult res = {0, 0, 0, 0};
+  uint32_t intervalUs = rate ? 1000000UL / rate : 0;
+  uint32_t start = micros();
+  uint32_t i = 0;
+  while (i < STRESS_STEP_COMMANDS) {
+    if (intervalUs) {
+      while ((int32_t)(micros() - (start + i * intervalUs)) < 0) {
+      }
+    }
+    char msg[32];
+    uint8_t count;
+    size_t len = mix.next(msg, sizeof(msg), i + 1 == STRESS_STEP_COMMANDS, count);
+    uint32_t holdUs;
+    if (transmit(msg, len, holdUs) == 0) {
+      res.sent += count;
+    } else {
+      res.nacks++;
+      mix.undo();
+    }
+    if (holdUs > res.holdMaxUs) res.holdMaxUs = holdUs;
+    i += count;
+  }
+  res.elapsedUs = micros() - start;
+  return res;
+}
+
+void report(uint16_t rate, const StepResult &res, const SlaveRxStats &rx, const SlaveStatus &st) {
+  const StressModel &model = mix.model();
+  uint32_t sentPerS = (uint64_t)res.sent * 1000000UL / (res.elapsedUs ? res.elapsedUs : 1);
+  uint32_t dropped = model.packets > rx.packets ? model.packets - rx.packets : 0;
+  uint32_t dropPermille = model.packets ? (uint64_t)dropped * 1000 / model.packets : 0;
+  bool hashOk = mix.rxOk(rx);
+  bool stateOk = mix.relaysOk(st);
+  char line[120];
+  snprintf(line, sizeof(line), "%6u %7lu %8lu %5lu %8lu %3lu.%lu %5s %5s %7lu %7u %8lu", rate,
+           (unsigned long)sentPerS, (unsigned long)rx.packets, (unsigned long)res.nacks, (unsigned long)dropped,
+           (unsigned long)(dropPermille / 10), (unsigned long)(dropPermille % 10), hashOk ? "ok" : "BAD",
+           stateOk ? "ok" : "BAD", (unsigned long)(rx.isrCount ? rx.isrTotalUs / rx.isrCount : 0), rx.isrMaxUs,
+           (unsigned long)res.holdMaxUs);
+  Serial.println(line);
+  if (rx.overflows) {
+    snprintf(line, sizeof(line), "       %lu packets dropped by the slave as too long", (unsigned long)rx.overflows);
+    Serial.println(line);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+#ifdef ESP8266
+  Wire.begin(D2, D1);
+#else
+  Wire.begin();
+#endif
+  Wire.setClock(STRESS_I2C_HZ);
+  delay(1000);
+  Serial.println();
+  Serial.println(F("I2C stress: rate/s sent/s packets nack dropped drop% hash state isr_avg isr_max hold_max"));
+
+  uint16_t sustained = 0;
+  for (uint8_t i = 0; i < RATE_COUNT; i++) {
+    mix.reset();
+    if (!control("rxreset")) {
+      Serial.println(F("Slave does not answer, check wiring and STRESS_SLAVE_ADDR"));
+      return;
+    }
+    StepResult res = runStep(RATES[i]);
+    delay(50); // let the slave's loop catch up before the readback
+    SlaveRxStats rx;
+    SlaveStatus st;
+    if (!readRxStats(rx) || !readStatus(st)) {
+      Serial.println(F("Readback failed (slave reset or bus stuck?)"));
+      return;
+    }
+    report(RATES[i], res, rx, st);
+    bool clean = mix.rxOk(rx) && !res.nacks;
+    if (clean && RATES[i] && RATES[i] > sustained) sustained = RATES[i];
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "Highest clean paced rate: %u commands/s", sustained);
+  Serial.println(line);
+}
+
+void loop() {
+}
@@ -1,13 +1,23 @@
 #include <Arduino.h>
-#include <SoftwareSerial.h>
 #include <Adafruit_Fingerprint.h>
 #include <Preferences.h>
 
-// SoftwareSerial for fingerprint sensor (D5=RX, D6=TX)
-SoftwareSerial mySerial(14, 12); // D5, D6
-Adafruit_Fingerprint finger = Adafruit_Fingerprint(&mySerial);
+#include <SoftwareSerial.h>
+#include <FingerprintLink.h>
+
+// Same sensor wiring as the main firmware's front door (D7=RX, D8=TX), but through
+// SoftwareSerial so Serial stays free for the menu
+SoftwareSerial fpSerial(FP_RX_PIN, FP_TX_PIN);
+FingerprintLink fpLink(fpSerial, "softserial");
+Adafruit_Fingerprint finger = Adafruit_Fingerprint(&fpLink);
 
-// Preferences for storing fingerprint names
+// Preferences for storing fingerprint names.
+// Template IDs are per sensor: the main firmware reads "fp_<id>" for the front door and
+// "fp1_<id>" for the back door. Build with -DFP_NAME_PREFIX=\"fp1_\" and wire the back
+// sensor to D7/D8 to manage it.
+#ifndef FP_NAME_PREFIX
+#define FP_NAME_PREFIX "fp_"
+#endif
 Preferences preferences;
 
 // Function declarations
@@ -16,6 +26,7 @@ void createFingerprintEntry();
 void setNamesToFingerprints();
 void showAllActiveFingerprints();
 void deleteFingerprint();
+void showLinkStats();
 int getNextAvailableID();
 bool getFingerprintEnroll(int id);
 int readNumberInput();
@@ -32,7 +43,7 @@ void setup() {
   Serial.println("Initializing fingerprint sensor...");
   
   // Initialize fingerprint sensor
-  mySerial.begin(57600);
+  fpSerial.begin(FP_BAUD);
   
   if (finger.verifyPassword()) {
     Serial.println("✓ Fingerprint sensor found and ready!");
@@ -77,9 +88,10 @@ void fingerprintManagementMenu() {
     Serial.println("2. Set Names To Fingerprints");  
     Serial.println("3. Show All Active Fingerprints");
     Serial.println("4. Delete Fingerprint");
+    Serial.println("5. Sensor Link Statistics");
     Serial.println("0. Exit Menu");
     Serial.println("====================================");
-    Serial.print("Enter your choice (1-4, 0 to exit): ");
+    Serial.print("Enter your choice (1-5, 0 to exit): ");
     
     // Wait for input with timeout
     unsigned long timeout = millis() + 30000; // 30 second timeout
@@ -109,6 +121,8 @@ void fingerprintManagementMenu() {
       showAllActiveFingerprints();
     } else if (choice == "4") {
       deleteFingerprint();
+    } else if (choice == "5") {
+      showLinkStats();
     } else if (choice == "0") {
       Serial.println("Exiting menu...");
       return;
@@ -119,6 +133,23 @@ void fingerprintManagementMenu() {
   }
 }
 
+// Round-trip time and error counters of the sensor link since boot
+void showLinkStats() {
+  fpLink.poll();
+  const FingerprintLinkStats &st = fpLink.stats();
+  Serial.println();
+  Serial.println("=== SENSOR LINK STATISTICS ===");
+  Serial.printf("Backend:   %s @ %d baud\n", fpLink.backendName(), FP_BAUD);
+  Serial.printf("Commands:  %lu\n", (unsigned long)st.commands);
+  Serial.printf("Replies:   %lu\n", (unsigned long)st.replies);
+  Serial.printf("Bad:       %lu\n", (unsigned long)st.badPackets);
+  Serial.printf("Timeouts:  %lu\n", (unsigned long)st.timeouts);
+  Serial.printf("Errors:    %u%%\n", fpLink.errorRate());
+  Serial.printf("RTT avg:   %lu us\n", (unsigned long)fpLink.averageRttUs());
+  Serial.printf("RTT max:   %lu us\n", (unsigned long)st.rttMaxUs);
+  delay(2000);
+}
+
 void createFingerprintEntry() {
   Serial.println();
   Serial.println("=== CREATE FINGERPRINT ENTRY ===");
@@ -162,7 +193,7 @@ void createFingerprintEntry() {
       Serial.print(" is already in use. ");
       
       // Show existing name if available
-      String key = "fp_" + String(id);
+      String key = String(FP_NAME_PREFIX) + String(id);
       String existingName = preferences.getString(key.c_str(), "Unnamed");
       Serial.print("Current name: ");
       Serial.println(existingName);
@@ -212,7 +243,7 @@ void createFingerprintEntry() {
     String name = readStringInput(30000); // 30 second timeout
     
     if (name.length() > 0) {
-      String key = "fp_" + String(id);
+      String key = String(FP_NAME_PREFIX) + String(id);
       preferences.putString(key.c_str(), name);
       Serial.println("✓ Name saved successfully!");
     }
@@ -252,7 +283,7 @@ void setNamesToFingerprints() {
   
   String name = readStringInput(30000);
   if (name.length() > 0) {
-    String key = "fp_" + String(id);
+    String key = String(FP_NAME_PREFIX) + String(id);
     preferences.putString(key.c_str(), name);
     Serial.println("✓ Name updated successfully!");
   } else {
@@ -270,7 +301,7 @@ void showAllActiveFingerprints() {
   for (int i = 1; i <= 162; i++) {
     if (finger.loadModel(i) == FINGERPRINT_OK) {
       count++;
-      String key = "fp_" + String(i);
+      String key = String(FP_NAME_PREFIX) + String(i);
       String name = preferences.getString(key.c_str(), "Unnamed");
       
       Serial.print("ID: ");
@@ -317,7 +348,7 @@ void deleteFingerprint() {
   }
   
   // Get name for confirmation
-  String key = "fp_" + String(id);
+  String key = String(FP_NAME_PREFIX) + String(id);
   String name = preferences.getString(key.c_str(), "Unnamed");
   
   Serial.print("Delete fingerprint ID ");
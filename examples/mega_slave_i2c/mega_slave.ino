@@ -6,48 +6,97 @@
   #include <Arduino.h>
   #include <Wire.h>
   #include <SoftwareSerial.h>
+  #include <LevelDebouncer.h>
+  #include <PumpController.h>
+  #include <DeviceConfig.h>
+  #include <SlaveStatus.h>
+  #include <SlaveCommand.h>
+  #include <SmsAggregator.h>
+  #include <EEPROM.h>
+  // Log lines are queued in RAM and written to Serial from loop(), never from the I2C interrupt.
+  // Build with -DLOG_LEVEL=LOG_LEVEL_TRACE to see every received byte.
+  #define LOG_RING_SIZE 512
+  #include <RingLog.h>
 
+  LOG_DEFINE();
+
+  // SRAM is painted at startup; free/untouched bytes are logged once a minute
+  #include <MemoryWatch.h>
+  MemoryLowWater memWatch;
+  unsigned long lastMemReport = 0;
+
+  // Loop supervisor: the running task is kept in .noinit RAM, which survives a
+  // watchdog reset. Build with -DMEGA_WDT to arm a 4 s watchdog (the bootloader
+  // must clear it after a reset, e.g. Optiboot or a current stk500v2).
+  #include <TaskSupervisor.h>
+  #include <avr/wdt.h>
+  TaskRecord taskRecord __attribute__((section(".noinit")));
+
+  // Counters and histograms for the NodeMCU's metrics snapshot ("metrics:<offset>").
+  // "metrics:0" takes the snapshot the following frames are cut from.
+  #include <Metrics.h>
+  MegaMetrics metrics(MEGA_METRIC_SHIFTS);
+  MegaMetrics::Block metricsSnapshot;
+  volatile uint16_t metricsOffset = 0;
+
+  // 0x08 is the main board. Extra relay expander boards use 0x09, 0x0A, 0x0B and
+  // serve relay IDs 17-32, 33-48, 49-64 on the NodeMCU side (channels 1-16 here).
   const uint8_t SLAVE_ADDR = 0x08;
   
   // SIM800L module setup
   #define SIM800L_TX 18  // Mega TX1 -> SIM800L RX
   #define SIM800L_RX 19  // Mega RX1 -> SIM800L TX
   #define SIM800L_RST 7  // Reset pin (optional)
-  // Set your phone number for SMS alerts (e.g., "+1234567890")
-  const String PHONE_NUMBER = "+YOUR_PHONE_NUMBER_HERE"; // <-- Fill in your number
+  // Phone number, relay pin mapping and polarity live in megaConfig (EEPROM).
+  // Defaults come from MEGA_CONFIG_DEFAULTS; the NodeMCU pushes updates with "cfg:" commands.
+  MegaConfig megaConfig = MEGA_CONFIG_DEFAULTS;
+  // v1 blobs (29 bytes) lived at 0; v2 no longer fits below the boot counter
+  const int LEGACY_CONFIG_EEPROM_ADDR = 0;
+  const int CONFIG_EEPROM_ADDR = 128;
+  bool configReadOnly = false; // blob written by newer firmware: never saved over
+  const int BOOT_COUNT_EEPROM_ADDR = 64; // uint16_t, after the v1 config blob
+  uint16_t bootCount = 0;
+  volatile bool configSavePending = false;
   
   // Use Hardware Serial1 for SIM800L (pins 18,19)
   #define sim800l Serial1
   
-  // SMS spam prevention
-  bool alertSMSSent = false;
-  bool waterEmptySMSSent = false;
-  
-  // SMS State Machine
-  enum SMSState {
-    SMS_IDLE,
-    SMS_SENDING_COMMAND,
-    SMS_WAITING_PROMPT,
-    SMS_SENDING_MESSAGE,
-    SMS_WAITING_RESPONSE
-  };
-  
-  SMSState smsState = SMS_IDLE;
-  String pendingSMSMessage = "";
-  unsigned long smsTimestamp = 0;
-  const unsigned long SMS_TIMEOUT = 10000; // 10 second timeout
+  // Doors served by the NodeMCU: "lock"/"unlock"/"alert" address door 0,
+  // "lock:<n>"/"unlock:<n>"/"alert:<n>" address door n
+  const uint8_t MAX_DOORS = 2;
+
+  // SMS alerts: raised from the I2C handler, collected for megaConfig.smsWindowS and
+  // sent as one digest to every recipient. An alert stays latched (no repeat SMS)
+  // until the door is unlocked or the water is back.
+  enum AlertKind : uint8_t { ALERT_INTRUDER, ALERT_WATER_EMPTY, ALERT_NOTICE };
+  int describeAlert(char *out, size_t size, uint8_t kind, uint8_t source);
+  void smsResult(uint8_t recipient, bool sent, uint32_t ms);
+  SmsAggregator<MAX_DOORS + 2> alerts({15000, 120000}, describeAlert);
+  SmsSession<HardwareSerial> sms(sim800l, smsResult);
+  char smsText[SMS_TEXT_MAX + 1];
+  // Point into megaConfig, which "cfg:" rewrites from the I2C handler: sms.start() copies them
+  const char *const SMS_RECIPIENTS[MEGA_SMS_RECIPIENTS] = {megaConfig.phoneNumber, megaConfig.extraPhone[0],
+                                                           megaConfig.extraPhone[1]};
+  static_assert(MEGA_SMS_RECIPIENTS <= SMS_RECIPIENTS_MAX && sizeof(megaConfig.phoneNumber) <= SMS_NUMBER_MAX &&
+                sizeof(megaConfig.extraPhone[0]) <= SMS_NUMBER_MAX, "SmsSession holds every number whole");
   
   // receive buffer
-  char recvBuf[128];
-  size_t recvLen = 0;
+  SlaveFramer<128> framer;
+
+  // Packets and receiveEvent() timing since the last "rxreset", read back with
+  // "rxstats" (examples/i2c_stress drives the slave and checks these).
+  // Only touched from the Wire interrupt.
+  SlaveRxStats rxStats = {SLAVE_RX_MAGIC, 0, SLAVE_RX_HASH_INIT, 0, 0, 0, 0, 0, 0};
+  #ifdef BENCH_ISR
+  // Log the timing every 10 s; compare a LOG_LEVEL_TRACE build with the default one
+  unsigned long lastIsrReport = 0;
+  #endif
 
   // Relay mapping and state cache
-  const int RELAY_BASE_PIN = 22; // ID 1 -> pin 22, ID 2 -> 23, ...
-  const int MAX_RELAYS = 16; // configurable upper bound
+  // ID 1 -> megaConfig.relayBasePin, ID 2 -> +1, ... up to megaConfig.maxRelays
+  const int MAX_RELAYS = 16; // capacity of the state cache
   bool relayInitialized[MAX_RELAYS + 1] = {false};
   bool relayState[MAX_RELAYS + 1] = {false};
-  // Set true if your relay board activates on LOW (common for some modules)
-  const bool RELAY_ACTIVE_LOW = true; // relays are active-low in your setup
 
 
   // Dedicated water relay
@@ -60,200 +109,198 @@
   const int WATER_SENSOR_PIN = 48; // wired to float/wet sensor; uses INPUT (HIGH = wet)
   bool waterSensorInitialized = false;
   bool waterSensorWet = false; // true = wet, false = dry
-  bool waterRequestedState = false; // last requested desired state from commands
-  unsigned long lastWaterSensorCheck = 0;
-  const unsigned long WATER_SENSOR_CHECK_INTERVAL = 1000; // ms
+  // Written by the Wire ISR; the relay itself is only driven from loop() (updatePump)
+  volatile bool waterRequestedState = false; // last requested desired state from commands
+  volatile bool waterRequestPending = false; // new request since the last updatePump()
+  // Pin 48 has no external/pin-change interrupt, so it is sampled every loop.
+  // Wet after 500 ms net wet, dry after 200 ms net dry (fast dry-run cut-off), hold >= 1 s
+  LevelDebouncer waterDebouncer({500, 200, 1000});
+  // Tank level as last reported by the NodeMCU float (waterempty / waterpresent)
+  volatile bool tankReportedEmpty = false;
+  // Pump safety rules (seconds): min on, min off, max on, cool-down, no-effect fault, pump watts
+  PumpController pump({30, 60, 900, 600, 1800, 370});
+
+  // What the next Wire.requestFrom() from the master returns (status unless selected)
+  enum ReplySelect : uint8_t { REPLY_STATUS, REPLY_PUMP, REPLY_METRICS, REPLY_RX_STATS };
+  volatile ReplySelect replySelect = REPLY_STATUS;
 
   // Forward declaration for receiveEvent function
   void receiveEvent(int howMany);
 
+  // SIM800L bring-up runs as a step task from loop(), so I2C is served meanwhile
+  StepTask simInitTask;
+  bool simInitDone = false;
+  bool simReady = false;
+  uint8_t simInitCmd = 0;
+  const char *const SIM_INIT_COMMANDS[] = {"AT+CREG?", "AT+CSQ", "AT+CMGF=1"}; // network, signal, SMS text mode
+  char simBuf[64];
+  uint8_t simLen = 0;
+  unsigned long simLastByte = 0;
+  unsigned long simInitAt = 0;
+
   // SIM800L Functions
-  void readAndPrintResponse() {
-    String response = "";
-    unsigned long timeout = millis() + 2000;
-    while (millis() < timeout) {
-      if (sim800l.available()) {
-        response += (char)sim800l.read();
-      }
-    }
-    if (response.length() > 0) {
-      Serial.print(F("SIM800L Response: "));
-      Serial.println(response);
+  // Collect whatever the module sent, without waiting
+  void simCollect() {
+    while (sim800l.available()) {
+      char c = sim800l.read();
+      if (simLen < sizeof(simBuf) - 1) simBuf[simLen++] = c;
+      simLastByte = millis();
     }
+    simBuf[simLen] = '\0';
+  }
+
+  void simClear() {
+    simLen = 0;
+    simBuf[0] = '\0';
   }
   
-  void initSIM800L() {
-    Serial.println(F("Initializing SIM800L..."));
+  // Returns true when bring-up has finished (simReady tells whether it worked)
+  bool initSIM800LStep(unsigned long now) {
+    simCollect();
+    STEP_BEGIN(simInitTask);
+    LOG_I("Initializing SIM800L...");
     
     // Initialize reset pin
     pinMode(SIM800L_RST, OUTPUT);
     digitalWrite(SIM800L_RST, HIGH);
-    delay(100);
+    STEP_WAIT_MS(simInitTask, now, 100);
     
     // Hardware reset
-    Serial.println(F("Resetting SIM800L..."));
+    LOG_I("Resetting SIM800L...");
     digitalWrite(SIM800L_RST, LOW);
-    delay(100);
+    STEP_WAIT_MS(simInitTask, now, 100);
     digitalWrite(SIM800L_RST, HIGH);
-    delay(5000); // Wait longer for module to boot
+    STEP_WAIT_MS(simInitTask, now, 5000); // Wait longer for module to boot
     
     // Use 115200 baud rate (confirmed working)
-    Serial.println(F("Starting SIM800L at 115200 baud..."));
+    LOG_I("Starting SIM800L at 115200 baud...");
     sim800l.begin(115200);
-    delay(1000);
+    STEP_WAIT_MS(simInitTask, now, 1000);
     
-    // Clear any existing data
-    while (sim800l.available()) {
-      sim800l.read();
-    }
-    
-    // Test AT command
+    // Clear any existing data, then test AT command
+    simCollect();
+    simClear();
     sim800l.println("AT");
-    delay(1000);
+    STEP_WAIT_MS(simInitTask, now, 4000);
     
-    String response = "";
-    unsigned long timeout = millis() + 3000;
-    while (millis() < timeout) {
-      if (sim800l.available()) {
-        response += (char)sim800l.read();
-      }
-    }
+    LOG_D("AT Response: %s", simBuf);
     
-    Serial.print(F("AT Response: "));
-    Serial.println(response);
-    
-    if (response.indexOf("OK") < 0) {
-      Serial.println(F("❌ Failed to connect to SIM800L at 115200"));
-      return;
+    if (simResult(simBuf, simLen) != SIM_OK) {
+      LOG_E("❌ Failed to connect to SIM800L at 115200");
+      STEP_EXIT(simInitTask);
     }
     
-    Serial.println(F("✅ SIM800L connected at 115200 baud"));
+    LOG_I("✅ SIM800L connected at 115200 baud");
     
-    // Check network registration
-    Serial.println(F("Checking network..."));
-    sim800l.println("AT+CREG?");
-    delay(1000);
-    readAndPrintResponse();
-    
-    // Check signal quality
-    Serial.println(F("Checking signal..."));
-    sim800l.println("AT+CSQ");
-    delay(1000);
-    readAndPrintResponse();
-    
-    // Set text mode for SMS
-    Serial.println(F("Setting SMS text mode..."));
-    sim800l.println("AT+CMGF=1");
-    delay(1000);
-    readAndPrintResponse();
+    for (simInitCmd = 0; simInitCmd < 3; simInitCmd++) {
+      LOG_I("SIM800L: %s", SIM_INIT_COMMANDS[simInitCmd]);
+      simClear();
+      sim800l.println(SIM_INIT_COMMANDS[simInitCmd]);
+      STEP_WAIT_MS(simInitTask, now, 3000);
+      if (simLen > 0) LOG_D("SIM800L Response: %s", simBuf);
+    }
     
-    Serial.println(F("✅ SIM800L initialized successfully"));
+    simClear();
+    simReady = true;
+    LOG_I("✅ SIM800L initialized successfully");
+    STEP_END(simInitTask);
   }
   
-  void sendSMS(String message) {
-    // Only start SMS if not already in progress
-    if (smsState == SMS_IDLE) {
-      Serial.print(F("📱 Queuing SMS: ")); Serial.println(message);
-      pendingSMSMessage = message;
-      smsState = SMS_SENDING_COMMAND;
-      smsTimestamp = millis();
-      
-      // Send AT+CMGS command
-      sim800l.print("AT+CMGS=\"");
-      sim800l.print(PHONE_NUMBER);
-      sim800l.println("\"");
-    } else {
-      Serial.println(F("⚠️ SMS already in progress, skipping"));
+  int describeAlert(char *out, size_t size, uint8_t kind, uint8_t source) {
+    switch (kind) {
+      case ALERT_INTRUDER:
+        if (source == 0) return snprintf(out, size, "Intruder Alert, 3 Maximum attempt is reached");
+        return snprintf(out, size, "Intruder Alert at door %u, Maximum attempt is reached", source + 1);
+      case ALERT_WATER_EMPTY:
+        return snprintf(out, size, "Alert! Water is Empty");
+      default:
+        return snprintf(out, size, "done initialize");
     }
   }
-  
-  void processSMSStateMachine() {
-    switch (smsState) {
-      case SMS_IDLE:
-        // Nothing to do
-        break;
-        
-      case SMS_SENDING_COMMAND:
-        // Wait 2 seconds after sending command, then look for prompt
-        if (millis() - smsTimestamp > 2000) {
-          smsState = SMS_WAITING_PROMPT;
-          Serial.println(F("Looking for > prompt..."));
-        }
-        break;
-        
-      case SMS_WAITING_PROMPT:
-        // Check for > prompt in available data
-        if (sim800l.available()) {
-          char c = sim800l.read();
-          if (c == '>') {
-            Serial.println(F("Got > prompt, sending message"));
-            sim800l.print(pendingSMSMessage);
-            sim800l.write(26); // Ctrl+Z
-            smsState = SMS_WAITING_RESPONSE;
-            smsTimestamp = millis();
-          }
-        }
-        // Timeout check
-        if (millis() - smsTimestamp > 5000) {
-          Serial.println(F("❌ Timeout waiting for prompt"));
-          smsState = SMS_IDLE;
-        }
-        break;
-        
-      case SMS_WAITING_RESPONSE:
-        // Wait for completion, then reset to idle
-        if (millis() - smsTimestamp > 5000) {
-          Serial.println(F("✅ SMS completed"));
-          smsState = SMS_IDLE;
-        }
-        break;
-    }
-    
-    // Global timeout
-    if (smsState != SMS_IDLE && millis() - smsTimestamp > SMS_TIMEOUT) {
-      Serial.println(F("❌ SMS timeout, resetting"));
-      smsState = SMS_IDLE;
-    }
+
+  // Outcome and duration of one recipient of the current digest
+  void smsResult(uint8_t recipient, bool sent, uint32_t ms) {
+    metrics.inc(sent ? MC_SMS_SENT : MC_SMS_FAILED);
+    metrics.observe(MH_SMS_MS, ms);
+    if (sent) LOG_I("✅ SMS to recipient %u sent", recipient + 1);
+    else LOG_E("❌ SMS to recipient %u failed", recipient + 1);
   }
-  
-  void sendStartupSMS(String message) {
-    // Simple SMS for startup (no I2C to disable)
-    Serial.print(F("📱 Startup SMS: ")); Serial.println(message);
-    
-    sim800l.print("AT+CMGS=\"");
-    sim800l.print(PHONE_NUMBER);
-    sim800l.println("\"");
-    delay(2000);
-    sim800l.print(message);
-    delay(100);
-    sim800l.write(26);
-    delay(3000);
-    
-    Serial.println(F("✅ Startup SMS sent"));
+
+  // Window over and the gap since the last digest kept: one SMS per recipient
+  void startAlertDigest() {
+    alerts.configure({megaConfig.smsWindowS * 1000UL, megaConfig.smsGapS * 1000UL});
+    if (!alerts.due(millis())) return;
+    uint8_t count = alerts.digest(smsText, sizeof(smsText), millis());
+    if (!count) return;
+    uint8_t recipients = 0;
+    for (uint8_t i = 0; i < MEGA_SMS_RECIPIENTS; i++) recipients += SMS_RECIPIENTS[i][0] ? 1 : 0;
+    LOG_I("📱 SMS with %u alert(s) to %u recipient(s): %s", count, recipients, smsText);
+    for (uint8_t i = 0; i < recipients; i++) metrics.inc(MC_SMS_QUEUED);
+    sms.start(smsText, SMS_RECIPIENTS, MEGA_SMS_RECIPIENTS, millis());
+  }
+
+  // Log an alert raised from the I2C handler
+  void raiseAlert(uint8_t kind, uint8_t source) {
+    SmsRaise r = alerts.raise(kind, source, millis());
+    if (r == SMS_RAISED) {
+      LOG_W("📱 Alert %u/%u queued for the next SMS", kind, source);
+    } else if (r == SMS_FULL) {
+      LOG_E("❌ Alert %u/%u dropped, no free slot", kind, source);
+    } else {
+      metrics.inc(MC_ALERTS_MERGED);
+      LOG_D("📱 Alert %u/%u %s - not spamming", kind, source, r == SMS_MERGED ? "already queued" : "already sent");
+    }
   }
   
   void readSIM800LResponse() {
     // Only read responses when not actively sending SMS
-    if (smsState != SMS_IDLE) return;
+    if (sms.busy()) return;
     
-    if (sim800l.available()) {
-      String response = sim800l.readString();
-      Serial.print(F("SIM800L: "));
-      Serial.println(response);
+    // Log once the module has been quiet for 50 ms (readString() would block for 1 s)
+    simCollect();
+    if (simLen > 0 && millis() - simLastByte > 50) {
+      LOG_D("SIM800L: %s", simBuf);
+      simClear();
+    }
+  }
+
+  // SIM800L: bring-up, then alert digests and unsolicited responses. Alerts raised
+  // while the modem is down or busy wait in the aggregator.
+  void serviceSIM800L() {
+    if (!simInitDone) {
+      simInitDone = initSIM800LStep(millis());
+      if (simInitDone && simReady) raiseAlert(ALERT_NOTICE, 0);
+      if (simInitDone) simInitAt = millis();
+      return;
     }
+    if (!simReady) {
+      // Bring-up failed: start over a minute later
+      if (millis() - simInitAt > 60000) simInitDone = false;
+      return;
+    }
+    
+    // Non-blocking SMS session, a new digest once it is idle
+    if (!sms.step(millis())) startAlertDigest();
+    
+    // Monitor SIM800L responses only when not actively sending SMS
+    readSIM800LResponse();
   }
 
-  void applyWaterRelay(bool on) {
-    // Remember requested state
+  // Called from the Wire ISR: record the request only, updatePump() applies it
+  void requestWaterRelay(bool on) {
     waterRequestedState = on;
+    waterRequestPending = true;
+  }
 
+  void initWaterRelay() {
     // Lazy init water relay
     if (!waterRelayInitialized) {
       pinMode(WATER_RELAY_PIN, OUTPUT);
-      digitalWrite(WATER_RELAY_PIN, RELAY_ACTIVE_LOW ? HIGH : LOW);
+      digitalWrite(WATER_RELAY_PIN, megaConfig.relayActiveLow ? HIGH : LOW);
       waterRelayInitialized = true;
       waterRelayState = false;
-      Serial.print(F("Initialized water relay pin: ")); Serial.println(WATER_RELAY_PIN);
+      pump.begin(millis());
+      LOG_D("Initialized water relay pin: %d", WATER_RELAY_PIN);
     }
 
     // Lazy init water sensor (if not initialized in setup)
@@ -262,232 +309,468 @@
       waterSensorInitialized = true;
       // With external wiring/high-active sensor, HIGH == wet
       waterSensorWet = (digitalRead(WATER_SENSOR_PIN) == HIGH); // HIGH = wet
-      Serial.print(F("Initialized water sensor pin: ")); Serial.print(WATER_SENSOR_PIN);
-      Serial.print(F(" (wet=")); Serial.print(waterSensorWet ? "true" : "false"); Serial.println(")");
+      waterDebouncer.begin(waterSensorWet, millis());
+      LOG_D("Initialized water sensor pin: %d (wet=%s)", WATER_SENSOR_PIN, waterSensorWet ? "true" : "false");
+    }
+  }
+
+  // Run the pump rule table and drive the water relay from its decision (loop only)
+  void updatePump() {
+    if (waterRequestPending) {
+      waterRequestPending = false;
+      initWaterRelay();
     }
+    if (!waterRelayInitialized) return;
 
-    // Actual hardware state only allowed when sensor reports wet
-    bool actualOn = on && waterSensorWet;
+    PumpState before = pump.currentState();
+    bool actualOn = pump.update({waterRequestedState, waterSensorWet, tankReportedEmpty}, millis());
+    PumpState after = pump.currentState();
 
-    if (waterRelayState == actualOn) {
-      // If the requested change couldn't be applied due to dry sensor, log once
-      if (on && !waterSensorWet) {
-        Serial.println(F("⚠️ Water sensor dry - cannot turn water relay ON; keeping OFF"));
+    if (before != after) {
+      LOG_I("Pump state: %s -> %s", PumpController::stateName(before), PumpController::stateName(after));
+      if (after == PUMP_FAULT_DRY) {
+        LOG_W("⚠️ Water sensor dry - water relay forced OFF");
       }
-      return;
     }
 
+    if (waterRelayState == actualOn) return;
+
     waterRelayState = actualOn;
-    digitalWrite(WATER_RELAY_PIN, (actualOn ^ RELAY_ACTIVE_LOW) ? HIGH : LOW);
-    Serial.print(F("Water relay (pin ")); Serial.print(WATER_RELAY_PIN); Serial.print(F(") set to ")); Serial.println(actualOn ? "ON" : "OFF");
+    digitalWrite(WATER_RELAY_PIN, (actualOn ^ megaConfig.relayActiveLow) ? HIGH : LOW);
+    LOG_I("Water relay (pin %d) set to %s", WATER_RELAY_PIN, actualOn ? "ON" : "OFF");
   }
 
-  // Poll water sensor and re-evaluate water relay when sensor changes
+  // Sample water sensor and re-evaluate water relay when the debounced state changes
   void updateWaterSensorIfNeeded() {
     if (!waterSensorInitialized) return;
-    if (millis() - lastWaterSensorCheck < WATER_SENSOR_CHECK_INTERVAL) return;
-    lastWaterSensorCheck = millis();
 
-  // HIGH == wet, LOW == dry
-  bool nowWet = (digitalRead(WATER_SENSOR_PIN) == HIGH);
-    if (nowWet == waterSensorWet) return; // no change
+    // HIGH == wet, LOW == dry
+    if (!waterDebouncer.poll(digitalRead(WATER_SENSOR_PIN) == HIGH, millis())) return;
 
-    waterSensorWet = nowWet;
-    Serial.print(F("Water sensor changed: ")); Serial.println(waterSensorWet ? "WET" : "DRY");
+    waterSensorWet = waterDebouncer.state();
+    LOG_I("Water sensor changed: %s", waterSensorWet ? "WET" : "DRY");
 
-    // Re-evaluate requested state: if previously requested ON and sensor now wet, this will turn it ON
-    // If sensor becomes dry, this will ensure relay is turned OFF regardless of request
-    applyWaterRelay(waterRequestedState);
+    // Sensor change is picked up by the pump rules on the next updatePump() call
   }
 
-  // Unlock relay (pin 53) - default ON, payload "unlock" turns it OFF
-  const int UNLOCK_RELAY_PIN = 53;
-  bool unlockRelayInitialized = false;
-  bool unlockRelayState = true; // default ON
+  // Unlock relays, one per door (front pin 53, back pin 51) - default ON, "unlock" turns it OFF
+  const int UNLOCK_RELAY_PINS[MAX_DOORS] = {53, 51};
+  bool unlockRelayInitialized[MAX_DOORS] = {false};
+  bool unlockRelayState[MAX_DOORS] = {true, true}; // default ON
 
-  void applyUnlockRelay(bool on) {
-    if (!unlockRelayInitialized) {
-      pinMode(UNLOCK_RELAY_PIN, OUTPUT);
+  void applyUnlockRelay(uint8_t door, bool on) {
+    int pin = UNLOCK_RELAY_PINS[door];
+    if (!unlockRelayInitialized[door]) {
+      pinMode(pin, OUTPUT);
       // Default ON at startup
-      digitalWrite(UNLOCK_RELAY_PIN, (true ^ RELAY_ACTIVE_LOW) ? HIGH : LOW);
-      unlockRelayInitialized = true;
-      unlockRelayState = true;
-      Serial.print(F("Initialized unlock relay pin: ")); Serial.println(UNLOCK_RELAY_PIN);
+      digitalWrite(pin, (true ^ megaConfig.relayActiveLow) ? HIGH : LOW);
+      unlockRelayInitialized[door] = true;
+      unlockRelayState[door] = true;
+      LOG_D("Initialized unlock relay pin: %d (door %u)", pin, door);
     }
-    if (unlockRelayState == on) return;
-    unlockRelayState = on;
-    digitalWrite(UNLOCK_RELAY_PIN, (on ^ RELAY_ACTIVE_LOW) ? HIGH : LOW);
-    Serial.print(F("Unlock relay (pin ")); Serial.print(UNLOCK_RELAY_PIN); Serial.print(F(") set to ")); Serial.println(on ? "ON" : "OFF");
+    if (unlockRelayState[door] == on) return;
+    unlockRelayState[door] = on;
+    digitalWrite(pin, (on ^ megaConfig.relayActiveLow) ? HIGH : LOW);
+    LOG_I("Unlock relay (pin %d, door %u) set to %s", pin, door, on ? "ON" : "OFF");
   }
 
-  // Apply a relay command to hardware: id -> pin (RELAY_BASE_PIN + id - 1)
+  // Apply a relay command to hardware: id -> pin (relayBasePin + id - 1)
   void applyRelayCommand(uint16_t id, bool on) {
-    if (id < 1 || id > MAX_RELAYS) return;
-    int pin = RELAY_BASE_PIN + (id - 1);
+    if (id < 1 || id > megaConfig.maxRelays) return;
+    int pin = megaConfig.relayBasePin + (id - 1);
     // Initialize pin mode on first use
     if (!relayInitialized[id]) {
       pinMode(pin, OUTPUT);
     // initialize to OFF with correct polarity
-    digitalWrite(pin, RELAY_ACTIVE_LOW ? HIGH : LOW);
+    digitalWrite(pin, megaConfig.relayActiveLow ? HIGH : LOW);
       relayInitialized[id] = true;
       relayState[id] = false;
-      Serial.print(F("Initialized relay pin: ")); Serial.print(pin); Serial.print(F(" for id=")); Serial.println(id);
+      LOG_D("Initialized relay pin: %d for id=%u", pin, id);
     }
 
     if (relayState[id] == on) return; // no change
     relayState[id] = on;
-    digitalWrite(pin, (on ^ RELAY_ACTIVE_LOW) ? HIGH : LOW);
-    Serial.print(F("Relay id=")); Serial.print(id); Serial.print(F(" -> pin ")); Serial.print(pin);
-    Serial.print(F(" set to ")); Serial.println(on ? "ON" : "OFF");
+    digitalWrite(pin, (on ^ megaConfig.relayActiveLow) ? HIGH : LOW);
+    metrics.inc(MC_RELAY_WRITES);
+    LOG_I("Relay id=%u -> pin %d set to %s", id, pin, on ? "ON" : "OFF");
   }
 
-  // Simple packet processing - just handle "id:state" format
-  void processPacket(const char *packet, size_t len) {
-    String p = String(packet);
-    p.trim();
-    if (p.length() == 0) return;
+  void saveConfig() {
+    if (configReadOnly) {
+      LOG_W("Config stored by newer firmware - not saved");
+      return;
+    }
+    uint8_t blob[sizeof(ConfigHeader) + sizeof(MegaConfig)];
+    size_t n = configEncode(megaConfig, MEGA_CONFIG_VERSION, blob, sizeof(blob));
+    for (size_t i = 0; i < n; i++) EEPROM.update(CONFIG_EEPROM_ADDR + i, blob[i]);
+    LOG_I("Config saved to EEPROM");
+  }
 
-    Serial.print(F("packet raw: '")); Serial.print(p); Serial.println('\'');
+  // Load the config blob from EEPROM (a v1 blob from the old address is moved);
+  // falls back to defaults if missing or corrupt
+  void loadConfig() {
+    uint8_t blob[sizeof(ConfigHeader) + 255]; // any stored length, newer versions included
+    for (size_t i = 0; i < sizeof(blob); i++) blob[i] = EEPROM.read(CONFIG_EEPROM_ADDR + i);
+    ConfigStatus status = configDecode(blob, sizeof(blob), MEGA_CONFIG_VERSION, megaConfig, MEGA_CONFIG_DEFAULTS);
+    if (status == CONFIG_DEFAULTS) {
+      for (size_t i = 0; i < sizeof(blob); i++) blob[i] = EEPROM.read(LEGACY_CONFIG_EEPROM_ADDR + i);
+      status = configDecode(blob, sizeof(blob), MEGA_CONFIG_VERSION, megaConfig, MEGA_CONFIG_DEFAULTS);
+    }
+    if (megaConfig.maxRelays > MAX_RELAYS) megaConfig.maxRelays = MAX_RELAYS;
+    configReadOnly = status == CONFIG_NEWER;
+    if (status == CONFIG_MIGRATED) saveConfig();
+    LOG_I("Config: %s", configStatusName(status));
+  }
 
-    // Handle special commands first
-    if (p.equalsIgnoreCase("lock")) {
-      applyUnlockRelay(true);
+  // "+" and digits only: the number is sent inside AT+CMGS="...". An extra
+  // recipient may be set to "" to remove it.
+  void setPhoneNumber(char (&dst)[20], const SlaveCommand &cmd, bool allowEmpty) {
+    uint8_t len = cmd.valueLen;
+    uint8_t i = (len && cmd.value[0] == '+') ? 1 : 0;
+    bool ok = (len >= i + 3 || (allowEmpty && len == 0)) && len < sizeof(dst);
+    for (; ok && i < len; i++) ok = cmd.value[i] >= '0' && cmd.value[i] <= '9';
+    if (!ok) {
+      LOG_W("⚠️ Phone number rejected");
       return;
     }
-    if (p.equalsIgnoreCase("unlock")) {
-      applyUnlockRelay(false);
-      // Reset alert SMS flag when system is unlocked (valid access)
-      if (alertSMSSent) {
-        Serial.println(F("🔓 System unlocked - resetting alert SMS flag"));
-        alertSMSSent = false;
-      }
+    memcpy(dst, cmd.value, len);
+    dst[len] = '\0';
+  }
+
+  // "cfg:key=value" from the NodeMCU; "cfg:save" persists (deferred to loop, EEPROM is slow).
+  // Values are checked before they are taken: a relay pin past the board, or a
+  // phone number carrying AT command text, is refused.
+  void applyConfigCommand(const SlaveCommand &cmd) {
+    if (!cmd.value) {
+      configSavePending = true;
       return;
     }
-    if (p.equalsIgnoreCase("waterempty")) {
-      applyWaterRelay(true);
-      if (!waterEmptySMSSent) {
-        Serial.println(F("💧 WATER EMPTY - Sending alert SMS"));
-        sendSMS("Alert! Water is Empty");
-        Serial.println(F("✅ Water empty SMS queued"));
-        waterEmptySMSSent = true;
-      } else {
-        Serial.println(F("💧 Water empty SMS already sent - not spamming"));
+    uint32_t n;
+    if (scEquals(cmd.key, cmd.keyLen, "base")) {
+      // New pin mapping is used for relays initialized from now on (all of them after restart)
+      if (!scParseUint(cmd.value, cmd.valueLen, 10, NUM_DIGITAL_PINS - megaConfig.maxRelays, n)) {
+        LOG_W("⚠️ Relay base pin out of range");
+        return;
       }
-      return;
+      megaConfig.relayBasePin = (uint8_t)n;
+    } else if (scEquals(cmd.key, cmd.keyLen, "max")) {
+      if (!scParseUint(cmd.value, cmd.valueLen, 10, MAX_RELAYS, n) || n < 1) n = MAX_RELAYS;
+      if (megaConfig.relayBasePin + n > NUM_DIGITAL_PINS) n = NUM_DIGITAL_PINS - megaConfig.relayBasePin;
+      megaConfig.maxRelays = (uint8_t)n;
+    } else if (scEquals(cmd.key, cmd.keyLen, "low")) {
+      megaConfig.relayActiveLow = (scParseUint(cmd.value, cmd.valueLen, 10, 0xFFFF, n) && n) ? 1 : 0;
+    } else if (scEquals(cmd.key, cmd.keyLen, "phone")) {
+      setPhoneNumber(megaConfig.phoneNumber, cmd, false);
+    } else if (scEquals(cmd.key, cmd.keyLen, "phone2")) {
+      setPhoneNumber(megaConfig.extraPhone[0], cmd, true);
+    } else if (scEquals(cmd.key, cmd.keyLen, "phone3")) {
+      setPhoneNumber(megaConfig.extraPhone[1], cmd, true);
+    } else if (scEquals(cmd.key, cmd.keyLen, "smswin")) {
+      if (scParseUint(cmd.value, cmd.valueLen, 10, 0xFF, n)) megaConfig.smsWindowS = (uint8_t)n;
+    } else if (scEquals(cmd.key, cmd.keyLen, "smsgap")) {
+      if (scParseUint(cmd.value, cmd.valueLen, 10, 0xFFFF, n)) megaConfig.smsGapS = (uint16_t)n;
+    } else {
+      LOG_W("⚠️ Unknown config key: %.*s", cmd.keyLen, cmd.key);
     }
-    if (p.equalsIgnoreCase("waterpresent")) {
-      applyWaterRelay(false);
-      // Reset water empty SMS flag when water is present again
-      if (waterEmptySMSSent) {
-        Serial.println(F("💧 Water is present again - resetting SMS flag"));
-        waterEmptySMSSent = false;
-      }
+  }
+
+  // One command from the NodeMCU (runs in the Wire receive interrupt)
+  void processPacket(const char *packet, size_t len) {
+    SlaveCommand cmd;
+    uint8_t kind = parseSlaveCommand(packet, len, MAX_DOORS, cmd);
+    if (kind == SC_EMPTY) return;
+    metrics.inc(MC_I2C_RX);
+
+    LOG_D("packet raw: '%s'", packet);
+
+    if (kind == SC_RX_STATS) {
+      // Master follows up with Wire.requestFrom(SLAVE_ADDR, sizeof(SlaveRxStats))
+      replySelect = REPLY_RX_STATS;
       return;
     }
-    if (p.equalsIgnoreCase("alert")) {
-      if (!alertSMSSent) {
-        Serial.println(F("🚨 ALERT RECEIVED - Sending intruder SMS"));
-        sendSMS("Intruder Alert, 3 Maximum attempt is reached");
-        Serial.println(F("✅ Alert SMS queued"));
-        alertSMSSent = true;
-      } else {
-        Serial.println(F("🚨 Alert SMS already sent - not spamming"));
-      }
+    if (kind == SC_RX_RESET) {
+      rxStats.packets = rxStats.bad = rxStats.overflows = 0;
+      rxStats.isrCount = rxStats.isrTotalUs = rxStats.isrMaxUs = 0;
+      rxStats.hash = SLAVE_RX_HASH_INIT;
       return;
     }
+    while (len && (packet[len - 1] == '\n' || packet[len - 1] == '\r')) len--;
+    rxStats.packets++;
+    rxStats.hash = slaveRxHash(rxStats.hash, packet, len);
 
-    // Parse simple "id:state" format (e.g., "1:1", "2:0")
-    int sep = p.indexOf(':');
-    if (sep != -1) {
-      String idStr = p.substring(0, sep);
-      String stateStr = p.substring(sep + 1);
-      idStr.trim(); 
-      stateStr.trim();
-      
-      uint16_t id = (uint16_t)idStr.toInt();
-      
-      Serial.print("Relay command id="); Serial.print(id);
-      Serial.print(" state='"); Serial.print(stateStr); Serial.println("'");
-      
-      if (id >= 1 && id <= MAX_RELAYS) {
-        bool on = (stateStr == "1");
-        applyRelayCommand(id, on);
-      } else {
-        Serial.print(F("⚠️ Relay id out of range: ")); Serial.println(id);
-      }
-      return;
+    switch (kind) {
+      case SC_LOCK:
+        applyUnlockRelay(cmd.door, true);
+        break;
+      case SC_UNLOCK:
+        applyUnlockRelay(cmd.door, false);
+        // Re-arm the intruder SMS when the door is unlocked (valid access)
+        if (alerts.clear(ALERT_INTRUDER, cmd.door)) {
+          LOG_I("🔓 Door %d unlocked - resetting alert SMS flag", cmd.door);
+        }
+        break;
+      case SC_WATER_EMPTY:
+        tankReportedEmpty = true;
+        requestWaterRelay(true);
+        LOG_W("💧 WATER EMPTY");
+        raiseAlert(ALERT_WATER_EMPTY, 0);
+        break;
+      case SC_WATER_PRESENT:
+        tankReportedEmpty = false;
+        requestWaterRelay(false);
+        // Re-arm the water empty SMS when water is present again
+        if (alerts.clear(ALERT_WATER_EMPTY, 0)) {
+          LOG_I("💧 Water is present again - resetting SMS flag");
+        }
+        break;
+      case SC_PUMP_STATS:
+        // Master follows up with Wire.requestFrom(SLAVE_ADDR, sizeof(PumpReport))
+        replySelect = REPLY_PUMP;
+        break;
+      case SC_METRICS:
+        // Master follows up with Wire.requestFrom(SLAVE_ADDR, sizeof(MetricsFrame))
+        metricsOffset = cmd.id;
+        if (metricsOffset == 0) metrics.take(metricsSnapshot);
+        replySelect = REPLY_METRICS;
+        break;
+      case SC_ALERT:
+        LOG_W("🚨 ALERT RECEIVED (door %d)", cmd.door);
+        raiseAlert(ALERT_INTRUDER, cmd.door);
+        break;
+      case SC_RELAY_MASK:
+        // Batched relay update from the NodeMCU bus manager
+        for (uint8_t ch = 1; ch <= MAX_RELAYS; ch++) {
+          uint16_t bit = 1U << (ch - 1);
+          if (cmd.mask & bit) applyRelayCommand(ch, (cmd.values & bit) != 0);
+        }
+        break;
+      case SC_CONFIG:
+        applyConfigCommand(cmd);
+        break;
+      case SC_RELAY:
+        LOG_D("Relay command id=%u state=%u", cmd.id, cmd.on);
+        if (cmd.id <= megaConfig.maxRelays) {
+          applyRelayCommand(cmd.id, cmd.on);
+        } else {
+          LOG_W("⚠️ Relay id out of range: %u", cmd.id);
+          metrics.inc(MC_I2C_BAD);
+        }
+        break;
+      default:
+        LOG_W("Malformed packet: '%s'", packet);
+        metrics.inc(MC_I2C_BAD);
+        rxStats.bad++;
     }
+  }
 
-    // If we reach here the packet couldn't be parsed
-    Serial.print(F("Malformed packet: '")); Serial.print(p); Serial.println('\'');
+  void endPacket() {
+    const char *packet = framer.packet();
+    if (!packet) {
+      LOG_W("Packet over %u bytes dropped", (unsigned)framer.MAX_LEN);
+      metrics.inc(MC_I2C_BAD);
+      rxStats.overflows++;
+    } else {
+      processPacket(packet, framer.length());
+    }
+    framer.next();
   }
 
   void receiveEvent(int howMany) {
-    Serial.print(F("onReceive howMany=")); Serial.println(howMany);
+    unsigned long isrStart = micros();
+    LOG_T("onReceive howMany=%d", howMany);
     while (Wire.available()) {
       int b = Wire.read();
-      char c = (char)b;
-      Serial.print(F(" recv byte: 0x")); Serial.print(b, HEX); Serial.print(F(" '")); Serial.print(c); Serial.println('\'');
-      // store until newline or buffer full
-      if (recvLen < sizeof(recvBuf) - 1) {
-        recvBuf[recvLen++] = c;
-      }
-      // if newline received, process packet
-      if (c == '\n') {
-        recvBuf[recvLen] = '\0';
-        processPacket(recvBuf, recvLen);
-        recvLen = 0;
-      }
+      LOG_T(" recv byte: 0x%02X '%c'", b, (char)b);
+      // a newline ends the packet
+      if (framer.push((char)b)) endPacket();
     }
     // If the master sent a transmission without a trailing newline, treat the
     // available bytes as a complete packet (common when sender uses Wire.write without '\n').
-    if (recvLen > 0) {
-      recvBuf[recvLen] = '\0';
-      processPacket(recvBuf, recvLen);
-      recvLen = 0;
+    if (framer.pending()) endPacket();
+    unsigned long isrUs = micros() - isrStart;
+    if (isrUs > rxStats.isrMaxUs) rxStats.isrMaxUs = isrUs > 0xFFFF ? 0xFFFF : isrUs;
+    rxStats.isrTotalUs += isrUs;
+    rxStats.isrCount++;
+  }
+  // Readback frame for the master's reconciliation loop
+  SlaveStatus buildStatus() {
+    SlaveStatus st;
+    st.magic = SLAVE_STATUS_MAGIC;
+    st.version = SLAVE_STATUS_VERSION;
+    st.bootCount = bootCount;
+    st.relayMask = 0;
+    st.relayKnown = 0;
+    for (uint8_t id = 1; id <= MAX_RELAYS; id++) {
+      if (relayState[id]) st.relayMask |= 1U << (id - 1);
+      if (relayInitialized[id]) st.relayKnown |= 1U << (id - 1);
     }
+    st.flags = (waterSensorWet ? SLAVE_FLAG_WATER_WET : 0) |
+               (waterRelayState ? SLAVE_FLAG_WATER_RELAY : 0) |
+               (unlockRelayState[0] ? SLAVE_FLAG_UNLOCK_RELAY : 0) |
+               (unlockRelayState[1] ? SLAVE_FLAG_UNLOCK_RELAY2 : 0) |
+               (tankReportedEmpty ? SLAVE_FLAG_TANK_EMPTY : 0) |
+               ((alerts.latched(ALERT_INTRUDER, 0) || alerts.latched(ALERT_INTRUDER, 1)) ? SLAVE_FLAG_ALERT_SENT : 0) |
+               (alerts.latched(ALERT_WATER_EMPTY, 0) ? SLAVE_FLAG_WATER_SENT : 0);
+    st.smsState = sms.state();
+    st.crc = slaveStatusCrc(st);
+    return st;
   }
+
+  // Master read: reply with whatever the last select command asked for, then fall back to status
+  void requestEvent() {
+    if (replySelect == REPLY_PUMP) {
+      PumpReport r = pump.report();
+      Wire.write((const uint8_t *)&r, sizeof(r));
+    } else if (replySelect == REPLY_METRICS) {
+      MetricsFrame f;
+      metricsFrame(&metricsSnapshot, sizeof(metricsSnapshot), MEGA_METRICS_LAYOUT, metricsOffset, f);
+      Wire.write((const uint8_t *)&f, sizeof(f));
+    } else if (replySelect == REPLY_RX_STATS) {
+      rxStats.crc = slaveRxCrc(rxStats);
+      Wire.write((const uint8_t *)&rxStats, sizeof(rxStats));
+    } else {
+      SlaveStatus st = buildStatus();
+      Wire.write((const uint8_t *)&st, sizeof(st));
+    }
+    replySelect = REPLY_STATUS;
+  }
+
+  // Blocking drain, only for setup() where nothing else is waiting
+  void logFlush() {
+    while (shLog.used()) shLog.drain(Serial);
+  }
+
+  // SRAM headroom: current gap and bytes the stack/heap have never touched
+  void reportMemory() {
+    if (millis() - lastMemReport < 60000) return;
+    lastMemReport = millis();
+    uint16_t freeNow = memFreeNow();
+    MemorySample m = {freeNow, freeNow, memStackUnused()};
+    memWatch.sample(m);
+    metrics.set(MG_SRAM_FREE, freeNow);
+    metrics.set(MG_SRAM_MIN, memWatch.lowest().freeHeap);
+    LOG_I("🧠 SRAM free %u (min %lu), never used %u", freeNow,
+          (unsigned long)memWatch.lowest().freeHeap, (unsigned)m.freeStack);
+  }
+
+  // Config received over I2C is written here, outside the receive interrupt
+  void saveConfigIfPending() {
+    if (configSavePending) {
+      configSavePending = false;
+      saveConfig();
+    }
+  }
+
+  void drainLog() {
+    // Write out whatever fits in the Serial TX buffer without waiting
+    shLog.drain(Serial);
+  }
+
+  void reportTaskOverruns();
+
+  #ifdef BENCH_ISR
+  void reportIsrTiming() {
+    if (millis() - lastIsrReport < 10000) return;
+    lastIsrReport = millis();
+    noInterrupts();
+    unsigned long count = rxStats.isrCount, total = rxStats.isrTotalUs, maxUs = rxStats.isrMaxUs;
+    interrupts();
+    if (count == 0) return;
+    LOG_I("⏱️ receiveEvent since rxreset: %lu calls, avg %lu us, max %lu us (log level %d, %lu dropped)",
+          count, total / count, maxUs, LOG_LEVEL, shLog.dropped());
+  }
+  #endif
+
+  void runReports() {
+  #ifdef BENCH_ISR
+    reportIsrTiming();
+  #endif
+    reportMemory();
+    reportTaskOverruns();
+  }
+
+  // Loop tasks in run order, each with the longest acceptable single call (us)
+  const TaskSpec LOOP_TASKS[] = {
+    // Poll water sensor so that relay respects wet/dry status
+    {"water", updateWaterSensorIfNeeded, 2000},
+    {"pump", updatePump, 2000},
+    {"config", saveConfigIfPending, 300000}, // EEPROM writes take ~3.3 ms per byte
+    {"sim", serviceSIM800L, 20000},
+    {"reports", runReports, 5000},
+    {"log", drainLog, 5000},
+  };
+  void persistTaskRecord(const TaskRecord &rec) {
+    taskRecord = rec;
+  }
+  uint32_t supervisorClock() {
+    return micros();
+  }
+  TaskSupervisor<sizeof(LOOP_TASKS) / sizeof(LOOP_TASKS[0])> supervisor(LOOP_TASKS, supervisorClock, persistTaskRecord);
+
+  void reportTaskOverruns() {
+    uint8_t id;
+    uint32_t us;
+    if (supervisor.takeOverrun(id, us)) {
+      LOG_W("⏱️ Task %s took %lu us", supervisor.name(id), (unsigned long)us);
+    }
+  }
+
   void setup() {
+    // Power-on, brown-out and reset button are clean resets; anything else
+    // (watchdog, or flags cleared by the bootloader) is attributed to a task
+    uint8_t resetFlags = MCUSR;
+    MCUSR = 0;
+  #ifdef MEGA_WDT
+    wdt_disable();
+  #endif
     Serial.begin(57600);
     while (!Serial) ;
-    Serial.println("Mega I2C Slave starting...");
+    LOG_I("Mega I2C Slave starting...");
+    loadConfig();
+    EEPROM.get(BOOT_COUNT_EEPROM_ADDR, bootCount);
+    bootCount++;
+    EEPROM.put(BOOT_COUNT_EEPROM_ADDR, bootCount);
+    LOG_I("Boot count: %u", bootCount);
 
-    // Initialize SIM800L first
-    initSIM800L();
-    
-    // Try to send startup SMS (don't block if it fails)
-    sendStartupSMS("done initialize");
-    Serial.println(F("⚠️ Startup SMS sent - continuing with normal operation"));
+    TaskRecord prevTasks = taskRecord;
+    uint8_t crashed = supervisor.begin(prevTasks, !(resetFlags & (_BV(PORF) | _BV(BORF) | _BV(EXTRF))));
+    if (crashed != TASK_NONE) {
+      LOG_E("💥 Reset inside task %s (%u so far)", supervisor.name(crashed), supervisor.record().resets);
+    }
+
+    // SIM800L bring-up and the startup SMS run from loop()
     
     Wire.begin(SLAVE_ADDR); // join I2C bus as slave
     Wire.onReceive(receiveEvent);
+    Wire.onRequest(requestEvent);
 
-    Serial.print("Listening on I2C address 0x");
-    Serial.print(SLAVE_ADDR, HEX);
-    Serial.println(" as slave.");
+    LOG_I("Listening on I2C address 0x%02X as slave.", SLAVE_ADDR);
 
-    // Ensure unlock relay is ON by default
-    applyUnlockRelay(true);
+    // Ensure unlock relays are ON by default
+    for (uint8_t d = 0; d < MAX_DOORS; d++) applyUnlockRelay(d, true);
   // Initialize water sensor (optional pin init). Uses INPUT; sensor should drive HIGH when wet.
   pinMode(WATER_SENSOR_PIN, INPUT);
   waterSensorInitialized = true;
   waterSensorWet = (digitalRead(WATER_SENSOR_PIN) == HIGH);
-  Serial.print(F("Water sensor initial (pin " )); Serial.print(WATER_SENSOR_PIN); Serial.print(F(") wet=")); Serial.println(waterSensorWet ? "true" : "false");
+  waterDebouncer.begin(waterSensorWet, millis());
+  LOG_I("Water sensor initial (pin %d) wet=%s", WATER_SENSOR_PIN, waterSensorWet ? "true" : "false");
   
-  Serial.println("=== MEGA SLAVE READY ===");
+  LOG_I("=== MEGA SLAVE READY ===");
+  logFlush();
+  #ifdef MEGA_WDT
+    wdt_enable(WDTO_4S);
+  #endif
   }
 
   void loop() {
-    // Poll water sensor so that relay respects wet/dry status
-    updateWaterSensorIfNeeded();
-    
-    // Non-blocking SMS state machine processing
-    processSMSStateMachine();
-    
-    // Monitor SIM800L responses only when not actively sending SMS
-    if (smsState == SMS_IDLE) {
-      readSIM800LResponse();
+    unsigned long passStart = micros();
+    for (uint8_t i = 0; i < supervisor.count(); i++) {
+  #ifdef MEGA_WDT
+      wdt_reset();
+  #endif
+      supervisor.run(i);
     }
+    metrics.observe(MH_LOOP_US, micros() - passStart);
     
     delay(10); // Reduced delay for more responsive SMS state machine
   }
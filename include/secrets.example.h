@@ -17,6 +17,17 @@
 // Optional: Phone number for SMS alerts (Mega SIM800L)
 #define PHONE_NUMBER "+1234567890"
 
+// Optional: token for the local access history endpoint (http://<ip>/history, sent
+// in the X-History-Token header); the endpoint is off when this is not defined.
+// Plain HTTP on the LAN only: do not forward port 80 to the NodeMCU.
+// #define HISTORY_TOKEN "choose-a-long-random-string"
+
+// Required for over-the-air updates: public key whose private half signs the
+// images (signing.py of the ESP8266 core); without it OTA requests are refused
+// #define OTA_PUBLIC_KEY "-----BEGIN PUBLIC KEY-----\n...\n-----END PUBLIC KEY-----\n"
+// Optional: SHA-1 fingerprint of the HTTPS update server's certificate
+// #define OTA_TLS_FINGERPRINT "AA BB CC ..."
+
 // Optional: Other device-specific constants
 // #define DEVICE_ID "fingerprint_door_001"
 
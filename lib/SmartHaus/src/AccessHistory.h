@@ -0,0 +1,348 @@
+/***************************************************
+  AccessHistory - local access log with an index
+  - one 16-byte AccessRecord per scan in a ring of
+    CAPACITY slots (seq 1 in slot 0). Store is
+    anything with read(offset, buf, len) returning the
+    bytes read and write(offset, buf, len): a LittleFS
+    file on the NodeMCU, a byte array on a host
+  - every record links to the previous record of the
+    same user (door + finger ID), a failed scan to the
+    previous failure. RAM holds the chain heads and the
+    first record of each of the last DAYS days
+  - add() writes one record and updates the index in
+    place; rebuild() recovers the index from the ring
+    in one pass at boot
+  - query() walks a user's chain, a day's range or the
+    whole ring newest first and hands out one record at
+    a time, so a page goes straight from flash to the
+    client. It returns the cursor of the next page
+  - a page reads at most HISTORY_SCAN_MAX records, so a
+    filter that matches little costs more pages, not a
+    long stall
+  - HistoryNameCache keeps the user names of one page,
+    so a page of one user's scans costs one name lookup
+  - historyTokenMatches() checks the endpoint's token in
+    constant time
+
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_ACCESS_HISTORY_H
+#define SMARTHAUS_ACCESS_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HISTORY_GRANTED   0x01
+#define HISTORY_PREV_LOST 0x02   // chain head was evicted: older records of this user need a scan
+#define HISTORY_FAIL_KEY  0xFFFF
+#define HISTORY_SCAN_MAX  512
+#define HISTORY_NAME_MAX  24    // with the NUL
+
+struct __attribute__((packed)) AccessRecord {
+  uint32_t seq;        // 1, 2, ... across reboots; 0 = empty slot
+  uint32_t epoch;      // 0 = wall clock unknown at the scan
+  uint32_t prevSeq;    // previous record with the same key, 0 = none
+  uint16_t fingerId;   // 0 for a failed scan
+  uint8_t door;
+  uint8_t flags;       // HISTORY_*
+};
+
+struct HistoryQuery {
+  int16_t door;        // -1 = any
+  int32_t fingerId;    // -1 = any; with door set, walks that user's chain
+  bool failedOnly;     // walks the failure chain
+  uint16_t day;        // 0 = any, else historyDay() of the local date
+  uint32_t from;       // cursor from the previous page, 0 = newest
+  uint8_t limit;
+};
+
+typedef void (*HistoryEmitFn)(const AccessRecord &r, void *ctx);
+
+inline uint16_t historyKey(uint8_t door, bool granted, uint16_t fingerId) {
+  return granted ? (uint16_t)(door << 12 | (fingerId & 0x0FFF)) : HISTORY_FAIL_KEY;
+}
+
+// Local days since 1970-01-01, 0 for an unknown time
+inline uint16_t historyDay(uint32_t epoch, int32_t utcOffsetS) {
+  return epoch ? (uint16_t)(((int64_t)epoch + utcOffsetS) / 86400) : 0;
+}
+
+// "YYYY-MM-DD" -> historyDay() of that date
+inline bool historyDayFromDate(const char *s, uint16_t &day) {
+  for (uint8_t i = 0; i < 10; i++) {
+    bool digit = s[i] >= '0' && s[i] <= '9';
+    if ((i == 4 || i == 7) ? s[i] != '-' : !digit) return false;
+  }
+  if (s[10]) return false;
+  int32_t y = (s[0] - '0') * 1000 + (s[1] - '0') * 100 + (s[2] - '0') * 10 + (s[3] - '0');
+  uint8_t m = (s[5] - '0') * 10 + (s[6] - '0');
+  uint8_t d = (s[8] - '0') * 10 + (s[9] - '0');
+  if (y < 1970 || m < 1 || m > 12 || d < 1 || d > 31) return false;
+  // Days from civil (proleptic Gregorian)
+  y -= m <= 2;
+  int32_t era = y / 400;
+  uint32_t yoe = (uint32_t)(y - era * 400);
+  uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int32_t days = era * 146097 + (int32_t)doe - 719468;
+  if (days <= 0 || days > 0xFFFF) return false;
+  day = (uint16_t)days;
+  return true;
+}
+
+// Does the token sent match the secret? The time taken depends only on the
+// secret's length, not on how much of it a guess got right. An empty secret
+// matches nothing.
+inline bool historyTokenMatches(const char *given, size_t givenLen, const char *secret) {
+  size_t n = strlen(secret);
+  uint8_t diff = givenLen != n;
+  for (size_t i = 0; i < n; i++) diff |= (uint8_t)secret[i] ^ (uint8_t)(i < givenLen ? given[i] : 0);
+  return n && !diff;
+}
+
+// User names for one page of records. A name lookup is a flash read
+// (Preferences on the NodeMCU) and a page mostly repeats a few users; with
+// more than N of them the oldest entry is replaced.
+template <uint8_t N>
+class HistoryNameCache {
+public:
+  typedef void (*LookupFn)(uint8_t door, uint16_t fingerId, char *out, size_t size);
+
+  explicit HistoryNameCache(LookupFn lookup) : lookup(lookup) {}
+
+  const char *name(uint8_t door, uint16_t fingerId) {
+    for (uint8_t i = 0; i < count; i++) {
+      if (entries[i].door == door && entries[i].fingerId == fingerId) return entries[i].name;
+    }
+    Entry &e = entries[count < N ? count++ : replace++ % N];
+    e.door = door;
+    e.fingerId = fingerId;
+    e.name[0] = '\0';
+    lookup(door, fingerId, e.name, sizeof(e.name));
+    e.name[sizeof(e.name) - 1] = '\0';
+    lookups++;
+    return e.name;
+  }
+
+  uint16_t lookupCount() const { return lookups; }
+
+private:
+  struct Entry {
+    uint8_t door;
+    uint16_t fingerId;
+    char name[HISTORY_NAME_MAX];
+  };
+
+  LookupFn lookup;
+  Entry entries[N];
+  uint8_t count = 0;
+  uint8_t replace = 0;
+  uint16_t lookups = 0;
+};
+
+template <typename Store, uint32_t CAPACITY, uint8_t USERS = 64, uint8_t DAYS = 32>
+class AccessHistory {
+public:
+  AccessHistory(Store &store, int32_t utcOffsetS) : store(store), utcOffset(utcOffsetS) {}
+
+  // Rebuild the index from whatever the store holds
+  void rebuild() {
+    newest = 0;
+    failHead = 0;
+    userCount = dayCount = 0;
+    usersEvicted = false;
+    AccessRecord chunk[16];
+    for (uint32_t slot = 0; slot < CAPACITY; slot += 16) {
+      uint32_t want = CAPACITY - slot < 16 ? CAPACITY - slot : 16;
+      size_t got = store.read(slot * sizeof(AccessRecord), chunk, want * sizeof(AccessRecord));
+      uint32_t n = got / sizeof(AccessRecord);
+      for (uint32_t i = 0; i < n; i++) {
+        const AccessRecord &r = chunk[i];
+        if (!r.seq || (r.seq - 1) % CAPACITY != slot + i) continue;
+        if (r.seq > newest) newest = r.seq;
+        noteHead(keyOf(r), r.seq);
+        noteDay(historyDay(r.epoch, utcOffset), r.seq, false);
+      }
+      if (n < want) break; // store ends here: the ring has not wrapped yet
+    }
+  }
+
+  bool add(uint8_t door, bool granted, uint16_t fingerId, uint32_t epoch) {
+    AccessRecord r;
+    r.seq = newest + 1;
+    r.epoch = epoch;
+    r.fingerId = granted ? fingerId : 0;
+    r.door = door;
+    r.flags = granted ? HISTORY_GRANTED : 0;
+    uint16_t key = keyOf(r);
+    uint32_t *head = findHead(key);
+    r.prevSeq = head ? *head : 0;
+    if (!head && usersEvicted) r.flags |= HISTORY_PREV_LOST;
+    if (!store.write(slotOffset(r.seq), &r, sizeof(r))) return false;
+    newest = r.seq;
+    noteHead(key, r.seq);
+    noteDay(historyDay(epoch, utcOffset), r.seq, true);
+    return true;
+  }
+
+  // Emit up to q.limit matching records, newest first. Returns the cursor for
+  // the next page (q.from), 0 when there is nothing older.
+  uint32_t query(const HistoryQuery &q, HistoryEmitFn emit, void *ctx) {
+    uint32_t lo = oldest();
+    bool chain = false;
+    uint16_t key = 0;
+    uint32_t seq = newest;
+    if (q.failedOnly || (q.door >= 0 && q.fingerId >= 0)) {
+      key = q.failedOnly ? HISTORY_FAIL_KEY : historyKey(q.door, true, q.fingerId);
+      uint32_t *head = findHead(key);
+      if (head) {
+        chain = true;
+        seq = *head;
+      } else if (!usersEvicted) {
+        return 0; // never seen
+      }
+    }
+    if (q.from) seq = q.from;
+    if (q.day && !chain) {
+      uint32_t dlo, dhi;
+      if (dayRange(q.day, dlo, dhi)) {
+        if (dlo > lo) lo = dlo;
+        if (seq > dhi) seq = dhi;
+      } else if (dayCount == DAYS && q.day < days[0].day) {
+        // Older than the index: scan
+      } else {
+        return 0;
+      }
+    }
+
+    uint8_t sent = 0;
+    uint16_t reads = 0;
+    while (seq && seq >= lo && seq <= newest) {
+      if (sent == q.limit || reads++ == HISTORY_SCAN_MAX) return seq;
+      AccessRecord r;
+      if (store.read(slotOffset(seq), &r, sizeof(r)) != sizeof(r) || r.seq != seq) return 0;
+      if (matches(q, r)) {
+        emit(r, ctx);
+        sent++;
+      }
+      uint16_t day = historyDay(r.epoch, utcOffset);
+      if (q.day && day && day < q.day) return 0; // time only runs forward through the ring
+      if (chain && keyOf(r) != key) chain = false; // cursor from a scanned page
+      if (chain && !(r.flags & HISTORY_PREV_LOST)) {
+        seq = r.prevSeq;
+      } else {
+        chain = false;
+        seq--;
+      }
+    }
+    return 0;
+  }
+
+  uint32_t newestSeq() const { return newest; }
+  uint32_t oldest() const { return newest > CAPACITY ? newest - CAPACITY + 1 : 1; }
+  uint32_t count() const { return newest ? newest - oldest() + 1 : 0; }
+
+private:
+  struct UserHead {
+    uint16_t key;
+    uint32_t head;
+  };
+  struct DayStart {
+    uint16_t day;
+    uint32_t first;
+  };
+
+  static uint32_t slotOffset(uint32_t seq) { return ((seq - 1) % CAPACITY) * sizeof(AccessRecord); }
+
+  static uint16_t keyOf(const AccessRecord &r) {
+    return historyKey(r.door, r.flags & HISTORY_GRANTED, r.fingerId);
+  }
+
+  bool matches(const HistoryQuery &q, const AccessRecord &r) const {
+    bool granted = r.flags & HISTORY_GRANTED;
+    if (q.door >= 0 && r.door != q.door) return false;
+    if (q.failedOnly && granted) return false;
+    if (q.fingerId >= 0 && (!granted || r.fingerId != q.fingerId)) return false;
+    return !q.day || historyDay(r.epoch, utcOffset) == q.day;
+  }
+
+  uint32_t *findHead(uint16_t key) {
+    if (key == HISTORY_FAIL_KEY) return failHead ? &failHead : nullptr;
+    for (uint8_t i = 0; i < userCount; i++) {
+      if (users[i].key == key) return &users[i].head;
+    }
+    return nullptr;
+  }
+
+  // Newest record of key; a full table gives up the user seen least recently
+  void noteHead(uint16_t key, uint32_t seq) {
+    uint32_t *head = findHead(key);
+    if (head) {
+      if (seq > *head) *head = seq;
+      return;
+    }
+    if (key == HISTORY_FAIL_KEY) {
+      failHead = seq;
+      return;
+    }
+    uint8_t slot = userCount;
+    if (userCount == USERS) {
+      slot = 0;
+      for (uint8_t i = 1; i < USERS; i++) {
+        if (users[i].head < users[slot].head) slot = i;
+      }
+      if (users[slot].head > seq) return;
+      usersEvicted = true;
+    } else {
+      userCount++;
+    }
+    users[slot].key = key;
+    users[slot].head = seq;
+  }
+
+  // First record of each day, ascending by day. add() only ever appends a
+  // later day; rebuild() sees the ring out of order.
+  void noteDay(uint16_t day, uint32_t seq, bool appending) {
+    if (!day) return;
+    uint8_t i = 0;
+    while (i < dayCount && days[i].day < day) i++;
+    if (i < dayCount && days[i].day == day) {
+      if (seq < days[i].first) days[i].first = seq;
+      return;
+    }
+    if (appending && i < dayCount) return; // clock stepped back: stays in the later day's range
+    if (dayCount == DAYS) {
+      if (i == 0) return; // older than everything kept
+      memmove(days, days + 1, (i - 1) * sizeof(DayStart));
+      i--;
+    } else {
+      memmove(days + i + 1, days + i, (dayCount - i) * sizeof(DayStart));
+      dayCount++;
+    }
+    days[i].day = day;
+    days[i].first = seq;
+  }
+
+  bool dayRange(uint16_t day, uint32_t &lo, uint32_t &hi) const {
+    for (uint8_t i = 0; i < dayCount; i++) {
+      if (days[i].day != day) continue;
+      lo = days[i].first;
+      hi = i + 1 < dayCount ? days[i + 1].first - 1 : newest;
+      return true;
+    }
+    return false;
+  }
+
+  Store &store;
+  int32_t utcOffset;
+  uint32_t newest = 0;
+  uint32_t failHead = 0;
+  UserHead users[USERS];
+  uint8_t userCount = 0;
+  bool usersEvicted = false;
+  DayStart days[DAYS];
+  uint8_t dayCount = 0;
+};
+
+#endif // SMARTHAUS_ACCESS_HISTORY_H
@@ -0,0 +1,128 @@
+/***************************************************
+  AccessPipeline - the work that follows a scan
+  - the caller actuates the door first and only then
+    queues a job; everything slow (Firebase isLocked,
+    lockout persistence, failed_attempts, name lookup,
+    history record, access log) runs as stages, one
+    stage per step(), so a loop pass never waits on
+    more than one of them
+  - a job carries the match time, not the time it was
+    queued, so the log shows when the finger was read
+  - each step() is timed with the caller's clock
+  - lockWritePending(door): the door changed but its
+    isLocked write has not run yet, so Firebase still
+    holds the old value and a lock poll must not
+    apply it
+
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_ACCESS_PIPELINE_H
+#define SMARTHAUS_ACCESS_PIPELINE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ACCESS_MAX_DOORS
+#define ACCESS_MAX_DOORS 2
+#endif
+
+enum AccessStage : uint8_t {
+  STAGE_DOOR_STATE = 0, // isLocked in Firebase
+  STAGE_PERSIST,        // lockout state to RTC/Preferences
+  STAGE_COUNTER,        // failed_attempts in Firebase
+  STAGE_NAME,           // user name from Preferences
+  STAGE_HISTORY,        // local history record on LittleFS
+  STAGE_LOG,            // access log entry in Firebase
+  STAGE_COUNT
+};
+
+struct AccessJob {
+  uint8_t door;
+  bool granted;
+  bool doorChanged;  // unlocked, or locked by a new lockout
+  uint16_t fingerId;
+  uint64_t atMs;     // monotonic match time; the log stage turns it into wall time
+  uint8_t stage;
+  char user[24];
+};
+
+// What one step() ran, for the caller's per-door timing
+struct AccessStep {
+  uint8_t door;
+  uint8_t stage;
+  uint32_t us;
+};
+
+template <uint8_t Q>
+class AccessPipeline {
+public:
+  typedef void (*StageFn)(uint8_t stage, AccessJob &job);
+  typedef uint32_t (*ClockFn)();
+
+  AccessPipeline(StageFn run, ClockFn clockUs) : runStage(run), clockUs(clockUs) {}
+
+  // The door was actuated: its Firebase state is stale until the job's
+  // STAGE_DOOR_STATE has run (or the job is lost)
+  void lockChanged(uint8_t door) {
+    if (door < ACCESS_MAX_DOORS) lockWrites[door]++;
+  }
+
+  // The job announced by lockChanged() will never be queued
+  void lockChangeLost(uint8_t door) {
+    if (door < ACCESS_MAX_DOORS && lockWrites[door]) lockWrites[door]--;
+  }
+
+  bool lockWritePending(uint8_t door) const { return door < ACCESS_MAX_DOORS && lockWrites[door]; }
+
+  // Returns false when the queue is full; the door was already actuated, only
+  // the bookkeeping is lost
+  bool queue(uint8_t door, bool granted, bool doorChanged, uint16_t fingerId, uint64_t atMs) {
+    if (count == Q) {
+      droppedJobs++;
+      if (doorChanged) lockChangeLost(door);
+      return false;
+    }
+    AccessJob &job = jobs[(head + count) % Q];
+    job.door = door;
+    job.granted = granted;
+    job.doorChanged = doorChanged;
+    job.fingerId = fingerId;
+    job.atMs = atMs;
+    job.stage = STAGE_DOOR_STATE;
+    strcpy(job.user, "unknown");
+    count++;
+    return true;
+  }
+
+  // Run the next stage of the oldest job. Returns false when idle.
+  bool step(AccessStep &done) {
+    if (!count) return false;
+    AccessJob &job = jobs[head];
+    uint32_t start = clockUs();
+    runStage(job.stage, job);
+    done.us = clockUs() - start;
+    done.door = job.door;
+    done.stage = job.stage;
+    if (job.stage == STAGE_DOOR_STATE && job.doorChanged) lockChangeLost(job.door);
+    if (++job.stage == STAGE_COUNT) {
+      head = (head + 1) % Q;
+      count--;
+    }
+    return true;
+  }
+
+  uint8_t pending() const { return count; }
+  uint32_t dropped() const { return droppedJobs; }
+  void countDropped() { droppedJobs++; } // job lost before it reached queue()
+
+private:
+  StageFn runStage;
+  ClockFn clockUs;
+  AccessJob jobs[Q];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint32_t droppedJobs = 0;
+  uint8_t lockWrites[ACCESS_MAX_DOORS] = {};
+};
+
+#endif // SMARTHAUS_ACCESS_PIPELINE_H
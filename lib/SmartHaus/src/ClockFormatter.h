@@ -0,0 +1,60 @@
+/***************************************************
+  ClockFormatter - cached "YYYY-MM-DD" / "HH:MM:SS"
+  localtime + strftime run once per day. Within the
+  same day the time of day is plain arithmetic, and
+  nothing is rewritten if the second has not changed.
+  Assumes a fixed UTC offset (configTime without DST).
+ ****************************************************/
+#ifndef SMARTHAUS_CLOCK_FORMATTER_H
+#define SMARTHAUS_CLOCK_FORMATTER_H
+
+#include <stdint.h>
+#include <time.h>
+
+class ClockFormatter {
+public:
+  // Returns true if the text changed
+  bool update(time_t now) {
+    if (now == lastSec) return false;
+    lastSec = now;
+
+    if (dateBuf[0] == '\0' || now < dayStart || now >= dayStart + 86400) {
+      struct tm t;
+      localtime_r(&now, &t);
+      strftime(dateBuf, sizeof(dateBuf), "%Y-%m-%d", &t);
+      dayStart = now - (t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec);
+    }
+
+    uint32_t s = (uint32_t)(now - dayStart);
+    put2(timeBuf, s / 3600);
+    timeBuf[2] = ':';
+    put2(timeBuf + 3, (s / 60) % 60);
+    timeBuf[5] = ':';
+    put2(timeBuf + 6, s % 60);
+    timeBuf[8] = '\0';
+
+    for (uint8_t i = 0; i < 10; i++) stampBuf[i] = dateBuf[i];
+    stampBuf[10] = ' ';
+    for (uint8_t i = 0; i < 9; i++) stampBuf[11 + i] = timeBuf[i];
+    return true;
+  }
+
+  const char *date() const { return dateBuf; }   // YYYY-MM-DD
+  const char *time() const { return timeBuf; }   // HH:MM:SS
+  const char *stamp() const { return stampBuf; } // YYYY-MM-DD HH:MM:SS
+  uint32_t secondOfDay() const { return (uint32_t)(lastSec - dayStart); }
+
+private:
+  static void put2(char *out, uint32_t v) {
+    out[0] = '0' + v / 10;
+    out[1] = '0' + v % 10;
+  }
+
+  time_t lastSec = -1;
+  time_t dayStart = 0;
+  char dateBuf[11] = "";
+  char timeBuf[9] = "";
+  char stampBuf[20] = "";
+};
+
+#endif // SMARTHAUS_CLOCK_FORMATTER_H
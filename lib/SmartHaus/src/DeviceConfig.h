@@ -0,0 +1,141 @@
+/***************************************************
+  DeviceConfig - persisted runtime configuration
+  One packed struct per board, stored as
+    [ConfigHeader][payload]
+  in Preferences (NodeMCU) or EEPROM (Mega).
+
+  Schema rules:
+  - fields are only ever appended to a payload struct
+  - bump the version whenever a field is added
+  - an older blob is copied over the defaults, so new
+    fields start at their default value
+  - semantic changes get an explicit step in migrate()
+  - a newer blob (firmware rolled back) is read for the
+    fields this version knows and never written back,
+    so the fields it does not know survive
+ ****************************************************/
+#ifndef SMARTHAUS_DEVICE_CONFIG_H
+#define SMARTHAUS_DEVICE_CONFIG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define CONFIG_MAGIC 0x5343 // "SC"
+
+struct __attribute__((packed)) ConfigHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t length;  // payload bytes that follow
+  uint16_t crc;    // CRC-16/CCITT of the payload
+};
+
+// NodeMCU portion
+#define NODE_CONFIG_VERSION 2
+struct __attribute__((packed)) NodeConfig {
+  uint16_t relaysCheckMs;    // Firebase relay poll
+  uint16_t doorLockCheckMs;  // Firebase door lock poll
+  uint8_t maxRelayId;        // relays mirrored from /smart_controls/relays
+  char deviceId[24];         // /devices/<deviceId>, front door and the controller itself
+  // v2
+  uint8_t doorCount;         // 1 = front only, 2 = front + back
+  char backDeviceId[24];     // /devices/<backDeviceId>
+};
+
+static const NodeConfig NODE_CONFIG_DEFAULTS = {
+  1500,
+  1000,
+  8,
+  "fingerprint_door_001",
+  1,
+  "fingerprint_door_002"
+};
+
+// Mega portion, distributed by the NodeMCU over I2C
+#define MEGA_CONFIG_VERSION 2
+#define MEGA_SMS_RECIPIENTS 3
+struct __attribute__((packed)) MegaConfig {
+  uint8_t relayBasePin;    // relay ID 1 -> this pin, ID 2 -> pin + 1, ...
+  uint8_t maxRelays;       // highest relay ID accepted
+  uint8_t relayActiveLow;  // 1 = relay board switches on LOW
+  char phoneNumber[20];    // SMS alert recipient ("cfg:phone=" + 19 chars fits one I2C write)
+  // v2
+  char extraPhone[MEGA_SMS_RECIPIENTS - 1][20]; // further recipients, "" = unused ("cfg:phone2=", "cfg:phone3=")
+  uint8_t smsWindowS;      // alerts within this many seconds share one SMS
+  uint16_t smsGapS;        // least time between two alert SMS
+};
+
+static const MegaConfig MEGA_CONFIG_DEFAULTS = {
+  22,
+  16,
+  1,
+  "+1234567890", // placeholder, set phone_number in Firebase config
+  {"", ""},
+  15,
+  120
+};
+
+enum ConfigStatus : uint8_t {
+  CONFIG_OK = 0,
+  CONFIG_MIGRATED,  // older schema, upgraded in place
+  CONFIG_DEFAULTS,  // nothing valid stored
+  CONFIG_NEWER      // written by newer firmware: read-only, do not save over it
+};
+
+inline const char *configStatusName(ConfigStatus s) {
+  switch (s) {
+    case CONFIG_OK: return "stored";
+    case CONFIG_MIGRATED: return "migrated";
+    case CONFIG_NEWER: return "newer (read-only)";
+    default: return "defaults";
+  }
+}
+
+inline uint16_t configCrc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Per-version fix-ups for changes that are not plain appends.
+// Nothing needed yet: every version so far only appended fields.
+inline void configMigrate(NodeConfig &, uint8_t /*fromVersion*/) {}
+inline void configMigrate(MegaConfig &, uint8_t /*fromVersion*/) {}
+
+// Write header + payload into out. Returns bytes written, 0 if out is too small.
+template <typename T>
+size_t configEncode(const T &cfg, uint8_t version, uint8_t *out, size_t outSize) {
+  if (outSize < sizeof(ConfigHeader) + sizeof(T)) return 0;
+  ConfigHeader h;
+  h.magic = CONFIG_MAGIC;
+  h.version = version;
+  h.length = sizeof(T);
+  h.crc = configCrc16((const uint8_t *)&cfg, sizeof(T));
+  memcpy(out, &h, sizeof(h));
+  memcpy(out + sizeof(h), &cfg, sizeof(T));
+  return sizeof(h) + sizeof(T);
+}
+
+// Decode a stored blob into out, migrating older schemas. Only CONFIG_MIGRATED
+// asks the caller to save the result.
+template <typename T>
+ConfigStatus configDecode(const uint8_t *blob, size_t len, uint8_t version, T &out, const T &defaults) {
+  out = defaults;
+  if (len < sizeof(ConfigHeader)) return CONFIG_DEFAULTS;
+
+  ConfigHeader h;
+  memcpy(&h, blob, sizeof(h));
+  if (h.magic != CONFIG_MAGIC || sizeof(h) + h.length > len) return CONFIG_DEFAULTS;
+  if (configCrc16(blob + sizeof(h), h.length) != h.crc) return CONFIG_DEFAULTS;
+
+  // Append-only layout: the common prefix is valid for any version
+  memcpy(&out, blob + sizeof(h), h.length < sizeof(T) ? h.length : sizeof(T));
+  if (h.version == version) return CONFIG_OK;
+  if (h.version > version) return CONFIG_NEWER;
+  configMigrate(out, h.version);
+  return CONFIG_MIGRATED;
+}
+
+#endif // SMARTHAUS_DEVICE_CONFIG_H
@@ -0,0 +1,77 @@
+/***************************************************
+  DoorScheduler - one fingerprint reader per loop pass
+  - next() serves the doors in turn, one per call, so
+    a pass costs at most one sensor read whatever the
+    door count and no door waits more than one read
+    of each other door
+  - it also decides what to do with that door: read
+    the sensor, skip it (unlocked, or a touch-line
+    sensor with no finger on it) or show the lockout
+  - the touch line is asked only when a read is
+    otherwise due, so its edge is consumed by the
+    scan it starts
+  - polling(): some door has no touch line and is
+    waiting for a finger, the loop must not sleep
+    past the poll period
+
+  Door state comes from the caller; no Arduino
+  dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_DOOR_SCHEDULER_H
+#define SMARTHAUS_DOOR_SCHEDULER_H
+
+#include <stdint.h>
+
+struct DoorScanState {
+  bool locked;     // waiting for a finger
+  bool lockedOut;  // too many failures: no scans until it expires
+  bool touchLine;  // sensor reports a finger on a GPIO
+};
+
+enum DoorScanAction : uint8_t {
+  SCAN_IDLE = 0,   // nothing to do for this door this pass
+  SCAN_READ,       // read the sensor
+  SCAN_LOCKOUT     // locked out: remind the user
+};
+
+template <uint8_t N>
+class DoorScheduler {
+public:
+  typedef DoorScanState (*StateFn)(uint8_t door);
+  typedef bool (*TouchFn)(uint8_t door); // finger on (or just lifted from) the sensor
+
+  DoorScheduler(StateFn state, TouchFn touched) : state(state), touched(touched) {}
+
+  void setDoorCount(uint8_t n) {
+    count = (n >= 1 && n <= N) ? n : 1;
+    if (nextDoor >= count) nextDoor = 0;
+  }
+  uint8_t doorCount() const { return count; }
+
+  // The door to serve this pass and what to do with it
+  DoorScanAction next(uint8_t &door) {
+    door = nextDoor;
+    nextDoor = (nextDoor + 1) % count;
+    DoorScanState s = state(door);
+    if (s.lockedOut) return SCAN_LOCKOUT;
+    if (!s.locked) return SCAN_IDLE;
+    if (s.touchLine && !touched(door)) return SCAN_IDLE;
+    return SCAN_READ;
+  }
+
+  bool polling() const {
+    for (uint8_t i = 0; i < count; i++) {
+      DoorScanState s = state(i);
+      if (s.locked && !s.lockedOut && !s.touchLine) return true;
+    }
+    return false;
+  }
+
+private:
+  StateFn state;
+  TouchFn touched;
+  uint8_t count = 1;
+  uint8_t nextDoor = 0;
+};
+
+#endif // SMARTHAUS_DOOR_SCHEDULER_H
@@ -0,0 +1,158 @@
+/***************************************************
+  EventBus - fixed-capacity publish/subscribe
+  - producers publish() a small typed event into a
+    ring and return; nothing runs on their stack
+  - subscribers are a const table fixed at compile
+    time, sorted by descending priority
+    (static_assert(eventSubsSorted(...)))
+  - dispatch() first runs the urgent subscribers
+    (priority >= EVENT_URGENT) of every queued event,
+    then finishes the oldest events with the rest; a
+    burst of cloud work never delays an actuator
+  - a full queue makes publish() return false; the
+    producer decides whether to retry or drop
+  - queue depth, drops and publish -> last subscriber
+    latency are tracked for the stats report
+  - a producer that saw the event earlier (a sensor
+    match) passes that time to publish(); latency and
+    atUs then count from it
+
+  Clock is passed in (micros()); no Arduino
+  dependency. publish() is safe from an ISR.
+ ****************************************************/
+#ifndef SMARTHAUS_EVENT_BUS_H
+#define SMARTHAUS_EVENT_BUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "IsrSupport.h"
+
+enum EventType : uint8_t {
+  EV_ACCESS_GRANTED = 0, // source = door, id = finger ID
+  EV_ACCESS_DENIED,      // source = door, value = 1 if a lockout started
+  EV_WATER_CHANGED,      // value = 1 water present
+  EV_RELAY_CHANGED,      // id = relay ID, value = state
+  EV_TYPE_COUNT
+};
+
+#define EVENT_URGENT 128 // this priority and above run before any non-urgent work
+
+struct Event {
+  uint8_t type;
+  uint8_t source;
+  uint16_t id;
+  int32_t value;
+  uint32_t atUs;   // when it happened: publish time unless the producer gave one
+};
+
+struct EventSub {
+  uint8_t type;
+  uint8_t priority;
+  void (*handle)(const Event &e);
+};
+
+struct EventBusStats {
+  uint32_t published;
+  uint32_t dropped;      // queue full
+  uint32_t delivered;    // subscriber calls
+  uint8_t maxDepth;
+  uint32_t maxLatencyUs; // publish -> last subscriber done
+};
+
+// Compile-time check of the subscriber table order
+constexpr bool eventSubsSorted(const EventSub *subs, size_t n) {
+  return n < 2 || (subs[0].priority >= subs[1].priority && eventSubsSorted(subs + 1, n - 1));
+}
+
+template <uint8_t N, uint8_t Q>
+class EventBus {
+public:
+  typedef uint32_t (*ClockFn)();
+
+  EventBus(const EventSub (&subs)[N], ClockFn clockUs) : subs(subs), clockUs(clockUs) {
+    for (uint8_t i = 0; i < N; i++) {
+      if (subs[i].priority >= EVENT_URGENT) urgentEnd = i + 1;
+    }
+  }
+
+  // atUs: clock time the event happened, 0 = now
+  bool publish(uint8_t type, uint8_t source, uint16_t id, int32_t value, uint32_t atUs = 0) {
+    uint32_t now = atUs ? atUs : clockUs();
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    if (count == Q) {
+      st.dropped++;
+      SH_IRQ_RESTORE(s);
+      return false;
+    }
+    uint8_t slot = (head + count) % Q;
+    Event &e = ring[slot];
+    e.type = type;
+    e.source = source;
+    e.id = id;
+    e.value = value;
+    e.atUs = now;
+    cursor[slot] = 0;
+    count++;
+    st.published++;
+    if (count > st.maxDepth) st.maxDepth = count;
+    SH_IRQ_RESTORE(s);
+    return true;
+  }
+
+  // Deliver queued events; finishes at most maxEvents of them per call.
+  // Returns the number of events finished.
+  uint8_t dispatch(uint8_t maxEvents) {
+    uint8_t queued = pending();
+    for (uint8_t i = 0; i < queued; i++) {
+      uint8_t slot = (head + i) % Q;
+      run(slot, urgentEnd);
+    }
+    uint8_t done = 0;
+    while (done < maxEvents && pending()) {
+      run(head, N);
+      uint32_t latency = clockUs() - ring[head].atUs;
+      if (latency > st.maxLatencyUs) st.maxLatencyUs = latency;
+      sh_irq_state_t s = SH_IRQ_SAVE();
+      head = (head + 1) % Q;
+      count--;
+      SH_IRQ_RESTORE(s);
+      done++;
+    }
+    return done;
+  }
+
+  uint8_t pending() const {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    uint8_t n = count;
+    SH_IRQ_RESTORE(s);
+    return n;
+  }
+
+  const EventBusStats &stats() const { return st; }
+  void resetPeaks() {
+    st.maxDepth = pending();
+    st.maxLatencyUs = 0;
+  }
+
+private:
+  // Call the subscribers of one event from its cursor up to (not including) end
+  void run(uint8_t slot, uint8_t end) {
+    const Event &e = ring[slot];
+    for (uint8_t &c = cursor[slot]; c < end; c++) {
+      if (subs[c].type != e.type) continue;
+      subs[c].handle(e);
+      st.delivered++;
+    }
+  }
+
+  const EventSub (&subs)[N];
+  ClockFn clockUs;
+  uint8_t urgentEnd = 0;   // subscribers [0, urgentEnd) are urgent
+  Event ring[Q];
+  uint8_t cursor[Q];       // next subscriber per queued event
+  volatile uint8_t head = 0;
+  volatile uint8_t count = 0;
+  EventBusStats st = {0, 0, 0, 0, 0};
+};
+
+#endif // SMARTHAUS_EVENT_BUS_H
@@ -0,0 +1,214 @@
+/***************************************************
+  FingerprintLink - sensor transport for Adafruit_Fingerprint
+  Sits between the library and the UART as a Stream:
+  - command packets are collected byte by byte and
+    handed to the backend in one write(), so a hardware
+    UART fills its FIFO in one go instead of 12+ calls
+  - replies are parsed as they are read to time each
+    command -> reply round trip and count checksum
+    errors and unanswered commands
+
+  The backend is any Stream, begun by the sketch:
+  - UART0 moved to GPIO13 (RX) / GPIO15 (TX) with
+    Serial.swap() - the main door
+  - SoftwareSerial - further doors, or the same pins
+    when Serial is needed for a console
+
+    FingerprintLink fpLink(Serial, "uart0-swap");
+    Adafruit_Fingerprint finger(&fpLink);
+    Serial.begin(FP_BAUD);
+    Serial.swap();
+ ****************************************************/
+#ifndef SMARTHAUS_FINGERPRINT_LINK_H
+#define SMARTHAUS_FINGERPRINT_LINK_H
+
+#include <stdint.h>
+
+#define FP_RX_PIN 13  // NodeMCU D7 <- sensor TX (UART0 RX after Serial.swap())
+#define FP_TX_PIN 15  // NodeMCU D8 -> sensor RX (UART0 TX after Serial.swap())
+#ifndef FP_BAUD
+#define FP_BAUD 57600
+#endif
+
+#define FP_PACKET_MAX 96   // largest packet buffered whole (commands are < 20 bytes)
+#define FP_REPLY_TIMEOUT_US 1500000UL
+
+struct FingerprintLinkStats {
+  uint32_t commands;     // command packets sent
+  uint32_t replies;      // well-formed reply packets received
+  uint32_t badPackets;   // checksum or framing errors
+  uint32_t timeouts;     // commands without a reply
+  uint32_t rttTotalUs;   // sum over replies, for the average
+  uint32_t rttMaxUs;
+  uint32_t rttLastUs;
+};
+
+// Packet framing and accounting, independent of the UART
+class FingerprintFramer {
+public:
+  // Feed one outgoing byte. Returns the number of bytes ready in txBuffer() (0 = keep collecting).
+  uint8_t pushTx(uint8_t b) {
+    if (txLen == 0 && b != 0xEF) {
+      txBuf[0] = b; // not a packet start, pass through
+      lastTxType = 0;
+      return 1;
+    }
+    txBuf[txLen++] = b;
+    if (txLen == 2 && b != 0x01) return takeTx();
+    if (txLen < 9) return 0;
+    uint16_t total = 9 + ((uint16_t)txBuf[7] << 8 | txBuf[8]);
+    if (txLen >= total || txLen >= FP_PACKET_MAX) return takeTx();
+    return 0;
+  }
+
+  const uint8_t *txBuffer() const { return txBuf; }
+
+  // Call after a complete command packet (type 0x01) has gone out
+  void commandSent(uint32_t nowUs) {
+    checkTimeout(nowUs);
+    stats.commands++;
+    awaitingReply = true;
+    sentAtUs = nowUs;
+  }
+
+  bool lastTxWasCommand() const { return lastTxType == 0x01; }
+
+  // Feed one incoming byte
+  void pushRx(uint8_t b, uint32_t nowUs) {
+    switch (rxPos) {
+      case 0:
+        if (b != 0xEF) return;
+        break;
+      case 1:
+        if (b != 0x01) {
+          stats.badPackets++;
+          rxPos = 0;
+          return;
+        }
+        break;
+      case 6:
+        rxSum = b; // packet type
+        break;
+      case 7:
+        rxLen = (uint16_t)b << 8;
+        rxSum += b;
+        break;
+      case 8:
+        rxLen |= b;
+        rxSum += b;
+        if (rxLen < 2) {
+          stats.badPackets++;
+          rxPos = 0;
+          return;
+        }
+        break;
+      default:
+        if (rxPos < 6) break; // address
+        if (rxPos < 7 + rxLen) {
+          rxSum += b; // payload
+        } else if (rxPos == 7 + rxLen) {
+          rxCheck = (uint16_t)b << 8;
+        } else {
+          rxCheck |= b;
+          finishRx(nowUs);
+          rxPos = 0;
+          return;
+        }
+    }
+    rxPos++;
+  }
+
+  void checkTimeout(uint32_t nowUs) {
+    if (awaitingReply && nowUs - sentAtUs > FP_REPLY_TIMEOUT_US) {
+      awaitingReply = false;
+      stats.timeouts++;
+    }
+  }
+
+  const FingerprintLinkStats &linkStats() const { return stats; }
+
+  uint32_t averageRttUs() const { return stats.replies ? stats.rttTotalUs / stats.replies : 0; }
+
+  // Failed commands (no reply or corrupt reply) in percent
+  uint8_t errorRate() const {
+    return stats.commands ? (uint8_t)((stats.timeouts + stats.badPackets) * 100UL / stats.commands) : 0;
+  }
+
+private:
+  uint8_t takeTx() {
+    uint8_t n = txLen;
+    lastTxType = n > 6 ? txBuf[6] : 0;
+    txLen = 0;
+    return n;
+  }
+
+  void finishRx(uint32_t nowUs) {
+    if (rxCheck != rxSum) {
+      stats.badPackets++;
+      return;
+    }
+    stats.replies++;
+    if (!awaitingReply) return;
+    awaitingReply = false;
+    uint32_t rtt = nowUs - sentAtUs;
+    stats.rttLastUs = rtt;
+    stats.rttTotalUs += rtt;
+    if (rtt > stats.rttMaxUs) stats.rttMaxUs = rtt;
+  }
+
+  uint8_t txBuf[FP_PACKET_MAX];
+  uint8_t txLen = 0;
+  uint8_t lastTxType = 0;
+  uint16_t rxPos = 0;
+  uint16_t rxLen = 0;
+  uint16_t rxSum = 0;
+  uint16_t rxCheck = 0;
+  bool awaitingReply = false;
+  uint32_t sentAtUs = 0;
+  FingerprintLinkStats stats = {0, 0, 0, 0, 0, 0, 0};
+};
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+class FingerprintLink : public Stream {
+public:
+  FingerprintLink(Stream &backend, const char *name) : backend(backend), name(name) {}
+
+  const char *backendName() const { return name; }
+
+  int available() override { return backend.available(); }
+  int peek() override { return backend.peek(); }
+
+  int read() override {
+    int c = backend.read();
+    if (c >= 0) framer.pushRx((uint8_t)c, micros());
+    return c;
+  }
+
+  size_t write(uint8_t b) override {
+    uint8_t n = framer.pushTx(b);
+    if (n) {
+      backend.write(framer.txBuffer(), n);
+      if (framer.lastTxWasCommand()) framer.commandSent(micros());
+    }
+    return 1;
+  }
+
+  void flush() override { backend.flush(); }
+
+  // Count commands whose reply never arrived; call from the main loop
+  void poll() { framer.checkTimeout(micros()); }
+
+  const FingerprintLinkStats &stats() const { return framer.linkStats(); }
+  uint32_t averageRttUs() const { return framer.averageRttUs(); }
+  uint8_t errorRate() const { return framer.errorRate(); }
+
+private:
+  Stream &backend;
+  const char *name;
+  FingerprintFramer framer;
+};
+#endif // ARDUINO
+
+#endif // SMARTHAUS_FINGERPRINT_LINK_H
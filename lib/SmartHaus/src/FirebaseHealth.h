@@ -0,0 +1,74 @@
+/***************************************************
+  FirebaseHealth - what one Firebase read outcome
+  does to the connection state (firebaseGetOk())
+  - readDone() classifies the FirebaseClient error
+    code (0 ok, < 0 transport: TCP/TLS/timeout, HTTP
+    401/403 auth, 5xx server) and feeds RetryBackoff:
+    every failure parks Firebase work, a success ends
+    the outage
+  - mayConnect() is the gate checkConnection() uses
+    before marking Firebase usable again
+  - takeOutage() hands out the length of an outage
+    once, after the read that ended it
+
+  Caller passes millis() and a random word; no Arduino
+  dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_FIREBASE_HEALTH_H
+#define SMARTHAUS_FIREBASE_HEALTH_H
+
+#include <stdint.h>
+#include "RetryBackoff.h"
+
+enum FirebaseRead : uint8_t {
+  FB_READ_OK = 0,
+  FB_READ_TRANSPORT,   // connection refused/dropped, TLS, timeout, cut-off body
+  FB_READ_AUTH,        // 401/403: token expired or rules deny
+  FB_READ_SERVER,      // 5xx
+  FB_READ_OTHER,
+  FB_READ_KINDS
+};
+
+inline FirebaseRead firebaseReadKind(int code) {
+  if (code == 0) return FB_READ_OK;
+  if (code < 0) return FB_READ_TRANSPORT;
+  if (code == 401 || code == 403) return FB_READ_AUTH;
+  if (code >= 500 && code <= 599) return FB_READ_SERVER;
+  return FB_READ_OTHER;
+}
+
+class FirebaseHealth {
+public:
+  explicit FirebaseHealth(const RetryBackoffConfig &cfg) : retry(cfg) {}
+
+  FirebaseRead readDone(int code, uint32_t nowMs, uint32_t random) {
+    FirebaseRead kind = firebaseReadKind(code);
+    count[kind]++;
+    if (kind == FB_READ_OK) {
+      uint32_t outage = retry.succeed(nowMs);
+      if (outage) lastOutage = outage;
+    } else {
+      retry.fail(nowMs, random);
+    }
+    return kind;
+  }
+
+  bool mayConnect(uint32_t nowMs) const { return retry.ready(nowMs); }
+
+  // Length of the outage the last success ended, 0 if none or already taken
+  uint32_t takeOutage() {
+    uint32_t o = lastOutage;
+    lastOutage = 0;
+    return o;
+  }
+
+  uint32_t reads(FirebaseRead kind) const { return kind < FB_READ_KINDS ? count[kind] : 0; }
+  const RetryBackoff &backoff() const { return retry; }
+
+private:
+  RetryBackoff retry;
+  uint32_t count[FB_READ_KINDS] = {};
+  uint32_t lastOutage = 0;
+};
+
+#endif // SMARTHAUS_FIREBASE_HEALTH_H
@@ -0,0 +1,702 @@
+/***************************************************
+  FirmwareUpdate - streamed firmware images
+  - DeltaApplier rebuilds a new NodeMCU image from a
+    block delta against the running firmware, as the
+    bytes arrive; nothing larger than one block is
+    ever buffered
+  - every block carries the CRC32 of its output; the
+    whole image is checked against the header CRC
+  - nextBlock()/streamOffset()/crc() are the resume
+    point: after an interruption, resume() with them
+    and restart the download at streamOffset()
+  - the rebuilt image carries an RSA/ECDSA signature
+    trailer (fwSignedSize()); the caller checks it
+    against its public key before installing
+  - HttpHead parses the response head byte by byte,
+    so the download never blocks waiting for a line
+  - MegaBootProxy streams a Mega image to its I2C
+    bootloader one flash page at a time, each page
+    checked by CRC-16 before it is programmed; the
+    bootloader keeps the page counter per image, so an
+    interrupted update resumes at the first page the
+    Mega does not have
+
+  Delta format (little endian, scripts/make_delta.py):
+    FwDeltaHeader
+    per output block, in order:
+      op FW_OP_COPY    src:u16 crc:u32
+      op FW_OP_XOR_RLE src:u16 len:u16 crc:u32 rle[len]
+      op FW_OP_RLE     len:u16 crc:u32 rle[len]
+  COPY takes base block <src> unchanged, XOR_RLE
+  XORs the decoded bytes onto it, RLE is new data.
+  RLE: control c < 0x80 -> c+1 literal bytes follow,
+  c >= 0x80 -> the next byte repeated c-0x80+3 times.
+
+  Flash is any type with
+    bool readBase(uint32_t offset, uint8_t *buf, uint16_t len);
+    bool writeBlock(uint16_t index, const uint8_t *data, uint16_t len);
+  Bus is anything with the TwoWire master API.
+ ****************************************************/
+#ifndef SMARTHAUS_FIRMWARE_UPDATE_H
+#define SMARTHAUS_FIRMWARE_UPDATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define FW_DELTA_MAGIC 0x31444853UL // "SHD1"
+#define FW_BLOCK_SIZE 4096          // one ESP8266 flash sector
+#define FW_SIGNATURE_MAX 512        // RSA-4096
+
+enum FwOp : uint8_t {
+  FW_OP_COPY = 0,
+  FW_OP_XOR_RLE = 1,
+  FW_OP_RLE = 2
+};
+
+enum FwStatus : uint8_t {
+  FW_OK = 0,        // consumed, more expected
+  FW_DONE,          // last block written and image CRC matches
+  FW_BAD_HEADER,
+  FW_BAD_OP,
+  FW_BAD_BLOCK_CRC,
+  FW_BAD_IMAGE_CRC,
+  FW_BAD_DATA,      // RLE overran the block or was cut short
+  FW_READ_FAILED,
+  FW_WRITE_FAILED,
+  FW_PENDING,       // Mega page or start not confirmed yet, poll again
+  FW_NO_BOOTLOADER  // nothing answers at MEGA_BOOT_ADDR, or it stopped answering
+};
+
+inline const char *fwStatusName(FwStatus s) {
+  static const char *const names[] = {"ok", "done", "bad_header", "bad_op",
+                                      "bad_block_crc", "bad_image_crc", "bad_data",
+                                      "read_failed", "write_failed", "pending", "no_bootloader"};
+  return s <= FW_NO_BOOTLOADER ? names[s] : "unknown";
+}
+
+struct __attribute__((packed)) FwDeltaHeader {
+  uint32_t magic;
+  uint32_t newSize;    // bytes of the rebuilt image
+  uint32_t newCrc;     // CRC32 of the rebuilt image
+  uint32_t baseSize;   // size of the image the delta was made against
+  uint16_t blockSize;  // FW_BLOCK_SIZE
+  uint16_t blockCount;
+};
+
+// CRC-32 (zlib polynomial), continue from a previous result; start with 0
+inline uint32_t fwCrc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+  }
+  return ~crc;
+}
+
+template <typename Flash>
+class DeltaApplier {
+public:
+  // block must hold FW_BLOCK_SIZE bytes and be 4-byte aligned
+  DeltaApplier(Flash &flash, uint8_t *block) : flash(flash), block(block) {}
+
+  // New download from the first byte of the delta
+  void begin() {
+    state = ST_HEADER;
+    fill = 0;
+    next = 0;
+    offset = 0;
+    recordStart = 0;
+    imageCrc = 0;
+  }
+
+  // Continue an interrupted download; feed bytes from streamOffset() on
+  void resume(const FwDeltaHeader &h, uint16_t nextBlock, uint32_t streamOffset, uint32_t crcSoFar) {
+    hdr = h;
+    next = nextBlock;
+    offset = recordStart = streamOffset;
+    imageCrc = crcSoFar;
+    state = next < hdr.blockCount ? ST_OP : ST_DONE;
+  }
+
+  // Consume a chunk of the stream. Anything but FW_OK/FW_DONE is final
+  // until begin()/resume(); bytes after the last block are ignored.
+  FwStatus push(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      if (state == ST_DONE) return FW_DONE;
+      if (state == ST_FAILED) return failure;
+      offset++;
+      FwStatus s = step(data[i]);
+      if (s != FW_OK) return s;
+    }
+    return state == ST_DONE ? FW_DONE : FW_OK;
+  }
+
+  const FwDeltaHeader &header() const { return hdr; }
+  bool headerKnown() const { return state != ST_HEADER; }
+  uint16_t nextBlock() const { return next; }
+  uint32_t streamOffset() const { return recordStart; }  // start of the next block record
+  uint32_t crc() const { return imageCrc; }              // over blocks written so far
+
+private:
+  enum State : uint8_t { ST_HEADER, ST_OP, ST_ARGS, ST_DATA, ST_DONE, ST_FAILED };
+
+  FwStatus fail(FwStatus s) {
+    state = ST_FAILED;
+    failure = s;
+    return s;
+  }
+
+  uint16_t blockLen(uint16_t index) const {
+    uint32_t start = (uint32_t)index * hdr.blockSize;
+    uint32_t left = hdr.newSize - start;
+    return left < hdr.blockSize ? (uint16_t)left : hdr.blockSize;
+  }
+
+  static uint8_t argBytes(uint8_t op) {
+    return op == FW_OP_COPY ? 6 : op == FW_OP_XOR_RLE ? 8 : 6;
+  }
+
+  FwStatus step(uint8_t b) {
+    switch (state) {
+      case ST_HEADER:
+        ((uint8_t *)&hdr)[fill++] = b;
+        if (fill < sizeof(hdr)) return FW_OK;
+        if (hdr.magic != FW_DELTA_MAGIC || hdr.blockSize != FW_BLOCK_SIZE || hdr.newSize == 0 ||
+            hdr.blockCount != (hdr.newSize + hdr.blockSize - 1) / hdr.blockSize) {
+          return fail(FW_BAD_HEADER);
+        }
+        recordStart = offset;
+        state = ST_OP;
+        return FW_OK;
+
+      case ST_OP:
+        if (b > FW_OP_RLE) return fail(FW_BAD_OP);
+        op = b;
+        fill = 0;
+        state = ST_ARGS;
+        return FW_OK;
+
+      case ST_ARGS:
+        args[fill++] = b;
+        if (fill < argBytes(op)) return FW_OK;
+        return startBlock();
+
+      case ST_DATA:
+        dataLeft--;
+        if (!rle(b)) return fail(FW_BAD_DATA);
+        if (dataLeft == 0) {
+          if (runLeft || litLeft || outPos != outLen) return fail(FW_BAD_DATA);
+          return finishBlock();
+        }
+        return FW_OK;
+
+      default:
+        return FW_OK;
+    }
+  }
+
+  FwStatus startBlock() {
+    uint8_t a = 0;
+    uint16_t src = 0;
+    if (op != FW_OP_RLE) {
+      src = args[0] | (uint16_t)args[1] << 8;
+      a = 2;
+    }
+    dataLeft = 0;
+    if (op != FW_OP_COPY) {
+      dataLeft = args[a] | (uint16_t)args[a + 1] << 8;
+      a += 2;
+    }
+    expectCrc = (uint32_t)args[a] | (uint32_t)args[a + 1] << 8 | (uint32_t)args[a + 2] << 16 |
+                (uint32_t)args[a + 3] << 24;
+
+    outLen = blockLen(next);
+    outPos = 0;
+    runLeft = litLeft = 0;
+    if (op == FW_OP_RLE) {
+      memset(block, 0, outLen);
+    } else {
+      uint32_t from = (uint32_t)src * hdr.blockSize;
+      if (from + outLen > hdr.baseSize) return fail(FW_BAD_DATA);
+      if (!flash.readBase(from, block, outLen)) return fail(FW_READ_FAILED);
+    }
+    if (op == FW_OP_COPY) {
+      outPos = outLen;
+      return finishBlock();
+    }
+    if (dataLeft == 0) return fail(FW_BAD_DATA);
+    state = ST_DATA;
+    return FW_OK;
+  }
+
+  // Decode one RLE byte into the block; false on overrun
+  bool rle(uint8_t b) {
+    if (litLeft) {
+      litLeft--;
+      return emit(b, 1);
+    }
+    if (runLeft) {
+      uint16_t n = runLeft;
+      runLeft = 0;
+      return emit(b, n);
+    }
+    if (b < 0x80) litLeft = b + 1;
+    else runLeft = b - 0x80 + 3;
+    return true;
+  }
+
+  bool emit(uint8_t b, uint16_t n) {
+    if (outPos + n > outLen) return false;
+    if (op == FW_OP_XOR_RLE) {
+      if (b) for (uint16_t i = 0; i < n; i++) block[outPos + i] ^= b;
+    } else {
+      memset(block + outPos, b, n);
+    }
+    outPos += n;
+    return true;
+  }
+
+  FwStatus finishBlock() {
+    if (fwCrc32(0, block, outLen) != expectCrc) return fail(FW_BAD_BLOCK_CRC);
+    if (!flash.writeBlock(next, block, outLen)) return fail(FW_WRITE_FAILED);
+    imageCrc = fwCrc32(imageCrc, block, outLen);
+    next++;
+    recordStart = offset;
+    if (next < hdr.blockCount) {
+      state = ST_OP;
+      return FW_OK;
+    }
+    if (imageCrc != hdr.newCrc) return fail(FW_BAD_IMAGE_CRC);
+    state = ST_DONE;
+    return FW_DONE;
+  }
+
+  Flash &flash;
+  uint8_t *block;
+  FwDeltaHeader hdr = {0, 0, 0, 0, 0, 0};
+  State state = ST_HEADER;
+  FwStatus failure = FW_OK;
+  uint8_t fill = 0;
+  uint8_t op = 0;
+  uint8_t args[8];
+  uint16_t next = 0;
+  uint32_t offset = 0;       // bytes of the stream consumed
+  uint32_t recordStart = 0;
+  uint32_t imageCrc = 0;
+  uint32_t expectCrc = 0;
+  uint16_t dataLeft = 0;
+  uint16_t outLen = 0;
+  uint16_t outPos = 0;
+  uint16_t litLeft = 0;
+  uint16_t runLeft = 0;
+};
+
+// Signed image, as the ESP8266 core's signing.py writes it:
+//   image | signature[sigLen] | sigLen:u32
+// Returns the bytes covered by the signature, 0 if the trailer is implausible.
+inline uint32_t fwSignedSize(uint32_t imageSize, uint32_t sigLen) {
+  if (sigLen == 0 || sigLen > FW_SIGNATURE_MAX || imageSize < sigLen + 4) return 0;
+  return imageSize - sigLen - 4;
+}
+
+// "http[s]://host[:port]/path"; path points into url
+inline bool fwParseUrl(const char *url, bool &tls, char *host, size_t hostSize, uint16_t &port,
+                       const char *&path) {
+  const char *p;
+  if (strncmp(url, "http://", 7) == 0) {
+    tls = false;
+    p = url + 7;
+  } else if (strncmp(url, "https://", 8) == 0) {
+    tls = true;
+    p = url + 8;
+  } else {
+    return false;
+  }
+  port = tls ? 443 : 80;
+  size_t n = strcspn(p, ":/");
+  if (n == 0 || n >= hostSize) return false;
+  memcpy(host, p, n);
+  host[n] = '\0';
+  p += n;
+  if (*p == ':') {
+    uint32_t v = 0;
+    p++;
+    if (*p < '0' || *p > '9') return false;
+    while (*p >= '0' && *p <= '9') {
+      v = v * 10 + (*p++ - '0');
+      if (v > 0xFFFF) return false;
+    }
+    if (v == 0 || (*p && *p != '/')) return false;
+    port = (uint16_t)v;
+  }
+  path = *p ? p : "/";
+  return true;
+}
+
+enum HttpHeadResult : uint8_t {
+  HTTP_HEAD_MORE = 0,  // feed more bytes
+  HTTP_HEAD_DONE,      // blank line seen, the body starts with the next byte
+  HTTP_HEAD_BAD        // not an HTTP response
+};
+
+// Response head of a download, fed one byte at a time as it arrives, so the
+// caller never waits for a whole line. Lines longer than the buffer are cut;
+// only the status line and Content-Range are looked at.
+class HttpHead {
+public:
+  void begin() {
+    len = 0;
+    lines = 0;
+    code = 0;
+    range = -1;
+  }
+
+  HttpHeadResult push(char c) {
+    if (c != '\n') {
+      if (c != '\r' && len < sizeof(line) - 1) line[len++] = c;
+      return HTTP_HEAD_MORE;
+    }
+    line[len] = '\0';
+    uint8_t n = len;
+    len = 0;
+    if (lines++ == 0) return statusLine() ? HTTP_HEAD_MORE : HTTP_HEAD_BAD;
+    if (n == 0) return HTTP_HEAD_DONE;
+    if (prefix("content-range:")) contentRange(line + 14);
+    return HTTP_HEAD_MORE;
+  }
+
+  int status() const { return code; }
+  int32_t rangeStart() const { return range; }  // first byte of a 206 body, -1 if not sent
+
+private:
+  bool statusLine() {
+    // "HTTP/1.x NNN ..."
+    if (strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ') return false;
+    for (uint8_t i = 9; i < 12; i++) {
+      if (line[i] < '0' || line[i] > '9') return false;
+      code = code * 10 + (line[i] - '0');
+    }
+    return true;
+  }
+
+  bool prefix(const char *name) const {
+    for (uint8_t i = 0; name[i]; i++) {
+      char c = line[i];
+      if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+      if (c != name[i]) return false;
+    }
+    return true;
+  }
+
+  // " bytes 1024-2047/4096"
+  void contentRange(const char *p) {
+    while (*p == ' ') p++;
+    if (strncmp(p, "bytes ", 6) != 0) return;
+    p += 6;
+    int32_t v = 0;
+    if (*p < '0' || *p > '9') return;
+    while (*p >= '0' && *p <= '9') {
+      if (v > 0x0CCCCCCC) return;
+      v = v * 10 + (*p++ - '0');
+    }
+    if (*p == '-') range = v;
+  }
+
+  char line[48];
+  uint8_t len = 0;
+  uint16_t lines = 0;
+  int code = 0;
+  int32_t range = -1;
+};
+
+/* Mega I2C bootloader protocol (address MEGA_BOOT_ADDR)
+   Master writes, each within one 32-byte Wire buffer:
+     'B' size:u32 crc:u32               image to load; the page counter is
+                                        kept if it is the image of the last
+                                        'B', else restarted at 0
+     'S'                                select status for the next read
+     'D' page:u16 offset:u8 len:u8 data  load bytes into the page buffer
+     'W' page:u16 crc:u16               program the buffered page if its
+                                        CRC-16/CCITT matches; the bootloader
+                                        NACKs while the flash is busy
+     'X' size:u32 crc:u32               check the CRC32 of the application
+                                        and start it
+   A read returns MegaBootStatus. The image CRC and nextPage live in EEPROM,
+   so an update interrupted by either side continues at that page. The
+   bootloader never starts an application that has not passed 'X'. */
+#define MEGA_BOOT_ADDR 0x29
+#define MEGA_BOOT_MAGIC 0xB7
+#define MEGA_BOOT_CHUNK 24      // data bytes per 'D' frame
+#define MEGA_BOOT_PAGE_MAX 256  // ATmega2560 SPM page
+#define MEGA_BOOT_RETRIES 3     // resends of a page that failed its CRC
+#define MEGA_BOOT_POLLS 50      // unanswered status reads before giving up
+
+enum MegaBootState : uint8_t {
+  MEGA_BOOT_IDLE = 0,
+  MEGA_BOOT_LOADING,
+  MEGA_BOOT_PAGE_CRC,   // last 'W' did not match the buffer
+  MEGA_BOOT_IMAGE_CRC,  // 'X' check failed, application not started
+  MEGA_BOOT_STARTING
+};
+
+struct __attribute__((packed)) MegaBootStatus {
+  uint8_t magic;
+  uint8_t version;
+  uint16_t pageSize;  // 256 on the ATmega2560
+  uint16_t nextPage;  // first page of the current image not yet programmed
+  uint8_t state;      // MegaBootState
+  uint8_t crc;        // CRC-8 as in SlaveStatus
+};
+
+inline uint8_t megaBootCrc(const MegaBootStatus &s) {
+  const uint8_t *p = (const uint8_t *)&s;
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < sizeof(MegaBootStatus) - 1; i++) {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+// CRC-16/CCITT-FALSE, the page check
+inline uint16_t fwCrc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// The frames of the protocol above
+template <typename Bus>
+class MegaBootClient {
+public:
+  explicit MegaBootClient(Bus &bus, uint8_t address = MEGA_BOOT_ADDR) : bus(bus), addr(address) {}
+
+  bool select(uint32_t size, uint32_t crc) { return sizeCrc('B', size, crc); }
+
+  bool status(MegaBootStatus &st) {
+    uint8_t sel = 'S';
+    if (!write(&sel, 1)) return false;
+    if (bus.requestFrom(addr, (uint8_t)sizeof(st)) != sizeof(st)) return false;
+    uint8_t *p = (uint8_t *)&st;
+    for (uint8_t i = 0; i < sizeof(st); i++) p[i] = bus.available() ? bus.read() : 0;
+    return st.magic == MEGA_BOOT_MAGIC && st.crc == megaBootCrc(st);
+  }
+
+  // Load and commit one page; status() shows it in nextPage once programmed
+  bool sendPage(uint16_t page, const uint8_t *data, uint16_t pageSize) {
+    uint8_t frame[5 + MEGA_BOOT_CHUNK];
+    for (uint16_t off = 0; off < pageSize; off += MEGA_BOOT_CHUNK) {
+      uint8_t n = pageSize - off < MEGA_BOOT_CHUNK ? pageSize - off : MEGA_BOOT_CHUNK;
+      frame[0] = 'D';
+      frame[1] = page & 0xFF;
+      frame[2] = page >> 8;
+      frame[3] = (uint8_t)off;
+      frame[4] = n;
+      memcpy(frame + 5, data + off, n);
+      if (!write(frame, 5 + n)) return false;
+    }
+    uint16_t crc = fwCrc16(data, pageSize);
+    uint8_t commit[5] = {'W', (uint8_t)(page & 0xFF), (uint8_t)(page >> 8), (uint8_t)(crc & 0xFF),
+                         (uint8_t)(crc >> 8)};
+    return write(commit, sizeof(commit));
+  }
+
+  bool finish(uint32_t size, uint32_t crc) { return sizeCrc('X', size, crc); }
+
+  uint32_t bytesSent() const { return sent; }
+
+private:
+  bool sizeCrc(uint8_t cmd, uint32_t size, uint32_t crc) {
+    uint8_t frame[9] = {cmd};
+    for (uint8_t i = 0; i < 4; i++) {
+      frame[1 + i] = (uint8_t)(size >> (8 * i));
+      frame[5 + i] = (uint8_t)(crc >> (8 * i));
+    }
+    return write(frame, sizeof(frame));
+  }
+
+  bool write(const uint8_t *data, uint8_t len) {
+    bus.beginTransmission(addr);
+    for (uint8_t i = 0; i < len; i++) bus.write(data[i]);
+    if (bus.endTransmission() != 0) return false;
+    sent += len;
+    return true;
+  }
+
+  Bus &bus;
+  uint8_t addr;
+  uint32_t sent = 0;
+};
+
+// Streams an image from a download to the bootloader. Bytes go in with
+// push() in image order from streamOffset(); a full page is sent and must be
+// confirmed (poll()) before the next one is taken, so the download is read
+// no faster than the Mega programs. Pages the Mega already has for this
+// image are taken without any I2C traffic. Every confirmed page is passed
+// to the accepted callback (the caller hashes the image there), so after a
+// reset the caller downloads from 0 again and the Mega is not rewritten.
+template <typename Bus>
+class MegaBootProxy {
+public:
+  typedef void (*PageFn)(const uint8_t *data, uint16_t len, void *ctx);
+
+  // page must hold MEGA_BOOT_PAGE_MAX bytes
+  MegaBootProxy(Bus &bus, uint8_t *page, PageFn accepted = nullptr, void *ctx = nullptr,
+                uint8_t address = MEGA_BOOT_ADDR)
+      : client(bus, address), buf(page), accepted(accepted), ctx(ctx) {}
+
+  // Tell the bootloader which image comes and learn where it stands.
+  // FW_NO_BOOTLOADER: not in the bootloader (yet); FW_PENDING: ask again.
+  FwStatus begin(uint32_t size, uint32_t crc) {
+    if (!client.select(size, crc)) return FW_NO_BOOTLOADER;
+    MegaBootStatus st;
+    if (!client.status(st)) return FW_PENDING;
+    if (st.pageSize == 0 || st.pageSize > MEGA_BOOT_PAGE_MAX) return FW_BAD_HEADER;
+    imageSize = size;
+    imageCrc = crc;
+    pageSize = st.pageSize;
+    resumePage = st.nextPage;
+    page = 0;
+    fill = 0;
+    retries = 0;
+    polls = 0;
+    resend = false;
+    skipped = 0;
+    state = size ? PX_FILL : PX_LOADED;
+    return FW_OK;
+  }
+
+  // Bytes push() takes now: 0 while a page is being programmed
+  size_t room() const {
+    if (state != PX_FILL) return 0;
+    uint32_t left = imageSize - streamOffset();
+    return left < (uint32_t)(pageSize - fill) ? left : pageSize - fill;
+  }
+
+  // Returns the bytes taken, at most room()
+  size_t push(const uint8_t *data, size_t len) {
+    size_t n = room();
+    if (len < n) n = len;
+    memcpy(buf + fill, data, n);
+    fill += n;
+    if (n && room() == 0) pageFull();
+    return n;
+  }
+
+  // Drive the page in flight. FW_OK: ready for more bytes (or loaded());
+  // FW_PENDING: not confirmed yet; anything else is final.
+  FwStatus poll() {
+    if (state == PX_FAILED) return failure;
+    if (state != PX_CONFIRM) return FW_OK;
+    if (resend) {
+      resend = !client.sendPage(page, buf, pageSize);
+      return busy();
+    }
+    MegaBootStatus st;
+    if (!client.status(st)) return busy(); // NACK while programming
+    if (st.nextPage > page) {
+      confirmed();
+      return FW_OK;
+    }
+    // It answers but does not have the page: the CRC did not match, or it
+    // restarted and lost its page buffer
+    if (++retries > MEGA_BOOT_RETRIES) return fail(st.state == MEGA_BOOT_PAGE_CRC ? FW_BAD_BLOCK_CRC : FW_NO_BOOTLOADER);
+    polls = 0;
+    resend = !client.sendPage(page, buf, pageSize);
+    return FW_PENDING;
+  }
+
+  bool loaded() const { return state == PX_LOADED || state == PX_STARTING || state == PX_STARTED; }
+
+  // Every page is programmed: have the bootloader check the image CRC and
+  // run it. FW_PENDING until it answers, FW_DONE once it starts.
+  FwStatus start() {
+    if (state == PX_LOADED) {
+      if (!client.finish(imageSize, imageCrc)) return busy();
+      state = PX_STARTING;
+      polls = 0;
+      return FW_PENDING;
+    }
+    if (state == PX_STARTING) {
+      MegaBootStatus st;
+      if (!client.status(st)) return busy();
+      if (st.state == MEGA_BOOT_STARTING) {
+        state = PX_STARTED;
+        return FW_DONE;
+      }
+      if (st.state == MEGA_BOOT_IMAGE_CRC) return fail(FW_BAD_IMAGE_CRC);
+      return busy();
+    }
+    if (state == PX_STARTED) return FW_DONE;
+    return state == PX_FAILED ? failure : FW_PENDING;
+  }
+
+  // The download broke off: a half-filled page is dropped, continue the
+  // download at streamOffset()
+  void restart() {
+    if (state == PX_FILL) fill = 0;
+  }
+
+  uint32_t streamOffset() const { return (uint32_t)page * pageSize + fill; }
+  uint16_t nextPage() const { return page; }
+  uint16_t pagesSkipped() const { return skipped; }  // already on the Mega
+  uint16_t resumeAt() const { return resumePage; }  // first page the Mega needs, from begin()
+  uint32_t bytesSent() const { return client.bytesSent(); }
+
+private:
+  enum ProxyState : uint8_t { PX_IDLE, PX_FILL, PX_CONFIRM, PX_LOADED, PX_STARTING, PX_STARTED, PX_FAILED };
+
+  void pageFull() {
+    if (page < resumePage) {
+      skipped++;
+      confirmed();
+      return;
+    }
+    memset(buf + fill, 0xFF, pageSize - fill);
+    state = PX_CONFIRM;
+    polls = 0;
+    retries = 0;
+    resend = !client.sendPage(page, buf, pageSize);
+  }
+
+  void confirmed() {
+    if (accepted) accepted(buf, fill, ctx);
+    page++;
+    fill = 0;
+    state = streamOffset() >= imageSize ? PX_LOADED : PX_FILL;
+  }
+
+  FwStatus busy() {
+    if (++polls > MEGA_BOOT_POLLS) return fail(FW_NO_BOOTLOADER);
+    return FW_PENDING;
+  }
+
+  FwStatus fail(FwStatus why) {
+    state = PX_FAILED;
+    failure = why;
+    return why;
+  }
+
+  MegaBootClient<Bus> client;
+  uint8_t *buf;
+  PageFn accepted;
+  void *ctx;
+  uint32_t imageSize = 0;
+  uint32_t imageCrc = 0;
+  uint16_t pageSize = 0;
+  uint16_t resumePage = 0;
+  uint16_t page = 0;
+  uint16_t fill = 0;
+  uint16_t skipped = 0;
+  uint8_t retries = 0;
+  uint8_t polls = 0;
+  bool resend = false;
+  ProxyState state = PX_IDLE;
+  FwStatus failure = FW_OK;
+};
+
+#endif // SMARTHAUS_FIRMWARE_UPDATE_H
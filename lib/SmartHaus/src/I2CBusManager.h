@@ -0,0 +1,193 @@
+/***************************************************
+  I2CBusManager - NodeMCU side registry of Mega slaves
+  - slaves are discovered by an address scan
+  - relay IDs map to a fixed (slave, channel) pair:
+      address 0x08 -> relays 1..16
+      address 0x09 -> relays 17..32, ...
+    so a missing board never shifts the other IDs
+  - relay changes are queued per slave and sent as one
+    "rm:<mask>:<values>" write per slave per flush()
+  - every transaction is counted per slave
+  - readStatus()/reconcile() compare a slave's readback
+    with what we asked for and requeue only the diverged
+    channels; a changed boot counter resends everything
+
+  Bus is anything with the TwoWire master API
+  (beginTransmission / write / endTransmission /
+  requestFrom / available / read).
+ ****************************************************/
+#ifndef SMARTHAUS_I2C_BUS_MANAGER_H
+#define SMARTHAUS_I2C_BUS_MANAGER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "SlaveStatus.h"
+
+#define I2C_FIRST_SLAVE_ADDR 0x08
+#ifndef I2C_MAX_SLAVES
+#define I2C_MAX_SLAVES 4
+#endif
+#define I2C_CHANNELS_PER_SLAVE 16
+#define I2C_MAX_RELAYS (I2C_MAX_SLAVES * I2C_CHANNELS_PER_SLAVE)
+#define I2C_OFFLINE_AFTER 5 // consecutive failures before a slave is treated as gone
+
+struct I2CSlaveStats {
+  uint32_t transactions;
+  uint32_t failures;
+  uint8_t consecutiveFailures;
+  bool present;
+  uint16_t reboots;       // boot counter changes seen
+  uint32_t repairedBits;  // channels re-pushed after readback
+};
+
+template <typename Bus>
+class I2CBusManager {
+public:
+  explicit I2CBusManager(Bus &bus) : bus(bus) {}
+
+  // Probe every slot address. Returns the number of slaves that answered.
+  uint8_t discover() {
+    uint8_t found = 0;
+    for (uint8_t i = 0; i < I2C_MAX_SLAVES; i++) {
+      bus.beginTransmission(address(i));
+      bool ack = (bus.endTransmission() == 0);
+      if (ack && !slaves[i].stats.present) slaves[i].resync = true; // (re)appeared: resend everything
+      slaves[i].stats.present = ack;
+      if (ack) {
+        slaves[i].stats.consecutiveFailures = 0;
+        found++;
+      }
+    }
+    return found;
+  }
+
+  static uint8_t address(uint8_t slot) { return I2C_FIRST_SLAVE_ADDR + slot; }
+
+  // Map a relay ID to its slave slot and 1-based channel
+  static bool route(uint16_t relayId, uint8_t &slot, uint8_t &channel) {
+    if (relayId < 1 || relayId > I2C_MAX_RELAYS) return false;
+    slot = (relayId - 1) / I2C_CHANNELS_PER_SLAVE;
+    channel = (relayId - 1) % I2C_CHANNELS_PER_SLAVE + 1;
+    return true;
+  }
+
+  // Queue a relay change; nothing is sent until flush()
+  bool setRelay(uint16_t relayId, bool on) {
+    uint8_t slot, channel;
+    if (!route(relayId, slot, channel)) return false;
+    uint16_t bit = 1U << (channel - 1);
+    Slave &s = slaves[slot];
+    s.desired = on ? (s.desired | bit) : (s.desired & ~bit);
+    s.pending |= bit;
+    return true;
+  }
+
+  // Force every known channel of a slave to be resent on the next flush()
+  void markResync(uint8_t slot) {
+    if (slot < I2C_MAX_SLAVES) slaves[slot].resync = true;
+  }
+
+  // One write per slave with pending changes. Returns the number of failed writes.
+  uint8_t flush() {
+    uint8_t failed = 0;
+    for (uint8_t i = 0; i < I2C_MAX_SLAVES; i++) {
+      Slave &s = slaves[i];
+      if (s.resync) {
+        s.pending |= s.known;
+        s.resync = false;
+      }
+      if (!s.pending || !s.stats.present) continue;
+      char msg[16];
+      snprintf(msg, sizeof(msg), "rm:%04X:%04X", s.pending, s.desired & s.pending);
+      if (send(i, msg)) {
+        s.known |= s.pending;
+        s.pending = 0;
+      } else {
+        failed++;
+      }
+    }
+    return failed;
+  }
+
+  // Send a raw command to one slave, with per-slave accounting
+  bool send(uint8_t slot, const char *msg) {
+    if (slot >= I2C_MAX_SLAVES) return false;
+    I2CSlaveStats &st = slaves[slot].stats;
+    bus.beginTransmission(address(slot));
+    bus.write((const uint8_t *)msg, strlen(msg));
+    bool ok = (bus.endTransmission() == 0);
+    st.transactions++;
+    if (ok) {
+      st.consecutiveFailures = 0;
+      if (!st.present) slaves[slot].resync = true;
+      st.present = true;
+    } else {
+      st.failures++;
+      if (st.consecutiveFailures < 0xFF) st.consecutiveFailures++;
+      if (st.consecutiveFailures >= I2C_OFFLINE_AFTER) st.present = false;
+    }
+    return ok;
+  }
+
+  // Read the slave's status frame. Returns false on a short or corrupt reply.
+  bool readStatus(uint8_t slot, SlaveStatus &status) {
+    if (slot >= I2C_MAX_SLAVES) return false;
+    uint8_t n = bus.requestFrom(address(slot), (uint8_t)sizeof(SlaveStatus));
+    uint8_t *dst = (uint8_t *)&status;
+    uint8_t got = 0;
+    while (bus.available() && got < sizeof(SlaveStatus)) dst[got++] = (uint8_t)bus.read();
+    while (bus.available()) bus.read();
+    bool ok = (n == sizeof(SlaveStatus) && got == sizeof(SlaveStatus) && slaveStatusValid(status));
+    I2CSlaveStats &st = slaves[slot].stats;
+    st.transactions++;
+    if (!ok) st.failures++;
+    return ok;
+  }
+
+  // Compare a readback with the desired state and queue the difference.
+  // Returns true when the slave rebooted since the last readback.
+  bool reconcile(uint8_t slot, const SlaveStatus &status) {
+    Slave &s = slaves[slot];
+    bool rebooted = s.bootSeen && status.bootCount != s.bootCount;
+    s.bootCount = status.bootCount;
+    s.bootSeen = true;
+    if (rebooted) {
+      s.stats.reboots++;
+      s.resync = true;
+      return true;
+    }
+    uint16_t diverged = (status.relayMask ^ s.desired) & s.known & ~s.pending;
+    if (diverged) {
+      s.pending |= diverged;
+      for (uint16_t d = diverged; d; d &= d - 1) s.stats.repairedBits++;
+    }
+    return false;
+  }
+
+  const I2CSlaveStats &stats(uint8_t slot) const { return slaves[slot].stats; }
+  bool isPresent(uint8_t slot) const { return slot < I2C_MAX_SLAVES && slaves[slot].stats.present; }
+  uint16_t desiredMask(uint8_t slot) const { return slaves[slot].desired; }
+
+  // Failure rate in percent since boot
+  uint8_t errorRate(uint8_t slot) const {
+    const I2CSlaveStats &st = slaves[slot].stats;
+    return st.transactions ? (uint8_t)(st.failures * 100UL / st.transactions) : 0;
+  }
+
+private:
+  struct Slave {
+    I2CSlaveStats stats = {0, 0, 0, false, 0, 0};
+    uint16_t desired = 0;  // wanted channel states
+    uint16_t pending = 0;  // channels not yet delivered
+    uint16_t known = 0;    // channels that have ever been set
+    bool resync = false;
+    uint16_t bootCount = 0;
+    bool bootSeen = false;
+  };
+
+  Bus &bus;
+  Slave slaves[I2C_MAX_SLAVES];
+};
+
+#endif // SMARTHAUS_I2C_BUS_MANAGER_H
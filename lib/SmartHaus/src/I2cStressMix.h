@@ -0,0 +1,127 @@
+/***************************************************
+  I2cStressMix - command mix of the I2C stress test
+  (examples/i2c_stress) and the model of what the
+  slave should have seen
+  - next() writes one transmission: mostly one command,
+    some two separated by '\n', half of them ending in
+    '\n'. Relay, batched relay, door, select and
+    malformed commands, in fixed proportions
+  - the model follows every command: packet count and
+    slaveRxHash() as processPacket() folds them, bad
+    packets, relay outputs. undo() takes back the last
+    transmission when the slave NACKed it
+  - rxOk() / relaysOk() compare the model with the
+    slave's "rxstats" and status frames
+
+  Shared with the host model in test_i2c_stress.
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_I2C_STRESS_MIX_H
+#define SMARTHAUS_I2C_STRESS_MIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "SlaveStatus.h"
+
+// What the slave should have seen and done
+struct StressModel {
+  uint32_t packets;
+  uint32_t hash;
+  uint32_t bad;
+  uint16_t relayMask;
+  uint16_t relayKnown;
+};
+
+class I2cStressMix {
+public:
+  // relays must not exceed the slave's max_relays
+  I2cStressMix(uint8_t relays, uint32_t seed) : relays(relays), rng(seed) {
+    m.relayMask = m.relayKnown = 0;
+    reset();
+  }
+
+  // After "rxreset"; relay state carries over
+  void reset() {
+    m.packets = 0;
+    m.hash = SLAVE_RX_HASH_INIT;
+    m.bad = 0;
+  }
+
+  // One transmission into out (room for 32 bytes); returns its length and
+  // the commands in it. last: only one command may go out.
+  size_t next(char *out, size_t size, bool last, uint8_t &count) {
+    uint32_t r = nextRandom();
+    count = (r & 0x0F) == 0 && !last ? 2 : 1;
+    before = m;
+    size_t len = 0;
+    for (uint8_t k = 0; k < count; k++) {
+      nextCommand(out + len, size - len - 1);
+      len += strlen(out + len);
+      if (k + 1 < count || (r & 0x10)) out[len++] = '\n';
+    }
+    return len;
+  }
+
+  // The last transmission was refused: it is not in the model
+  void undo() { m = before; }
+
+  const StressModel &model() const { return m; }
+
+  bool rxOk(const SlaveRxStats &rx) const {
+    return rx.packets == m.packets && rx.hash == m.hash && rx.bad == m.bad;
+  }
+  bool relaysOk(const SlaveStatus &st) const { return (st.relayMask & m.relayKnown) == m.relayMask; }
+
+private:
+  uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+  void relay(uint8_t id, bool on) {
+    uint16_t bit = 1U << (id - 1);
+    m.relayKnown |= bit;
+    if (on) m.relayMask |= bit;
+    else m.relayMask &= ~bit;
+  }
+
+  // Next command of the mix into out (no newline); updates the model
+  void nextCommand(char *out, size_t size) {
+    uint32_t r = nextRandom();
+    uint8_t kind = r % 100;
+    uint8_t id = 1 + (r >> 8) % relays;
+    bool on = (r >> 16) & 1;
+    if (kind < 50) {
+      snprintf(out, size, "%u:%u", id, on);
+      relay(id, on);
+    } else if (kind < 70) {
+      uint16_t mask = ((r >> 8) & 0xFF) & ((1U << relays) - 1);
+      uint16_t values = (r >> 20) & mask;
+      snprintf(out, size, "rm:%x:%x", mask, values);
+      for (uint8_t ch = 1; ch <= relays; ch++) {
+        uint16_t bit = 1U << (ch - 1);
+        if (mask & bit) relay(ch, values & bit);
+      }
+    } else if (kind < 80) {
+      snprintf(out, size, "%s", on ? "lock" : "unlock");
+    } else if (kind < 90) {
+      snprintf(out, size, "pumpstats");
+    } else {
+      snprintf(out, size, "%u:%u", id, (unsigned)(2 + (r >> 24) % 7)); // state out of range
+      m.bad++;
+    }
+    m.packets++;
+    m.hash = slaveRxHash(m.hash, out, strlen(out));
+  }
+
+  uint8_t relays;
+  uint32_t rng;
+  StressModel m;
+  StressModel before;
+};
+
+#endif // SMARTHAUS_I2C_STRESS_MIX_H
@@ -0,0 +1,150 @@
+/***************************************************
+  IdleGovernor - sleep between scheduled work
+  - plan() turns "anything pending?" and the time to
+    the next scheduled job into a sleep length for the
+    end of the loop pass
+  - sleeping()/woke() account every transition, so the
+    awake share (duty cycle) and an estimated average
+    current come out per reporting window
+  - wakeLatency() takes the delay from a wake edge to
+    the first sensor read; a sample over the budget
+    steps the mode down (light -> modem -> off), a run
+    of good samples steps it back up, so the penalty a
+    sleeping controller adds to an unlock stays bounded
+
+  Currents are a model (datasheet figures by default),
+  not a measurement. Caller passes millis(); no
+  Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_IDLE_GOVERNOR_H
+#define SMARTHAUS_IDLE_GOVERNOR_H
+
+#include <stdint.h>
+
+enum IdleMode : uint8_t {
+  IDLE_OFF = 0,  // never sleep
+  IDLE_MODEM,    // CPU idles, radio sleeps between beacons
+  IDLE_LIGHT     // CPU and radio sleep between beacons, GPIO wake
+};
+
+enum WakeSource : uint8_t {
+  WAKE_TIMER = 0,
+  WAKE_TOUCH,
+  WAKE_FLOAT,
+  WAKE_SOURCES
+};
+
+// Tenths of a mA
+struct IdlePowerModel {
+  uint16_t activeMa10;
+  uint16_t modemMa10;
+  uint16_t lightMa10;  // averaged over the beacon wakes
+};
+
+struct IdleConfig {
+  IdleMode mode;          // deepest mode allowed
+  uint16_t minSleepMs;    // shorter gaps are not worth a transition
+  uint16_t maxSleepMs;    // cap per sleep, also bounds SSE/poll latency
+  uint16_t wakeBudgetMs;  // wake edge -> first sensor read
+  uint8_t recoverAfter;   // good samples before trying the deeper mode again
+  IdlePowerModel power;
+};
+
+struct IdleStats {
+  uint32_t awakeMs;
+  uint32_t modemMs;
+  uint32_t lightMs;
+  uint32_t sleeps;
+  uint32_t wakes[WAKE_SOURCES];
+  uint32_t latencyMaxMs;
+  uint32_t latencySamples;
+  uint32_t overBudget;
+};
+
+class IdleGovernor {
+public:
+  explicit IdleGovernor(const IdleConfig &cfg) : cfg(cfg), current(cfg.mode) {}
+
+  void begin(uint32_t nowMs) {
+    lastMs = nowMs;
+    resetStats();
+  }
+
+  // Sleep length for this pass, 0 = stay awake
+  uint32_t plan(bool busy, uint32_t untilNextMs) const {
+    if (current == IDLE_OFF || busy) return 0;
+    uint32_t ms = untilNextMs < cfg.maxSleepMs ? untilNextMs : cfg.maxSleepMs;
+    return ms < cfg.minSleepMs ? 0 : ms;
+  }
+
+  void sleeping(uint32_t nowMs) {
+    account(nowMs);
+    asleep = true;
+    sleptIn = current;
+    st.sleeps++;
+  }
+
+  void woke(uint32_t nowMs, WakeSource src) {
+    account(nowMs);
+    asleep = false;
+    if (src < WAKE_SOURCES) st.wakes[src]++;
+  }
+
+  void wakeLatency(uint32_t ms) {
+    st.latencySamples++;
+    if (ms > st.latencyMaxMs) st.latencyMaxMs = ms;
+    if (ms > cfg.wakeBudgetMs) {
+      st.overBudget++;
+      good = 0;
+      if (current > IDLE_OFF) current = (IdleMode)(current - 1);
+    } else if (current < cfg.mode && ++good >= cfg.recoverAfter) {
+      good = 0;
+      current = (IdleMode)(current + 1);
+    }
+  }
+
+  // Awake share of the window in tenths of a percent
+  uint16_t dutyPermille(uint32_t nowMs) {
+    account(nowMs);
+    uint32_t total = st.awakeMs + st.modemMs + st.lightMs;
+    return total ? (uint16_t)((uint64_t)st.awakeMs * 1000 / total) : 1000;
+  }
+
+  // Estimated average draw over the window, tenths of a mA
+  uint16_t averageMa10(uint32_t nowMs) {
+    account(nowMs);
+    uint64_t total = (uint64_t)st.awakeMs + st.modemMs + st.lightMs;
+    if (!total) return cfg.power.activeMa10;
+    uint64_t charge = (uint64_t)st.awakeMs * cfg.power.activeMa10 + (uint64_t)st.modemMs * cfg.power.modemMa10 +
+                      (uint64_t)st.lightMs * cfg.power.lightMa10;
+    return (uint16_t)(charge / total);
+  }
+
+  // Start a new reporting window
+  void resetStats() {
+    st = IdleStats();
+  }
+
+  IdleMode mode() const { return current; }
+  bool isAsleep() const { return asleep; }
+  const IdleStats &stats() const { return st; }
+
+private:
+  void account(uint32_t nowMs) {
+    uint32_t dt = nowMs - lastMs;
+    lastMs = nowMs;
+    if (!asleep) st.awakeMs += dt;
+    else if (sleptIn == IDLE_LIGHT) st.lightMs += dt;
+    else st.modemMs += dt;
+  }
+
+  IdleConfig cfg;
+  IdleMode current;
+  IdleMode sleptIn = IDLE_OFF;
+  bool asleep = false;
+  uint8_t good = 0;
+  uint32_t lastMs = 0;
+  IdleStats st = IdleStats();
+};
+
+#endif // SMARTHAUS_IDLE_GOVERNOR_H
@@ -0,0 +1,50 @@
+/***************************************************
+  IsrSupport - ISR placement and critical sections
+  shared by the headers that touch state from both an
+  interrupt and the main loop.
+ ****************************************************/
+#ifndef SMARTHAUS_ISR_SUPPORT_H
+#define SMARTHAUS_ISR_SUPPORT_H
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+// Code called from an ISR must live in IRAM on the ESP boards
+#if defined(ESP8266) || defined(ESP32)
+#define SH_ISR_ATTR IRAM_ATTR
+#else
+#define SH_ISR_ATTR
+#endif
+
+// Main-loop only: unconditionally re-enables interrupts on exit
+#ifdef ARDUINO
+#define SH_ENTER_CRITICAL() noInterrupts()
+#define SH_EXIT_CRITICAL() interrupts()
+#else
+#define SH_ENTER_CRITICAL()
+#define SH_EXIT_CRITICAL()
+#endif
+
+// Nestable variant, safe inside an ISR: restores the previous interrupt state
+#if defined(__AVR__)
+typedef uint8_t sh_irq_state_t;
+#define SH_IRQ_SAVE() ({ uint8_t s_ = SREG; cli(); s_; })
+#define SH_IRQ_RESTORE(s) (SREG = (s))
+#elif defined(ESP8266)
+typedef uint32_t sh_irq_state_t;
+#define SH_IRQ_SAVE() xt_rsil(15)
+#define SH_IRQ_RESTORE(s) xt_wsr_ps(s)
+#elif defined(ARDUINO)
+typedef uint8_t sh_irq_state_t;
+#define SH_IRQ_SAVE() (noInterrupts(), (uint8_t)0)
+#define SH_IRQ_RESTORE(s) ((void)(s), interrupts())
+#else
+typedef uint8_t sh_irq_state_t;
+#define SH_IRQ_SAVE() ((uint8_t)0)
+#define SH_IRQ_RESTORE(s) ((void)(s))
+#endif
+
+#endif // SMARTHAUS_ISR_SUPPORT_H
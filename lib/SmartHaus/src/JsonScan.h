@@ -0,0 +1,140 @@
+/***************************************************
+  JsonScan - tiny allocation-free JSON field lookup
+  Enough for the flat objects we read from Firebase
+  (config, relay trees). Keys are matched on their
+  first occurrence; no validation beyond that, but
+  every function stops at the terminating NUL and
+  the iterators always make progress, whatever the
+  server sent.
+ ****************************************************/
+#ifndef SMARTHAUS_JSON_SCAN_H
+#define SMARTHAUS_JSON_SCAN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Returns a pointer to the value of "key", or nullptr
+inline const char *jsonFind(const char *json, const char *key) {
+  size_t keyLen = strlen(key);
+  const char *p = json;
+  while ((p = strchr(p, '"')) != nullptr) {
+    p++;
+    if (strncmp(p, key, keyLen) == 0 && p[keyLen] == '"') {
+      const char *v = p + keyLen + 1;
+      while (*v == ' ' || *v == '\t' || *v == '\r' || *v == '\n') v++;
+      if (*v == ':') {
+        v++;
+        while (*v == ' ' || *v == '\t' || *v == '\r' || *v == '\n') v++;
+        return v;
+      }
+    }
+    // skip to the end of this string
+    while (*p && *p != '"') {
+      if (*p == '\\' && p[1]) p++;
+      p++;
+    }
+    if (*p) p++;
+  }
+  return nullptr;
+}
+
+inline bool jsonGetLong(const char *json, const char *key, long &out) {
+  const char *v = jsonFind(json, key);
+  if (!v) return false;
+  char *end;
+  long n = strtol(v, &end, 10);
+  if (end == v) return false;
+  out = n;
+  return true;
+}
+
+inline bool jsonGetBool(const char *json, const char *key, bool &out) {
+  const char *v = jsonFind(json, key);
+  if (!v) return false;
+  if (strncmp(v, "true", 4) == 0) { out = true; return true; }
+  if (strncmp(v, "false", 5) == 0) { out = false; return true; }
+  return false;
+}
+
+// Copies a string value (escapes are not decoded). Fails if it does not fit.
+inline bool jsonGetString(const char *json, const char *key, char *out, size_t size) {
+  const char *v = jsonFind(json, key);
+  if (!v || *v != '"') return false;
+  v++;
+  size_t n = 0;
+  while (v[n] && v[n] != '"') n++;
+  if (v[n] != '"' || n >= size) return false;
+  memcpy(out, v, n);
+  out[n] = '\0';
+  return true;
+}
+
+// Skip one JSON value starting at p; returns the first char after it
+inline const char *jsonSkipValue(const char *p) {
+  if (*p == '"') {
+    p++;
+    while (*p && *p != '"') {
+      if (*p == '\\' && p[1]) p++;
+      p++;
+    }
+    return *p ? p + 1 : p;
+  }
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (*p) {
+      if (*p == '"') { p = jsonSkipValue(p); continue; }
+      if (*p == '{' || *p == '[') depth++;
+      else if (*p == '}' || *p == ']') {
+        if (--depth == 0) return p + 1;
+      }
+      p++;
+    }
+    return p;
+  }
+  while (*p && *p != ',' && *p != '}' && *p != ']') p++;
+  return p;
+}
+
+// Iterate the elements of an array in one pass. Start with p just past '['.
+// Returns false at ']' or the end of the text. Every call moves p forward,
+// so a malformed array ends the loop instead of spinning on a stray '}'.
+inline bool jsonNextElement(const char *&p, const char *&value, const char *&valueEnd) {
+  while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+  if (!*p || *p == ']') return false;
+  value = p;
+  valueEnd = jsonSkipValue(p);
+  if (valueEnd == p) valueEnd = p + 1;
+  p = valueEnd;
+  return true;
+}
+
+// Iterate the members of a top-level object in one pass.
+// Start with p pointing at '{'. Returns false when there are no more members.
+// value/valueEnd bracket the member's raw value text.
+inline bool jsonNextMember(const char *&p, char *key, size_t keySize, const char *&value, const char *&valueEnd) {
+  while (*p && *p != '"') {
+    if (*p == '}') return false;
+    p++;
+  }
+  if (!*p) return false;
+  p++;
+  size_t n = 0;
+  while (*p && *p != '"') {
+    if (n + 1 < keySize) key[n++] = *p;
+    p++;
+  }
+  key[n] = '\0';
+  if (!*p) return false;
+  p++;
+  while (*p && *p != ':') p++;
+  if (!*p) return false;
+  p++;
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+  value = p;
+  valueEnd = jsonSkipValue(p);
+  p = valueEnd;
+  return true;
+}
+
+#endif // SMARTHAUS_JSON_SCAN_H
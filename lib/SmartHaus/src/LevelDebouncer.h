@@ -0,0 +1,112 @@
+/***************************************************
+  LevelDebouncer - shared float / water sensor debouncer
+  Used by the NodeMCU (FLOAT_PIN, edge interrupt) and the
+  Mega (WATER_SENSOR_PIN, polled every loop).
+
+  Time spent at each raw level is integrated between edges.
+  The stable state only flips once the net time at the new
+  level reaches assertMs (going true) or releaseMs (going
+  false), and never before minDwellMs in the current state.
+  Sloshing cancels itself out in the integrator instead of
+  producing a burst of state changes.
+ ****************************************************/
+#ifndef SMARTHAUS_LEVEL_DEBOUNCER_H
+#define SMARTHAUS_LEVEL_DEBOUNCER_H
+
+#include <stdint.h>
+#include "IsrSupport.h"
+
+class LevelDebouncer {
+public:
+  struct Config {
+    uint16_t assertMs;   // net time at the true level before reporting true
+    uint16_t releaseMs;  // net time at the false level before reporting false
+    uint16_t minDwellMs; // minimum time a stable state is held
+  };
+
+  explicit LevelDebouncer(const Config &cfg) : cfg(cfg) {}
+
+  // Seed the stable state from a single read at boot
+  void begin(bool level, uint32_t nowMs) {
+    SH_ENTER_CRITICAL();
+    stable = level;
+    integ = level ? cfg.releaseMs : 0;
+    edgeLevel = level;
+    edgeMs = nowMs;
+    highAcc = 0;
+    lowAcc = 0;
+    SH_EXIT_CRITICAL();
+    lastChangeMs = nowMs - cfg.minDwellMs; // first real transition is not held back
+  }
+
+  // Record a raw edge. Safe to call from a pin-change ISR.
+  void SH_ISR_ATTR onEdge(bool level, uint32_t nowMs) {
+    uint32_t dt = nowMs - edgeMs;
+    if (edgeLevel) highAcc += dt; else lowAcc += dt;
+    edgeMs = nowMs;
+    edgeLevel = level;
+    edges++;
+  }
+
+  // Polled boards: feed the current raw level every loop
+  bool poll(bool level, uint32_t nowMs) {
+    if (level != edgeLevel) onEdge(level, nowMs);
+    return update(nowMs);
+  }
+
+  // Advance the integrator. Returns true when the stable state changed.
+  bool update(uint32_t nowMs) {
+    SH_ENTER_CRITICAL();
+    uint32_t dt = nowMs - edgeMs;
+    uint32_t hi = highAcc + (edgeLevel ? dt : 0);
+    uint32_t lo = lowAcc + (edgeLevel ? 0 : dt);
+    highAcc = 0;
+    lowAcc = 0;
+    edgeMs = nowMs;
+    SH_EXIT_CRITICAL();
+
+    int32_t limit = stable ? cfg.releaseMs : cfg.assertMs;
+    int32_t next = (int32_t)integ + clampDelta(hi) - clampDelta(lo);
+    if (next < 0) next = 0;
+    if (next > limit) next = limit;
+    integ = (uint16_t)next;
+
+    bool dwellOk = (nowMs - lastChangeMs) >= cfg.minDwellMs;
+    if (!stable && integ >= cfg.assertMs && dwellOk) {
+      stable = true;
+      integ = cfg.releaseMs;
+    } else if (stable && integ == 0 && dwellOk) {
+      stable = false;
+    } else {
+      return false;
+    }
+    lastChangeMs = nowMs;
+    changes++;
+    return true;
+  }
+
+  bool state() const { return stable; }
+  // Raw level agrees with the stable state and the integrator is at rest
+  // (nothing for update() to do until the next edge)
+  bool settled() const { return edgeLevel == stable && integ == (stable ? cfg.releaseMs : 0); }
+  uint32_t edgeCount() const { return edges; }
+  uint32_t changeCount() const { return changes; }
+
+private:
+  static int32_t clampDelta(uint32_t ms) { return ms > 0x7FFF ? 0x7FFF : (int32_t)ms; }
+
+  Config cfg;
+  bool stable = false;
+  uint16_t integ = 0;
+  uint32_t lastChangeMs = 0;
+  uint32_t changes = 0;
+
+  // Written from the ISR
+  volatile bool edgeLevel = false;
+  volatile uint32_t edgeMs = 0;
+  volatile uint32_t highAcc = 0;
+  volatile uint32_t lowAcc = 0;
+  volatile uint32_t edges = 0;
+};
+
+#endif // SMARTHAUS_LEVEL_DEBOUNCER_H
@@ -0,0 +1,135 @@
+/***************************************************
+  LockoutPolicy - failed fingerprint attempt policy
+  - failures are counted inside a sliding window
+  - reaching maxAttempts starts a lockout of
+    baseLockS * 2^level (capped at maxLockS)
+  - the lockout ends on its own when the time is up
+  - the backoff level drops back to 0 after a clean
+    decayS period or a successful scan
+
+  All times are seconds on a caller supplied monotonic
+  clock. Snapshots store relative times, so a power
+  cycle resumes a lockout instead of clearing it.
+ ****************************************************/
+#ifndef SMARTHAUS_LOCKOUT_POLICY_H
+#define SMARTHAUS_LOCKOUT_POLICY_H
+
+#include <stdint.h>
+
+struct LockoutConfig {
+  uint8_t maxAttempts;  // failures inside windowS that start a lockout
+  uint16_t windowS;     // failure counting window
+  uint16_t baseLockS;   // first lockout length
+  uint32_t maxLockS;    // longest lockout after doubling
+  uint32_t decayS;      // clean time before the backoff level resets
+};
+
+// Persisted form (RTC memory / flash)
+struct __attribute__((packed)) LockoutSnapshot {
+  uint8_t version;
+  uint8_t failures;
+  uint8_t level;
+  uint16_t windowAgeS;
+  uint32_t lockRemainingS;
+  uint32_t cleanS;  // seconds since the last failure
+};
+
+#define LOCKOUT_SNAPSHOT_VERSION 1
+
+class LockoutPolicy {
+public:
+  explicit LockoutPolicy(const LockoutConfig &cfg) : cfg(cfg) {}
+
+  void restore(const LockoutSnapshot &snap, uint32_t nowS) {
+    if (snap.version != LOCKOUT_SNAPSHOT_VERSION) return;
+    failCount = snap.failures;
+    backoffLevel = snap.level;
+    windowStartS = nowS - snap.windowAgeS;
+    lockUntilS = nowS + snap.lockRemainingS;
+    locked = snap.lockRemainingS > 0;
+    lastFailureS = nowS - snap.cleanS;
+  }
+
+  LockoutSnapshot snapshot(uint32_t nowS) const {
+    LockoutSnapshot snap;
+    snap.version = LOCKOUT_SNAPSHOT_VERSION;
+    snap.failures = failCount;
+    snap.level = backoffLevel;
+    uint32_t age = nowS - windowStartS;
+    snap.windowAgeS = age > 0xFFFF ? 0xFFFF : (uint16_t)age;
+    snap.lockRemainingS = remainingS(nowS);
+    snap.cleanS = nowS - lastFailureS;
+    return snap;
+  }
+
+  // Returns true when this failure started a lockout
+  bool recordFailure(uint32_t nowS) {
+    tick(nowS);
+    if (failCount == 0 || nowS - windowStartS >= cfg.windowS) {
+      windowStartS = nowS;
+      failCount = 0;
+    }
+    if (failCount < 0xFF) failCount++;
+    lastFailureS = nowS;
+    if (locked || failCount < cfg.maxAttempts) return false;
+
+    uint32_t lockS = cfg.baseLockS;
+    for (uint8_t i = 0; i < backoffLevel && lockS < cfg.maxLockS; i++) lockS <<= 1;
+    if (lockS > cfg.maxLockS) lockS = cfg.maxLockS;
+    if (backoffLevel < 31) backoffLevel++;
+    locked = true;
+    lockUntilS = nowS + lockS;
+    return true;
+  }
+
+  void recordSuccess(uint32_t nowS) {
+    tick(nowS);
+    failCount = 0;
+    backoffLevel = 0;
+  }
+
+  // Remote override, e.g. failed_attempts reset to 0 in Firebase
+  void setFailures(uint8_t failures, uint32_t nowS) {
+    failCount = failures;
+    windowStartS = nowS;
+    if (failures == 0) {
+      locked = false;
+      backoffLevel = 0;
+    } else if (!locked && failures >= cfg.maxAttempts) {
+      locked = true;
+      lockUntilS = nowS + cfg.baseLockS;
+    }
+  }
+
+  // Advance timers. Returns true when a lockout just expired.
+  bool tick(uint32_t nowS) {
+    bool expired = false;
+    if (locked && (int32_t)(nowS - lockUntilS) >= 0) {
+      locked = false;
+      failCount = 0;
+      expired = true;
+    }
+    if (backoffLevel && !locked && nowS - lastFailureS >= cfg.decayS) backoffLevel = 0;
+    return expired;
+  }
+
+  bool isLocked() const { return locked; }
+  uint8_t failures() const { return failCount; }
+  uint8_t level() const { return backoffLevel; }
+
+  uint32_t remainingS(uint32_t nowS) const {
+    if (!locked || (int32_t)(nowS - lockUntilS) >= 0) return 0;
+    return lockUntilS - nowS;
+  }
+
+private:
+  LockoutConfig cfg;
+  bool locked = false;
+  uint8_t failCount = 0;
+  uint8_t backoffLevel = 0;
+  uint32_t windowStartS = 0;
+  uint32_t lockUntilS = 0;
+  uint32_t lastFailureS = 0;
+};
+
+#endif // SMARTHAUS_LOCKOUT_POLICY_H
@@ -0,0 +1,86 @@
+/***************************************************
+  MemoryWatch - runtime memory high-water marks
+  - MemoryLowWater keeps the lowest free heap, largest
+    free block and free stack seen since boot, from
+    samples the sketch takes (ESP.getFreeHeap() etc.)
+  - on AVR the SRAM between .bss and the stack is
+    painted before setup() runs (.init3), so
+    memStackUnused() reports how deep the stack and
+    heap have ever reached, not just the current gap
+
+  Static sizes are checked at build time by
+  scripts/memory_report.py.
+ ****************************************************/
+#ifndef SMARTHAUS_MEMORY_WATCH_H
+#define SMARTHAUS_MEMORY_WATCH_H
+
+#include <stdint.h>
+
+struct MemorySample {
+  uint32_t freeHeap;
+  uint32_t maxBlock;   // largest single allocation possible
+  uint32_t freeStack;
+};
+
+class MemoryLowWater {
+public:
+  void sample(const MemorySample &s) {
+    last = s;
+    if (count == 0) {
+      low = s;
+    } else {
+      if (s.freeHeap < low.freeHeap) low.freeHeap = s.freeHeap;
+      if (s.maxBlock < low.maxBlock) low.maxBlock = s.maxBlock;
+      if (s.freeStack < low.freeStack) low.freeStack = s.freeStack;
+    }
+    count++;
+  }
+
+  const MemorySample &lowest() const { return low; }
+  const MemorySample &latest() const { return last; }
+  uint32_t samples() const { return count; }
+
+private:
+  MemorySample low = {0, 0, 0};
+  MemorySample last = {0, 0, 0};
+  uint32_t count = 0;
+};
+
+#ifdef __AVR__
+#define MEM_PAINT 0xC5
+
+extern uint8_t _end;      // end of .bss, start of the heap
+extern uint8_t __stack;   // last SRAM byte
+extern char *__brkval;    // heap top, 0 before the first malloc
+
+// Runs from the startup code, after the stack pointer and r1 are set up
+// and before static constructors; nothing is on the stack yet.
+static void memPaintStack() __attribute__((naked, used, section(".init3")));
+static void memPaintStack() {
+  uint8_t *p = &_end;
+  while (p <= &__stack) *p++ = MEM_PAINT;
+}
+
+static inline const uint8_t *memHeapTop() {
+  return __brkval ? (const uint8_t *)__brkval : &_end;
+}
+
+// Bytes between heap and stack never touched since boot
+static inline uint16_t memStackUnused() {
+  const uint8_t *p = memHeapTop();
+  uint16_t n = 0;
+  while (p <= &__stack && *p == MEM_PAINT) {
+    p++;
+    n++;
+  }
+  return n;
+}
+
+// Current gap between heap top and stack pointer
+static inline uint16_t memFreeNow() {
+  uint8_t marker;
+  return (uint16_t)(&marker - memHeapTop());
+}
+#endif // __AVR__
+
+#endif // SMARTHAUS_MEMORY_WATCH_H
@@ -0,0 +1,223 @@
+/***************************************************
+  Metrics - fixed-slot counters, gauges and log2
+  histograms in static RAM
+  - every slot is an enum index chosen at compile time;
+    inc()/set()/observe() are O(1) and safe against an
+    ISR taking a snapshot in the middle of them
+  - a histogram bucket is the bit length of
+    (value >> shift), 16 buckets: bucket 0 holds values
+    below 1 << shift, bucket 15 everything from
+    1 << (14 + shift) up
+  - take() copies the block and starts a new histogram
+    window; counters run since boot, gauges are levels
+  - the Mega's block is pulled over I2C in 32-byte
+    MetricsFrame pieces ("metrics:<offset>", offset 0
+    takes the snapshot); the NodeMCU turns both blocks
+    into one JSON snapshot with metricsJson()
+
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_METRICS_H
+#define SMARTHAUS_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "IsrSupport.h"
+
+#define METRIC_BUCKETS 16
+
+struct __attribute__((packed)) MetricHistogram {
+  uint32_t bucket[METRIC_BUCKETS];
+  uint32_t max;  // raw value, before the shift
+};
+
+// The packed layout is what goes over I2C (both boards are little-endian)
+template <uint8_t C, uint8_t G, uint8_t H>
+struct __attribute__((packed)) MetricsBlock {
+  uint32_t counter[C];
+  int32_t gauge[G];
+  MetricHistogram hist[H];
+};
+
+// Names for metricsJson(); the Mega never references them, so they cost it no RAM
+struct MetricsNames {
+  const char *const *counters;
+  const char *const *gauges;
+  const char *const *hists;
+  const uint8_t *shifts;
+};
+
+// Bit length of v, 0 for 0
+inline uint8_t metricBitLength(uint32_t v) {
+  uint8_t b = 0;
+  if (v >> 16) { v >>= 16; b += 16; }
+  if (v >> 8) { v >>= 8; b += 8; }
+  if (v >> 4) { v >>= 4; b += 4; }
+  if (v >> 2) { v >>= 2; b += 2; }
+  if (v >> 1) { v >>= 1; b += 1; }
+  return b + (uint8_t)v;
+}
+
+template <uint8_t C, uint8_t G, uint8_t H>
+class Metrics {
+public:
+  static_assert(C && G && H, "every metric kind needs at least one slot");
+  typedef MetricsBlock<C, G, H> Block;
+
+  explicit Metrics(const uint8_t (&shifts)[H]) : shifts(shifts) {}
+
+  void inc(uint8_t id, uint32_t n = 1) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    b.counter[id] += n;
+    SH_IRQ_RESTORE(s);
+  }
+
+  void set(uint8_t id, int32_t v) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    b.gauge[id] = v;
+    SH_IRQ_RESTORE(s);
+  }
+
+  void observe(uint8_t id, uint32_t v) {
+    uint8_t i = metricBitLength(v >> shifts[id]);
+    if (i >= METRIC_BUCKETS) i = METRIC_BUCKETS - 1;
+    MetricHistogram &h = b.hist[id];
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    h.bucket[i]++;
+    if (v > h.max) h.max = v;
+    SH_IRQ_RESTORE(s);
+  }
+
+  // Copy the block and clear the histograms for the next window
+  void take(Block &out) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    memcpy(&out, &b, sizeof(b));
+    memset(b.hist, 0, sizeof(b.hist));
+    SH_IRQ_RESTORE(s);
+  }
+
+  uint32_t counter(uint8_t id) const { return b.counter[id]; }
+  int32_t gauge(uint8_t id) const { return b.gauge[id]; }
+
+private:
+  const uint8_t (&shifts)[H];
+  Block b = {};
+};
+
+// One I2C read, exactly one AVR Wire buffer
+#define METRICS_FRAME_MAGIC 0xC3
+#define METRICS_FRAME_DATA 24
+
+struct __attribute__((packed)) MetricsFrame {
+  uint8_t magic;
+  uint8_t layout;    // block layout version, a mismatch is not decoded
+  uint16_t offset;   // of data[] within the block
+  uint16_t total;    // block size
+  uint8_t len;
+  uint8_t data[METRICS_FRAME_DATA];
+  uint8_t crc;
+};
+
+inline uint8_t metricsFrameCrc(const MetricsFrame &f) {
+  const uint8_t *p = (const uint8_t *)&f;
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < sizeof(MetricsFrame) - 1; i++) {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+// Slave side: the piece of a taken block starting at offset
+inline void metricsFrame(const void *block, uint16_t total, uint8_t layout, uint16_t offset, MetricsFrame &f) {
+  memset(&f, 0, sizeof(f));
+  f.magic = METRICS_FRAME_MAGIC;
+  f.layout = layout;
+  f.offset = offset;
+  f.total = total;
+  if (offset < total) {
+    f.len = total - offset < METRICS_FRAME_DATA ? total - offset : METRICS_FRAME_DATA;
+    memcpy(f.data, (const uint8_t *)block + offset, f.len);
+  }
+  f.crc = metricsFrameCrc(f);
+}
+
+// Master side: copy a frame into the block being reassembled
+inline bool metricsFrameApply(const MetricsFrame &f, uint8_t layout, uint16_t offset, void *block, uint16_t total) {
+  if (f.magic != METRICS_FRAME_MAGIC || f.crc != metricsFrameCrc(f)) return false;
+  if (f.layout != layout || f.offset != offset || f.total != total || f.len == 0) return false;
+  if (f.len > METRICS_FRAME_DATA || offset + f.len > total) return false;
+  memcpy((uint8_t *)block + offset, f.data, f.len);
+  return true;
+}
+
+// {"c":{..},"g":{..},"h":{"name":{"s":shift,"max":m,"b":[..]}}}; empty histograms
+// are left out and trailing empty buckets trimmed. Returns the length, 0 if it did not fit.
+template <uint8_t C, uint8_t G, uint8_t H>
+size_t metricsJson(char *out, size_t size, const MetricsBlock<C, G, H> &b, const MetricsNames &names) {
+  size_t n = 0;
+  int w;
+#define METRICS_PUT(...) \
+  do { \
+    w = snprintf(out + n, size - n, __VA_ARGS__); \
+    if (w < 0 || (size_t)w >= size - n) return 0; \
+    n += w; \
+  } while (0)
+  METRICS_PUT("{\"c\":{");
+  for (uint8_t i = 0; i < C; i++) METRICS_PUT("%s\"%s\":%lu", i ? "," : "", names.counters[i], (unsigned long)b.counter[i]);
+  METRICS_PUT("},\"g\":{");
+  for (uint8_t i = 0; i < G; i++) METRICS_PUT("%s\"%s\":%ld", i ? "," : "", names.gauges[i], (long)b.gauge[i]);
+  METRICS_PUT("},\"h\":{");
+  bool first = true;
+  for (uint8_t i = 0; i < H; i++) {
+    const MetricHistogram &h = b.hist[i];
+    int8_t last = METRIC_BUCKETS - 1;
+    while (last >= 0 && !h.bucket[last]) last--;
+    if (last < 0) continue;
+    METRICS_PUT("%s\"%s\":{\"s\":%u,\"max\":%lu,\"b\":[", first ? "" : ",", names.hists[i], names.shifts[i],
+                (unsigned long)h.max);
+    for (int8_t k = 0; k <= last; k++) METRICS_PUT("%s%lu", k ? "," : "", (unsigned long)h.bucket[k]);
+    METRICS_PUT("]}");
+    first = false;
+  }
+  METRICS_PUT("}}");
+#undef METRICS_PUT
+  return n;
+}
+
+// Mega slave metrics, pulled by the NodeMCU
+#define MEGA_METRICS_LAYOUT 2
+
+enum MegaCounter : uint8_t {
+  MC_I2C_RX = 0,      // packets from the master
+  MC_I2C_BAD,         // malformed packets
+  MC_RELAY_WRITES,    // relay outputs switched
+  MC_SMS_QUEUED,      // one per recipient of a digest
+  MC_SMS_SENT,        // +CMGS / OK
+  MC_SMS_FAILED,      // no prompt, an error code or no answer, on the retry too
+  MC_ALERTS_MERGED,   // alerts folded into a pending digest or already reported
+  MC_COUNT
+};
+
+enum MegaGauge : uint8_t {
+  MG_SRAM_FREE = 0,
+  MG_SRAM_MIN,
+  MG_COUNT
+};
+
+enum MegaHist : uint8_t {
+  MH_LOOP_US = 0,     // task pass without the idle delay
+  MH_SMS_MS,          // digest start -> this recipient done or failed
+  MH_COUNT
+};
+
+static const uint8_t MEGA_METRIC_SHIFTS[MH_COUNT] = {4, 6};
+static const char *const MEGA_COUNTER_NAMES[MC_COUNT] = {"i2c_rx", "i2c_bad", "relay_writes", "sms_queued",
+                                                         "sms_sent", "sms_failed", "alerts_merged"};
+static const char *const MEGA_GAUGE_NAMES[MG_COUNT] = {"sram_free", "sram_min"};
+static const char *const MEGA_HIST_NAMES[MH_COUNT] = {"loop_us", "sms_ms"};
+
+typedef Metrics<MC_COUNT, MG_COUNT, MH_COUNT> MegaMetrics;
+
+#endif // SMARTHAUS_METRICS_H
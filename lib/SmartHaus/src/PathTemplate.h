@@ -0,0 +1,132 @@
+/***************************************************
+  PathTemplate - RTDB paths without per-call snprintf
+  A template is a fixed prefix and suffix known at
+  compile time (lengths come from sizeof, text can sit
+  in flash). A PathBuffer copies the prefix once and on
+  each call only writes the variable segment + suffix.
+
+    static const char RELAY_PREFIX[] PROGMEM = "/smart_controls/relays/";
+    static const char RELAY_SUFFIX[] PROGMEM = "/state";
+    static const PathTemplate RELAY_STATE = PATH_TEMPLATE(RELAY_PREFIX, RELAY_SUFFIX);
+    PathBuffer<48> relayPath(RELAY_STATE);
+    Database.get<bool>(aClient, relayPath.format(id));
+ ****************************************************/
+#ifndef SMARTHAUS_PATH_TEMPLATE_H
+#define SMARTHAUS_PATH_TEMPLATE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
+
+struct PathTemplate {
+  const char *prefix;  // may be PROGMEM
+  uint8_t prefixLen;
+  const char *suffix;  // may be PROGMEM
+  uint8_t suffixLen;
+};
+
+#define PATH_TEMPLATE(prefix, suffix) { prefix, sizeof(prefix) - 1, suffix, sizeof(suffix) - 1 }
+
+template <size_t N>
+class PathBuffer {
+public:
+  PathBuffer() {}
+  explicit PathBuffer(const PathTemplate &t) { bind(t); }
+
+  // Copy the prefix once; later calls with the same template are free
+  void bind(const PathTemplate &t) {
+    if (bound == &t) return;
+    bound = &t;
+    base = t.prefixLen < N ? t.prefixLen : N - 1;
+    memcpy_P(buf, t.prefix, base);
+    buf[base] = '\0';
+  }
+
+  // Runtime prefix (e.g. built from the device ID), extended by a fixed literal
+  void bindRuntime(const char *prefix, const char *literal) {
+    bound = nullptr;
+    len = 0;
+    appendRaw(prefix, strlen(prefix));
+    appendRaw(literal, strlen(literal));
+    base = len;
+  }
+
+  // prefix + <id> + suffix
+  const char *format(uint32_t id) {
+    len = base;
+    appendUInt(id);
+    appendSuffix();
+    return buf;
+  }
+
+  // prefix + <segment> + suffix
+  const char *format(const char *segment) {
+    len = base;
+    appendRaw(segment, strlen(segment));
+    appendSuffix();
+    return buf;
+  }
+
+  // prefix + a + '/' + b + '/' + leaf, for runtime-bound buffers
+  const char *format(const char *a, const char *b, const char *leaf) {
+    len = base;
+    appendRaw(a, strlen(a));
+    appendRaw("/", 1);
+    appendRaw(b, strlen(b));
+    appendRaw("/", 1);
+    tail = len;
+    appendRaw(leaf, strlen(leaf));
+    return buf;
+  }
+
+  // Replace only the last segment written by format(a, b, leaf)
+  const char *leaf(const char *leaf) {
+    len = tail;
+    appendRaw(leaf, strlen(leaf));
+    return buf;
+  }
+
+  const char *c_str() const { return buf; }
+
+private:
+  void appendRaw(const char *s, size_t n) {
+    if (len + n >= N) n = N - 1 - len;
+    memcpy(buf + len, s, n);
+    len += n;
+    buf[len] = '\0';
+  }
+
+  void appendUInt(uint32_t v) {
+    char tmp[10];
+    uint8_t n = 0;
+    do {
+      tmp[n++] = '0' + (v % 10);
+      v /= 10;
+    } while (v);
+    while (n && len + 1 < N) buf[len++] = tmp[--n];
+    buf[len] = '\0';
+  }
+
+  void appendSuffix() {
+    if (!bound) return;
+    size_t n = bound->suffixLen;
+    if (len + n >= N) n = N - 1 - len;
+    memcpy_P(buf + len, bound->suffix, n);
+    len += n;
+    buf[len] = '\0';
+  }
+
+  char buf[N] = {0};
+  const PathTemplate *bound = nullptr;
+  size_t base = 0;
+  size_t len = 0;
+  size_t tail = 0;
+};
+
+#endif // SMARTHAUS_PATH_TEMPLATE_H
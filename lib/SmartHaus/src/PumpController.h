@@ -0,0 +1,187 @@
+/***************************************************
+  PumpController - water relay safety engine (Mega)
+  Table-driven state machine evaluated once per loop.
+  Each state has at most a handful of transition rows,
+  so an update is constant time regardless of history.
+
+  Inputs:  requested  - pump wanted (tank reported empty)
+           supplyWet  - Mega WATER_SENSOR_PIN (dry-run guard)
+           tankEmpty  - NodeMCU FLOAT_PIN via waterempty/waterpresent
+ ****************************************************/
+#ifndef SMARTHAUS_PUMP_CONTROLLER_H
+#define SMARTHAUS_PUMP_CONTROLLER_H
+
+#include <stdint.h>
+
+enum PumpState : uint8_t {
+  PUMP_OFF = 0,
+  PUMP_ON,
+  PUMP_COOLDOWN,       // max continuous runtime reached
+  PUMP_FAULT_DRY,      // supply sensor dry while running or requested
+  PUMP_FAULT_DISAGREE  // pumping but the tank float never reports water
+};
+
+// Compact rule limits, in seconds
+struct PumpRules {
+  uint16_t minOnS;     // shortest run once started
+  uint16_t minOffS;    // shortest rest before the next start
+  uint16_t maxOnS;     // longest continuous run before a cool-down
+  uint16_t cooldownS;  // forced rest after maxOnS
+  uint16_t disagreeS;  // accumulated run with tank still empty before faulting
+  uint16_t pumpWatts;  // nameplate power, for the energy estimate
+};
+
+struct PumpInputs {
+  bool requested;
+  bool supplyWet;
+  bool tankEmpty;
+};
+
+// Sent upstream over I2C (both boards are little-endian)
+struct __attribute__((packed)) PumpReport {
+  uint8_t state;
+  uint8_t output;
+  uint16_t starts;
+  uint32_t runtimeS;
+  uint32_t energyWh;
+  uint16_t dryFaults;
+  uint16_t disagreeFaults;
+  uint16_t cooldowns;
+};
+
+class PumpController {
+public:
+  explicit PumpController(const PumpRules &rules) : rules(rules) {}
+
+  void begin(uint32_t nowMs) {
+    state = PUMP_OFF;
+    sinceMs = nowMs - (uint32_t)rules.minOffS * 1000UL; // allow an immediate first start
+    lastMs = nowMs;
+  }
+
+  // Evaluate the rule table. Returns the relay output to apply.
+  bool update(const PumpInputs &in, uint32_t nowMs) {
+    accumulate(in, nowMs);
+
+    // Rows for one state are ordered by priority
+    static const Transition TABLE[] = {
+      {PUMP_OFF, G_DRY_REQUEST, PUMP_FAULT_DRY},
+      {PUMP_OFF, G_START, PUMP_ON},
+      {PUMP_ON, G_SUPPLY_DRY, PUMP_FAULT_DRY},
+      {PUMP_ON, G_NO_EFFECT, PUMP_FAULT_DISAGREE},
+      {PUMP_ON, G_MAX_ON, PUMP_COOLDOWN},
+      {PUMP_ON, G_STOP, PUMP_OFF},
+      {PUMP_COOLDOWN, G_COOLED, PUMP_OFF},
+      {PUMP_FAULT_DRY, G_SUPPLY_WET, PUMP_OFF},
+      {PUMP_FAULT_DISAGREE, G_TANK_OK, PUMP_OFF},
+    };
+
+    const uint8_t n = sizeof(TABLE) / sizeof(TABLE[0]);
+    for (uint8_t i = 0; i < n; i++) {
+      if (TABLE[i].from != state) continue;
+      if (!guard(TABLE[i].guard, in, nowMs - sinceMs)) continue;
+      enter((PumpState)TABLE[i].to, nowMs);
+      break;
+    }
+    return state == PUMP_ON;
+  }
+
+  PumpState currentState() const { return state; }
+  bool output() const { return state == PUMP_ON; }
+
+  PumpReport report() const {
+    PumpReport r;
+    r.state = state;
+    r.output = output() ? 1 : 0;
+    r.starts = starts;
+    r.runtimeS = runtimeS;
+    r.energyWh = runtimeS / 3600UL * rules.pumpWatts + (runtimeS % 3600UL) * rules.pumpWatts / 3600UL;
+    r.dryFaults = dryFaults;
+    r.disagreeFaults = disagreeFaults;
+    r.cooldowns = cooldowns;
+    return r;
+  }
+
+  static const char *stateName(uint8_t s) {
+    switch (s) {
+      case PUMP_OFF: return "off";
+      case PUMP_ON: return "on";
+      case PUMP_COOLDOWN: return "cooldown";
+      case PUMP_FAULT_DRY: return "fault_dry";
+      case PUMP_FAULT_DISAGREE: return "fault_disagree";
+    }
+    return "unknown";
+  }
+
+private:
+  enum Guard : uint8_t {
+    G_DRY_REQUEST,  // requested while the supply is dry
+    G_START,        // requested, supply wet, rested long enough
+    G_SUPPLY_DRY,   // supply went dry while running (ignores minOn)
+    G_MAX_ON,       // ran for maxOnS
+    G_NO_EFFECT,    // ran disagreeS in total without the tank reporting water
+    G_STOP,         // no longer requested and ran minOnS
+    G_COOLED,       // rested cooldownS
+    G_SUPPLY_WET,   // supply recovered
+    G_TANK_OK       // tank reports water or request dropped
+  };
+
+  struct Transition {
+    uint8_t from;
+    uint8_t guard;
+    uint8_t to;
+  };
+
+  bool guard(uint8_t g, const PumpInputs &in, uint32_t elapsedMs) const {
+    switch (g) {
+      case G_DRY_REQUEST: return in.requested && !in.supplyWet;
+      case G_START: return in.requested && in.supplyWet && elapsedMs >= rules.minOffS * 1000UL;
+      case G_SUPPLY_DRY: return !in.supplyWet;
+      case G_MAX_ON: return elapsedMs >= rules.maxOnS * 1000UL;
+      case G_NO_EFFECT: return in.tankEmpty && noEffectMs >= rules.disagreeS * 1000UL;
+      case G_STOP: return !in.requested && elapsedMs >= rules.minOnS * 1000UL;
+      case G_COOLED: return elapsedMs >= rules.cooldownS * 1000UL;
+      case G_SUPPLY_WET: return in.supplyWet;
+      case G_TANK_OK: return !in.tankEmpty || !in.requested;
+    }
+    return false;
+  }
+
+  void accumulate(const PumpInputs &in, uint32_t nowMs) {
+    uint32_t dt = nowMs - lastMs;
+    lastMs = nowMs;
+    if (state == PUMP_ON) {
+      runtimeRemMs += dt;
+      runtimeS += runtimeRemMs / 1000UL;
+      runtimeRemMs %= 1000UL;
+      noEffectMs += dt;
+    }
+    if (!in.tankEmpty) noEffectMs = 0;
+  }
+
+  void enter(PumpState next, uint32_t nowMs) {
+    state = next;
+    sinceMs = nowMs;
+    switch (next) {
+      case PUMP_ON: starts++; break;
+      case PUMP_COOLDOWN: cooldowns++; break;
+      case PUMP_FAULT_DRY: dryFaults++; break;
+      case PUMP_FAULT_DISAGREE: disagreeFaults++; noEffectMs = 0; break;
+      default: break;
+    }
+  }
+
+  PumpRules rules;
+  PumpState state = PUMP_OFF;
+  uint32_t sinceMs = 0;
+  uint32_t lastMs = 0;
+  uint32_t noEffectMs = 0;
+  uint32_t runtimeS = 0;
+  uint32_t runtimeRemMs = 0;
+  uint16_t starts = 0;
+  uint16_t dryFaults = 0;
+  uint16_t disagreeFaults = 0;
+  uint16_t cooldowns = 0;
+};
+
+#endif // SMARTHAUS_PUMP_CONTROLLER_H
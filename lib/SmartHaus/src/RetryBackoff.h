@@ -0,0 +1,60 @@
+/***************************************************
+  RetryBackoff - exponential retry delay with jitter
+  - fail() starts a wait of minMs, doubling with every
+    further failure up to maxMs, plus up to 25% jitter
+    so devices that lost the same server do not come
+    back in lockstep
+  - ready() says whether the next attempt is due
+  - succeed() goes back to trying immediately and
+    reports how long the outage lasted
+
+  Caller passes millis() and a random word; no Arduino
+  dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_RETRY_BACKOFF_H
+#define SMARTHAUS_RETRY_BACKOFF_H
+
+#include <stdint.h>
+
+struct RetryBackoffConfig {
+  uint32_t minMs;  // wait after the first failure
+  uint32_t maxMs;  // longest wait after doubling
+};
+
+class RetryBackoff {
+public:
+  explicit RetryBackoff(const RetryBackoffConfig &cfg) : cfg(cfg) {}
+
+  void fail(uint32_t nowMs, uint32_t random) {
+    if (!failCount) firstFailMs = nowMs;
+    if (failCount < 0xFF) failCount++;
+    uint32_t wait = cfg.minMs;
+    for (uint8_t i = 1; i < failCount && wait < cfg.maxMs; i++) wait *= 2;
+    if (wait > cfg.maxMs) wait = cfg.maxMs;
+    wait += random % (wait / 4 + 1);
+    waitMs = wait;
+    lastFailMs = nowMs;
+  }
+
+  // Returns the outage length (first failure -> now), 0 if there was none
+  uint32_t succeed(uint32_t nowMs) {
+    uint32_t outage = failCount ? nowMs - firstFailMs : 0;
+    failCount = 0;
+    waitMs = 0;
+    return outage;
+  }
+
+  bool ready(uint32_t nowMs) const { return !failCount || nowMs - lastFailMs >= waitMs; }
+  uint32_t remainingMs(uint32_t nowMs) const { return ready(nowMs) ? 0 : waitMs - (nowMs - lastFailMs); }
+  uint8_t failures() const { return failCount; }
+  uint32_t delayMs() const { return waitMs; }
+
+private:
+  RetryBackoffConfig cfg;
+  uint8_t failCount = 0;
+  uint32_t waitMs = 0;
+  uint32_t lastFailMs = 0;
+  uint32_t firstFailMs = 0;
+};
+
+#endif // SMARTHAUS_RETRY_BACKOFF_H
@@ -0,0 +1,195 @@
+/***************************************************
+  RingLog - leveled logging into a RAM ring buffer
+  LOG_E/W/I/D/T format into a small stack line and copy
+  it into the ring; nothing waits on a UART. The main
+  loop calls drain() to move as many bytes as the sink
+  can take without blocking.
+
+  - LOG_LEVEL (build flag) removes the disabled levels
+    at compile time: their format strings and arguments
+    are never emitted
+  - format strings stay in flash (PSTR / vsnprintf_P)
+  - callable from ISRs: the copy into the ring runs with
+    interrupts masked, formatting does not
+  - a full ring drops new lines (LOG_DROP_NEWEST) or
+    overwrites the oldest (LOG_KEEP_NEWEST, for a RAM-only
+    sink read back with copyTail())
+ ****************************************************/
+#ifndef SMARTHAUS_RING_LOG_H
+#define SMARTHAUS_RING_LOG_H
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "IsrSupport.h"
+
+#ifndef ARDUINO
+#define PSTR(s) (s)
+#define vsnprintf_P vsnprintf
+#endif
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Ring size in bytes, must be a power of two
+#ifndef LOG_RING_SIZE
+#ifdef __AVR__
+#define LOG_RING_SIZE 256
+#else
+#define LOG_RING_SIZE 1024
+#endif
+#endif
+
+// Longest single line; longer output is truncated
+#ifndef LOG_LINE_MAX
+#define LOG_LINE_MAX 96
+#endif
+
+enum LogMode : uint8_t {
+  LOG_DROP_NEWEST = 0,
+  LOG_KEEP_NEWEST
+};
+
+template <uint16_t SIZE>
+class RingLog {
+  static_assert((SIZE & (SIZE - 1)) == 0, "RingLog size must be a power of two");
+
+public:
+  void setMode(LogMode m) { mode = m; }
+
+  void write(uint8_t level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vwrite(level, fmt, ap);
+    va_end(ap);
+  }
+
+  void vwrite(uint8_t level, const char *fmt, va_list ap) {
+    static const char TAGS[] = "?EWIDT";
+    char line[LOG_LINE_MAX];
+    line[0] = TAGS[level < 6 ? level : 0];
+    line[1] = ' ';
+    int n = vsnprintf_P(line + 2, sizeof(line) - 3, fmt, ap);
+    if (n < 0) return;
+    size_t len = 2 + ((size_t)n < sizeof(line) - 3 ? (size_t)n : sizeof(line) - 4);
+    if (line[len - 1] != '\n') line[len++] = '\n';
+    push(line, len);
+  }
+
+  // Move buffered text to out (anything with write() and availableForWrite()).
+  // Never blocks; returns the number of bytes written.
+  template <typename Out>
+  size_t drain(Out &out) {
+    size_t total = 0;
+    for (;;) {
+      sh_irq_state_t s = SH_IRQ_SAVE();
+      uint16_t h = head, t = tail;
+      SH_IRQ_RESTORE(s);
+      uint16_t avail = h - t;
+      if (!avail) break;
+      int room = out.availableForWrite();
+      if (room <= 0) break;
+      uint16_t idx = t & (SIZE - 1);
+      uint16_t chunk = SIZE - idx; // contiguous run up to the wrap
+      if (chunk > avail) chunk = avail;
+      if ((unsigned)room < chunk) chunk = (uint16_t)room;
+      out.write((const uint8_t *)buf + idx, chunk);
+      total += chunk;
+      s = SH_IRQ_SAVE();
+      // a KEEP_NEWEST producer may have pushed tail past what we just sent
+      if ((uint16_t)(tail - t) == 0) tail = t + chunk;
+      SH_IRQ_RESTORE(s);
+    }
+    return total;
+  }
+
+  // Copy the buffered text, oldest first, NUL terminated. Does not consume it.
+  size_t copyTail(char *out, size_t size) const {
+    if (!size) return 0;
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    uint16_t n = head - tail;
+    if (n > size - 1) n = size - 1;
+    uint16_t from = head - n;
+    for (uint16_t i = 0; i < n; i++) out[i] = buf[(uint16_t)(from + i) & (SIZE - 1)];
+    SH_IRQ_RESTORE(s);
+    out[n] = '\0';
+    return n;
+  }
+
+  uint16_t used() const { return head - tail; }
+  uint32_t written() const { return lines; }
+  uint32_t dropped() const { return drops; }
+
+private:
+  void push(const char *data, size_t len) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    uint16_t free = SIZE - (uint16_t)(head - tail);
+    if (len > free) {
+      if (mode == LOG_DROP_NEWEST || len > SIZE) {
+        drops++;
+        SH_IRQ_RESTORE(s);
+        return;
+      }
+      // discard whole lines from the front until it fits
+      do {
+        while (buf[tail & (SIZE - 1)] != '\n') tail++;
+        tail++;
+        drops++;
+      } while ((uint16_t)(SIZE - (head - tail)) < len);
+    }
+    for (size_t i = 0; i < len; i++) buf[(uint16_t)(head + i) & (SIZE - 1)] = data[i];
+    head += len;
+    lines++;
+    SH_IRQ_RESTORE(s);
+  }
+
+  char buf[SIZE];
+  volatile uint16_t head = 0; // free-running write index
+  volatile uint16_t tail = 0; // free-running read index
+  uint32_t lines = 0;
+  uint32_t drops = 0;
+  LogMode mode = LOG_DROP_NEWEST;
+};
+
+// One logger per firmware, defined by the sketch with LOG_DEFINE()
+extern RingLog<LOG_RING_SIZE> shLog;
+#define LOG_DEFINE() RingLog<LOG_RING_SIZE> shLog
+
+#define LOG_AT(level, fmt, ...) shLog.write(level, PSTR(fmt), ##__VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_E(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_W(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_I(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_D(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_T(fmt, ...) LOG_AT(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define LOG_T(fmt, ...) ((void)0)
+#endif
+
+#endif // SMARTHAUS_RING_LOG_H
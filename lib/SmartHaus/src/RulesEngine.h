@@ -0,0 +1,459 @@
+/***************************************************
+  RulesEngine - local sensor-to-relay automations
+  Rules are compiled once from text into a small stack
+  bytecode, e.g.
+
+    float == 0 && hour >= 6 -> relay 3 on
+    failed >= 3 -> send alert
+    !door_locked && relay1 -> relay 2 off
+
+  Every rule records which inputs it reads. setInput()
+  only marks those rules dirty, and run() evaluates just
+  the dirty ones, firing the action on a false -> true edge.
+  A rule must read at least one input (a constant one
+  would never be re-evaluated), and "send" only accepts
+  the door and relay commands of the slave protocol.
+  ruleTarget() tells the caller which relay or door
+  state an action sets, so the copy it keeps (and
+  reconciles the slave's readback against) follows
+  the rule instead of undoing it.
+ ****************************************************/
+#ifndef SMARTHAUS_RULES_ENGINE_H
+#define SMARTHAUS_RULES_ENGINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "SlaveCommand.h"
+
+#ifndef RULES_MAX_RULES
+#define RULES_MAX_RULES 128
+#endif
+#ifndef RULES_CODE_SIZE
+#define RULES_CODE_SIZE 2048
+#endif
+#define RULES_STACK_DEPTH 8
+#define RULES_MAX_NEST 16   // '(' and '!' levels; bounds compiler recursion on the 4 KB stack
+#define RULES_MAX_RELAYS 16
+#ifndef RULES_MAX_DOORS
+#define RULES_MAX_DOORS 2   // "send lock:<door>" etc.
+#endif
+
+enum RuleInput : uint8_t {
+  IN_FLOAT = 0,       // 1 = water present
+  IN_FAILED,          // failed fingerprint attempts
+  IN_DOOR_LOCKED,     // 1 = locked
+  IN_HOUR,            // 0..23, -1 until time is known
+  IN_MINUTE,          // minute of day 0..1439, -1 until time is known
+  IN_RELAY_FIRST,     // relay1 .. relay16
+  IN_COUNT = IN_RELAY_FIRST + RULES_MAX_RELAYS
+};
+
+enum RuleActionType : uint8_t {
+  ACT_RELAY_ON = 0,
+  ACT_RELAY_OFF,
+  ACT_LOCK,
+  ACT_UNLOCK,
+  ACT_SEND  // I2C command text: lock, unlock, alert, <id>:<0|1>, rm:<mask>:<values>
+};
+
+class RulesEngine {
+public:
+  typedef void (*ActionFn)(uint8_t type, uint8_t arg, const char *text);
+
+  explicit RulesEngine(ActionFn action) : action(action) {
+    for (uint8_t i = 0; i < IN_COUNT; i++) inputs[i] = -1;
+  }
+
+  // Drop all rules; input values are kept
+  void clear() {
+    ruleCount = 0;
+    codeLen = 0;
+    dirty = 0;
+  }
+
+  // Compile one rule line. Returns false (and sets lastError()) on a syntax error.
+  // Blank lines and lines starting with '#' are accepted and ignored.
+  bool addRule(const char *line) {
+    src = line;
+    err = nullptr;
+    skipSpace();
+    if (*src == '\0' || *src == '#') return true;
+    if (ruleCount >= RULES_MAX_RULES) return fail("too many rules");
+
+    uint16_t start = codeLen;
+    deps = 0;
+    depth = 0;
+    nest = 0;
+    if (!parseOr()) { codeLen = start; return false; }
+    if (!deps) { codeLen = start; return fail("condition reads no input"); }
+    if (!emit(OP_END)) { codeLen = start; return false; }
+
+    skipSpace();
+    if (src[0] != '-' || src[1] != '>') { codeLen = start; return fail("expected '->'"); }
+    src += 2;
+
+    Rule &r = rules[ruleCount];
+    r.codeOff = start;
+    r.deps = deps;
+    r.last = false;
+    if (!parseAction(r)) { codeLen = start; return false; }
+    ruleCount++;
+    dirty |= deps; // evaluate against current inputs on the next run()
+    return true;
+  }
+
+  // Compile a whole newline-separated program. Returns the number of rejected lines.
+  uint8_t load(const char *text, void (*onError)(uint16_t lineNo, const char *msg) = nullptr) {
+    clear();
+    uint8_t rejected = 0;
+    uint16_t lineNo = 0;
+    char line[96];
+    while (*text) {
+      const char *nl = strchr(text, '\n');
+      size_t n = nl ? (size_t)(nl - text) : strlen(text);
+      lineNo++;
+      if (n >= sizeof(line)) {
+        rejected++;
+        if (onError) onError(lineNo, "line too long");
+      } else {
+        memcpy(line, text, n);
+        line[n] = '\0';
+        if (!addRule(line)) {
+          rejected++;
+          if (onError) onError(lineNo, err);
+        }
+      }
+      text += n;
+      if (*text == '\n') text++;
+    }
+    return rejected;
+  }
+
+  // Update an input; only rules that read it are re-evaluated on run()
+  void setInput(uint8_t in, int16_t value) {
+    if (in >= IN_COUNT || inputs[in] == value) return;
+    inputs[in] = value;
+    dirty |= (1UL << in);
+  }
+
+  // Evaluate dirty rules. Returns the number of rules evaluated.
+  uint8_t run() {
+    if (!dirty) return 0;
+    uint32_t mask = dirty;
+    dirty = 0;
+    uint8_t evaluated = 0;
+    for (uint8_t i = 0; i < ruleCount; i++) {
+      Rule &r = rules[i];
+      if (!(r.deps & mask)) continue;
+      evaluated++;
+      bool now = eval(&code[r.codeOff]);
+      if (now && !r.last && action) {
+        action(r.type, r.arg, r.textOff ? (const char *)&code[r.textOff] : nullptr);
+      }
+      r.last = now;
+    }
+    return evaluated;
+  }
+
+  uint8_t count() const { return ruleCount; }
+  uint16_t codeBytes() const { return codeLen; }
+  const char *lastError() const { return err; }
+
+private:
+  enum Op : uint8_t {
+    OP_END = 0, OP_LOAD, OP_CONST, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_AND, OP_OR, OP_NOT
+  };
+
+  struct Rule {
+    uint16_t codeOff;
+    uint16_t textOff;  // 0 = no text (offset 0 always holds code)
+    uint32_t deps;
+    uint8_t type;
+    uint8_t arg;
+    bool last;
+  };
+
+  bool eval(const uint8_t *pc) const {
+    int16_t stack[RULES_STACK_DEPTH];
+    uint8_t sp = 0;
+    for (;;) {
+      uint8_t op = *pc++;
+      switch (op) {
+        case OP_END: return sp && stack[sp - 1] != 0;
+        case OP_LOAD: stack[sp++] = inputs[*pc++]; break;
+        case OP_CONST: stack[sp++] = (int16_t)(pc[0] | (pc[1] << 8)); pc += 2; break;
+        case OP_NOT: stack[sp - 1] = !stack[sp - 1]; break;
+        default: {
+          int16_t b = stack[--sp];
+          int16_t a = stack[sp - 1];
+          int16_t v = 0;
+          switch (op) {
+            case OP_EQ: v = a == b; break;
+            case OP_NE: v = a != b; break;
+            case OP_LT: v = a < b; break;
+            case OP_LE: v = a <= b; break;
+            case OP_GT: v = a > b; break;
+            case OP_GE: v = a >= b; break;
+            case OP_AND: v = a && b; break;
+            case OP_OR: v = a || b; break;
+          }
+          stack[sp - 1] = v;
+        }
+      }
+    }
+  }
+
+  // --- compiler (recursive descent, emits postfix) ---
+
+  bool parseOr() {
+    if (!parseAnd()) return false;
+    while (match("||")) {
+      if (!parseAnd() || !emit(OP_OR)) return false;
+      pop();
+    }
+    return true;
+  }
+
+  bool parseAnd() {
+    if (!parseUnary()) return false;
+    while (match("&&")) {
+      if (!parseUnary() || !emit(OP_AND)) return false;
+      pop();
+    }
+    return true;
+  }
+
+  bool parseUnary() {
+    skipSpace();
+    if (*src == '!' && src[1] != '=') {
+      src++;
+      if (++nest > RULES_MAX_NEST) return fail("expression too deep");
+      bool ok = parseUnary() && emit(OP_NOT);
+      nest--;
+      return ok;
+    }
+    if (*src == '(') {
+      src++;
+      if (++nest > RULES_MAX_NEST) return fail("expression too deep");
+      if (!parseOr()) return false;
+      if (!match(")")) return fail("expected ')'");
+      nest--;
+      return true;
+    }
+    return parseCompare();
+  }
+
+  bool parseCompare() {
+    if (!parseOperand()) return false;
+    static const struct { const char *tok; uint8_t op; } CMP[] = {
+      {"==", OP_EQ}, {"!=", OP_NE}, {"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}
+    };
+    for (uint8_t i = 0; i < sizeof(CMP) / sizeof(CMP[0]); i++) {
+      if (match(CMP[i].tok)) return parseOperand() && emit(CMP[i].op) && pop();
+    }
+    return true; // bare operand is a truth test
+  }
+
+  bool parseOperand() {
+    skipSpace();
+    if (isdigit((unsigned char)*src) || *src == '-') {
+      char *end;
+      long v = strtol(src, &end, 10);
+      if (end == src) return fail("bad number");
+      src = end;
+      return push() && emit(OP_CONST) && emit((uint8_t)(v & 0xFF)) && emit((uint8_t)((v >> 8) & 0xFF));
+    }
+    char name[16];
+    if (!readWord(name, sizeof(name))) return fail("expected input name");
+    int8_t in = inputIndex(name);
+    if (in < 0) return fail("unknown input");
+    deps |= (1UL << in);
+    return push() && emit(OP_LOAD) && emit((uint8_t)in);
+  }
+
+  bool parseAction(Rule &r) {
+    char verb[10];
+    if (!readWord(verb, sizeof(verb))) return fail("expected action");
+    r.textOff = 0;
+    r.arg = 0;
+    if (!strcmp(verb, "relay")) {
+      skipSpace();
+      long id = strtol(src, (char **)&src, 10);
+      if (id < 1 || id > RULES_MAX_RELAYS) return fail("relay id out of range");
+      char onoff[4];
+      if (!readWord(onoff, sizeof(onoff))) return fail("expected on/off");
+      if (!strcmp(onoff, "on")) r.type = ACT_RELAY_ON;
+      else if (!strcmp(onoff, "off")) r.type = ACT_RELAY_OFF;
+      else return fail("expected on/off");
+      r.arg = (uint8_t)id;
+    } else if (!strcmp(verb, "lock")) {
+      r.type = ACT_LOCK;
+    } else if (!strcmp(verb, "unlock")) {
+      r.type = ACT_UNLOCK;
+    } else if (!strcmp(verb, "send")) {
+      char text[24];
+      if (!readWord(text, sizeof(text))) return fail("expected command text");
+      size_t n = strlen(text) + 1;
+      if (!sendAllowed(text, n - 1)) return fail("command not allowed");
+      if (codeLen + n > RULES_CODE_SIZE) return fail("rule memory full");
+      r.type = ACT_SEND;
+      r.textOff = codeLen;
+      memcpy(&code[codeLen], text, n);
+      codeLen += n;
+    } else {
+      return fail("unknown action");
+    }
+    skipSpace();
+    if (*src != '\0' && *src != '#') return fail("trailing text");
+    return true;
+  }
+
+  // Door and relay commands only: no cfg: or diagnostics from a rule
+  static bool sendAllowed(const char *text, size_t len) {
+    SlaveCommand cmd;
+    switch (parseSlaveCommand(text, len, RULES_MAX_DOORS, cmd)) {
+      case SC_LOCK:
+      case SC_UNLOCK:
+      case SC_ALERT:
+      case SC_RELAY_MASK:
+        return true;
+      case SC_RELAY:
+        return cmd.id <= RULES_MAX_RELAYS;
+      default:
+        return false;
+    }
+  }
+
+  static int8_t inputIndex(const char *name) {
+    if (!strcmp(name, "float")) return IN_FLOAT;
+    if (!strcmp(name, "failed")) return IN_FAILED;
+    if (!strcmp(name, "door_locked")) return IN_DOOR_LOCKED;
+    if (!strcmp(name, "hour")) return IN_HOUR;
+    if (!strcmp(name, "minute")) return IN_MINUTE;
+    if (!strncmp(name, "relay", 5)) {
+      int id = atoi(name + 5);
+      if (id >= 1 && id <= RULES_MAX_RELAYS) return IN_RELAY_FIRST + id - 1;
+    }
+    return -1;
+  }
+
+  bool readWord(char *out, size_t size) {
+    skipSpace();
+    size_t n = 0;
+    while (*src && (isalnum((unsigned char)*src) || *src == '_' || *src == ':')) {
+      if (n + 1 >= size) return false;
+      out[n++] = *src++;
+    }
+    out[n] = '\0';
+    return n > 0;
+  }
+
+  bool match(const char *tok) {
+    skipSpace();
+    size_t n = strlen(tok);
+    if (strncmp(src, tok, n) != 0) return false;
+    src += n;
+    return true;
+  }
+
+  void skipSpace() { while (*src == ' ' || *src == '\t' || *src == '\r') src++; }
+
+  // Track the evaluation stack while compiling so eval() never overflows
+  bool push() {
+    if (++depth > RULES_STACK_DEPTH) return fail("expression too deep");
+    return true;
+  }
+
+  bool pop() {
+    depth--;
+    return true;
+  }
+
+  bool emit(uint8_t b) {
+    if (codeLen >= RULES_CODE_SIZE) return fail("rule memory full");
+    code[codeLen++] = b;
+    return true;
+  }
+
+  bool fail(const char *msg) {
+    if (!err) err = msg;
+    return false;
+  }
+
+  ActionFn action;
+  Rule rules[RULES_MAX_RULES];
+  uint8_t code[RULES_CODE_SIZE];
+  int16_t inputs[IN_COUNT];
+  uint8_t ruleCount = 0;
+  uint16_t codeLen = 0;
+  uint32_t dirty = 0;
+
+  // compiler state
+  const char *src = nullptr;
+  const char *err = nullptr;
+  uint32_t deps = 0;
+  uint8_t depth = 0;
+  uint8_t nest = 0;
+};
+
+enum RuleTargetKind : uint8_t {
+  RT_NONE = 0,  // one-shot command (alert): send as is
+  RT_RELAYS,    // relays 1..16 of the main slave
+  RT_DOOR       // lock state of one door
+};
+
+struct RuleTarget {
+  uint8_t kind;
+  uint16_t mask;    // RT_RELAYS: bit 0 = relay 1
+  uint16_t values;
+  uint8_t door;     // RT_DOOR
+  bool locked;
+};
+
+// State set by an action, whether it was written as "relay 3 on", "lock" or
+// "send 3:1" / "send rm:..." / "send unlock:1"
+inline RuleTarget ruleTarget(uint8_t type, uint8_t arg, const char *text) {
+  RuleTarget t = {RT_NONE, 0, 0, 0, false};
+  switch (type) {
+    case ACT_RELAY_ON:
+    case ACT_RELAY_OFF:
+      t.kind = RT_RELAYS;
+      t.mask = 1U << (arg - 1);
+      t.values = type == ACT_RELAY_ON ? t.mask : 0;
+      break;
+    case ACT_LOCK:
+    case ACT_UNLOCK:
+      t.kind = RT_DOOR;
+      t.locked = type == ACT_LOCK;
+      break;
+    case ACT_SEND: {
+      SlaveCommand cmd;
+      switch (parseSlaveCommand(text, strlen(text), RULES_MAX_DOORS, cmd)) {
+        case SC_RELAY:
+          if (cmd.id < 1 || cmd.id > RULES_MAX_RELAYS) break;
+          t.kind = RT_RELAYS;
+          t.mask = 1U << (cmd.id - 1);
+          t.values = cmd.on ? t.mask : 0;
+          break;
+        case SC_RELAY_MASK:
+          t.kind = RT_RELAYS;
+          t.mask = cmd.mask;
+          t.values = cmd.values & cmd.mask;
+          break;
+        case SC_LOCK:
+        case SC_UNLOCK:
+          t.kind = RT_DOOR;
+          t.door = cmd.door;
+          t.locked = cmd.kind == SC_LOCK;
+          break;
+      }
+      break;
+    }
+  }
+  return t;
+}
+
+#endif // SMARTHAUS_RULES_ENGINE_H
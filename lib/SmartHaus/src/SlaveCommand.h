@@ -0,0 +1,230 @@
+/***************************************************
+  SlaveCommand - parsers for the bytes a Mega slave
+  receives
+  - parseSlaveCommand() decodes one I2C text command
+    from (buffer, length): no String, no heap, never
+    reads past len and does not need a NUL, so it runs
+    inside the Wire receive interrupt and can be fed
+    arbitrary bytes on a host
+  - numbers must be all digits (hex for "rm:") and in
+    range; "65537:1" is rejected instead of wrapping
+    to relay 1
+  - SlaveFramer splits what one Wire transmission
+    delivers into packets: '\n' ends a packet and so
+    does the end of the transmission; a packet longer
+    than the buffer is dropped whole, never run cut short
+  - simResult() finds the final result code in a
+    SIM800L response buffer, embedded NULs included
+
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_SLAVE_COMMAND_H
+#define SMARTHAUS_SLAVE_COMMAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+enum SlaveCommandKind : uint8_t {
+  SC_BAD = 0,
+  SC_EMPTY,          // only whitespace
+  SC_LOCK,           // "lock", "lock:<door>"
+  SC_UNLOCK,         // "unlock", "unlock:<door>"
+  SC_ALERT,          // "alert", "alert:<door>"
+  SC_WATER_EMPTY,    // "waterempty"
+  SC_WATER_PRESENT,  // "waterpresent"
+  SC_PUMP_STATS,     // "pumpstats"
+  SC_METRICS,        // "metrics:<offset>"
+  SC_RX_STATS,       // "rxstats"
+  SC_RX_RESET,       // "rxreset"
+  SC_RELAY_MASK,     // "rm:<mask hex>:<values hex>"
+  SC_RELAY,          // "<id>:<0|1>"
+  SC_CONFIG          // "cfg:<key>=<value>", "cfg:save"
+};
+
+struct SlaveCommand {
+  uint8_t kind;
+  uint8_t door;        // lock / unlock / alert
+  uint16_t id;         // SC_RELAY: relay ID (range is the caller's), SC_METRICS: offset
+  bool on;             // SC_RELAY
+  uint16_t mask;       // SC_RELAY_MASK
+  uint16_t values;
+  const char *key;     // SC_CONFIG, spans into the buffer (not NUL-terminated);
+  uint8_t keyLen;      // key "save" with no value persists the config
+  const char *value;
+  uint8_t valueLen;
+};
+
+// Unsigned number filling all of [p, p + len): 1..8 digits, at most max
+inline bool scParseUint(const char *p, size_t len, uint8_t base, uint32_t max, uint32_t &out) {
+  if (len == 0 || len > 8) return false;
+  uint32_t v = 0;
+  for (size_t i = 0; i < len; i++) {
+    char c = p[i];
+    uint8_t d;
+    if (c >= '0' && c <= '9') d = c - '0';
+    else if (base == 16 && c >= 'a' && c <= 'f') d = c - 'a' + 10;
+    else if (base == 16 && c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    else return false;
+    v = v * base + d;
+  }
+  if (v > max) return false;
+  out = v;
+  return true;
+}
+
+inline bool scSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+// Case-insensitive match of a whole word
+inline bool scEquals(const char *p, size_t len, const char *word) {
+  size_t n = strlen(word);
+  if (len != n) return false;
+  for (size_t i = 0; i < n; i++) {
+    char c = p[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    if (c != word[i]) return false;
+  }
+  return true;
+}
+
+// "word" or "word:<n>" with n < doors
+inline bool scDoorCommand(const char *p, size_t len, const char *word, uint8_t doors, uint8_t &door) {
+  size_t n = strlen(word);
+  if (len < n || !scEquals(p, n, word)) return false;
+  uint32_t d = 0;
+  if (len > n && (p[n] != ':' || !scParseUint(p + n + 1, len - n - 1, 10, doors - 1, d))) return false;
+  door = (uint8_t)d;
+  return true;
+}
+
+// Position of the first c in [p, p + len), or len
+inline size_t scFind(const char *p, size_t len, char c) {
+  size_t i = 0;
+  while (i < len && p[i] != c) i++;
+  return i;
+}
+
+inline uint8_t parseSlaveCommand(const char *buf, size_t len, uint8_t doors, SlaveCommand &cmd) {
+  memset(&cmd, 0, sizeof(cmd));
+  while (len && scSpace(*buf)) { buf++; len--; }
+  while (len && scSpace(buf[len - 1])) len--;
+  if (!len) return cmd.kind = SC_EMPTY;
+
+  if (scDoorCommand(buf, len, "lock", doors, cmd.door)) return cmd.kind = SC_LOCK;
+  if (scDoorCommand(buf, len, "unlock", doors, cmd.door)) return cmd.kind = SC_UNLOCK;
+  if (scDoorCommand(buf, len, "alert", doors, cmd.door)) return cmd.kind = SC_ALERT;
+  if (scEquals(buf, len, "waterempty")) return cmd.kind = SC_WATER_EMPTY;
+  if (scEquals(buf, len, "waterpresent")) return cmd.kind = SC_WATER_PRESENT;
+  if (scEquals(buf, len, "pumpstats")) return cmd.kind = SC_PUMP_STATS;
+  if (scEquals(buf, len, "rxstats")) return cmd.kind = SC_RX_STATS;
+  if (scEquals(buf, len, "rxreset")) return cmd.kind = SC_RX_RESET;
+
+  uint32_t a, b;
+  if (len > 8 && !memcmp(buf, "metrics:", 8)) {
+    if (!scParseUint(buf + 8, len - 8, 10, 0xFFFF, a)) return cmd.kind = SC_BAD;
+    cmd.id = (uint16_t)a;
+    return cmd.kind = SC_METRICS;
+  }
+  if (len > 3 && !memcmp(buf, "rm:", 3)) {
+    const char *p = buf + 3;
+    size_t rest = len - 3;
+    size_t sep = scFind(p, rest, ':');
+    if (sep == rest || !scParseUint(p, sep, 16, 0xFFFF, a) ||
+        !scParseUint(p + sep + 1, rest - sep - 1, 16, 0xFFFF, b)) {
+      return cmd.kind = SC_BAD;
+    }
+    cmd.mask = (uint16_t)a;
+    cmd.values = (uint16_t)b;
+    return cmd.kind = SC_RELAY_MASK;
+  }
+  if (len > 4 && !memcmp(buf, "cfg:", 4)) {
+    const char *p = buf + 4;
+    size_t rest = len - 4;
+    if (scEquals(p, rest, "save")) {
+      cmd.key = p;
+      cmd.keyLen = 4;
+      return cmd.kind = SC_CONFIG;
+    }
+    size_t eq = scFind(p, rest, '=');
+    if (eq == 0 || eq == rest || eq > 0xFF || rest - eq - 1 > 0xFF) return cmd.kind = SC_BAD;
+    cmd.key = p;
+    cmd.keyLen = (uint8_t)eq;
+    cmd.value = p + eq + 1;
+    cmd.valueLen = (uint8_t)(rest - eq - 1);
+    return cmd.kind = SC_CONFIG;
+  }
+
+  // "<id>:<state>", spaces allowed around both
+  size_t sep = scFind(buf, len, ':');
+  if (sep == len) return cmd.kind = SC_BAD;
+  size_t idLen = sep;
+  while (idLen && scSpace(buf[idLen - 1])) idLen--;
+  const char *s = buf + sep + 1;
+  size_t sLen = len - sep - 1;
+  while (sLen && scSpace(*s)) { s++; sLen--; }
+  if (!scParseUint(buf, idLen, 10, 0xFFFF, a) || a == 0 || sLen != 1 || (*s != '0' && *s != '1')) {
+    return cmd.kind = SC_BAD;
+  }
+  cmd.id = (uint16_t)a;
+  cmd.on = *s == '1';
+  return cmd.kind = SC_RELAY;
+}
+
+// Receive buffer of a slave. push() every byte of a transmission and end the
+// packet when it returns true; at the end of the transmission end the packet
+// if pending(). Then packet() is NUL-terminated, or nullptr if it overflowed.
+template <size_t SIZE>
+class SlaveFramer {
+public:
+  static const size_t MAX_LEN = SIZE - 1;
+
+  bool push(char c) {
+    if (len < SIZE - 1) buf[len++] = c;
+    else overflow = true;
+    return c == '\n';
+  }
+
+  bool pending() const { return len > 0; }
+
+  const char *packet() {
+    buf[len] = '\0';
+    return overflow ? nullptr : buf;
+  }
+  size_t length() const { return len; }
+
+  // Start the next packet (after packet() has been handled)
+  void next() {
+    len = 0;
+    overflow = false;
+  }
+
+private:
+  char buf[SIZE];
+  size_t len = 0;
+  bool overflow = false;
+};
+
+// Final result code of a SIM800L command, if it has arrived
+enum SimResult : uint8_t {
+  SIM_PENDING = 0,
+  SIM_OK,       // "OK"; for an SMS also "+CMGS: <ref>"
+  SIM_ERROR     // "ERROR", "+CMS ERROR: <n>", "+CME ERROR: <n>"
+};
+
+inline bool scContains(const char *p, size_t len, const char *token) {
+  size_t n = strlen(token);
+  for (size_t i = 0; i + n <= len; i++) {
+    if (!memcmp(p + i, token, n)) return true;
+  }
+  return false;
+}
+
+inline SimResult simResult(const char *buf, size_t len) {
+  if (scContains(buf, len, "ERROR")) return SIM_ERROR;
+  if (scContains(buf, len, "OK") || scContains(buf, len, "+CMGS:")) return SIM_OK;
+  return SIM_PENDING;
+}
+
+#endif // SMARTHAUS_SLAVE_COMMAND_H
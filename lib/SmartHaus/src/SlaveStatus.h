@@ -0,0 +1,85 @@
+/***************************************************
+  SlaveStatus - readback frame a Mega returns to a plain
+  Wire.requestFrom() (no select command before it).
+  Small enough for one AVR Wire buffer (32 bytes).
+  - SlaveRxStats, selected with "rxstats": packets seen
+    since "rxreset", with an order-sensitive hash of
+    their bytes, so a load generator can tell dropped,
+    merged or reordered packets apart from applied ones
+ ****************************************************/
+#ifndef SMARTHAUS_SLAVE_STATUS_H
+#define SMARTHAUS_SLAVE_STATUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLAVE_STATUS_MAGIC 0xA5
+#define SLAVE_STATUS_VERSION 1
+
+// flags
+#define SLAVE_FLAG_WATER_WET    0x01  // debounced WATER_SENSOR_PIN
+#define SLAVE_FLAG_WATER_RELAY  0x02  // water relay output on
+#define SLAVE_FLAG_UNLOCK_RELAY 0x04  // door 0 (front) unlock relay on (door locked)
+#define SLAVE_FLAG_TANK_EMPTY   0x08  // last waterempty/waterpresent seen
+#define SLAVE_FLAG_ALERT_SENT   0x10  // intruder SMS queued or sent, not re-armed by an unlock (any door)
+#define SLAVE_FLAG_WATER_SENT   0x20  // water-empty SMS queued or sent, not re-armed yet
+#define SLAVE_FLAG_UNLOCK_RELAY2 0x40 // door 1 (back) unlock relay on (door locked)
+
+struct __attribute__((packed)) SlaveStatus {
+  uint8_t magic;
+  uint8_t version;
+  uint16_t bootCount;   // incremented in EEPROM on every Mega boot
+  uint16_t relayMask;   // channel states, bit 0 = channel 1
+  uint16_t relayKnown;  // channels set since boot
+  uint8_t flags;
+  uint8_t smsState;     // SmsSessionState on the Mega, 0 = idle
+  uint8_t crc;
+};
+
+inline uint8_t slaveStatusCrc(const SlaveStatus &s) {
+  const uint8_t *p = (const uint8_t *)&s;
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < sizeof(SlaveStatus) - 1; i++) {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+inline bool slaveStatusValid(const SlaveStatus &s) {
+  return s.magic == SLAVE_STATUS_MAGIC && s.version == SLAVE_STATUS_VERSION && s.crc == slaveStatusCrc(s);
+}
+
+#define SLAVE_RX_MAGIC 0x5A
+#define SLAVE_RX_HASH_INIT 2166136261UL  // FNV-1a offset basis
+
+struct __attribute__((packed)) SlaveRxStats {
+  uint8_t magic;
+  uint32_t packets;     // processed since rxreset; rxstats/rxreset themselves excluded
+  uint32_t hash;        // slaveRxHash() over those packets, in order
+  uint32_t bad;         // ... that did not parse
+  uint32_t overflows;   // dropped for not fitting the receive buffer
+  uint32_t isrCount;    // receiveEvent() calls
+  uint32_t isrTotalUs;
+  uint16_t isrMaxUs;
+  uint8_t crc;
+};
+
+// Fold one packet (without its trailing newline) into the running hash; the
+// separator keeps "1:1" + "2:0" apart from "1:12:0"
+inline uint32_t slaveRxHash(uint32_t h, const char *p, size_t len) {
+  for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)p[i]) * 16777619UL;
+  return (h ^ '\n') * 16777619UL;
+}
+
+inline uint8_t slaveRxCrc(const SlaveRxStats &s) {
+  const uint8_t *p = (const uint8_t *)&s;
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < sizeof(SlaveRxStats) - 1; i++) {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+#endif // SMARTHAUS_SLAVE_STATUS_H
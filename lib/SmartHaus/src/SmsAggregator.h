@@ -0,0 +1,332 @@
+/***************************************************
+  SmsAggregator - alert SMS batching for the Mega
+  - raise() records an alert by (kind, source) and
+    returns at once; it is safe from the Wire receive
+    interrupt and never loses an alert to an SMS that
+    is still being sent
+  - alerts raised within windowMs of the first one go
+    out as one digest; a repeat of a pending alert only
+    bumps its count ("(x3)")
+  - a reported alert stays latched until clear() (door
+    unlocked, water back): repeats are suppressed
+  - digests are at least minGapMs apart, so cost is one
+    SMS per recipient per max(windowMs, minGapMs) and an
+    alert waits at most windowMs + minGapMs
+  - SmsSession sends one digest to every recipient in a
+    single pass over the modem (AT+CMGS per number, no
+    re-init); Modem is anything with print(), write(),
+    available() and read(), a HardwareSerial on the
+    board or a scripted fake on a host
+  - a recipient fails on no prompt, an error code or no
+    result within RESULT_MS, and is tried once more
+    after RETRY_MS. A timeout may hide an SMS that did
+    go out: a duplicate beats a lost alert
+
+  Clock is passed in (millis()); no Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_SMS_AGGREGATOR_H
+#define SMARTHAUS_SMS_AGGREGATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "IsrSupport.h"
+#include "SlaveCommand.h"
+
+#define SMS_TEXT_MAX 160
+#define SMS_NUMBER_MAX 20      // with the NUL, as MegaConfig::phoneNumber
+#define SMS_RECIPIENTS_MAX 3
+
+struct SmsAggregatorConfig {
+  uint32_t windowMs;   // collect alerts this long after the first one
+  uint32_t minGapMs;   // least time between two digests
+};
+
+enum SmsRaise : uint8_t {
+  SMS_RAISED = 0,      // new alert, will be in the next digest
+  SMS_MERGED,          // already pending, count bumped
+  SMS_SUPPRESSED,      // already reported and not cleared since
+  SMS_FULL             // no free slot
+};
+
+// Writes the text for one alert, returns its length (snprintf style)
+typedef int (*SmsDescribeFn)(char *out, size_t size, uint8_t kind, uint8_t source);
+
+template <uint8_t N>
+class SmsAggregator {
+public:
+  SmsAggregator(const SmsAggregatorConfig &cfg, SmsDescribeFn describe) : cfg(cfg), describe(describe) {}
+
+  void configure(const SmsAggregatorConfig &c) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    cfg = c;
+    SH_IRQ_RESTORE(s);
+  }
+
+  SmsRaise raise(uint8_t kind, uint8_t source, uint32_t nowMs) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    SmsRaise r;
+    Slot *slot = find(kind, source);
+    if (slot && slot->state == SLOT_PENDING) {
+      if (slot->count < 0xFF) slot->count++;
+      slot->clearAfter = false;
+      r = SMS_MERGED;
+    } else if (slot && slot->state == SLOT_REPORTED) {
+      r = SMS_SUPPRESSED;
+    } else if (!(slot = find(0, 0, SLOT_FREE))) {
+      r = SMS_FULL;
+    } else {
+      slot->kind = kind;
+      slot->source = source;
+      slot->state = SLOT_PENDING;
+      slot->count = 1;
+      if (!pending++) windowStart = nowMs;
+      r = SMS_RAISED;
+    }
+    SH_IRQ_RESTORE(s);
+    return r;
+  }
+
+  // The condition is over: the next raise() is reported again. A pending alert
+  // is still sent. Returns true if the alert was latched.
+  bool clear(uint8_t kind, uint8_t source) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    Slot *slot = find(kind, source);
+    bool latched = slot != nullptr;
+    if (slot && slot->state == SLOT_REPORTED) slot->state = SLOT_FREE;
+    else if (slot) slot->clearAfter = true;
+    SH_IRQ_RESTORE(s);
+    return latched;
+  }
+
+  // Raised and not cleared since (pending or reported)
+  bool latched(uint8_t kind, uint8_t source) const {
+    for (uint8_t i = 0; i < N; i++) {
+      const Slot &sl = slots[i];
+      if (sl.state != SLOT_FREE && !sl.clearAfter && sl.kind == kind && sl.source == source) return true;
+    }
+    return false;
+  }
+
+  bool due(uint32_t nowMs) const {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    bool d = pending && nowMs - windowStart >= cfg.windowMs && (!digests || nowMs - lastDigest >= cfg.minGapMs);
+    SH_IRQ_RESTORE(s);
+    return d;
+  }
+
+  // Text of the pending alerts, one per line; they become reported. An alert
+  // that does not fit stays pending for the next digest. Returns the number
+  // of alerts in out, 0 if there was nothing to send.
+  uint8_t digest(char *out, size_t size, uint32_t nowMs) {
+    size_t n = 0;
+    uint8_t parts = 0;
+    out[0] = '\0';
+    for (uint8_t i = 0; i < N; i++) {
+      sh_irq_state_t s = SH_IRQ_SAVE();
+      Slot copy = slots[i];
+      if (copy.state == SLOT_PENDING) slots[i].count = 0; // raises from now on count anew
+      SH_IRQ_RESTORE(s);
+      if (copy.state != SLOT_PENDING) continue;
+
+      char part[SMS_TEXT_MAX + 1];
+      int len = describe(part, sizeof(part), copy.kind, copy.source);
+      if (len < 0) len = 0;
+      if ((size_t)len >= sizeof(part)) len = sizeof(part) - 1;
+      if (copy.count > 1) len += snprintf(part + len, sizeof(part) - len, " (x%u)", copy.count);
+      if ((size_t)len >= sizeof(part)) len = sizeof(part) - 1;
+      bool fits = n + (n ? 1 : 0) + len < size;
+
+      s = SH_IRQ_SAVE();
+      if (fits) {
+        if (n) out[n++] = '\n';
+        memcpy(out + n, part, len);
+        n += len;
+        out[n] = '\0';
+        parts++;
+        slots[i].state = slots[i].clearAfter ? SLOT_FREE : SLOT_REPORTED;
+        slots[i].clearAfter = false;
+        pending--;
+        if (slots[i].count) {
+          // Raised again while the text was being built: goes in the next digest
+          slots[i].state = SLOT_PENDING;
+          pending++;
+        }
+      } else {
+        slots[i].count += copy.count;
+      }
+      SH_IRQ_RESTORE(s);
+    }
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    if (parts) {
+      lastDigest = nowMs;
+      digests++;
+    }
+    if (pending) windowStart = nowMs;
+    SH_IRQ_RESTORE(s);
+    return parts;
+  }
+
+  uint8_t pendingCount() const { return pending; }
+  uint32_t digestCount() const { return digests; }
+
+private:
+  enum SlotState : uint8_t { SLOT_FREE = 0, SLOT_PENDING, SLOT_REPORTED };
+
+  struct Slot {
+    uint8_t kind;
+    uint8_t source;
+    uint8_t state;
+    uint8_t count;      // raises since the last digest
+    bool clearAfter;    // cleared while pending: free once reported
+  };
+
+  Slot *find(uint8_t kind, uint8_t source, uint8_t state = 0xFF) {
+    for (uint8_t i = 0; i < N; i++) {
+      Slot &sl = slots[i];
+      if (state != 0xFF) {
+        if (sl.state == state) return &sl;
+      } else if (sl.state != SLOT_FREE && sl.kind == kind && sl.source == source) {
+        return &sl;
+      }
+    }
+    return nullptr;
+  }
+
+  SmsAggregatorConfig cfg;
+  SmsDescribeFn describe;
+  Slot slots[N] = {};
+  volatile uint8_t pending = 0;
+  uint32_t windowStart = 0;
+  uint32_t lastDigest = 0;
+  uint32_t digests = 0;
+};
+
+enum SmsSessionState : uint8_t {
+  SMS_SESSION_IDLE = 0,
+  SMS_SESSION_COMMAND,   // next recipient's AT+CMGS goes out
+  SMS_SESSION_PROMPT,    // waiting for '>'
+  SMS_SESSION_RESULT     // text sent, waiting for +CMGS / ERROR
+};
+
+// Outcome of one recipient; ms counts from start()
+typedef void (*SmsResultFn)(uint8_t recipient, bool sent, uint32_t ms);
+
+template <typename Modem>
+class SmsSession {
+public:
+  static const uint16_t PROMPT_MS = 5000;
+  static const uint16_t RESULT_MS = 10000;
+  static const uint16_t RETRY_MS = 2000;
+  static const uint8_t ATTEMPTS = 2;
+
+  SmsSession(Modem &modem, SmsResultFn onResult) : modem(modem), onResult(onResult) {}
+
+  // text must stay valid until the session is idle again. The recipients are
+  // copied (interrupts off: they may be rewritten from an ISR); empty ones are
+  // skipped, a number longer than SMS_NUMBER_MAX - 1 is cut.
+  bool start(const char *msg, const char *const *to, uint8_t count, uint32_t nowMs) {
+    if (st != SMS_SESSION_IDLE) return false;
+    if (count > SMS_RECIPIENTS_MAX) count = SMS_RECIPIENTS_MAX;
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t n = 0;
+      for (; n < SMS_NUMBER_MAX - 1 && to[i][n]; n++) recipients[i][n] = to[i][n];
+      recipients[i][n] = '\0';
+    }
+    SH_IRQ_RESTORE(s);
+    text = msg;
+    recipientCount = count;
+    next = 0;
+    attempt = 0;
+    startMs = nowMs;
+    st = SMS_SESSION_COMMAND;
+    return true;
+  }
+
+  // Advance without blocking; returns true while the session is busy
+  bool step(uint32_t nowMs) {
+    switch (st) {
+      case SMS_SESSION_IDLE:
+        return false;
+
+      case SMS_SESSION_COMMAND:
+        while (next < recipientCount && !recipients[next][0]) next++;
+        if (next >= recipientCount) {
+          st = SMS_SESSION_IDLE;
+          return false;
+        }
+        if (attempt && nowMs - since < RETRY_MS) return true;
+        while (modem.available()) modem.read();
+        modem.print("AT+CMGS=\"");
+        modem.print(recipients[next]);
+        modem.print("\"\r\n");
+        since = nowMs;
+        st = SMS_SESSION_PROMPT;
+        return true;
+
+      case SMS_SESSION_PROMPT:
+        while (modem.available()) {
+          if (modem.read() != '>') continue;
+          modem.print(text);
+          modem.write((uint8_t)26); // Ctrl+Z sends
+          len = 0;
+          since = nowMs;
+          st = SMS_SESSION_RESULT;
+          return true;
+        }
+        if (nowMs - since > PROMPT_MS) finish(false, nowMs);
+        return true;
+
+      case SMS_SESSION_RESULT: {
+        while (modem.available()) {
+          if (len == sizeof(buf)) {
+            // Keep the tail: a result code may straddle the cut
+            memmove(buf, buf + sizeof(buf) - 8, 8);
+            len = 8;
+          }
+          buf[len++] = (char)modem.read();
+        }
+        SimResult r = simResult(buf, len);
+        if (r == SIM_OK) finish(true, nowMs);
+        else if (r == SIM_ERROR || nowMs - since > RESULT_MS) finish(false, nowMs);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool busy() const { return st != SMS_SESSION_IDLE; }
+  uint8_t state() const { return st; }
+
+private:
+  void finish(bool sent, uint32_t nowMs) {
+    st = SMS_SESSION_COMMAND;
+    if (!sent) {
+      modem.write((uint8_t)27); // ESC leaves a prompt still open
+      if (++attempt < ATTEMPTS) {
+        since = nowMs;
+        return;
+      }
+    }
+    if (onResult) onResult(next, sent, nowMs - startMs);
+    next++;
+    attempt = 0;
+  }
+
+  Modem &modem;
+  SmsResultFn onResult;
+  const char *text = nullptr;
+  char recipients[SMS_RECIPIENTS_MAX][SMS_NUMBER_MAX];
+  uint8_t recipientCount = 0;
+  uint8_t next = 0;
+  uint8_t attempt = 0;
+  uint8_t st = SMS_SESSION_IDLE;
+  uint32_t startMs = 0;
+  uint32_t since = 0;
+  char buf[32];
+  uint8_t len = 0;
+};
+
+#endif // SMARTHAUS_SMS_AGGREGATOR_H
@@ -0,0 +1,153 @@
+/***************************************************
+  TaskSupervisor - time budgets and crash attribution
+  for the main loop
+  - the loop is a table of short task functions; each
+    call is timed against its budget and overruns are
+    counted per task
+  - the running task ID is persisted (ESP8266 RTC user
+    memory, AVR .noinit RAM) before each call and
+    cleared after it, so after a watchdog reset begin()
+    names the task that never returned
+  - STEP_* macros turn a long operation into a resumable
+    step function (protothread style): each call runs to
+    the next wait and returns; locals do not survive a
+    wait, keep state in globals or the StepTask owner
+
+    bool alarmStep(uint32_t now) {
+      STEP_BEGIN(alarmTask);
+      for (beep = 0; beep < 10; beep++) {
+        buzzerOn();
+        STEP_WAIT_MS(alarmTask, now, 200);
+        buzzerOff();
+        STEP_WAIT_MS(alarmTask, now, 100);
+      }
+      STEP_END(alarmTask);
+    }
+
+  Clock and persistence are passed in; no Arduino
+  dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_TASK_SUPERVISOR_H
+#define SMARTHAUS_TASK_SUPERVISOR_H
+
+#include <stdint.h>
+
+#define TASK_NONE 0xFF
+#define TASK_RECORD_MAGIC 0x5441534BUL // "TASK"
+
+struct TaskSpec {
+  const char *name;
+  void (*run)();
+  uint32_t budgetUs;  // longest acceptable single call
+};
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t overruns;
+  uint32_t maxUs;
+};
+
+// Persisted form, 12 bytes
+struct __attribute__((packed)) TaskRecord {
+  uint32_t magic;
+  uint8_t current;        // task being run, TASK_NONE between tasks
+  uint8_t lastOverrun;    // last task over its budget
+  uint16_t resets;        // resets that happened inside a task
+  uint32_t lastOverrunUs;
+};
+
+template <uint8_t N>
+class TaskSupervisor {
+public:
+  typedef uint32_t (*ClockFn)();
+  typedef void (*PersistFn)(const TaskRecord &rec);
+
+  TaskSupervisor(const TaskSpec (&tasks)[N], ClockFn clockUs, PersistFn persist)
+      : tasks(tasks), clockUs(clockUs), persist(persist) {}
+
+  // Take over the record left by the previous boot. Returns the task
+  // that was running when it ended, or TASK_NONE after a clean reset
+  // (abnormalReset = false, e.g. a restart requested by the firmware).
+  uint8_t begin(const TaskRecord &prev, bool abnormalReset = true) {
+    uint8_t crashed = TASK_NONE;
+    if (prev.magic == TASK_RECORD_MAGIC) {
+      rec = prev;
+      if (abnormalReset && prev.current < N) crashed = prev.current;
+      if (crashed != TASK_NONE) rec.resets++;
+    } else {
+      rec.magic = TASK_RECORD_MAGIC;
+      rec.lastOverrun = TASK_NONE;
+      rec.resets = 0;
+      rec.lastOverrunUs = 0;
+    }
+    rec.current = TASK_NONE;
+    persist(rec);
+    return crashed;
+  }
+
+  void run(uint8_t id) {
+    rec.current = id;
+    persist(rec);
+    uint32_t start = clockUs();
+    tasks[id].run();
+    uint32_t elapsed = clockUs() - start;
+
+    TaskStats &s = stat[id];
+    s.runs++;
+    if (elapsed > s.maxUs) s.maxUs = elapsed;
+    if (elapsed > tasks[id].budgetUs) {
+      s.overruns++;
+      rec.lastOverrun = id;
+      rec.lastOverrunUs = elapsed;
+      overrunPending = true;
+    }
+    rec.current = TASK_NONE;
+    persist(rec);
+  }
+
+  void runAll() {
+    for (uint8_t i = 0; i < N; i++) run(i);
+  }
+
+  // True once per overrun batch, with the latest one, for logging outside the task
+  bool takeOverrun(uint8_t &id, uint32_t &us) {
+    if (!overrunPending) return false;
+    overrunPending = false;
+    id = rec.lastOverrun;
+    us = rec.lastOverrunUs;
+    return true;
+  }
+
+  const char *name(uint8_t id) const { return id < N ? tasks[id].name : "none"; }
+  const TaskStats &stats(uint8_t id) const { return stat[id]; }
+  const TaskRecord &record() const { return rec; }
+  uint8_t count() const { return N; }
+
+private:
+  const TaskSpec (&tasks)[N];
+  ClockFn clockUs;
+  PersistFn persist;
+  TaskRecord rec = {TASK_RECORD_MAGIC, TASK_NONE, TASK_NONE, 0, 0};
+  TaskStats stat[N] = {};
+  bool overrunPending = false;
+};
+
+// Resumable step functions. A step function returns true when the whole
+// operation has finished and false while it is waiting.
+struct StepTask {
+  uint16_t pc = 0;     // resume point (source line), 0 = start
+  uint32_t since = 0;  // start of the current wait
+};
+
+#define STEP_BEGIN(t) switch ((t).pc) { case 0:
+#define STEP_WAIT_MS(t, nowMs, ms) \
+  (t).since = (nowMs); (t).pc = __LINE__; /* fall through */ case __LINE__: \
+  if ((uint32_t)((nowMs) - (t).since) < (uint32_t)(ms)) return false
+#define STEP_WAIT_UNTIL(t, cond) \
+  (t).pc = __LINE__; /* fall through */ case __LINE__: if (!(cond)) return false
+#define STEP_YIELD(t) (t).pc = __LINE__; return false; case __LINE__:
+#define STEP_END(t) } (t).pc = 0; return true
+#define STEP_EXIT(t) do { (t).pc = 0; return true; } while (0)
+#define STEP_RESET(t) ((t).pc = 0)
+
+#endif // SMARTHAUS_TASK_SUPERVISOR_H
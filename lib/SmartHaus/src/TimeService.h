@@ -0,0 +1,161 @@
+/***************************************************
+  TimeService - wall clock on top of millis()
+  - monotonicMs() extends millis() to 64 bits, so it
+    stays ordered across the 49.7 day wraparound
+    (call it at least once per wrap, e.g. every loop)
+  - synced() anchors the wall clock to a monotonic
+    instant; two syncs far enough apart give the
+    crystal drift, which is applied in between
+  - shouldRequestSync() schedules SNTP requests:
+    every resyncS when synced, with a doubling retry
+    while no answer has arrived
+  - save()/restore() carry the last known time and
+    drift in RTC memory over a soft reset; restored
+    time is TIME_ESTIMATED until the next sync
+  - epochAtMs() turns a monotonic event time recorded
+    before the first sync into a real timestamp
+
+  Caller passes millis(); no Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_TIME_SERVICE_H
+#define SMARTHAUS_TIME_SERVICE_H
+
+#include <stdint.h>
+
+enum TimeQuality : uint8_t {
+  TIME_UNSET = 0,   // no wall clock since power-up
+  TIME_ESTIMATED,   // restored from RTC memory after a reset
+  TIME_SYNCED       // anchored by SNTP
+};
+
+struct TimeServiceConfig {
+  uint32_t resyncS;     // interval between requests once synced
+  uint16_t retryMinS;   // first retry while unsynced
+  uint16_t retryMaxS;   // retry cap
+};
+
+#define TIME_RTC_MAGIC 0x54494D31UL   // "TIM1"
+#define TIME_DRIFT_MIN_SPAN_MS 600000UL // syncs closer than 10 min are too noisy for drift
+#define TIME_DRIFT_MAX_PPM 500          // beyond this it is a clock step, not drift
+
+// Persisted form (RTC user memory, 16 bytes)
+struct __attribute__((packed)) TimeRtcRecord {
+  uint32_t magic;
+  uint32_t epoch;     // seconds at save
+  uint16_t ms;        // millisecond part
+  int16_t driftPpm;
+  uint32_t check;
+};
+
+class TimeService {
+public:
+  explicit TimeService(const TimeServiceConfig &cfg) : cfg(cfg), retryS(cfg.retryMinS) {}
+
+  // 64-bit milliseconds since boot
+  uint64_t monotonicMs(uint32_t nowMs) {
+    uint32_t delta = nowMs - lastMs;
+    if (delta >= 0x80000000UL) return compose(lastMs); // stale sample taken before the last call
+    if (nowMs < lastMs) wraps++;
+    lastMs = nowMs;
+    return compose(nowMs);
+  }
+
+  // SNTP (or another source) reported the current time
+  void synced(uint64_t epochMs, uint32_t nowMs) {
+    uint64_t mono = monotonicMs(nowMs);
+    if (state == TIME_SYNCED && mono - anchorMono >= TIME_DRIFT_MIN_SPAN_MS) {
+      int64_t elapsed = (int64_t)(mono - anchorMono);
+      int64_t error = (int64_t)(epochMs - anchorEpochMs) - elapsed;
+      int64_t ppm = error * 1000000 / elapsed;
+      if (ppm >= -TIME_DRIFT_MAX_PPM && ppm <= TIME_DRIFT_MAX_PPM) {
+        drift = (int16_t)(driftKnown ? (drift + ppm) / 2 : ppm); // smooth over successive syncs
+        driftKnown = true;
+      }
+    }
+    anchorMono = mono;
+    anchorEpochMs = epochMs;
+    state = TIME_SYNCED;
+    awaiting = false;
+    lastRequestMono = mono; // next request resyncS after this answer
+    retryS = cfg.retryMinS;
+    syncs++;
+  }
+
+  // True when a new SNTP request should go out now
+  bool shouldRequestSync(uint32_t nowMs) {
+    uint64_t mono = monotonicMs(nowMs);
+    if (requested) {
+      uint32_t interval = awaiting ? retryS : cfg.resyncS;
+      if (mono - lastRequestMono < (uint64_t)interval * 1000) return false;
+      if (awaiting) retryS = (uint32_t)retryS * 2 > cfg.retryMaxS ? cfg.retryMaxS : retryS * 2;
+    }
+    requested = true;
+    awaiting = true;
+    lastRequestMono = mono;
+    return true;
+  }
+
+  // Wall clock in milliseconds, 0 while TIME_UNSET
+  uint64_t epochMs(uint32_t nowMs) { return epochAtMs(monotonicMs(nowMs)); }
+  uint32_t now(uint32_t nowMs) { return (uint32_t)(epochMs(nowMs) / 1000); }
+
+  // Wall clock at an earlier (or later) monotonic instant of this boot
+  uint64_t epochAtMs(uint64_t mono) const {
+    if (state == TIME_UNSET) return 0;
+    int64_t elapsed = (int64_t)(mono - anchorMono);
+    return anchorEpochMs + elapsed + elapsed * drift / 1000000;
+  }
+  uint32_t epochAt(uint64_t mono) const { return (uint32_t)(epochAtMs(mono) / 1000); }
+
+  TimeRtcRecord save(uint32_t nowMs) {
+    uint64_t e = epochMs(nowMs);
+    TimeRtcRecord rec;
+    rec.magic = state == TIME_UNSET ? 0 : TIME_RTC_MAGIC;
+    rec.epoch = (uint32_t)(e / 1000);
+    rec.ms = (uint16_t)(e % 1000);
+    rec.driftPpm = drift;
+    rec.check = checksum(rec);
+    return rec;
+  }
+
+  // Resume from a record saved before a reset. The reset itself is not
+  // counted (it is under a second), so boot is taken as the save instant.
+  bool restore(const TimeRtcRecord &rec) {
+    if (rec.magic != TIME_RTC_MAGIC || rec.check != checksum(rec) || rec.ms >= 1000) return false;
+    if (rec.driftPpm < -TIME_DRIFT_MAX_PPM || rec.driftPpm > TIME_DRIFT_MAX_PPM) return false;
+    anchorMono = 0;
+    anchorEpochMs = (uint64_t)rec.epoch * 1000 + rec.ms;
+    drift = rec.driftPpm;
+    driftKnown = drift != 0;
+    state = TIME_ESTIMATED;
+    return true;
+  }
+
+  TimeQuality quality() const { return state; }
+  bool valid() const { return state != TIME_UNSET; }
+  int16_t driftPpm() const { return drift; }
+  uint32_t syncCount() const { return syncs; }
+
+private:
+  uint64_t compose(uint32_t ms) const { return ((uint64_t)wraps << 32) | ms; }
+
+  static uint32_t checksum(const TimeRtcRecord &rec) {
+    return rec.magic ^ rec.epoch ^ ((uint32_t)rec.ms << 16) ^ (uint16_t)rec.driftPpm ^ 0xA5A5A5A5UL;
+  }
+
+  TimeServiceConfig cfg;
+  uint32_t lastMs = 0;
+  uint32_t wraps = 0;
+  TimeQuality state = TIME_UNSET;
+  uint64_t anchorMono = 0;
+  uint64_t anchorEpochMs = 0;
+  int16_t drift = 0;
+  bool driftKnown = false;
+  uint32_t syncs = 0;
+  bool requested = false;
+  bool awaiting = false;
+  uint32_t retryS;
+  uint64_t lastRequestMono = 0;
+};
+
+#endif // SMARTHAUS_TIME_SERVICE_H
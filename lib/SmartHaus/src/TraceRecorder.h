@@ -0,0 +1,205 @@
+/***************************************************
+  TraceRecorder - compact input trace for field bugs
+  - every input the firmware acts on (Firebase values,
+    float edges, fingerprint results, I2C outcomes) is
+    one record: type, delta ms since the previous
+    record (varint), arg byte, value (zigzag varint);
+    usually 4 bytes
+  - TraceBuffer collects records in RAM; add() is safe
+    from an ISR, a full buffer drops the newest records
+    and leaves a TR_DROPPED count for the next one
+  - the caller moves take() chunks to flash. A segment
+    starts with a TraceSegmentHeader and a TR_SYNC
+    record holding the absolute time, so every segment
+    decodes on its own
+  - TraceReader walks a segment and hands out records
+    with absolute ms: the feed for traceReplay()
+    (TraceReplay.h) and for scripts/trace_tool.py
+
+  No Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_TRACE_RECORDER_H
+#define SMARTHAUS_TRACE_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "IsrSupport.h"
+
+#define TRACE_MAGIC 0x31544853UL  // "SHT1"
+#define TRACE_RECORD_MAX 12       // type + 5 + arg + 5
+
+enum TraceType : uint8_t {
+  TR_SYNC = 1,         // delta is the absolute ms, value = epoch seconds (0 unknown)
+  TR_BOOT,             // arg = reset reason, value = task running at a crash
+  TR_DROPPED,          // value = records lost to a full buffer
+  TR_RELAY,            // fetched relay change: value = id * 2 + state
+  TR_DOOR_LOCK,        // arg = door, value = door_lock from Firebase
+  TR_FAILED_ATTEMPTS,  // arg = door, value = remote failed_attempts
+  TR_FB_ERROR,         // value = FirebaseClient error code
+  TR_FLOAT_EDGE,       // arg = raw level (1 = water)
+  TR_FLOAT,            // debounced water level; arg 1 = level read at boot
+  TR_FINGER,           // arg = door, value = finger ID * 256 + sensor result
+  TR_DOOR_CMD,         // arg = door, value = command letter + 256 if the I2C write failed
+  TR_TYPE_COUNT
+};
+
+struct __attribute__((packed)) TraceSegmentHeader {
+  uint32_t magic;
+  uint32_t seq;        // increases by one per segment, across reboots
+};
+
+struct TraceRecord {
+  uint8_t type;
+  uint8_t arg;
+  int32_t value;
+  uint32_t ms;         // absolute, millis() of the recording board
+};
+
+inline uint8_t SH_ISR_ATTR traceVarint(uint8_t *p, uint32_t v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+// Returns the bytes used, 0 if the varint runs past len or is too long
+inline uint8_t traceReadVarint(const uint8_t *p, size_t len, uint32_t &v) {
+  v = 0;
+  for (uint8_t n = 0; n < 5 && n < len; n++) {
+    v |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+    if (!(p[n] & 0x80)) return n + 1;
+  }
+  return 0;
+}
+
+inline uint8_t SH_ISR_ATTR traceEncode(uint8_t *p, uint8_t type, uint32_t dt, uint8_t arg, int32_t value) {
+  uint8_t n = 0;
+  p[n++] = type;
+  n += traceVarint(p + n, dt);
+  p[n++] = arg;
+  n += traceVarint(p + n, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+  return n;
+}
+
+template <uint16_t SIZE>
+class TraceBuffer {
+public:
+  bool SH_ISR_ATTR add(uint8_t type, uint8_t arg, int32_t value, uint32_t nowMs) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    if (drops && SIZE - len >= 2 * TRACE_RECORD_MAX) {
+      len += traceEncode(buf + len, TR_DROPPED, nowMs - lastMs, 0, drops);
+      lastMs = nowMs;
+      drops = 0;
+    }
+    bool ok = SIZE - len >= TRACE_RECORD_MAX;
+    if (ok) {
+      len += traceEncode(buf + len, type, nowMs - lastMs, arg, value);
+      lastMs = nowMs;
+    } else {
+      drops++;
+      lost++;
+    }
+    SH_IRQ_RESTORE(s);
+    return ok;
+  }
+
+  // Move the pending records to out (room for SIZE bytes). baseMs is the time
+  // their first delta counts from; a new segment writes it as its TR_SYNC.
+  uint16_t take(uint8_t *out, uint32_t &baseMs) {
+    sh_irq_state_t s = SH_IRQ_SAVE();
+    uint16_t n = len;
+    memcpy(out, buf, n);
+    baseMs = chunkMs;
+    chunkMs = lastMs;
+    len = 0;
+    SH_IRQ_RESTORE(s);
+    return n;
+  }
+
+  uint16_t used() const { return len; }
+  uint32_t dropped() const { return lost; }
+
+private:
+  uint8_t buf[SIZE];
+  volatile uint16_t len = 0;
+  uint32_t lastMs = 0;
+  uint32_t chunkMs = 0;     // time before the first buffered record
+  uint32_t drops = 0;       // not yet written as TR_DROPPED
+  uint32_t lost = 0;        // since boot
+};
+
+// Segment header plus the TR_SYNC record; returns the bytes written (room for
+// sizeof(TraceSegmentHeader) + TRACE_RECORD_MAX)
+inline uint8_t traceSegmentStart(uint8_t *out, uint32_t seq, uint32_t baseMs, uint32_t epoch) {
+  TraceSegmentHeader h = {TRACE_MAGIC, seq};
+  memcpy(out, &h, sizeof(h));
+  return sizeof(h) + traceEncode(out + sizeof(h), TR_SYNC, baseMs, 0, (int32_t)epoch);
+}
+
+inline bool traceSegmentHeader(const uint8_t *p, size_t len, uint32_t &seq) {
+  TraceSegmentHeader h;
+  if (len < sizeof(h)) return false;
+  memcpy(&h, p, sizeof(h));
+  if (h.magic != TRACE_MAGIC) return false;
+  seq = h.seq;
+  return true;
+}
+
+// Records of one segment in order. next() stops at the end or at the first
+// record cut short (a flush interrupted by a reset).
+class TraceReader {
+public:
+  TraceReader(const uint8_t *data, size_t len) : p(data), end(data + len) {
+    uint32_t seq;
+    if (traceSegmentHeader(data, len, seq)) {
+      p += sizeof(TraceSegmentHeader);
+      segmentSeq = seq;
+      valid = true;
+    }
+  }
+
+  bool next(TraceRecord &r) {
+    if (!valid || cut || p >= end) return false;
+    uint32_t dt, zz;
+    uint8_t n;
+    const uint8_t *q = p;
+    uint8_t type = *q++;
+    if (type == 0 || type >= TR_TYPE_COUNT) return stop();
+    if (!(n = traceReadVarint(q, end - q, dt))) return stop();
+    q += n;
+    if (q >= end) return stop();
+    uint8_t arg = *q++;
+    if (!(n = traceReadVarint(q, end - q, zz))) return stop();
+    q += n;
+    p = q;
+    ms = type == TR_SYNC ? dt : ms + dt;
+    r.type = type;
+    r.arg = arg;
+    r.value = (int32_t)((zz >> 1) ^ (0U - (zz & 1)));
+    r.ms = ms;
+    return true;
+  }
+
+  bool ok() const { return valid; }           // segment header found
+  bool truncated() const { return cut; }      // ended inside a record
+  uint32_t seq() const { return segmentSeq; }
+
+private:
+  bool stop() {
+    cut = true;
+    return false;
+  }
+
+  const uint8_t *p;
+  const uint8_t *end;
+  bool valid = false;
+  bool cut = false;
+  uint32_t segmentSeq = 0;
+  uint32_t ms = 0;
+};
+
+#endif // SMARTHAUS_TRACE_RECORDER_H
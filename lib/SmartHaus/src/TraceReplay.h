@@ -0,0 +1,160 @@
+/***************************************************
+  TraceReplay - run a recorded trace on virtual time
+  - traceReplay() walks a segment with TraceReader and
+    hands every record to a target at its recorded ms;
+    between records the target's tick() runs every
+    tickMs, standing in for the firmware's loop
+  - FloatReplay is the target for the water sensor: raw
+    TR_FLOAT_EDGE records go through a LevelDebouncer
+    with the firmware's config, and each debounced
+    change it produces is checked against the TR_FLOAT
+    record the board wrote
+  - a change counts as matched within toleranceMs of
+    the recorded one. The board's update() times are not
+    recorded, and the integrator clamps, so the replay
+    agrees with the board only to about one loop pass
+
+  Clock is the trace's; no Arduino dependency.
+ ****************************************************/
+#ifndef SMARTHAUS_TRACE_REPLAY_H
+#define SMARTHAUS_TRACE_REPLAY_H
+
+#include <stdint.h>
+#include "TraceRecorder.h"
+#include "LevelDebouncer.h"
+
+// Target: tick(ms), record(r), started() (a record was seen) and lastTickMs()
+// (the last tick, or the first record after a reboot). Ticks run on a fixed
+// grid however dense the records are, as loop passes do on the board.
+// Returns the number of records replayed. Call once per segment, in order.
+template <typename Target>
+uint32_t traceReplay(TraceReader &reader, Target &target, uint16_t tickMs) {
+  uint32_t n = 0;
+  TraceRecord r;
+  while (reader.next(r)) {
+    if (target.started()) {
+      for (uint32_t t = target.lastTickMs() + tickMs; (int32_t)(r.ms - t) > 0; t += tickMs) target.tick(t);
+    }
+    target.record(r);
+    n++;
+  }
+  return n;
+}
+
+class FloatReplay {
+public:
+  FloatReplay(const LevelDebouncer::Config &cfg, uint16_t toleranceMs) : deb(cfg), tolerance(toleranceMs) {}
+
+  void tick(uint32_t ms) {
+    now = tickMs = ms;
+    if (seeded && deb.update(ms)) replayed(deb.state(), ms);
+    expire(ms);
+  }
+
+  void record(const TraceRecord &r) {
+    if (!running || (int32_t)(r.ms - now) < 0) {
+      tickMs = r.ms; // first record, or millis() restarted
+      if (running) reboot();
+    }
+    now = r.ms;
+    running = true;
+    switch (r.type) {
+      case TR_BOOT:
+        reboot();
+        break;
+      case TR_FLOAT_EDGE:
+        if (seeded) deb.onEdge(r.arg, r.ms);
+        break;
+      case TR_FLOAT:
+        if (r.arg == 1 || !seeded) {
+          // Boot seed, or a trace that starts mid-run: take the board's word
+          deb.begin(r.value != 0, r.ms);
+          seeded = true;
+          queued = 0;
+          break;
+        }
+        // checkWaterLevel() calls update() right before it records a change
+        if (deb.update(r.ms)) replayed(deb.state(), r.ms);
+        recorded(r.value != 0, r.ms);
+        break;
+    }
+    expire(r.ms);
+  }
+
+  bool started() const { return running; }
+  uint32_t lastTickMs() const { return tickMs; }
+  uint32_t matched() const { return matches; }
+  uint32_t missed() const { return misses; }       // recorded, no replayed change nearby
+  uint32_t extra() const { return extras; }        // replayed, never recorded
+  uint32_t maxSkewMs() const { return maxSkew; }   // worst recorded - replayed of a match
+
+  // Call after the last segment: changes still waiting count as extra
+  void finish() {
+    extras += queued;
+    queued = 0;
+  }
+
+private:
+  struct Change {
+    bool state;
+    uint32_t ms;
+  };
+
+  void reboot() {
+    extras += queued;
+    queued = 0;
+    seeded = false;
+  }
+
+  void replayed(bool state, uint32_t ms) {
+    if (queued == sizeof(pending) / sizeof(pending[0])) {
+      drop();
+      extras++;
+    }
+    pending[queued++] = {state, ms};
+  }
+
+  void recorded(bool state, uint32_t ms) {
+    // A replayed change that went the other way was never seen by the board
+    while (queued && pending[0].state != state) {
+      drop();
+      extras++;
+    }
+    uint32_t skew = queued ? ms - pending[0].ms : 0; // replayed at or before ms
+    if (!queued || skew > tolerance) {
+      misses++;
+      deb.begin(state, ms); // follow the board from here
+      return;
+    }
+    if (skew > maxSkew) maxSkew = skew;
+    matches++;
+    drop();
+  }
+
+  void expire(uint32_t ms) {
+    while (queued && ms - pending[0].ms > tolerance) {
+      drop();
+      extras++;
+    }
+  }
+
+  void drop() {
+    for (uint8_t i = 1; i < queued; i++) pending[i - 1] = pending[i];
+    queued--;
+  }
+
+  LevelDebouncer deb;
+  uint16_t tolerance;
+  Change pending[4];
+  uint8_t queued = 0;
+  bool seeded = false;
+  bool running = false;
+  uint32_t now = 0;
+  uint32_t tickMs = 0;
+  uint32_t matches = 0;
+  uint32_t misses = 0;
+  uint32_t extras = 0;
+  uint32_t maxSkew = 0;
+};
+
+#endif // SMARTHAUS_TRACE_REPLAY_H
@@ -0,0 +1,213 @@
+"""
+make_delta.py - block delta between two NodeMCU firmware images
+
+    python scripts/make_delta.py old.bin new.bin update.shd
+    python scripts/make_delta.py --mega-info mega.signed.bin
+
+old.bin must be exactly the image running on the device (keep the
+firmware.bin of every release). Each 4 KB block of new.bin becomes the
+smallest of:
+- COPY     an identical block somewhere in old.bin
+- XOR_RLE  the XOR with a similar old block, run-length encoded
+- RLE      the block itself, run-length encoded
+Format and decoder: lib/SmartHaus/src/FirmwareUpdate.h (DeltaApplier).
+
+Prints the delta size next to the full and gzip-compressed image, i.e.
+what an update costs over the air compared to flashing the whole thing.
+Every delta is decoded again before it is written (--no-verify skips it).
+
+new.bin must be signed (signing.py from the ESP8266 core appends the
+signature and its length); the device refuses an unsigned image after
+downloading it, so this script refuses to make the delta.
+
+The Mega takes its whole image, no delta: --mega-info prints the request
+for a signed Mega .bin. size and crc cover the application only, which is
+what the bootloader programs and checks (MegaBootProxy in
+FirmwareUpdate.h); the trailer stays on the NodeMCU for the signature.
+"""
+import argparse
+import gzip
+import struct
+import sys
+import zlib
+
+MAGIC = 0x31444853  # "SHD1"
+BLOCK = 4096
+OP_COPY, OP_XOR_RLE, OP_RLE = 0, 1, 2
+SIGNATURE_MAX = 512  # FW_SIGNATURE_MAX
+HEADER = struct.Struct("<IIIIHH")
+# how far around the same index to look for a similar old block
+# (code inserted early in the image shifts everything after it)
+SEARCH = 8
+
+
+def rle_encode(data):
+    out = bytearray()
+    lit = bytearray()
+    i, n = 0, len(data)
+
+    def flush_literal():
+        while lit:
+            chunk = lit[:128]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+            del lit[:128]
+
+    while i < n:
+        run = 1
+        while i + run < n and run < 130 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            flush_literal()
+            out.append(0x80 + run - 3)
+            out.append(data[i])
+            i += run
+        else:
+            lit.append(data[i])
+            i += 1
+    flush_literal()
+    return bytes(out)
+
+
+def rle_decode(enc, size):
+    out = bytearray()
+    i = 0
+    while i < len(enc):
+        c = enc[i]
+        if c < 0x80:
+            out.extend(enc[i + 1:i + 2 + c])
+            i += 2 + c
+        else:
+            out.extend(bytes([enc[i + 1]]) * (c - 0x80 + 3))
+            i += 2
+    if len(out) != size:
+        raise ValueError("RLE length %d, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def blocks(image):
+    return [image[i:i + BLOCK] for i in range(0, len(image), BLOCK)]
+
+
+def make_delta(old, new):
+    old_blocks = blocks(old)
+    index = {}
+    for i, b in enumerate(old_blocks):
+        index.setdefault(b, i)
+    out = bytearray(HEADER.pack(MAGIC, len(new), zlib.crc32(new), len(old), BLOCK,
+                                (len(new) + BLOCK - 1) // BLOCK))
+    ops = {OP_COPY: 0, OP_XOR_RLE: 0, OP_RLE: 0}
+    for i, b in enumerate(blocks(new)):
+        crc = zlib.crc32(b)
+        src = index.get(b)
+        if src is not None and len(old_blocks[src]) >= len(b):
+            out += struct.pack("<BHI", OP_COPY, src, crc)
+            ops[OP_COPY] += 1
+            continue
+        best = (OP_RLE, None, rle_encode(b))
+        for s in range(max(0, i - SEARCH), min(len(old_blocks), i + SEARCH + 1)):
+            base = old_blocks[s]
+            if len(base) < len(b):
+                continue
+            enc = rle_encode(bytes(x ^ y for x, y in zip(b, base)))
+            if len(enc) < len(best[2]):
+                best = (OP_XOR_RLE, s, enc)
+        op, s, enc = best
+        if op == OP_XOR_RLE:
+            out += struct.pack("<BHHI", op, s, len(enc), crc) + enc
+        else:
+            out += struct.pack("<BHI", op, len(enc), crc) + enc
+        ops[op] += 1
+    return bytes(out), ops
+
+
+def apply_delta(old, delta):
+    magic, size, crc, base_size, block, count = HEADER.unpack_from(delta)
+    if magic != MAGIC or block != BLOCK or base_size != len(old):
+        raise ValueError("bad header")
+    pos = HEADER.size
+    new = bytearray()
+    for i in range(count):
+        length = min(BLOCK, size - i * BLOCK)
+        op = delta[pos]
+        if op == OP_COPY:
+            src, bcrc = struct.unpack_from("<HI", delta, pos + 1)
+            pos += 7
+            b = old[src * BLOCK:src * BLOCK + length]
+        elif op == OP_XOR_RLE:
+            src, n, bcrc = struct.unpack_from("<HHI", delta, pos + 1)
+            pos += 9
+            raw = rle_decode(delta[pos:pos + n], length)
+            b = bytes(x ^ y for x, y in zip(raw, old[src * BLOCK:src * BLOCK + length]))
+            pos += n
+        else:
+            n, bcrc = struct.unpack_from("<HI", delta, pos + 1)
+            pos += 7
+            b = rle_decode(delta[pos:pos + n], length)
+            pos += n
+        if zlib.crc32(b) != bcrc:
+            raise ValueError("block %d CRC mismatch" % i)
+        new += b
+    if zlib.crc32(new) != crc:
+        raise ValueError("image CRC mismatch")
+    return bytes(new)
+
+
+def signed(image):
+    # image | signature | length:u32, as FirmwareUpdate.h fwSignedSize() expects
+    if len(image) < 4:
+        return False
+    sig_len = struct.unpack("<I", image[-4:])[0]
+    return 0 < sig_len <= SIGNATURE_MAX and len(image) >= sig_len + 4
+
+
+def mega_info(path):
+    with open(path, "rb") as f:
+        image = f.read()
+    if not signed(image):
+        sys.stderr.write("%s has no signature trailer; sign it with signing.py first\n" % path)
+        return 1
+    app = image[:len(image) - 4 - struct.unpack("<I", image[-4:])[0]]
+    print("application %d bytes, %d pages of 256" % (len(app), (len(app) + 255) // 256))
+    print('{"target":"mega","size":%d,"crc":"%08x"}' % (len(app), zlib.crc32(app)))
+    return 0
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Block delta between two firmware images")
+    parser.add_argument("old", nargs="?")
+    parser.add_argument("new", nargs="?")
+    parser.add_argument("out", nargs="?")
+    parser.add_argument("--no-verify", action="store_true")
+    parser.add_argument("--mega-info", metavar="SIGNED_BIN", help="print the update request for a signed Mega image")
+    args = parser.parse_args(argv)
+    if args.mega_info:
+        return mega_info(args.mega_info)
+    if not (args.old and args.new and args.out):
+        parser.error("old, new and out are required")
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+    if not signed(new):
+        sys.stderr.write("%s has no signature trailer; sign it with signing.py first\n" % args.new)
+        return 1
+    delta, ops = make_delta(old, new)
+    if not args.no_verify and apply_delta(old, delta) != new:
+        sys.stderr.write("Delta does not reproduce %s\n" % args.new)
+        return 1
+    with open(args.out, "wb") as f:
+        f.write(delta)
+
+    full = len(new)
+    packed = len(gzip.compress(new, 9))
+    print("blocks: %d copy, %d xor, %d literal" % (ops[OP_COPY], ops[OP_XOR_RLE], ops[OP_RLE]))
+    print("full image %d bytes, gzip %d bytes, delta %d bytes (%.1f%% of full)"
+          % (full, packed, len(delta), 100.0 * len(delta) / full))
+    print('{"target":"node","size":%d,"crc":"%08x"}' % (full, zlib.crc32(new)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
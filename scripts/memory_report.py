@@ -0,0 +1,211 @@
+"""
+memory_report.py - static RAM / flash footprint with budgets
+
+PlatformIO extra script (runs after every link) and standalone tool.
+
+    [env:nodemcuv2]
+    extra_scripts = post:scripts/memory_report.py
+    custom_ram_budget = <bytes>   ; static DRAM: data + rodata + bss
+    custom_iram_budget = <bytes>  ; ESP8266 only
+    custom_flash_budget = <bytes> ; each is optional; copy from the suggestions
+
+    pio run                        ; report + budget check after linking
+    pio run -t memreport           ; report again without relinking
+
+    # Mega sketch built with arduino-cli (--output-dir build/mega)
+    python scripts/memory_report.py build/mega/mega_slave.ino.elf --arch avr \
+        --env mega
+
+Output:
+- <build dir>/memory_report.txt: totals and the largest symbols per region
+- memory_trend.csv (project root, tracked in git): one row per commit
+  and environment, so growth shows up in review instead of in the field
+- suggested custom_*_budget lines: the measured use plus HEADROOM_PCT,
+  rounded up to 256 bytes. Budgets are meant to be copied from here
+  after a real link, not estimated by hand
+
+A budget that is exceeded fails the build (exit code 1).
+"""
+import csv
+import datetime
+import os
+import subprocess
+import sys
+
+TOP_SYMBOLS = 25
+HEADROOM_PCT = 5
+TREND_FILE = "memory_trend.csv"
+
+# Sections counted per region (as printed by `size -A`)
+REGIONS = {
+    "esp8266": {
+        "ram": (".data", ".rodata", ".bss", ".noinit"),
+        "iram": (".text", ".text1", ".iram0.text"),
+        "flash": (".irom0.text", ".text", ".text1", ".data", ".rodata"),
+    },
+    "avr": {
+        "ram": (".data", ".bss", ".noinit"),
+        "flash": (".text", ".data"),
+    },
+}
+
+
+def symbol_region(arch, addr):
+    if arch == "avr":
+        return "ram" if 0x800000 <= addr < 0x810000 else "flash"
+    if 0x3FF00000 <= addr < 0x40000000:
+        return "ram"
+    if 0x40100000 <= addr < 0x40200000:
+        return "iram"
+    return "flash"
+
+
+def run(cmd):
+    return subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+
+
+def section_totals(size_tool, arch, elf):
+    sizes = {}
+    for line in run([size_tool, "-A", elf]).splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith(".") and parts[1].isdigit():
+            sizes[parts[0]] = int(parts[1])
+    return {region: sum(sizes.get(s, 0) for s in sections)
+            for region, sections in REGIONS[arch].items()}
+
+
+def largest_symbols(nm_tool, arch, elf):
+    symbols = {}
+    for line in run([nm_tool, "-S", "--size-sort", "-C", elf]).splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        addr, size, _kind, name = parts
+        region = symbol_region(arch, int(addr, 16))
+        symbols.setdefault(region, []).append((int(size, 16), name))
+    for region in symbols:
+        symbols[region].sort(reverse=True)
+    return symbols
+
+
+def git_revision(project_dir):
+    try:
+        rev = run(["git", "-C", project_dir, "rev-parse", "--short", "HEAD"]).strip()
+        # the trend file itself changes on every build
+        dirty = run(["git", "-C", project_dir, "status", "--porcelain", "--untracked-files=no",
+                     "--", ".", ":!" + TREND_FILE]).strip()
+        return rev + ("+dirty" if dirty else "")
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def record_trend(project_dir, env_name, totals):
+    path = os.path.join(project_dir, TREND_FILE)
+    fields = ["commit", "env", "ram", "iram", "flash", "date"]
+    rows = []
+    if os.path.exists(path):
+        with open(path, newline="") as f:
+            rows = list(csv.DictReader(f))
+    row = {"commit": git_revision(project_dir), "env": env_name,
+           "ram": totals.get("ram", 0), "iram": totals.get("iram", ""),
+           "flash": totals.get("flash", 0),
+           "date": datetime.date.today().isoformat()}
+    # rebuilding the same commit replaces its row
+    rows = [r for r in rows if not (r["commit"] == row["commit"] and r["env"] == env_name)]
+    rows.append(row)
+    with open(path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=fields)
+        writer.writeheader()
+        writer.writerows(rows)
+
+
+def suggested_budget(used, headroom_pct):
+    return (used * (100 + headroom_pct) // 100 + 255) // 256 * 256
+
+
+def report(elf, arch, size_tool, nm_tool, budgets, env_name, build_dir, project_dir,
+           headroom_pct=HEADROOM_PCT):
+    totals = section_totals(size_tool, arch, elf)
+    symbols = largest_symbols(nm_tool, arch, elf)
+
+    lines = ["Memory report for %s (%s)" % (env_name, os.path.basename(elf))]
+    for region, used in totals.items():
+        budget = budgets.get(region)
+        lines.append("  %-5s %8d bytes%s" % (region, used, " / budget %d" % budget if budget else ""))
+    for region in totals:
+        lines.append("")
+        lines.append("Largest %s symbols:" % region)
+        for size, name in symbols.get(region, [])[:TOP_SYMBOLS]:
+            lines.append("  %7d  %s" % (size, name))
+    lines.append("")
+    lines.append("Suggested budgets (+%d%%), for platformio.ini:" % headroom_pct)
+    for region, used in totals.items():
+        lines.append("  custom_%s_budget = %d" % (region, suggested_budget(used, headroom_pct)))
+    text = "\n".join(lines) + "\n"
+
+    with open(os.path.join(build_dir, "memory_report.txt"), "w") as f:
+        f.write(text)
+    print("\n".join(lines[:len(totals) + 1]))
+    record_trend(project_dir, env_name, totals)
+
+    over = [(r, totals[r], b) for r, b in budgets.items() if b and totals.get(r, 0) > b]
+    for region, used, budget in over:
+        sys.stderr.write("Memory budget exceeded: %s uses %d bytes, budget %d (+%d)\n"
+                         % (region, used, budget, used - budget))
+    return 1 if over else 0
+
+
+def tool_beside(size_tool, name):
+    # xtensa-lx106-elf-size -> xtensa-lx106-elf-nm
+    return size_tool[:-len("size")] + name if size_tool.endswith("size") else name
+
+
+def main(argv):
+    import argparse
+    parser = argparse.ArgumentParser(description="Static RAM/flash footprint with budgets")
+    parser.add_argument("elf")
+    parser.add_argument("--arch", choices=sorted(REGIONS), default="esp8266")
+    parser.add_argument("--env", default="standalone")
+    parser.add_argument("--tool-prefix", help="e.g. avr- or xtensa-lx106-elf-")
+    parser.add_argument("--ram-budget", type=int)
+    parser.add_argument("--iram-budget", type=int)
+    parser.add_argument("--flash-budget", type=int)
+    parser.add_argument("--headroom", type=int, default=HEADROOM_PCT,
+                        help="percent added to the measured use for suggested budgets")
+    args = parser.parse_args(argv)
+
+    prefix = args.tool_prefix
+    if prefix is None:
+        prefix = "avr-" if args.arch == "avr" else "xtensa-lx106-elf-"
+    budgets = {"ram": args.ram_budget, "iram": args.iram_budget, "flash": args.flash_budget}
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    return report(args.elf, args.arch, prefix + "size", prefix + "nm",
+                  {k: v for k, v in budgets.items() if v}, args.env,
+                  os.path.dirname(os.path.abspath(args.elf)), project_dir, args.headroom)
+
+
+def register(env):
+    arch = "avr" if env.subst("$PIOPLATFORM") == "atmelavr" else "esp8266"
+    budgets = {}
+    for region in REGIONS[arch]:
+        value = env.GetProjectOption("custom_%s_budget" % region, "")
+        if value:
+            budgets[region] = int(value)
+
+    def action(target, source, env):
+        elf = env.subst("$BUILD_DIR/${PROGNAME}.elf")
+        size_tool = env.subst("$SIZETOOL")
+        return report(elf, arch, size_tool, tool_beside(size_tool, "nm"), budgets,
+                      env.subst("$PIOENV"), env.subst("$BUILD_DIR"),
+                      env.subst("$PROJECT_DIR"))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", action)
+    env.AddCustomTarget("memreport", "$BUILD_DIR/${PROGNAME}.elf", action,
+                        title="Memory report", description="RAM/flash per symbol and budget check")
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
+else:
+    Import("env")  # noqa: F821 - provided by PlatformIO (SCons)
+    register(env)  # noqa: F821
@@ -0,0 +1,444 @@
+"""
+rtdb_proxy.py - local Realtime Database stand-in with scripted network faults
+
+    python scripts/rtdb_proxy.py scripts/fault_scenarios.json --cert cert.pem --key key.pem
+
+Serves the RTDB REST API (GET/PUT/PATCH/POST/DELETE on <path>.json, and
+SSE streams) from an in-memory tree over HTTPS. The firmware does not
+check certificates (setInsecure), so a self-signed one is enough:
+
+    openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=rtdb \\
+        -keyout key.pem -out cert.pem
+
+Build the NodeMCU with DATABASE_URL pointing here (e.g.
+"https://192.168.1.20:8443") and -DMETRICS_REPORT_MIN=1 so loop-time
+histograms arrive once a minute. Sign-in still goes to Firebase Auth;
+only database traffic is faked.
+
+The scenario file is a JSON object with the initial "tree" and a list of
+"phases" run one after the other. Fault keys of a phase:
+- latency_ms          delay before every response
+- bandwidth_bps       response bytes per second
+- tls_stall_s         hold each new TLS handshake this long
+- error_rate          share of requests answered with error_status (503)
+- token_expired       401 "Auth token is expired"; open streams get auth_revoked
+- truncate            send half of each body, then close the connection
+- sse_truncate_bytes  close streams after this many bytes, mid-event
+- drop_rate           share of connections closed without an answer
+
+When the last phase ends a report is printed per phase: requests, faults
+injected, p99 and max loop time (from the loop_us histograms written to
+/devices/<id>/metrics), resets (writes to /devices/<id>/last_reset), and
+for faulty phases the recovery time: end of the phase to the next good
+poll of /smart_controls/relays.
+"""
+import argparse
+import json
+import random
+import socket
+import ssl
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+FAULT_KEYS = ("latency_ms", "bandwidth_bps", "tls_stall_s", "error_rate", "token_expired",
+              "truncate", "sse_truncate_bytes", "drop_rate")
+RELAYS_PATH = ["smart_controls", "relays"]
+KEEPALIVE_S = 30
+
+
+class Phases:
+    """Which phase is active, and what happened during each."""
+
+    def __init__(self, phases, seed):
+        self.phases = phases
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        ends, t = [], 0.0
+        for p in phases:
+            t += p["duration_s"]
+            ends.append(t)
+        self.ends = ends
+        self.stats = [{"requests": 0, "faults": 0, "resets": 0, "hist": {}, "recovery_s": None}
+                      for _ in phases]
+
+    def now(self):
+        return time.monotonic() - self.start
+
+    def index(self):
+        t = self.now()
+        for i, end in enumerate(self.ends):
+            if t < end:
+                return i
+        return None
+
+    def current(self):
+        i = self.index()
+        return (i, self.phases[i]) if i is not None else (None, {})
+
+    def chance(self, rate):
+        with self.lock:
+            return rate > 0 and self.rng.random() < rate
+
+    def count(self, key, n=1):
+        i = self.index()
+        if i is not None:
+            with self.lock:
+                self.stats[i][key] += n
+
+    def relays_polled(self):
+        """A good relay poll closes the recovery window of every earlier faulty phase."""
+        t = self.now()
+        with self.lock:
+            for i, p in enumerate(self.phases):
+                if self.ends[i] > t or self.stats[i]["recovery_s"] is not None:
+                    continue
+                if any(p.get(k) for k in FAULT_KEYS):
+                    self.stats[i]["recovery_s"] = t - self.ends[i]
+
+    def loop_histogram(self, hist):
+        if not isinstance(hist, dict) or "b" not in hist:
+            return
+        i = self.index()
+        if i is None:
+            return
+        with self.lock:
+            h = self.stats[i]["hist"]
+            h.setdefault("s", hist.get("s", 0))
+            h["max"] = max(h.get("max", 0), hist.get("max", 0))
+            buckets = h.setdefault("b", [])
+            for k, n in enumerate(hist["b"]):
+                if k >= len(buckets):
+                    buckets.append(0)
+                buckets[k] += n
+
+
+class Tree:
+    """The database, plus the open SSE streams that watch parts of it."""
+
+    def __init__(self, data):
+        self.data = data
+        self.lock = threading.Lock()
+        self.streams = []
+        self.pushes = 0
+
+    def get(self, parts):
+        with self.lock:
+            node = self.data
+            for p in parts:
+                if not isinstance(node, dict) or p not in node:
+                    return None
+                node = node[p]
+            return json.loads(json.dumps(node))
+
+    def put(self, parts, value, merge=False):
+        with self.lock:
+            if not parts:
+                if merge and isinstance(value, dict) and isinstance(self.data, dict):
+                    self.data.update(value)
+                else:
+                    self.data = value if value is not None else {}
+            else:
+                node = self.data
+                for p in parts[:-1]:
+                    if not isinstance(node.get(p), dict):
+                        node[p] = {}
+                    node = node[p]
+                if merge and isinstance(value, dict) and isinstance(node.get(parts[-1]), dict):
+                    node[parts[-1]].update(value)
+                elif value is None:
+                    node.pop(parts[-1], None)
+                else:
+                    node[parts[-1]] = value
+            streams = list(self.streams)
+        for watch, queue in streams:
+            if parts[:len(watch)] == watch:
+                rel = "/" + "/".join(parts[len(watch):])
+                queue.append(("patch" if merge else "put", rel, value))
+            elif watch[:len(parts)] == parts:
+                queue.append(("put", "/", self.get(watch)))
+
+    def push(self, parts, value):
+        with self.lock:
+            self.pushes += 1
+            key = "-SH%08d" % self.pushes
+        self.put(parts + [key], value)
+        return key
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "rtdb-proxy"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write("%.1f %s\n" % (self.server.phases.now(), fmt % args))
+
+    def parts(self):
+        path = urlsplit(self.path).path
+        if path.endswith(".json"):
+            path = path[:-5]
+        return [p for p in path.split("/") if p]
+
+    def silent(self):
+        return parse_qs(urlsplit(self.path).query).get("print") == ["silent"]
+
+    def body(self):
+        n = int(self.headers.get("Content-Length") or 0)
+        raw = self.rfile.read(n) if n else b""
+        return json.loads(raw) if raw else None
+
+    def reply(self, status, value, phase):
+        body = b"" if status == 204 else json.dumps(value).encode()
+        time.sleep(phase.get("latency_ms", 0) / 1000.0)
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if phase.get("truncate") and body:
+            self.server.phases.count("faults")
+            self.write_throttled(body[:len(body) // 2], phase)
+            self.close_connection = True
+            self.connection.shutdown(socket.SHUT_RDWR)
+            return
+        self.write_throttled(body, phase)
+
+    def write_throttled(self, data, phase):
+        bps = phase.get("bandwidth_bps")
+        if not bps:
+            self.wfile.write(data)
+            return
+        step = max(1, bps // 10)
+        for i in range(0, len(data), step):
+            self.wfile.write(data[i:i + step])
+            self.wfile.flush()
+            time.sleep(0.1)
+
+    def fault(self, phase):
+        """Answer with an injected error; returns True if the request is done."""
+        phases = self.server.phases
+        if phase.get("token_expired"):
+            phases.count("faults")
+            self.reply(401, {"error": "Auth token is expired"}, phase)
+            return True
+        if phases.chance(phase.get("error_rate", 0)):
+            phases.count("faults")
+            status = phase.get("error_status", 503)
+            self.reply(status, {"error": "injected %d" % status}, phase)
+            return True
+        return False
+
+    def do_GET(self):
+        phases = self.server.phases
+        phases.count("requests")
+        _, phase = phases.current()
+        if self.fault(phase):
+            return
+        parts = self.parts()
+        if "text/event-stream" in (self.headers.get("Accept") or ""):
+            self.stream(parts)
+            return
+        self.reply(200, self.server.tree.get(parts), phase)
+        if parts == RELAYS_PATH:
+            phases.relays_polled()
+
+    def write(self, merge):
+        phases = self.server.phases
+        phases.count("requests")
+        _, phase = phases.current()
+        value = self.body()
+        if self.fault(phase):
+            return
+        parts = self.parts()
+        if self.command == "POST":
+            key = self.server.tree.push(parts, value)
+            self.reply(200, {"name": key}, phase)
+            return
+        self.server.tree.put(parts, value, merge)
+        if len(parts) == 3 and parts[0] == "devices":
+            if parts[2] == "last_reset":
+                phases.count("resets")
+            elif parts[2] == "metrics" and isinstance(value, dict):
+                phases.loop_histogram(value.get("node", {}).get("h", {}).get("loop_us"))
+        self.reply(204 if self.silent() else 200, value, phase)
+
+    def do_PUT(self):
+        self.write(False)
+
+    def do_PATCH(self):
+        self.write(True)
+
+    def do_POST(self):
+        self.write(False)
+
+    def do_DELETE(self):
+        self.server.phases.count("requests")
+        _, phase = self.server.phases.current()
+        if self.fault(phase):
+            return
+        self.server.tree.put(self.parts(), None)
+        self.reply(204 if self.silent() else 200, None, phase)
+
+    def stream(self, parts):
+        """SSE: the current value, then every change under parts, until a fault ends it."""
+        phases = self.server.phases
+        queue = [("put", "/", self.server.tree.get(parts))]
+        watch = (parts, queue)
+        self.server.tree.streams.append(watch)
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Cache-Control", "no-cache")
+        self.send_header("Connection", "close")
+        self.end_headers()
+        self.close_connection = True
+        sent = 0
+        last = time.monotonic()
+        try:
+            while phases.index() is not None:
+                _, phase = phases.current()
+                if phase.get("token_expired"):
+                    phases.count("faults")
+                    self.wfile.write(b"event: auth_revoked\ndata: credential is no longer valid\n\n")
+                    return
+                if queue:
+                    event, path, data = queue.pop(0)
+                    msg = "event: %s\ndata: %s\n\n" % (event, json.dumps({"path": path, "data": data}))
+                elif time.monotonic() - last >= KEEPALIVE_S:
+                    msg = "event: keep-alive\ndata: null\n\n"
+                else:
+                    time.sleep(0.2)
+                    continue
+                data = msg.encode()
+                limit = phase.get("sse_truncate_bytes")
+                if limit and sent + len(data) > limit:
+                    phases.count("faults")
+                    self.wfile.write(data[:max(1, limit - sent)])
+                    self.wfile.flush()
+                    return
+                time.sleep(phase.get("latency_ms", 0) / 1000.0)
+                self.write_throttled(data, phase)
+                self.wfile.flush()
+                sent += len(data)
+                last = time.monotonic()
+        except OSError:
+            pass
+        finally:
+            self.server.tree.streams.remove(watch)
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, addr, tree, phases, context, verbose):
+        super().__init__(addr, Handler)
+        self.tree = tree
+        self.phases = phases
+        self.context = context
+        self.verbose = verbose
+
+    def finish_request(self, request, client_address):
+        # Runs on the connection's own thread, so stalls here only hold this client
+        _, phase = self.phases.current()
+        if self.phases.chance(phase.get("drop_rate", 0)):
+            self.phases.count("faults")
+            request.close()
+            return
+        if phase.get("tls_stall_s"):
+            self.phases.count("faults")
+            time.sleep(phase["tls_stall_s"])
+        if self.context:
+            try:
+                request = self.context.wrap_socket(request, server_side=True)
+            except (ssl.SSLError, OSError):
+                return
+        self.RequestHandlerClass(request, client_address, self)
+
+
+def p99(hist):
+    """Upper bound of the bucket holding the 99th percentile, in the histogram's units."""
+    buckets = hist.get("b")
+    if not buckets:
+        return None
+    total = sum(buckets)
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if seen >= 0.99 * total:
+            if i == 15:
+                return hist.get("max")
+            return 1 << (i + hist.get("s", 0))
+    return hist.get("max")
+
+
+def report(phases):
+    rows = []
+    for p, st in zip(phases.phases, phases.stats):
+        faulty = any(p.get(k) for k in FAULT_KEYS)
+        rows.append({
+            "phase": p.get("name", "?"),
+            "requests": st["requests"],
+            "faults": st["faults"],
+            "loop_p99_us": p99(st["hist"]),
+            "loop_max_us": st["hist"].get("max"),
+            "resets": st["resets"],
+            "recovery_s": round(st["recovery_s"], 1) if st["recovery_s"] is not None else
+                          ("none" if faulty else None),
+        })
+    print("%-14s %8s %7s %12s %12s %7s %11s" % ("phase", "requests", "faults", "loop p99 us",
+                                                "loop max us", "resets", "recovery s"))
+    for r in rows:
+        print("%-14s %8d %7d %12s %12s %7d %11s" % (r["phase"], r["requests"], r["faults"],
+                                                    "-" if r["loop_p99_us"] is None else r["loop_p99_us"],
+                                                    "-" if r["loop_max_us"] is None else r["loop_max_us"],
+                                                    r["resets"], "-" if r["recovery_s"] is None else r["recovery_s"]))
+    return rows
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Local RTDB stand-in with scripted network faults")
+    parser.add_argument("scenario")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", help="PEM certificate (plain HTTP without it)")
+    parser.add_argument("--key", help="PEM private key")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--report", metavar="JSON", help="also write the report here")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args(argv)
+
+    with open(args.scenario) as f:
+        scenario = json.load(f)
+    context = None
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+
+    phases = Phases(scenario["phases"], args.seed)
+    server = Server((args.host, args.port), Tree(scenario.get("tree", {})), phases, context, args.verbose)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("Serving %s on %s:%d, %d phases, %.0f s" % ("HTTPS" if context else "HTTP", args.host, args.port,
+                                                     len(phases.phases), phases.ends[-1]))
+    last = None
+    try:
+        while phases.index() is not None:
+            i = phases.index()
+            if i != last:
+                print("%6.0f s  phase %s" % (phases.now(), phases.phases[i].get("name", i)))
+                last = i
+            time.sleep(0.5)
+    except KeyboardInterrupt:
+        pass
+    server.shutdown()
+
+    rows = report(phases)
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump(rows, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
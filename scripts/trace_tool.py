@@ -0,0 +1,250 @@
+"""
+trace_tool.py - receive, decode and check NodeMCU input traces
+
+    python scripts/trace_tool.py receive traces/ --port 8090
+    python scripts/trace_tool.py dump traces/            (or single .bin files)
+    python scripts/trace_tool.py check traces/
+
+The firmware records every input it acts on (Firebase values, float
+edges, fingerprint results, door commands) into a ring of LittleFS
+segments, see lib/SmartHaus/src/TraceRecorder.h for the format. Writing
+
+    /devices/<id>/trace = {"upload": "http://<this host>:8090/"}
+
+makes it POST each segment as <url>?seg=<seq>; "receive" stores them as
+<dir>/<device>-<seq>.bin (device from the ?dev= query, if given).
+
+"dump" prints one line per record, with wall-clock time where the segment
+knew it. "check" looks for the patterns behind the usual field reports:
+float flapping (one water SMS per cycle), repeated alerts for a door with
+no unlock between, failed door commands, Firebase error bursts, records
+dropped by a full buffer, and resets during a task.
+"""
+import argparse
+import json
+import os
+import struct
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+MAGIC = 0x31544853
+TYPES = {1: "sync", 2: "boot", 3: "dropped", 4: "relay", 5: "door_lock", 6: "failed_attempts",
+         7: "fb_error", 8: "float_edge", 9: "float", 10: "finger", 11: "door_cmd"}
+FINGER_RESULTS = {0: "match", 9: "not_found", 1: "packet_error"}
+DOOR_CMDS = {"l": "lock", "u": "unlock", "a": "alert"}
+FLAP_WINDOW_S = 600
+FLAP_CHANGES = 4
+FB_BURST = 10
+
+
+def read_varint(data, pos):
+    value = 0
+    for n in range(5):
+        if pos + n >= len(data):
+            return None, pos
+        b = data[pos + n]
+        value |= (b & 0x7F) << (7 * n)
+        if not b & 0x80:
+            return value, pos + n + 1
+    return None, pos
+
+
+def decode_segment(data):
+    """(seq, records, truncated); records are dicts with absolute ms."""
+    if len(data) < 8:
+        return None, [], False
+    magic, seq = struct.unpack_from("<II", data)
+    if magic != MAGIC:
+        return None, [], False
+    pos, ms, records = 8, 0, []
+    epoch_base = None
+    while pos < len(data):
+        rtype = data[pos]
+        if rtype not in TYPES:
+            return seq, records, True
+        dt, p = read_varint(data, pos + 1)
+        if dt is None or p >= len(data):
+            return seq, records, True
+        arg = data[p]
+        zz, p = read_varint(data, p + 1)
+        if zz is None:
+            return seq, records, True
+        pos = p
+        value = (zz >> 1) ^ -(zz & 1)
+        ms = dt if rtype == 1 else (ms + dt) & 0xFFFFFFFF
+        if rtype == 1:
+            epoch_base = (value & 0xFFFFFFFF, ms) if value else None
+        rec = {"seq": seq, "ms": ms, "type": TYPES[rtype], "arg": arg, "value": value}
+        if epoch_base:
+            rec["epoch"] = epoch_base[0] + (ms - epoch_base[1]) / 1000.0
+        records.append(rec)
+    return seq, records, False
+
+
+def load(paths):
+    """Segments from files and directories, ordered by sequence number."""
+    files = []
+    for path in paths:
+        if os.path.isdir(path):
+            files += [os.path.join(path, f) for f in sorted(os.listdir(path)) if f.endswith(".bin")]
+        else:
+            files.append(path)
+    segments = []
+    for name in files:
+        with open(name, "rb") as f:
+            seq, records, truncated = decode_segment(f.read())
+        if seq is None:
+            print(f"{name}: not a trace segment", file=sys.stderr)
+            continue
+        segments.append((seq, name, records, truncated))
+    segments.sort()
+    return segments
+
+
+def describe(rec):
+    t, arg, v = rec["type"], rec["arg"], rec["value"]
+    if t == "sync":
+        return "segment start" + (f", epoch {v & 0xFFFFFFFF}" if v else ", no wall clock")
+    if t == "boot":
+        return f"boot, reset reason {arg}" + (f", crashed in task {v}" if v != 0xFF else "")
+    if t == "relay":
+        return f"relay {v >> 1} -> {v & 1}"
+    if t == "door_lock":
+        return f"door {arg} door_lock = {bool(v)}"
+    if t == "failed_attempts":
+        return f"door {arg} failed_attempts = {v}"
+    if t == "fb_error":
+        return f"firebase error {v}"
+    if t == "float_edge":
+        return f"float raw {'wet' if arg else 'dry'}"
+    if t == "float":
+        return f"water {'present' if v else 'EMPTY'}" + (" at boot" if arg == 1 else "")
+    if t == "finger":
+        result = v & 0xFF
+        name = FINGER_RESULTS.get(result, f"result {result}")
+        return f"door {arg} finger {name}" + (f" id {v >> 8}" if result == 0 else "")
+    if t == "door_cmd":
+        cmd = DOOR_CMDS.get(chr(v & 0xFF), chr(v & 0xFF))
+        return f"door {arg} {cmd}" + (" (I2C FAILED)" if v & 0x100 else "")
+    return f"{t} arg {arg} value {v}"
+
+
+def stamp(rec):
+    if "epoch" in rec:
+        return time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(rec["epoch"]))
+    return f"+{rec['ms'] / 1000:.3f}s"
+
+
+def dump(segments, as_json):
+    for seq, name, records, truncated in segments:
+        for rec in records:
+            if as_json:
+                print(json.dumps(rec))
+            else:
+                print(f"{seq:5d} {stamp(rec):>20} {describe(rec)}")
+        if truncated and not as_json:
+            print(f"{seq:5d} {'':>20} (segment ends inside a record: {name})")
+
+
+def check(segments):
+    findings = []
+    float_changes = []
+    alerts = {}
+    fb_errors = 0
+    prev_seq = None
+    for seq, name, records, truncated in segments:
+        if prev_seq is not None and seq != prev_seq + 1:
+            findings.append(f"segments {prev_seq + 1}..{seq - 1} missing (overwritten or not uploaded)")
+        prev_seq = seq
+        if truncated:
+            findings.append(f"segment {seq} ends inside a record (reset during a flush?)")
+        for rec in records:
+            t, arg, v = rec["type"], rec["arg"], rec["value"]
+            where = f"segment {seq} {stamp(rec)}"
+            if t == "boot":
+                float_changes, alerts, fb_errors = [], {}, 0
+                if v != 0xFF:
+                    findings.append(f"{where}: reset (reason {arg}) while task {v} was running")
+            elif t == "dropped":
+                findings.append(f"{where}: {v} records lost to a full trace buffer")
+            elif t == "float" and arg != 1:
+                float_changes = [ms for ms in float_changes if rec["ms"] - ms < FLAP_WINDOW_S * 1000]
+                float_changes.append(rec["ms"])
+                if len(float_changes) == FLAP_CHANGES:
+                    findings.append(f"{where}: water level changed {FLAP_CHANGES} times in {FLAP_WINDOW_S} s "
+                                    "(one empty SMS per cycle)")
+            elif t == "door_cmd":
+                cmd = chr(v & 0xFF)
+                if v & 0x100:
+                    findings.append(f"{where}: door {arg} {DOOR_CMDS.get(cmd, cmd)} not delivered over I2C")
+                if cmd == "a":
+                    if alerts.get(arg):
+                        findings.append(f"{where}: second alert for door {arg} without an unlock between")
+                    alerts[arg] = True
+                elif cmd == "u":
+                    alerts[arg] = False
+            elif t == "fb_error":
+                fb_errors += 1
+                if fb_errors == FB_BURST:
+                    findings.append(f"{where}: {FB_BURST} Firebase errors in a row")
+            elif t == "relay":
+                fb_errors = 0
+    for line in findings:
+        print(line)
+    records = sum(len(s[2]) for s in segments)
+    print(f"{len(segments)} segments, {records} records, {len(findings)} findings")
+    return 1 if findings else 0
+
+
+def receive(directory, host, port):
+    os.makedirs(directory, exist_ok=True)
+
+    class Handler(BaseHTTPRequestHandler):
+        def do_POST(self):
+            query = parse_qs(urlsplit(self.path).query)
+            seq = query.get("seg", ["0"])[0]
+            dev = query.get("dev", ["trace"])[0]
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            name = os.path.join(directory, f"{os.path.basename(dev)}-{int(seq):06d}.bin")
+            with open(name, "wb") as f:
+                f.write(body)
+            print(f"{name}: {len(body)} bytes")
+            self.send_response(200)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+
+        def log_message(self, fmt, *args):
+            pass
+
+    print(f"Waiting for trace segments on {host}:{port}")
+    HTTPServer((host, port), Handler).serve_forever()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Receive, decode and check NodeMCU input traces")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("receive", help="store uploaded segments")
+    p.add_argument("dir")
+    p.add_argument("--host", default="0.0.0.0")
+    p.add_argument("--port", type=int, default=8090)
+    p = sub.add_parser("dump", help="one line per record")
+    p.add_argument("paths", nargs="+")
+    p.add_argument("--json", action="store_true", help="JSON lines instead of text")
+    p = sub.add_parser("check", help="look for known field-bug patterns")
+    p.add_argument("paths", nargs="+")
+    args = parser.parse_args(argv)
+
+    if args.cmd == "receive":
+        receive(args.dir, args.host, args.port)
+        return 0
+    segments = load(args.paths)
+    if args.cmd == "dump":
+        dump(segments, args.json)
+        return 0
+    return check(segments)
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -10,14 +10,115 @@
 #include <FirebaseClient.h>
 #include "secrets.h"
 #include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
 #include <Wire.h>
 #include <Preferences.h>
 #include <WiFiUdp.h>
 #include <time.h>
+#include <sys/time.h>
+#include <coredecls.h>
+#include <eboot_command.h>
+#include <flash_hal.h>
+#include <LevelDebouncer.h>
+#include <PumpController.h>
+#include <RulesEngine.h>
+#include <LockoutPolicy.h>
+#include <DeviceConfig.h>
+#include <JsonScan.h>
+#include <I2CBusManager.h>
+#include <PathTemplate.h>
+#include <ClockFormatter.h>
+#include <TimeService.h>
+#include <RingLog.h>
+#include <MemoryWatch.h>
+#include <IdleGovernor.h>
+#include <EventBus.h>
+#include <Metrics.h>
+#include <FirebaseHealth.h>
+#include <TaskSupervisor.h>
+#include <FingerprintLink.h>
+#include <FirmwareUpdate.h>
+#include <TraceRecorder.h>
+#include <AccessHistory.h>
+#include <AccessPipeline.h>
+#include <DoorScheduler.h>
+#include <LittleFS.h>
+#include <ESP8266WebServer.h>
+#include <SoftwareSerial.h>
+
+// Diagnostics never go to Serial: UART0 belongs to the fingerprint sensor.
+// LOG_SINK_SERIAL1 - TX-only UART1 on GPIO2 (D4), 115200 baud
+// LOG_SINK_RAM     - keep the newest lines in RAM, pushed to <devicePath>/log_tail
+#define LOG_SINK_SERIAL1 1
+#define LOG_SINK_RAM 2
+#ifndef LOG_SINK
+#define LOG_SINK LOG_SINK_SERIAL1
+#endif
+LOG_DEFINE();
+unsigned long lastLogTailReport = 0;
+const unsigned long LOG_TAIL_INTERVAL = 300000; // 5 minutes
+uint32_t logTailLines = 0;
 
 // Hardware setup
-Adafruit_Fingerprint finger = Adafruit_Fingerprint(&Serial);
+// Front door sensor on UART0, swapped to GPIO13/15 (see FingerprintLink.h)
+FingerprintLink frontLink(Serial, "uart0-swap");
+Adafruit_Fingerprint frontFinger = Adafruit_Fingerprint(&frontLink);
+// Back door sensor on SoftwareSerial (only started when door_count is 2)
+#define BACK_FP_RX_PIN 14  // NodeMCU D5 <- sensor TX (not a boot strap pin)
+#define BACK_FP_TX_PIN 16  // NodeMCU D0 -> sensor RX
+SoftwareSerial backFpSerial(BACK_FP_RX_PIN, BACK_FP_TX_PIN);
+FingerprintLink backLink(backFpSerial, "softserial");
+Adafruit_Fingerprint backFinger = Adafruit_Fingerprint(&backLink);
+unsigned long lastFingerprintStatsReport = 0;
+const unsigned long FINGERPRINT_STATS_INTERVAL = 300000; // 5 minutes
+
+// Runtime memory low-water marks (static sizes: scripts/memory_report.py)
+MemoryLowWater memWatch;
+unsigned long lastMemSample = 0;
+unsigned long lastMemReport = 0;
+const unsigned long MEM_SAMPLE_INTERVAL = 1000;
+const unsigned long MEM_REPORT_INTERVAL = 300000; // 5 minutes
+const uint32_t HEAP_WARN_BYTES = 8000; // a TLS handshake needs more than this
+bool heapWarned = false;
 Preferences preferences;
+I2CBusManager<TwoWire> i2cBus(Wire); // slot 0 (0x08) is the main Mega
+unsigned long lastI2CScan = 0;
+const unsigned long I2C_SCAN_INTERVAL = 30000; // look for new/returning slaves
+unsigned long lastReconcile = 0;
+const unsigned long RECONCILE_INTERVAL = 2000; // status readback from every slave
+unsigned long divergedSinceMs[I2C_MAX_SLAVES] = {0};
+unsigned long lastI2CStatsReport = 0;
+const unsigned long I2C_STATS_INTERVAL = 300000; // 5 minutes
+
+// Access pipeline: the door is actuated inside getFingerprintID(), everything
+// slow (flash, Preferences, Firebase) runs afterwards, one stage per loop pass
+const char *const STAGE_NAMES[STAGE_COUNT] = {"door", "persist", "counter", "name", "history", "log"};
+#define ACCESS_QUEUE_SIZE 4
+void runAccessStage(uint8_t stage, AccessJob &job);
+uint32_t eventClock();
+AccessPipeline<ACCESS_QUEUE_SIZE> accessPipeline(runAccessStage, eventClock);
+
+// Access log entries held back until there is a wall clock and a connection.
+// Only the monotonic time is kept; the timestamp is filled in when written.
+struct JournalEntry {
+  uint8_t door;
+  bool granted;
+  uint64_t atMs;
+  char user[24];
+};
+const uint8_t JOURNAL_SIZE = 16;
+JournalEntry journal[JOURNAL_SIZE];
+uint8_t journalHead = 0;
+uint8_t journalCount = 0;
+uint32_t journalDropped = 0;
+
+// Latest and worst-case timings in microseconds
+struct AccessTiming {
+  uint32_t matchUs;     // image2Tz + fingerFastSearch
+  uint32_t unlockUs;    // image captured -> unlock sent
+  uint32_t unlockMaxUs;
+  uint32_t stageMaxUs[STAGE_COUNT];
+};
 
 // Firebase minimal setup
 WiFiClientSecure ssl_client;
@@ -27,412 +128,2553 @@ FirebaseApp app;
 RealtimeDatabase Database;
 AsyncResult databaseResult;
 
+// Separate TLS session for the failed_attempts stream (remote override)
+WiFiClientSecure stream_ssl_client;
+AsyncClientClass streamClient(stream_ssl_client);
+bool failedAttemptsStreamStarted = false;
+
+// Runtime configuration (Preferences, refreshed from /devices/<id>/config)
+NodeConfig nodeConfig = NODE_CONFIG_DEFAULTS;
+MegaConfig megaConfig = MEGA_CONFIG_DEFAULTS;
+bool nodeConfigReadOnly = false; // stored by newer firmware (CONFIG_NEWER): changes are not saved
+bool megaConfigReadOnly = false;
+unsigned long lastConfigCheck = 0;
+const unsigned long CONFIG_CHECK_INTERVAL = 60000; // 1 minute
+uint32_t configHash = 0;
+
+// Relay state path, prefix/suffix kept in flash
+static const char RELAY_PREFIX[] PROGMEM = "/smart_controls/relays/";
+static const char RELAY_SUFFIX[] PROGMEM = "/state";
+static const PathTemplate RELAY_STATE = PATH_TEMPLATE(RELAY_PREFIX, RELAY_SUFFIX);
+PathBuffer<48> relayPath(RELAY_STATE);
+
+// Cached wall clock for log entries
+ClockFormatter wallClock;
+
+// Time service: SNTP every 6 h once synced, retries from 15 s doubling to 10 min
+TimeService timeService({6 * 3600, 15, 600});
+const long TIME_UTC_OFFSET_S = 8 * 3600; // UTC+8 (adjust timezone as needed)
+const uint32_t TIME_RTC_OFFSET = 48;     // RTC user memory block, after the lockout records
+const unsigned long TIME_SAVE_INTERVAL = 1000;
+unsigned long lastTimeSave = 0;
+volatile bool timeSyncPending = false;
+
+// Controller paths (the front door's device), built once from nodeConfig.deviceId
+char devicePath[40];
+char configPath[56];
+
 // Connection status
 bool wifiConnected = false;
 bool firebaseConnected = false;
+// A failed read parks Firebase work for 2 s, doubling up to a minute; a
+// stalled TLS read gives up after FB_IO_TIMEOUT_MS instead of the default 15 s
+FirebaseHealth firebaseHealth({2000, 60000});
+#define FB_IO_TIMEOUT_MS 5000
 
 // Relay monitoring
 unsigned long lastRelaysCheck = 0;
-const unsigned long RELAYS_CHECK_INTERVAL = 1500; // 1.5 seconds for real-time
-const int MAX_RELAY_ID = 8;
+const int MAX_RELAY_ID = I2C_MAX_RELAYS; // capacity; nodeConfig.maxRelayId is the active count
 bool relayStateLast[MAX_RELAY_ID + 1] = {false};
 bool relaysInitialized = false;
 
+// Failed attempts tracking
+// 3 failures within 5 min lock for 30 s, doubling per lockout up to 1 h; backoff resets after 24 h clean
+const LockoutConfig LOCKOUT_CONFIG = {3, 300, 30, 3600, 86400};
+
+// One instance per door: sensor, lock state, lockout and Firebase subtree.
+// Door 0 (front) keeps the original paths and keys; door 1 (back) is enabled with door_count = 2.
+// Rules (IN_DOOR_LOCKED, IN_FAILED, lock/unlock actions) follow door 0.
+#define MAX_DOORS 2
+struct Door {
+  Door(FingerprintLink &link, Adafruit_Fingerprint &finger) : link(link), finger(finger), lockout(LOCKOUT_CONFIG) {}
+
+  FingerprintLink &link;
+  Adafruit_Fingerprint &finger;
+  LockoutPolicy lockout;
+  bool systemLocked = false;
+  bool isDoorLocked = true;
+  bool doorLockStateLast = false;
+  int remoteFailures = -1;  // last failed_attempts value written or seen in Firebase
+  unsigned long lastLockoutMessage = 0;
+  char devicePath[40];
+  char failedAttemptsPath[64];
+  char lastUpdatedPath[64];
+  char lockPath[48];
+  PathBuffer<96> logPath;   // <devicePath>/logs/<date>/<time>/<leaf>
+  AccessTiming timing = {0, 0, 0, {0}};
+};
+Door doors[MAX_DOORS] = {{frontLink, frontFinger}, {backLink, backFinger}};
+uint8_t doorCount = 1;
+DoorScanState doorScanState(uint8_t door);
+bool doorTouched(uint8_t door);
+DoorScheduler<MAX_DOORS> doorScheduler(doorScanState, doorTouched); // one sensor read per loop pass
+uint8_t nextLockPollDoor = 0;
+const uint8_t DOOR_LOCK_FLAGS[MAX_DOORS] = {SLAVE_FLAG_UNLOCK_RELAY, SLAVE_FLAG_UNLOCK_RELAY2};
+const char *const LOCKOUT_KEYS[MAX_DOORS] = {"lockout", "lockout1"};
+
 // Door lock
 unsigned long lastDoorLockCheck = 0;
-const unsigned long DOORLOCK_CHECK_INTERVAL = 1000; // 1 second
-bool doorLockStateLast = false;
-bool isDoorLocked = true;
 
-// Failed attempts tracking
-int currentFailedAttempts = 0;
-const int MAX_FAILED_ATTEMPTS = 3;
-bool systemLocked = false;
-unsigned long lastFailedAttemptsCheck = 0;
-const unsigned long FAILED_ATTEMPTS_CHECK_INTERVAL = 5000; // Check every 5 seconds
+const uint32_t LOCKOUT_RTC_OFFSET = 32; // RTC user memory, 4-byte blocks (first 128 bytes belong to OTA)
+const uint32_t LOCKOUT_RTC_MAGIC = 0x4C4B4F31; // "LKO1"
 
 // Water level monitoring
 #define FLOAT_PIN 12  // NodeMCU D6 -> GPIO12
-unsigned long lastFloatRead = 0;
-const unsigned long FLOAT_READ_INTERVAL = 2000; // Check every 2 seconds
 bool lastFloatState = false;
+// Present after 300 ms net wet, empty after 1.5 s net dry, hold each state >= 3 s
+LevelDebouncer floatDebouncer({300, 1500, 3000});
 
-// Buzzer pin
-#define BUZZER_PIN 13  // NodeMCU D7 -> GPIO13
+// Input trace for field bugs: every input the firmware acts on, buffered in
+// RAM (float edges straight from the ISR), flushed to a ring of LittleFS
+// segment files and uploaded on request (see serviceTrace())
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 512
+#endif
+TraceBuffer<TRACE_BUFFER_SIZE> trace;
+const char *TRACE_DIR = "/trace";
+const uint8_t TRACE_SEGMENTS = 4;                 // ring of 4 x 16 KB, weeks of normal activity
+const uint32_t TRACE_SEGMENT_BYTES = 16384;
+const unsigned long TRACE_FLUSH_INTERVAL = 30000; // or as soon as the buffer is half full
+const unsigned long TRACE_CHECK_INTERVAL = 60000;
+bool traceReady = false;        // LittleFS mounted and scanned
+uint32_t traceSeq = 0;          // segment being written
+uint32_t traceSegBytes = 0;     // 0: the next flush starts a new segment
+unsigned long lastTraceFlush = 0;
+unsigned long lastTraceCheck = 0;
+char traceUploadUrl[96] = "";   // upload in progress while set
+uint32_t traceUploadSeq = 0;    // next segment to send
+uint32_t traceUploadBytes = 0;
 
-// Buzzer pin (NodeMCU D7 -> GPIO13)
-#define BUZZER_PIN 13
+// Local access history: one record per scan in a LittleFS ring, indexed by user
+// and day in RAM, served page by page on http://<ip>/history when HISTORY_TOKEN
+// is set (see handleHistoryRequest()). Plain HTTP: LAN only.
+struct HistoryFile {
+  File f;
+  size_t read(uint32_t offset, void *buf, size_t len) {
+    if (!f || !f.seek(offset)) return 0;
+    return f.read((uint8_t *)buf, len);
+  }
+  bool write(uint32_t offset, const void *buf, size_t len) {
+    if (!f || !f.seek(offset) || f.write((const uint8_t *)buf, len) != len) return false;
+    f.flush();
+    return true;
+  }
+};
+#ifndef HISTORY_TOKEN
+#define HISTORY_TOKEN ""
+#endif
+const char *HISTORY_FILE = "/history.bin";
+const uint32_t HISTORY_RECORDS = 8192;   // 128 KB, months of scans
+const uint8_t HISTORY_PAGE_DEFAULT = 20;
+const uint8_t HISTORY_PAGE_MAX = 50;
+HistoryFile historyFile;
+AccessHistory<HistoryFile, HISTORY_RECORDS> history(historyFile, TIME_UTC_OFFSET_S);
+bool historyReady = false;
+ESP8266WebServer historyServer(80);
+bool historyServing = false;
+const char *HISTORY_HEADERS[] = {"X-History-Token"};
+
+// Idle governor: the loop sleeps between scheduled jobs (light sleep between
+// DTIM beacons, so the SSE stream stays associated). The front sensor's touch
+// output and the float switch end a sleep early through a GPIO wake-up.
+#ifndef FP_TOUCH_PIN
+#define FP_TOUCH_PIN -1       // no touch line: poll the sensor; opt in with -DFP_TOUCH_PIN=<gpio>
+#endif
+#ifndef FP_TOUCH_ACTIVE
+#define FP_TOUCH_ACTIVE HIGH  // touch output level while a finger is on the sensor
+#endif
+#ifndef IDLE_MAX_MODE
+#define IDLE_MAX_MODE IDLE_LIGHT // IDLE_OFF: spin as before
+#endif
+const unsigned long FP_TOUCH_HOLD_MS = 2000; // keep reading the sensor this long after a touch
+const unsigned long FP_POLL_MS = 100;        // sensors without a touch line
+const uint8_t WIFI_LISTEN_INTERVAL = 3;      // DTIM periods slept through, the AP buffers for us
+// Sleep 20 ms..1 s; a touch must reach the sensor read within 150 ms.
+// Draw (0.1 mA): 20 mA awake (modem sleep between beacons), 15 mA idle in
+// modem sleep, 1.2 mA in light sleep at DTIM 3 (datasheet figures)
+IdleGovernor idleGovernor({IDLE_MAX_MODE, 20, 1000, 150, 20, {200, 150, 12}});
+volatile uint8_t idleWakeSource = WAKE_TIMER;
+volatile uint32_t touchEdgeUs = 0;   // touch edge not yet seen by the scanner
+uint32_t touchAtUs = 0;              // touch that led to the current scan
+uint32_t touchUnlockMaxUs = 0;       // touch edge -> unlock sent, per report window
+unsigned long lastTouchMs = 0;
+bool idleLightSleep = false;         // sleep type last given to the SDK
+unsigned long lastPowerReport = 0;
+const unsigned long POWER_REPORT_INTERVAL = 300000; // 5 minutes
+
+// Level interrupts armed for a wake-up keep firing while the level holds;
+// drop back to an edge interrupt (what attachInterrupt() writes, without the handler)
+inline void IRAM_ATTR idleEdgeMode(uint8_t pin, uint8_t mode) {
+  GPC(pin) = (GPC(pin) & ~(0xF << GPCI)) | ((mode & 0xF) << GPCI);
+}
+
+void IRAM_ATTR floatPinISR() {
+  idleEdgeMode(FLOAT_PIN, CHANGE);
+  bool wet = digitalRead(FLOAT_PIN) == LOW; // LOW = water present
+  floatDebouncer.onEdge(wet, millis());
+  trace.add(TR_FLOAT_EDGE, wet, 0, millis());
+  idleWakeSource = WAKE_FLOAT;
+  esp_schedule(); // ends idleSleep() early
+}
+
+#if FP_TOUCH_PIN >= 0
+void IRAM_ATTR touchISR() {
+  idleEdgeMode(FP_TOUCH_PIN, FP_TOUCH_ACTIVE == HIGH ? RISING : FALLING);
+  if (!touchEdgeUs) touchEdgeUs = micros() | 1;
+  idleWakeSource = WAKE_TOUCH;
+  esp_schedule();
+}
+#endif
+
+// Pump runtime/energy counters pulled from the Mega
+unsigned long lastPumpReport = 0;
+const unsigned long PUMP_REPORT_INTERVAL = 60000; // 1 minute
+
+// Local automation rules (compiled from /rules.txt, refreshed from Firebase)
+void runRuleAction(uint8_t type, uint8_t arg, const char *text);
+RulesEngine rules(runRuleAction);
+const char *RULES_FILE = "/rules.txt";
+unsigned long lastRulesCheck = 0;
+const unsigned long RULES_CHECK_INTERVAL = 60000; // 1 minute
+uint32_t rulesHash = 0;
+int lastRuleMinute = -2;
+
+// Device metrics: O(1) updates from the hot paths, both boards published as
+// one snapshot to <devicePath>/metrics (histograms cover one report window)
+enum NodeCounter : uint8_t {
+  NC_FB_GETS = 0,     // polled Firebase reads
+  NC_FB_ERRORS,       // ... that failed
+  NC_TLS_ERRORS,      // ... with a TCP/TLS transport error (negative codes)
+  NC_I2C_SENDS,
+  NC_I2C_FAILS,
+  NC_ACCESS_GRANTED,
+  NC_ACCESS_DENIED,
+  NC_LOCKOUTS,
+  NC_WIFI_LOST,
+  NC_COUNT
+};
+enum NodeGauge : uint8_t { NG_HEAP_FREE = 0, NG_MAX_BLOCK, NG_RSSI, NG_FB_OUTAGE_MS, NG_COUNT };
+enum NodeHist : uint8_t { NH_LOOP_US = 0, NH_FB_GET_MS, NH_COUNT };
+const uint8_t NODE_METRIC_SHIFTS[NH_COUNT] = {6, 3};
+const char *const NODE_COUNTER_NAMES[NC_COUNT] = {"fb_gets", "fb_errors", "tls_errors", "i2c_sends", "i2c_fails",
+                                                  "granted", "denied", "lockouts", "wifi_lost"};
+const char *const NODE_GAUGE_NAMES[NG_COUNT] = {"heap", "max_block", "rssi", "fb_outage_ms"};
+const char *const NODE_HIST_NAMES[NH_COUNT] = {"loop_us", "fb_get_ms"};
+const MetricsNames NODE_METRIC_NAMES = {NODE_COUNTER_NAMES, NODE_GAUGE_NAMES, NODE_HIST_NAMES, NODE_METRIC_SHIFTS};
+const MetricsNames MEGA_METRIC_NAMES = {MEGA_COUNTER_NAMES, MEGA_GAUGE_NAMES, MEGA_HIST_NAMES, MEGA_METRIC_SHIFTS};
+typedef Metrics<NC_COUNT, NG_COUNT, NH_COUNT> NodeMetrics;
+NodeMetrics metrics(NODE_METRIC_SHIFTS);
+#ifndef METRICS_REPORT_MIN
+#define METRICS_REPORT_MIN 5
+#endif
+unsigned long lastMetricsReport = 0;
+const unsigned long METRICS_REPORT_INTERVAL = METRICS_REPORT_MIN * 60000UL;
 
-// Simple I2C sender
+// Event bus: sensors publish and return; actuators, rules and cloud sync
+// subscribe here, highest priority first. Unlock and lock stay direct calls
+// in getFingerprintID(), the bus only carries what may wait a loop pass.
+void onRelayToSlave(const Event &e);
+void onWaterToSlave(const Event &e);
+void onLockoutAlarm(const Event &e);
+void onAccessRules(const Event &e);
+void onWaterRules(const Event &e);
+void onRelayRules(const Event &e);
+void onAccessBookkeeping(const Event &e);
+void onWaterCloud(const Event &e);
+constexpr EventSub EVENT_SUBS[] = {
+  // Actuators
+  {EV_RELAY_CHANGED, 200, onRelayToSlave},
+  {EV_WATER_CHANGED, 200, onWaterToSlave},
+  {EV_ACCESS_DENIED, 200, onLockoutAlarm},
+  // Local rule inputs
+  {EV_ACCESS_GRANTED, 150, onAccessRules},
+  {EV_ACCESS_DENIED, 150, onAccessRules},
+  {EV_WATER_CHANGED, 150, onWaterRules},
+  {EV_RELAY_CHANGED, 150, onRelayRules},
+  // Cloud sync and logs
+  {EV_ACCESS_GRANTED, 60, onAccessBookkeeping},
+  {EV_ACCESS_DENIED, 60, onAccessBookkeeping},
+  {EV_WATER_CHANGED, 50, onWaterCloud},
+};
+static_assert(eventSubsSorted(EVENT_SUBS, sizeof(EVENT_SUBS) / sizeof(EVENT_SUBS[0])),
+              "EVENT_SUBS must be sorted by descending priority");
+#define EVENT_QUEUE_SIZE 32 // one full relay tree fetch fits
+const uint8_t EVENT_DISPATCH_MAX = 8; // events finished per loop pass
+uint32_t eventClock() {
+  return micros();
+}
+EventBus<sizeof(EVENT_SUBS) / sizeof(EVENT_SUBS[0]), EVENT_QUEUE_SIZE> events(EVENT_SUBS, eventClock);
+unsigned long lastEventReport = 0;
+const unsigned long EVENT_REPORT_INTERVAL = 300000; // 5 minutes
+
+// Buzzer pin (NodeMCU D3 -> GPIO0). The active-low buzzer idles HIGH, which is
+// the level the GPIO0 boot strap needs; GPIO13/14 are fingerprint RX lines.
+#define BUZZER_PIN 0
+
+// Simple I2C sender (main Mega)
 bool sendI2CMessage(const char* msg) {
-  Wire.beginTransmission(0x08);
-  Wire.write(msg, strlen(msg));
-  return (Wire.endTransmission() == 0);
+  bool ok = i2cBus.send(0, msg);
+  metrics.inc(NC_I2C_SENDS);
+  if (!ok) metrics.inc(NC_I2C_FAILS);
+  return ok;
+}
+
+// Account a polled Firebase read started at startMs; true if it succeeded.
+// A failure takes Firebase offline until the backoff allows the next try.
+bool firebaseGetOk(unsigned long startMs) {
+  int code = aClient.lastError().code();
+  metrics.inc(NC_FB_GETS);
+  metrics.observe(NH_FB_GET_MS, millis() - startMs);
+  FirebaseRead kind = firebaseHealth.readDone(code, millis(), RANDOM_REG32);
+  if (kind == FB_READ_OK) {
+    uint32_t outage = firebaseHealth.takeOutage();
+    if (outage) {
+      LOG_I("✅ Firebase back after %lu ms", (unsigned long)outage);
+      metrics.set(NG_FB_OUTAGE_MS, outage);
+    }
+    return true;
+  }
+  metrics.inc(NC_FB_ERRORS);
+  if (kind == FB_READ_TRANSPORT) metrics.inc(NC_TLS_ERRORS);
+  trace.add(TR_FB_ERROR, 0, code, millis());
+  firebaseConnected = false;
+  LOG_W("⚠️ Firebase read failed (%d) after %lu ms, retry in %lu ms", code, millis() - startMs,
+        (unsigned long)firebaseHealth.backoff().delayMs());
+  return false;
+}
+
+// "lock" / "unlock" / "alert" for door 0, "<cmd>:<n>" for door n
+bool sendDoorCommand(uint8_t door, const char *cmd) {
+  bool ok;
+  if (door == 0) {
+    ok = sendI2CMessage(cmd);
+  } else {
+    char msg[16];
+    snprintf(msg, sizeof(msg), "%s:%u", cmd, door);
+    ok = sendI2CMessage(msg);
+  }
+  trace.add(TR_DOOR_CMD, door, cmd[0] + (ok ? 0 : 256), millis());
+  return ok;
+}
+
+// Ask the Mega for its pump counters ("pumpstats" selects the reply)
+bool readPumpReport(PumpReport &report) {
+  if (!sendI2CMessage("pumpstats")) return false;
+  if (Wire.requestFrom(0x08, (int)sizeof(PumpReport)) != sizeof(PumpReport)) return false;
+  Wire.readBytes((uint8_t *)&report, sizeof(PumpReport));
+  return true;
+}
+
+// Pull the Mega's metrics block; "metrics:<offset>" selects each frame, offset 0 snapshots
+bool readMegaMetrics(MegaMetrics::Block &block) {
+  char cmd[16];
+  for (uint16_t off = 0; off < sizeof(block); off += METRICS_FRAME_DATA) {
+    snprintf(cmd, sizeof(cmd), "metrics:%u", off);
+    if (!sendI2CMessage(cmd)) return false;
+    MetricsFrame f;
+    if (Wire.requestFrom(0x08, (int)sizeof(f)) != sizeof(f)) return false;
+    Wire.readBytes((uint8_t *)&f, sizeof(f));
+    if (!metricsFrameApply(f, MEGA_METRICS_LAYOUT, off, &block, sizeof(block))) return false;
+  }
+  return true;
+}
+
+// Relays set by a rule go through the bus manager like a Firebase change, so
+// the readback reconcile keeps them instead of restoring the old state
+void ruleSetRelays(uint16_t mask, uint16_t values) {
+  for (uint8_t id = 1; id <= RULES_MAX_RELAYS; id++) {
+    uint16_t bit = 1U << (id - 1);
+    if (!(mask & bit)) continue;
+    bool on = values & bit;
+    i2cBus.setRelay(id, on);
+    relayStateLast[id] = on;
+    rules.setInput(IN_RELAY_FIRST + id - 1, on);
+    if (app.ready() && firebaseConnected) {
+      Database.set<bool>(aClient, relayPath.format(id), on);
+    }
+    LOG_I("⚙️ Rule: relay %d %s", id, on ? "ON" : "OFF");
+  }
+  i2cBus.flush();
+}
+
+// A rule's lock/unlock becomes the door's state: the reconcile compares the
+// Mega with it, and the next lock poll reads it back from Firebase
+void ruleSetDoorLock(uint8_t door, bool locked) {
+  if (door >= doorCount) return;
+  Door &d = doors[door];
+  d.isDoorLocked = locked;
+  d.doorLockStateLast = locked;
+  if (door == 0) rules.setInput(IN_DOOR_LOCKED, locked);
+  sendDoorCommand(door, locked ? "lock" : "unlock");
+  if (app.ready() && firebaseConnected) {
+    Database.set<bool>(aClient, d.lockPath, locked);
+  }
+  LOG_I("⚙️ Rule: %s door %u", locked ? "lock" : "unlock", door);
+}
+
+// Execute a rule action locally; relay and lock changes are mirrored to Firebase when online
+void runRuleAction(uint8_t type, uint8_t arg, const char *text) {
+  RuleTarget t = ruleTarget(type, arg, text);
+  switch (t.kind) {
+    case RT_RELAYS:
+      ruleSetRelays(t.mask, t.values);
+      break;
+    case RT_DOOR:
+      ruleSetDoorLock(t.door, t.locked);
+      break;
+    default:
+      sendI2CMessage(text);
+      LOG_I("⚙️ Rule: send %s", text);
+      break;
+  }
+}
+
+void onRuleError(uint16_t lineNo, const char *msg) {
+  LOG_W("⚠️ Rule line %u rejected: %s", lineNo, msg);
+}
+
+// FNV-1a, only used to notice that the rules text changed
+uint32_t hashText(const char *text) {
+  uint32_t h = 2166136261UL;
+  while (*text) h = (h ^ (uint8_t)*text++) * 16777619UL;
+  return h;
+}
+
+void compileRules(const String &text) {
+  uint8_t rejected = rules.load(text.c_str(), onRuleError);
+  rulesHash = hashText(text.c_str());
+  LOG_I("⚙️ Rules loaded: %u active, %u rejected, %u bytes",
+        rules.count(), rejected, rules.codeBytes());
+}
+
+// Boot-time rules from flash so automations work without connectivity
+void loadRulesFromFlash() {
+  File f = LittleFS.open(RULES_FILE, "r");
+  if (!f) return;
+  compileRules(f.readString());
+  f.close();
+}
+
+// Pick up rule edits from /smart_controls/rules and cache them in flash
+void checkRulesUpdate() {
+  if (millis() - lastRulesCheck < RULES_CHECK_INTERVAL) return;
+  lastRulesCheck = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  unsigned long start = millis();
+  String text = Database.get<String>(aClient, "/smart_controls/rules");
+  if (!firebaseGetOk(start) || hashText(text.c_str()) == rulesHash) return;
+
+  compileRules(text);
+  File f = LittleFS.open(RULES_FILE, "w");
+  if (f) {
+    f.print(text);
+    f.close();
+  }
+}
+
+// Feed the clock inputs once per minute and evaluate whatever changed
+void runRules() {
+  int minuteOfDay = -1;
+  if (timeService.valid()) {
+    wallClock.update(timeService.now(millis()));
+    minuteOfDay = wallClock.secondOfDay() / 60;
+  }
+  if (minuteOfDay != lastRuleMinute) {
+    lastRuleMinute = minuteOfDay;
+    rules.setInput(IN_HOUR, minuteOfDay < 0 ? -1 : minuteOfDay / 60);
+    rules.setInput(IN_MINUTE, minuteOfDay);
+  }
+  rules.run();
+}
+
+void buildDevicePaths() {
+  snprintf(devicePath, sizeof(devicePath), "/devices/%s", nodeConfig.deviceId);
+  snprintf(configPath, sizeof(configPath), "%s/config", devicePath);
+  for (uint8_t i = 0; i < MAX_DOORS; i++) {
+    Door &d = doors[i];
+    snprintf(d.devicePath, sizeof(d.devicePath), "/devices/%s", i == 0 ? nodeConfig.deviceId : nodeConfig.backDeviceId);
+    snprintf(d.failedAttemptsPath, sizeof(d.failedAttemptsPath), "%s/failed_attempts", d.devicePath);
+    snprintf(d.lastUpdatedPath, sizeof(d.lastUpdatedPath), "%s/last_updated", d.devicePath);
+    if (i == 0) {
+      strcpy(d.lockPath, "/smart_controls/relays/door/isLocked");
+    } else {
+      snprintf(d.lockPath, sizeof(d.lockPath), "/smart_controls/relays/door_%u/isLocked", i + 1);
+    }
+    d.logPath.bindRuntime(d.devicePath, "/logs/");
+  }
+}
+
+template <typename T>
+void saveConfigBlob(const char *key, const T &cfg, uint8_t version) {
+  uint8_t blob[sizeof(ConfigHeader) + sizeof(T)];
+  size_t n = configEncode(cfg, version, blob, sizeof(blob));
+  preferences.putBytes(key, blob, n);
 }
 
+template <typename T>
+ConfigStatus loadConfigBlob(const char *key, T &cfg, uint8_t version, const T &defaults) {
+  uint8_t blob[sizeof(ConfigHeader) + 255]; // any stored length, newer versions included
+  size_t n = preferences.getBytes(key, blob, sizeof(blob));
+  ConfigStatus status = configDecode(blob, n, version, cfg, defaults);
+  if (status == CONFIG_MIGRATED) saveConfigBlob(key, cfg, version);
+  return status;
+}
+
+// Load both board configs once at boot
+void loadConfig() {
+  ConfigStatus node = loadConfigBlob("cfg_node", nodeConfig, NODE_CONFIG_VERSION, NODE_CONFIG_DEFAULTS);
+  ConfigStatus mega = loadConfigBlob("cfg_mega", megaConfig, MEGA_CONFIG_VERSION, MEGA_CONFIG_DEFAULTS);
+  nodeConfigReadOnly = node == CONFIG_NEWER;
+  megaConfigReadOnly = mega == CONFIG_NEWER;
+  if (nodeConfig.maxRelayId > MAX_RELAY_ID) nodeConfig.maxRelayId = MAX_RELAY_ID;
+  doorCount = (nodeConfig.doorCount >= 1 && nodeConfig.doorCount <= MAX_DOORS) ? nodeConfig.doorCount : 1;
+  doorScheduler.setDoorCount(doorCount);
+  buildDevicePaths();
+  LOG_I("⚙️ Config: node %s, mega %s, device %s, %u door(s)",
+        configStatusName(node), configStatusName(mega),
+        nodeConfig.deviceId, doorCount);
+}
+
+// Send the Mega's portion as short "cfg:" commands (fits the 32 byte AVR Wire buffer)
+bool pushMegaConfig() {
+  char msg[32];
+  bool ok = true;
+  snprintf(msg, sizeof(msg), "cfg:base=%u", megaConfig.relayBasePin);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:max=%u", megaConfig.maxRelays);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:low=%u", megaConfig.relayActiveLow);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:phone=%s", megaConfig.phoneNumber);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:phone2=%s", megaConfig.extraPhone[0]);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:phone3=%s", megaConfig.extraPhone[1]);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:smswin=%u", megaConfig.smsWindowS);
+  ok &= sendI2CMessage(msg);
+  snprintf(msg, sizeof(msg), "cfg:smsgap=%u", megaConfig.smsGapS);
+  ok &= sendI2CMessage(msg);
+  ok &= sendI2CMessage("cfg:save");
+  LOG_W("⚙️ Mega config %s", ok ? "pushed" : "push failed");
+  return ok;
+}
+
+// Apply /devices/<id>/config; only keys present in Firebase are changed
+void checkConfigUpdate() {
+  if (millis() - lastConfigCheck < CONFIG_CHECK_INTERVAL) return;
+  lastConfigCheck = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  unsigned long start = millis();
+  String json = Database.get<String>(aClient, configPath);
+  if (!firebaseGetOk(start) || hashText(json.c_str()) == configHash) return;
+  configHash = hashText(json.c_str());
+
+  const char *j = json.c_str();
+  long v;
+  NodeConfig node = nodeConfig;
+  if (jsonGetLong(j, "relays_check_ms", v) && v >= 200 && v <= 60000) node.relaysCheckMs = v;
+  if (jsonGetLong(j, "doorlock_check_ms", v) && v >= 200 && v <= 60000) node.doorLockCheckMs = v;
+  if (jsonGetLong(j, "max_relay_id", v) && v >= 1 && v <= MAX_RELAY_ID) node.maxRelayId = v;
+  // A new device_id / door setup takes effect after restart (streams and paths are bound at boot)
+  jsonGetString(j, "device_id", node.deviceId, sizeof(node.deviceId));
+  if (jsonGetLong(j, "door_count", v) && v >= 1 && v <= MAX_DOORS) node.doorCount = v;
+  jsonGetString(j, "back_device_id", node.backDeviceId, sizeof(node.backDeviceId));
+
+  MegaConfig mega = megaConfig;
+  if (jsonGetLong(j, "relay_base_pin", v) && v >= 2 && v <= 53) mega.relayBasePin = v;
+  if (jsonGetLong(j, "max_relays", v) && v >= 1 && v <= 16) mega.maxRelays = v;
+  bool b;
+  if (jsonGetBool(j, "relay_active_low", b)) mega.relayActiveLow = b;
+  jsonGetString(j, "phone_number", mega.phoneNumber, sizeof(mega.phoneNumber));
+  jsonGetString(j, "phone_number_2", mega.extraPhone[0], sizeof(mega.extraPhone[0]));
+  jsonGetString(j, "phone_number_3", mega.extraPhone[1], sizeof(mega.extraPhone[1]));
+  if (jsonGetLong(j, "sms_window_s", v) && v >= 0 && v <= 255) mega.smsWindowS = v;
+  if (jsonGetLong(j, "sms_gap_s", v) && v >= 0 && v <= 3600) mega.smsGapS = v;
+
+  if (memcmp(&node, &nodeConfig, sizeof(node)) != 0) {
+    nodeConfig = node;
+    if (!nodeConfigReadOnly) saveConfigBlob("cfg_node", nodeConfig, NODE_CONFIG_VERSION);
+    LOG_I("⚙️ Node config updated%s", nodeConfigReadOnly ? " (not saved: stored by newer firmware)" : "");
+  }
+  if (memcmp(&mega, &megaConfig, sizeof(mega)) != 0) {
+    megaConfig = mega;
+    if (!megaConfigReadOnly) saveConfigBlob("cfg_mega", megaConfig, MEGA_CONFIG_VERSION);
+    pushMegaConfig();
+  }
+}
+
+// Buzzer alarm pattern, played by serviceBuzzer() one step per loop pass
+StepTask buzzerTask;
+bool buzzerActive = false;
+uint8_t buzzerBeep = 0;
+
 // Simple buzzer alarm for security breach
 void buzzerAlarm() {
-  Serial.println("🚨 SECURITY BREACH ALARM! 🚨");
-  
+  LOG_W("🚨 SECURITY BREACH ALARM! 🚨");
+  STEP_RESET(buzzerTask);
+  buzzerActive = true;
+}
+
+bool buzzerStep(uint32_t now) {
+  STEP_BEGIN(buzzerTask);
   // Quick aggressive alarm pattern
-  for (int i = 0; i < 10; i++) {
+  for (buzzerBeep = 0; buzzerBeep < 10; buzzerBeep++) {
     digitalWrite(BUZZER_PIN, LOW);  // Turn on buzzer
-    delay(200);
+    STEP_WAIT_MS(buzzerTask, now, 200);
     digitalWrite(BUZZER_PIN, HIGH); // Turn off buzzer
-    delay(100);
+    STEP_WAIT_MS(buzzerTask, now, 100);
   }
-  
-  Serial.println("🔊 Security alarm complete");
+  LOG_I("🔊 Security alarm complete");
+  STEP_END(buzzerTask);
+}
+
+void serviceBuzzer() {
+  if (buzzerActive && buzzerStep(millis())) buzzerActive = false;
+}
+
+// Apply one relay value from Firebase; changes are queued per slave
+// Returns false when the event queue was full; the relay is retried on the next poll
+bool applyFetchedRelay(int id, bool state) {
+  if (id < 1 || id > nodeConfig.maxRelayId) return true;
+  if (relaysInitialized && relayStateLast[id] == state) return true;
+  if (!events.publish(EV_RELAY_CHANGED, 0, id, state)) return false;
+  relayStateLast[id] = state;
+  trace.add(TR_RELAY, 0, id * 2 + state, millis());
+  return true;
 }
 
-// Simple relay check
+// Relay check: one GET for the whole relay tree, one I2C write per slave
 void fetchRelays() {
-  if (millis() - lastRelaysCheck < RELAYS_CHECK_INTERVAL) return;
+  if (millis() - lastRelaysCheck < nodeConfig.relaysCheckMs) return;
   lastRelaysCheck = millis();
   if (!app.ready() || !firebaseConnected) return;
 
-  for (int id = 1; id <= MAX_RELAY_ID; id++) {
-    char path[50];
-    snprintf(path, sizeof(path), "/smart_controls/relays/%d/state", id);
-    
-    bool state = Database.get<bool>(aClient, path);
-    if (aClient.lastError().code() != 0) {
-      firebaseConnected = false;
-      return;
+  unsigned long start = millis();
+  String json = Database.get<String>(aClient, "/smart_controls/relays");
+  if (!firebaseGetOk(start)) return;
+
+  const char *p = json.c_str();
+  const char *value;
+  const char *valueEnd;
+  bool complete = true;
+  if (*p == '[') {
+    // All keys numeric: RTDB returns an array indexed by relay ID
+    p++;
+    for (int id = 0; jsonNextElement(p, value, valueEnd); id++) {
+      bool state;
+      if (*value == '{' && jsonGetBool(value, "state", state) && jsonFind(value, "state") < p) {
+        complete &= applyFetchedRelay(id, state);
+      }
+    }
+  } else {
+    char key[8];
+    while (jsonNextMember(p, key, sizeof(key), value, valueEnd)) {
+      int id = atoi(key);
+      bool state;
+      if (id > 0 && *value == '{' && jsonGetBool(value, "state", state) && jsonFind(value, "state") < valueEnd) {
+        complete &= applyFetchedRelay(id, state);
+      }
+    }
+  }
+
+  // Slaves are written by dispatchEvents(); the first sync only counts once every relay got through
+  if (complete) relaysInitialized = true;
+}
+
+// Re-scan for expander boards and drop/restore slaves
+void checkI2CSlaves() {
+  if (millis() - lastI2CScan < I2C_SCAN_INTERVAL) return;
+  lastI2CScan = millis();
+
+  bool before[I2C_MAX_SLAVES];
+  for (uint8_t i = 0; i < I2C_MAX_SLAVES; i++) before[i] = i2cBus.isPresent(i);
+  i2cBus.discover();
+  for (uint8_t i = 0; i < I2C_MAX_SLAVES; i++) {
+    if (before[i] != i2cBus.isPresent(i)) {
+      LOG_I("🔌 I2C slave 0x%02X %s", I2CBusManager<TwoWire>::address(i),
+            i2cBus.isPresent(i) ? "online" : "offline");
+    }
+  }
+  i2cBus.flush(); // deliver anything queued for a slave that just came back
+}
+
+// Read back every slave and re-push only what diverged (or everything after a reboot)
+void reconcileSlaves() {
+  if (millis() - lastReconcile < RECONCILE_INTERVAL) return;
+  lastReconcile = millis();
+
+  for (uint8_t slot = 0; slot < I2C_MAX_SLAVES; slot++) {
+    if (!i2cBus.isPresent(slot)) continue;
+    SlaveStatus st;
+    if (!i2cBus.readStatus(slot, st)) continue;
+
+    uint32_t repairedBefore = i2cBus.stats(slot).repairedBits;
+    bool rebooted = i2cBus.reconcile(slot, st);
+    if (rebooted) {
+      LOG_I("♻️ I2C slave 0x%02X rebooted (boot #%u) - resending state",
+            I2CBusManager<TwoWire>::address(slot), st.bootCount);
+      if (slot == 0) {
+        // Non-relay state on the main Mega is lost with a reboot too
+        for (uint8_t i = 0; i < doorCount; i++) sendDoorCommand(i, doors[i].isDoorLocked ? "lock" : "unlock");
+        sendI2CMessage(lastFloatState ? "waterpresent" : "waterempty");
+      }
+      divergedSinceMs[slot] = millis();
+    } else if (i2cBus.stats(slot).repairedBits != repairedBefore) {
+      if (!divergedSinceMs[slot]) divergedSinceMs[slot] = millis();
+    } else if (divergedSinceMs[slot]) {
+      LOG_I("♻️ I2C slave 0x%02X converged in %lu ms",
+            I2CBusManager<TwoWire>::address(slot), millis() - divergedSinceMs[slot]);
+      divergedSinceMs[slot] = 0;
     }
 
-    if (!relaysInitialized || relayStateLast[id] != state) {
-      char msg[8];
-      snprintf(msg, sizeof(msg), "%d:%d", id, state ? 1 : 0);
-      sendI2CMessage(msg);
-      relayStateLast[id] = state;
+    if (slot == 0 && !rebooted) {
+      for (uint8_t i = 0; i < doorCount; i++) {
+        bool megaLocked = st.flags & DOOR_LOCK_FLAGS[i];
+        if (megaLocked != doors[i].isDoorLocked) sendDoorCommand(i, doors[i].isDoorLocked ? "lock" : "unlock");
+      }
+      bool megaTankEmpty = st.flags & SLAVE_FLAG_TANK_EMPTY;
+      if (megaTankEmpty == lastFloatState) sendI2CMessage(lastFloatState ? "waterpresent" : "waterempty");
     }
   }
-  relaysInitialized = true;
+  i2cBus.flush();
 }
 
-// Simple door lock check
-void fetchDoorLock() {
-  if (millis() - lastDoorLockCheck < DOORLOCK_CHECK_INTERVAL) return;
-  lastDoorLockCheck = millis();
+// Per-slave transaction/error counters
+void reportI2CStats() {
+  if (millis() - lastI2CStatsReport < I2C_STATS_INTERVAL) return;
+  lastI2CStatsReport = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  char json[96 * I2C_MAX_SLAVES + 4];
+  size_t n = snprintf(json, sizeof(json), "{");
+  for (uint8_t i = 0; i < I2C_MAX_SLAVES; i++) {
+    const I2CSlaveStats &st = i2cBus.stats(i);
+    n += snprintf(json + n, sizeof(json) - n, "%s\"0x%02X\":{\"present\":%s,\"tx\":%lu,\"fail\":%lu,\"err_pct\":%u,\"reboots\":%u,\"repaired\":%lu}",
+                  i ? "," : "", I2CBusManager<TwoWire>::address(i), st.present ? "true" : "false",
+                  (unsigned long)st.transactions, (unsigned long)st.failures, i2cBus.errorRate(i),
+                  st.reboots, (unsigned long)st.repairedBits);
+  }
+  snprintf(json + n, sizeof(json) - n, "}");
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s/i2c", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+}
+
+// Sensor link round-trip time and error counters, per door
+void reportFingerprintStats() {
+  for (uint8_t i = 0; i < doorCount; i++) doors[i].link.poll();
+  if (millis() - lastFingerprintStatsReport < FINGERPRINT_STATS_INTERVAL) return;
+  lastFingerprintStatsReport = millis();
   if (!app.ready() || !firebaseConnected) return;
 
-  bool value = Database.get<bool>(aClient, "/smart_controls/relays/door/isLocked");
-  if (aClient.lastError().code() == 0) {
-    isDoorLocked = value;
-    if (doorLockStateLast != value) {
-      sendI2CMessage(value ? "lock" : "unlock");
-      doorLockStateLast = value;
+  for (uint8_t i = 0; i < doorCount; i++) {
+    Door &d = doors[i];
+    const FingerprintLinkStats &st = d.link.stats();
+    char json[256];
+    snprintf(json, sizeof(json),
+             "{\"backend\":\"%s\",\"commands\":%lu,\"replies\":%lu,\"bad\":%lu,\"timeouts\":%lu,"
+             "\"err_pct\":%u,\"rtt_avg_us\":%lu,\"rtt_max_us\":%lu}",
+             d.link.backendName(), (unsigned long)st.commands, (unsigned long)st.replies,
+             (unsigned long)st.badPackets, (unsigned long)st.timeouts, d.link.errorRate(),
+             (unsigned long)d.link.averageRttUs(), (unsigned long)st.rttMaxUs);
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/fingerprint_link", d.devicePath);
+    Database.set<object_t>(aClient, path, object_t(json));
+
+    // Finger-to-unlock latency and worst case per background stage
+    size_t n = snprintf(json, sizeof(json), "{\"match_us\":%lu,\"unlock_us\":%lu,\"unlock_max_us\":%lu,\"dropped\":%lu",
+                        (unsigned long)d.timing.matchUs, (unsigned long)d.timing.unlockUs,
+                        (unsigned long)d.timing.unlockMaxUs, (unsigned long)accessPipeline.dropped());
+    for (uint8_t s = 0; s < STAGE_COUNT; s++) {
+      n += snprintf(json + n, sizeof(json) - n, ",\"%s_max_us\":%lu", STAGE_NAMES[s], (unsigned long)d.timing.stageMaxUs[s]);
     }
-  } else {
-    firebaseConnected = false;
+    snprintf(json + n, sizeof(json) - n, "}");
+    snprintf(path, sizeof(path), "%s/access_timing", d.devicePath);
+    Database.set<object_t>(aClient, path, object_t(json));
   }
 }
 
-// Check failed attempts from Firebase (allows remote reset)
-void checkFailedAttempts() {
-  if (millis() - lastFailedAttemptsCheck < FAILED_ATTEMPTS_CHECK_INTERVAL) return;
-  lastFailedAttemptsCheck = millis();
-  
+// Sample heap and stack; low-water marks go to <devicePath>/memory
+void watchMemory() {
+  if (millis() - lastMemSample < MEM_SAMPLE_INTERVAL) return;
+  lastMemSample = millis();
+  MemorySample m = {ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getFreeContStack()};
+  memWatch.sample(m);
+  metrics.set(NG_HEAP_FREE, m.freeHeap);
+  metrics.set(NG_MAX_BLOCK, m.maxBlock);
+  if (!heapWarned && m.freeHeap < HEAP_WARN_BYTES) {
+    heapWarned = true;
+    LOG_W("⚠️ Free heap down to %lu bytes (largest block %lu)", (unsigned long)m.freeHeap, (unsigned long)m.maxBlock);
+  }
+
+  if (millis() - lastMemReport < MEM_REPORT_INTERVAL) return;
+  lastMemReport = millis();
   if (!app.ready() || !firebaseConnected) return;
-  
-  int firebaseFailedAttempts = Database.get<int>(aClient, "/devices/fingerprint_door_001/failed_attempts");
-  if (aClient.lastError().code() == 0) {
-    // If Firebase value is different from local, sync
-    if (currentFailedAttempts != firebaseFailedAttempts) {
-      Serial.printf("🔄 Syncing failed attempts: Local=%d → Firebase=%d\n", 
-                    currentFailedAttempts, firebaseFailedAttempts);
-      currentFailedAttempts = firebaseFailedAttempts;
-      
-      // Update system lock status
-      bool wasLocked = systemLocked;
-      systemLocked = (currentFailedAttempts >= MAX_FAILED_ATTEMPTS);
-      
-      if (wasLocked && !systemLocked) {
-        Serial.println("🔓 SYSTEM UNLOCKED - Failed attempts reset remotely");
-      } else if (!wasLocked && systemLocked) {
-        Serial.println("🔒 SYSTEM LOCKED - Failed attempts updated from Firebase");
-      }
+
+  const MemorySample &low = memWatch.lowest();
+  char json[192];
+  snprintf(json, sizeof(json),
+           "{\"heap\":%lu,\"heap_min\":%lu,\"max_block\":%lu,\"max_block_min\":%lu,"
+           "\"frag_pct\":%u,\"stack_free_min\":%lu}",
+           (unsigned long)m.freeHeap, (unsigned long)low.freeHeap, (unsigned long)m.maxBlock,
+           (unsigned long)low.maxBlock, ESP.getHeapFragmentation(), (unsigned long)low.freeStack);
+  char path[56];
+  snprintf(path, sizeof(path), "%s/memory", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+}
+
+// Move queued log lines to the sink without blocking
+void drainLog() {
+#if LOG_SINK == LOG_SINK_SERIAL1
+  shLog.drain(Serial1);
+#else
+  if (millis() - lastLogTailReport < LOG_TAIL_INTERVAL) return;
+  lastLogTailReport = millis();
+  if (!app.ready() || !firebaseConnected || shLog.written() == logTailLines) return;
+  logTailLines = shLog.written();
+
+  char tail[LOG_RING_SIZE + 1];
+  shLog.copyTail(tail, sizeof(tail));
+  char path[64];
+  snprintf(path, sizeof(path), "%s/log_tail", devicePath);
+  Database.set<String>(aClient, path, tail);
+#endif
+}
+
+// Blocking drain for setup(), where nothing else is waiting
+void logFlush() {
+#if LOG_SINK == LOG_SINK_SERIAL1
+  while (shLog.used()) shLog.drain(Serial1);
+#endif
+}
+
+// Seconds since boot, immune to millis() wraparound
+uint32_t uptimeSeconds() {
+  return (uint32_t)(timeService.monotonicMs(millis()) / 1000);
+}
+
+// Lockout state survives soft resets in RTC memory and power cycles in flash
+struct LockoutRtcRecord {
+  uint32_t magic;
+  LockoutSnapshot snap;
+};
+
+void saveLockoutState(uint8_t door) {
+  LockoutRtcRecord rec;
+  rec.magic = LOCKOUT_RTC_MAGIC;
+  rec.snap = doors[door].lockout.snapshot(uptimeSeconds());
+  uint32_t offset = LOCKOUT_RTC_OFFSET + door * ((sizeof(rec) + 3) / 4);
+  ESP.rtcUserMemoryWrite(offset, (uint32_t *)&rec, sizeof(rec));
+  preferences.putBytes(LOCKOUT_KEYS[door], &rec.snap, sizeof(rec.snap));
+}
+
+void restoreLockoutState(uint8_t door) {
+  Door &d = doors[door];
+  LockoutRtcRecord rec;
+  uint32_t offset = LOCKOUT_RTC_OFFSET + door * ((sizeof(rec) + 3) / 4);
+  bool found = ESP.rtcUserMemoryRead(offset, (uint32_t *)&rec, sizeof(rec)) &&
+               rec.magic == LOCKOUT_RTC_MAGIC;
+  if (!found) {
+    found = preferences.getBytes(LOCKOUT_KEYS[door], &rec.snap, sizeof(rec.snap)) == sizeof(rec.snap);
+  }
+  if (!found) return;
+
+  d.lockout.restore(rec.snap, uptimeSeconds());
+  d.systemLocked = d.lockout.isLocked();
+  LOG_I("🔐 Door %u: restored lockout state: %d failures, level %d, %lu s locked", door,
+        d.lockout.failures(), d.lockout.level(), (unsigned long)d.lockout.remainingS(uptimeSeconds()));
+}
+
+void pushFailedAttempts(uint8_t door) {
+  Door &d = doors[door];
+  if (app.ready() && firebaseConnected) {
+    Database.set<int>(aClient, d.failedAttemptsPath, d.lockout.failures());
+    d.remoteFailures = d.lockout.failures();
+  }
+}
+
+// Remote override of a door's failed_attempts (SSE for door 0, polled for the others)
+void applyRemoteFailedAttempts(uint8_t door, int remote) {
+  Door &d = doors[door];
+  bool changed = (remote != d.remoteFailures);
+  d.remoteFailures = remote;
+  if (changed) trace.add(TR_FAILED_ATTEMPTS, door, remote, millis());
+  if (!changed || remote < 0 || remote == d.lockout.failures()) return; // our own write echoing back
+
+  LOG_I("🔄 Door %u: remote failed attempts override: %d → %d", door, d.lockout.failures(), remote);
+  bool wasLocked = d.systemLocked;
+  d.lockout.setFailures(remote > 255 ? 255 : remote, uptimeSeconds());
+  d.systemLocked = d.lockout.isLocked();
+  if (door == 0) rules.setInput(IN_FAILED, d.lockout.failures());
+  saveLockoutState(door);
+
+  if (wasLocked && !d.systemLocked) {
+    LOG_I("🔓 Door %u UNLOCKED - Failed attempts reset remotely", door);
+  } else if (!wasLocked && d.systemLocked) {
+    LOG_I("🔒 Door %u LOCKED - Failed attempts updated from Firebase", door);
+  }
+}
+
+// Door 0's failed_attempts edited in Firebase is pushed to us over SSE
+void onFailedAttemptsStream(AsyncResult &aResult) {
+  if (!aResult.available()) return;
+  RealtimeDatabaseResult &stream = aResult.to<RealtimeDatabaseResult>();
+  if (!stream.isStream() || stream.type() == realtime_database_data_type_null) return;
+  applyRemoteFailedAttempts(0, stream.to<int>());
+}
+
+// One TLS stream is all the heap allows, so only door 0 streams
+void startFailedAttemptsStream() {
+  if (failedAttemptsStreamStarted || !app.ready()) return;
+  streamClient.setSSEFilters("put,patch,cancel,auth_revoked");
+  Database.get(streamClient, doors[0].failedAttemptsPath,
+               onFailedAttemptsStream, true /* SSE */, "failedAttemptsStream");
+  failedAttemptsStreamStarted = true;
+}
+
+// SNTP callback (settimeofday), picked up by serviceTime() in the loop
+void onTimeSync() {
+  timeSyncPending = true;
+}
+
+// Starts SNTP without waiting for an answer; also sets the timezone
+void requestTimeSync() {
+  configTime(TIME_UTC_OFFSET_S, 0, "pool.ntp.org", "time.nist.gov");
+}
+
+// Resume the wall clock after a soft reset (RTC memory does not survive power loss)
+void restoreTime() {
+  TimeRtcRecord rec;
+  if (ESP.rtcUserMemoryRead(TIME_RTC_OFFSET, (uint32_t *)&rec, sizeof(rec)) && timeService.restore(rec)) {
+    LOG_I("⏰ Time restored from RTC memory (estimated until next sync)");
+  }
+}
+
+// Apply sync results, schedule SNTP requests and keep the RTC copy fresh
+void serviceTime() {
+  unsigned long now = millis();
+  if (timeSyncPending) {
+    timeSyncPending = false;
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    bool first = timeService.quality() != TIME_SYNCED;
+    timeService.synced((uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000, now);
+    if (first) {
+      LOG_I("⏰ Time synced, %u journaled log entries to backfill", journalCount);
+    } else {
+      LOG_D("⏰ Time resynced, drift %d ppm", timeService.driftPpm());
+    }
+  }
+
+  if (wifiConnected && timeService.shouldRequestSync(now)) requestTimeSync();
+
+  if (timeService.valid() && now - lastTimeSave >= TIME_SAVE_INTERVAL) {
+    lastTimeSave = now;
+    TimeRtcRecord rec = timeService.save(now);
+    ESP.rtcUserMemoryWrite(TIME_RTC_OFFSET, (uint32_t *)&rec, sizeof(rec));
+  }
+}
+
+// Door lock check, one door per call: each door keeps its poll period,
+// but a loop pass never does more than one door's GETs
+void fetchDoorLock() {
+  if (millis() - lastDoorLockCheck < nodeConfig.doorLockCheckMs / doorCount) return;
+  lastDoorLockCheck = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  uint8_t i = nextLockPollDoor;
+  nextLockPollDoor = (nextLockPollDoor + 1) % doorCount;
+  Door &d = doors[i];
+  // A scan changed this door and its isLocked write is still queued: the
+  // value in Firebase is the old one, applying it would undo the scan
+  if (accessPipeline.lockWritePending(i)) return;
+
+  unsigned long start = millis();
+  bool value = Database.get<bool>(aClient, d.lockPath);
+  if (!firebaseGetOk(start)) return;
+  d.isDoorLocked = value;
+  if (i == 0) rules.setInput(IN_DOOR_LOCKED, value);
+  if (d.doorLockStateLast != value) {
+    trace.add(TR_DOOR_LOCK, i, value, millis());
+    sendDoorCommand(i, value ? "lock" : "unlock");
+    d.doorLockStateLast = value;
+  }
+
+  // Doors without an SSE stream pick up remote failed_attempts edits here
+  if (i > 0) {
+    start = millis();
+    String remote = Database.get<String>(aClient, d.failedAttemptsPath);
+    if (firebaseGetOk(start) && remote.length() && isDigit(remote[0])) {
+      applyRemoteFailedAttempts(i, remote.toInt());
     }
   }
 }
 
-// Get fingerprint user name from preferences
-String getFingerprintUserName(int id) {
-  String key = "fp_" + String(id);
+// Expire lockouts on time; no polling of Firebase needed
+void checkLockout() {
+  for (uint8_t i = 0; i < doorCount; i++) {
+    Door &d = doors[i];
+    if (!d.lockout.tick(uptimeSeconds())) continue;
+    d.systemLocked = false;
+    if (i == 0) rules.setInput(IN_FAILED, 0);
+    saveLockoutState(i);
+    pushFailedAttempts(i);
+    LOG_I("🔓 Door %u UNLOCKED - Lockout period expired", i);
+  }
+}
+
+// Get fingerprint user name from preferences ("fp_<id>" for door 0, "fp<door>_<id>" otherwise:
+// template IDs are per sensor)
+String getFingerprintUserName(uint8_t door, int id) {
+  String key = (door == 0 ? String("fp_") : "fp" + String(door) + "_") + String(id);
   String name = preferences.getString(key.c_str(), "Unknown");
   return name;
 }
 
-// Create timestamped log entry in Firebase
-void logFingerprintAccess(bool success, String userName) {
-  if (!app.ready() || !firebaseConnected) return;
-  
-  time_t now = time(nullptr);
-  struct tm* timeinfo = localtime(&now);
-  
-  // Check if we have valid time from NTP
-  if (now < 1000000000) { // If time is not properly set (before year 2001)
-    // Fallback to simple incrementing counter with system date
-    static int logCounter = 0;
-    logCounter++;
-    
-    char statusPath[100];
-    char userPath[100];
-    char systemDate[12] = "system";
-    char timeKey[20];
-    snprintf(timeKey, sizeof(timeKey), "entry_%d", logCounter);
-    
-    // Create individual property paths
-    snprintf(statusPath, sizeof(statusPath), "/devices/fingerprint_door_001/logs/%s/%s/status", systemDate, timeKey);
-    snprintf(userPath, sizeof(userPath), "/devices/fingerprint_door_001/logs/%s/%s/user", systemDate, timeKey);
-    
-    // Write status and user as separate properties
-    Database.set<String>(aClient, statusPath, success ? "success" : "failed");
-    Database.set<String>(aClient, userPath, userName);
-    
-    // Update last_updated with basic timestamp
-    Database.set<String>(aClient, "/devices/fingerprint_door_001/last_updated", "system_time_unavailable");
-    
-    Serial.printf("📝 Logged fingerprint access (counter %d): %s - %s\n", 
-                  logCounter, success ? "SUCCESS" : "FAILED", userName.c_str());
-    return;
-  }
+// Create timestamped log entry in Firebase; epoch comes from timeService
+void logFingerprintAccess(uint8_t door, bool success, const char *userName, uint32_t epoch) {
+  Door &d = doors[door];
   
-  // Format date as YYYY-MM-DD (matching your database structure)
-  char dateStr[12];
-  strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", timeinfo);
-  
-  // Format time as HH:MM:SS (matching your database structure)
-  char timeStr[10];
-  strftime(timeStr, sizeof(timeStr), "%H:%M:%S", timeinfo);
-  
-  // Create log entry paths - follows exact structure from your JSON
-  char statusPath[120];
-  char userPath[120];
-  
-  snprintf(statusPath, sizeof(statusPath), "/devices/fingerprint_door_001/logs/%s/%s/status", dateStr, timeStr);
-  snprintf(userPath, sizeof(userPath), "/devices/fingerprint_door_001/logs/%s/%s/user", dateStr, timeStr);
+  // Date YYYY-MM-DD and time HH:MM:SS (matching your database structure),
+  // recomputed only when the second changes
+  wallClock.update(epoch);
   
   // Write status and user as separate properties (matching your JSON structure)
-  Database.set<String>(aClient, statusPath, success ? "success" : "failed");
-  Database.set<String>(aClient, userPath, userName);
+  Database.set<String>(aClient, d.logPath.format(wallClock.date(), wallClock.time(), "status"), success ? "success" : "failed");
+  Database.set<String>(aClient, d.logPath.leaf("user"), userName);
   
   // Update last_updated timestamp (matching format: "2025-09-15 01:35:31")
-  char lastUpdatedStr[20];
-  snprintf(lastUpdatedStr, sizeof(lastUpdatedStr), "%s %s", dateStr, timeStr);
-  Database.set<String>(aClient, "/devices/fingerprint_door_001/last_updated", lastUpdatedStr);
+  Database.set<String>(aClient, d.lastUpdatedPath, wallClock.stamp());
   
-  Serial.printf("📝 Logged fingerprint access: %s - %s (%s)\n", 
-                success ? "SUCCESS" : "FAILED", userName.c_str(), lastUpdatedStr);
+  LOG_I("📝 Door %u: logged fingerprint access: %s - %s (%s)", door,
+        success ? "SUCCESS" : "FAILED", userName, wallClock.stamp());
+}
+
+// Log now if possible, otherwise keep the entry until time and Firebase are available
+void logOrJournalAccess(const AccessJob &job) {
+  if (journalCount == 0 && timeService.valid() && app.ready() && firebaseConnected) {
+    logFingerprintAccess(job.door, job.granted, job.user, timeService.epochAt(job.atMs));
+    return;
+  }
+  if (journalCount == JOURNAL_SIZE) {
+    journalDropped++;
+    LOG_W("⚠️ Access journal full, entry dropped (%lu total)", (unsigned long)journalDropped);
+    return;
+  }
+  JournalEntry &e = journal[(journalHead + journalCount) % JOURNAL_SIZE];
+  e.door = job.door;
+  e.granted = job.granted;
+  e.atMs = job.atMs;
+  strcpy(e.user, job.user);
+  journalCount++;
+}
+
+// Backfill one journaled entry per loop pass, with the timestamp it would have had
+void flushAccessJournal() {
+  if (journalCount == 0 || !timeService.valid() || !app.ready() || !firebaseConnected) return;
+  JournalEntry &e = journal[journalHead];
+  logFingerprintAccess(e.door, e.granted, e.user, timeService.epochAt(e.atMs));
+  journalHead = (journalHead + 1) % JOURNAL_SIZE;
+  journalCount--;
+}
+
+// Local history record; the epoch stays 0 if the wall clock is not known yet
+void recordAccessHistory(const AccessJob &job) {
+  if (!historyReady) return;
+  uint32_t epoch = timeService.valid() ? timeService.epochAt(job.atMs) : 0;
+  if (!history.add(job.door, job.granted, job.fingerId, epoch)) LOG_W("⚠️ Access history write failed");
+}
+
+// Queued by onAccessBookkeeping(); atUs is the match time carried by the event
+void queueAccessJob(uint8_t door, bool granted, bool doorChanged, uint16_t fingerId, uint32_t atUs) {
+  uint64_t atMs = timeService.monotonicMs(millis()) - (micros() - atUs) / 1000;
+  accessPipeline.queue(door, granted, doorChanged, fingerId, atMs);
+}
+
+void runAccessStage(uint8_t stage, AccessJob &job) {
+  Door &d = doors[job.door];
+  switch (stage) {
+    case STAGE_DOOR_STATE:
+      if (job.doorChanged && app.ready() && firebaseConnected) {
+        Database.set<bool>(aClient, d.lockPath, !job.granted);
+      }
+      break;
+    case STAGE_PERSIST:
+      saveLockoutState(job.door);
+      break;
+    case STAGE_COUNTER:
+      pushFailedAttempts(job.door);
+      break;
+    case STAGE_NAME:
+      if (job.granted) {
+        getFingerprintUserName(job.door, job.fingerId).toCharArray(job.user, sizeof(job.user));
+        LOG_I("👤 Door %u user: %s", job.door, job.user);
+      }
+      break;
+    case STAGE_HISTORY:
+      recordAccessHistory(job);
+      break;
+    case STAGE_LOG:
+      logOrJournalAccess(job);
+      break;
+  }
+}
+
+// Run the next stage of the oldest access job
+void runAccessPipeline() {
+  AccessStep step;
+  if (!accessPipeline.step(step)) return;
+  Door &d = doors[step.door];
+  if (step.us > d.timing.stageMaxUs[step.stage]) d.timing.stageMaxUs[step.stage] = step.us;
+  LOG_D("⏱️ stage %s: %lu us", STAGE_NAMES[step.stage], (unsigned long)step.us);
+}
+
+bool hasTouchLine(uint8_t door) {
+  return FP_TOUCH_PIN >= 0 && door == 0;
 }
 
-// Simple fingerprint scan with failed attempts tracking and logging
-uint8_t getFingerprintID() {
-  uint8_t p = finger.getImage();
+// Sensor with a touch line: read it only while a finger is (or just was) on
+// it. The first read after a touch edge is the wake latency sample.
+bool touchPending() {
+  uint32_t edge = touchEdgeUs;
+  if (edge) {
+    touchEdgeUs = 0;
+    touchAtUs = edge;
+    idleGovernor.wakeLatency((micros() - edge) / 1000);
+    lastTouchMs = millis();
+  }
+  if (digitalRead(FP_TOUCH_PIN) == FP_TOUCH_ACTIVE) lastTouchMs = millis();
+  return millis() - lastTouchMs < FP_TOUCH_HOLD_MS;
+}
+
+// Fingerprint scan: match, actuate, queue the rest
+uint8_t getFingerprintID(uint8_t door) {
+  Door &d = doors[door];
+  uint8_t p = d.finger.getImage();
   if (p != FINGERPRINT_OK) return p;
 
-  p = finger.image2Tz();
+  uint32_t capturedAt = micros();
+  p = d.finger.image2Tz();
   if (p != FINGERPRINT_OK) return p;
 
-  p = finger.fingerFastSearch();
+  p = d.finger.fingerFastSearch();
+  d.timing.matchUs = micros() - capturedAt;
+  trace.add(TR_FINGER, door, (p == FINGERPRINT_OK ? d.finger.fingerID << 8 : 0) | p, millis());
   if (p == FINGERPRINT_OK) {
-    Serial.println("✅ ACCESS GRANTED!");
-    Serial.printf("ID: %d, Confidence: %d\n", finger.fingerID, finger.confidence);
-    
-    // Get user name from preferences
-    String userName = getFingerprintUserName(finger.fingerID);
-    Serial.printf("👤 User: %s\n", userName.c_str());
-    
-    // Log successful access
-    logFingerprintAccess(true, userName);
-    
-    // Reset failed attempts on successful access
-    currentFailedAttempts = 0;
-    systemLocked = false;
-    
-    // Update failed attempts in Firebase
-    if (app.ready() && firebaseConnected) {
-      Database.set<int>(aClient, "/devices/fingerprint_door_001/failed_attempts", 0);
+    // Unlock door first
+    sendDoorCommand(door, "unlock");
+    d.timing.unlockUs = micros() - capturedAt;
+    if (d.timing.unlockUs > d.timing.unlockMaxUs) d.timing.unlockMaxUs = d.timing.unlockUs;
+    if (touchAtUs && hasTouchLine(door)) {
+      uint32_t us = micros() - touchAtUs;
+      if (us > touchUnlockMaxUs) touchUnlockMaxUs = us;
+      touchAtUs = 0;
     }
+    d.isDoorLocked = false;
     
-    // Unlock door
-    sendI2CMessage("unlock");
-    isDoorLocked = false;
+    // Reset failed attempts and backoff on successful access (RAM only, persisted later)
+    d.lockout.recordSuccess(uptimeSeconds());
+    d.systemLocked = false;
     
-    // Update Firebase door state
-    if (app.ready() && firebaseConnected) {
-      Database.set<bool>(aClient, "/smart_controls/relays/door/isLocked", false);
+    LOG_I("✅ Door %u: ACCESS GRANTED! (%lu ms to unlock)", door, (unsigned long)(d.timing.unlockUs / 1000));
+    LOG_D("ID: %d, Confidence: %d", d.finger.fingerID, d.finger.confidence);
+    metrics.inc(NC_ACCESS_GRANTED);
+    // isLocked in Firebase is stale until the job's door stage has run
+    accessPipeline.lockChanged(door);
+    if (!events.publish(EV_ACCESS_GRANTED, door, d.finger.fingerID, 1, capturedAt + d.timing.matchUs)) {
+      accessPipeline.countDropped();
+      accessPipeline.lockChangeLost(door);
     }
   } else if (p == FINGERPRINT_NOTFOUND) {
-    Serial.println("❌ ACCESS DENIED");
-    
-    // Log failed access attempt
-    logFingerprintAccess(false, "unknown");
+    // Count the failure; the policy decides whether this starts a lockout
+    bool lockoutStarted = d.lockout.recordFailure(uptimeSeconds());
+    metrics.inc(NC_ACCESS_DENIED);
     
-    // Increment failed attempts
-    currentFailedAttempts++;
-    Serial.printf("🚨 Failed attempt: %d/%d\n", currentFailedAttempts, MAX_FAILED_ATTEMPTS);
+    if (lockoutStarted) {
+      d.systemLocked = true;
+      metrics.inc(NC_LOCKOUTS);
+      
+      // Lock the door (the SMS alert and the alarm follow through the event bus)
+      sendDoorCommand(door, "lock");
+      accessPipeline.lockChanged(door);
+    }
     
-    // Update failed attempts in Firebase
-    if (app.ready() && firebaseConnected) {
-      Database.set<int>(aClient, "/devices/fingerprint_door_001/failed_attempts", currentFailedAttempts);
+    LOG_W("❌ Door %u: ACCESS DENIED", door);
+    LOG_W("🚨 Failed attempt: %d (backoff level %d)", d.lockout.failures(), d.lockout.level());
+    if (!events.publish(EV_ACCESS_DENIED, door, 0, lockoutStarted, capturedAt + d.timing.matchUs)) {
+      accessPipeline.countDropped();
+      if (lockoutStarted) accessPipeline.lockChangeLost(door);
     }
     
-    // Check if system should be locked
-    if (currentFailedAttempts >= MAX_FAILED_ATTEMPTS) {
-      systemLocked = true;
-      Serial.println("🔒 SYSTEM LOCKED - Too many failed attempts!");
-      
-      // Sound alarm
-      buzzerAlarm();
-      
-      // Send alert to mega slave for SMS notification
-      sendI2CMessage("alert");
-      
-      // Lock the door
-      sendI2CMessage("lock");
-      
-      // Update Firebase door state to locked
-      if (app.ready() && firebaseConnected) {
-        Database.set<bool>(aClient, "/smart_controls/relays/door/isLocked", true);
-      }
+    if (lockoutStarted) {
+      LOG_I("🔒 Door %u LOCKED for %lu s - Too many failed attempts!", door,
+            (unsigned long)d.lockout.remainingS(uptimeSeconds()));
     }
   }
   return p;
 }
 
-// Simple WiFi setup
-void setupWiFi() {
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  Serial.print("Connecting WiFi");
-  
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println(" OK");
+DoorScanState doorScanState(uint8_t door) {
+  return {doors[door].isDoorLocked, doors[door].systemLocked, hasTouchLine(door)};
+}
+
+bool doorTouched(uint8_t door) {
+  return hasTouchLine(door) && touchPending();
+}
+
+// Round-robin sensor polling (DoorScheduler): one reader per loop pass, so
+// the loop time does not grow with the number of doors
+void scanNextDoor() {
+  uint8_t i;
+  DoorScanAction action = doorScheduler.next(i);
+  Door &d = doors[i];
+  if (action == SCAN_READ) {
+    getFingerprintID(i);
+  } else if (action == SCAN_LOCKOUT && millis() - d.lastLockoutMessage > 10000) {
+    // Show lockout message periodically
+    LOG_I("🔒 Door %u LOCKED - %lu s left (or reset failed_attempts in Firebase)", i,
+          (unsigned long)d.lockout.remainingS(uptimeSeconds()));
+    d.lastLockoutMessage = millis();
+  }
+}
+
+// Start WiFi without waiting; checkConnection() picks up the result and
+// the SDK keeps reconnecting on its own
+void setupWiFi() {
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  LOG_I("Connecting WiFi");
+}
+
+// Simple connection check
+void checkConnection() {
+  if (WiFi.status() == WL_CONNECTED) {
+    if (!wifiConnected) LOG_I("WiFi OK");
     wifiConnected = true;
+    if (app.ready() && firebaseHealth.mayConnect(millis())) {
+      firebaseConnected = true;
+    }
   } else {
-    Serial.println(" FAILED");
+    if (wifiConnected) {
+      LOG_W("WiFi lost");
+      metrics.inc(NC_WIFI_LOST);
+    }
     wifiConnected = false;
+    firebaseConnected = false;
   }
 }
 
-// Water level monitoring
+// Water level monitoring (edges come from floatPinISR, debounced here)
 void checkWaterLevel() {
-  if (millis() - lastFloatRead < FLOAT_READ_INTERVAL) return;
-  lastFloatRead = millis();
+  floatDebouncer.update(millis());
+  bool state = floatDebouncer.state();
   
-  bool state = (digitalRead(FLOAT_PIN) == LOW); // LOW = water present (closed switch)
+  // Only act when debounced state changes; a full event queue retries next pass
+  if (state == lastFloatState) return;
+  if (!events.publish(EV_WATER_CHANGED, 0, 0, state)) return;
+  lastFloatState = state;
+  trace.add(TR_FLOAT, 0, state, millis());
+  if (state) {
+    LOG_I("💧 WATER PRESENT");
+  } else {
+    LOG_W("🚨 WATER EMPTY");
+  }
+}
+
+// Event subscribers (table: EVENT_SUBS)
+void onRelayToSlave(const Event &e) {
+  i2cBus.setRelay(e.id, e.value); // sent by the flush in dispatchEvents()
+}
+
+void onWaterToSlave(const Event &e) {
+  sendI2CMessage(e.value ? "waterpresent" : "waterempty");
+}
+
+// Lockout just started: SMS alert from the Mega and the local alarm
+void onLockoutAlarm(const Event &e) {
+  if (!e.value) return;
+  sendDoorCommand(e.source, "alert");
+  buzzerAlarm();
+}
+
+void onAccessRules(const Event &e) {
+  if (e.source != 0) return; // rules follow door 0
+  if (e.type == EV_ACCESS_GRANTED) rules.setInput(IN_DOOR_LOCKED, 0);
+  rules.setInput(IN_FAILED, doors[0].lockout.failures());
+}
+
+void onWaterRules(const Event &e) {
+  rules.setInput(IN_FLOAT, e.value);
+}
+
+void onRelayRules(const Event &e) {
+  if (e.id <= RULES_MAX_RELAYS) rules.setInput(IN_RELAY_FIRST + e.id - 1, e.value);
+}
+
+// Firebase writes and the access log, one stage per pass (runAccessPipeline)
+void onAccessBookkeeping(const Event &e) {
+  bool granted = e.type == EV_ACCESS_GRANTED;
+  queueAccessJob(e.source, granted, granted || e.value, e.id, e.atUs);
+}
+
+void onWaterCloud(const Event &e) {
+  if (!app.ready() || !firebaseConnected) return;
+  bool state = e.value;
+  String status = state ? "water_present" : "water_empty";
+  String tank_status = state ? "normal" : "alert";
   
-  // Only act when state changes
-  if (state != lastFloatState) {
-    lastFloatState = state;
-    
-    // Send I2C message for water state change
-    if (state) {
-      sendI2CMessage("waterpresent");
-      Serial.println("💧 WATER PRESENT");
+  // Update water level status
+  Database.set<bool>(aClient, "/devices/water_level_001/water_level", state);
+  Database.set<String>(aClient, "/devices/water_level_001/status", status);
+  Database.set<String>(aClient, "/devices/water_level_001/tank_status", tank_status);
+  
+  LOG_I("💾 Water level updated in Firebase: %s", status.c_str());
+}
+
+// Deliver queued events, then write whatever relay changes they queued
+void dispatchEvents() {
+  if (!events.pending()) return;
+  events.dispatch(EVENT_DISPATCH_MAX);
+  i2cBus.flush();
+}
+
+// Queue depth, drops and publish -> delivery latency
+void reportEvents() {
+  if (millis() - lastEventReport < EVENT_REPORT_INTERVAL) return;
+  lastEventReport = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  const EventBusStats &st = events.stats();
+  char json[160];
+  snprintf(json, sizeof(json),
+           "{\"published\":%lu,\"dropped\":%lu,\"delivered\":%lu,\"max_depth\":%u,\"max_latency_us\":%lu}",
+           (unsigned long)st.published, (unsigned long)st.dropped, (unsigned long)st.delivered, st.maxDepth,
+           (unsigned long)st.maxLatencyUs);
+  char path[56];
+  snprintf(path, sizeof(path), "%s/events", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+  events.resetPeaks();
+}
+
+// Both boards' counters, gauges and this window's histograms as one snapshot
+void reportMetrics() {
+  if (millis() - lastMetricsReport < METRICS_REPORT_INTERVAL) return;
+  lastMetricsReport = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  metrics.set(NG_RSSI, WiFi.RSSI());
+  NodeMetrics::Block node;
+  metrics.take(node);
+  MegaMetrics::Block mega;
+  bool megaOk = i2cBus.isPresent(0) && readMegaMetrics(mega);
+
+  static char json[1280]; // too big for the 4 KB stack
+  size_t n = snprintf(json, sizeof(json), "{\"up_s\":%lu,\"window_s\":%lu,\"node\":",
+                      (unsigned long)uptimeSeconds(), METRICS_REPORT_INTERVAL / 1000);
+  size_t w = metricsJson(json + n, sizeof(json) - n - 1, node, NODE_METRIC_NAMES);
+  if (!w) {
+    LOG_W("⚠️ Metrics snapshot does not fit %u bytes", (unsigned)sizeof(json));
+    return;
+  }
+  n += w;
+  if (megaOk) {
+    size_t mark = n;
+    n += snprintf(json + n, sizeof(json) - n, ",\"mega\":");
+    w = metricsJson(json + n, sizeof(json) - n - 1, mega, MEGA_METRIC_NAMES);
+    n = w ? n + w : mark;
+  }
+  snprintf(json + n, sizeof(json) - n, "}");
+
+  char path[56];
+  snprintf(path, sizeof(path), "%s/metrics", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+}
+
+// Periodic pump counters upload
+void reportPumpStats() {
+  if (millis() - lastPumpReport < PUMP_REPORT_INTERVAL) return;
+  lastPumpReport = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  PumpReport r;
+  if (!readPumpReport(r)) {
+    LOG_W("⚠️ Pump report read failed");
+    return;
+  }
+
+  char json[200];
+  snprintf(json, sizeof(json),
+           "{\"state\":\"%s\",\"on\":%s,\"starts\":%u,\"runtime_s\":%lu,\"energy_wh\":%lu,"
+           "\"dry_faults\":%u,\"disagree_faults\":%u,\"cooldowns\":%u}",
+           PumpController::stateName(r.state), r.output ? "true" : "false", r.starts,
+           (unsigned long)r.runtimeS, (unsigned long)r.energyWh,
+           r.dryFaults, r.disagreeFaults, r.cooldowns);
+  Database.set<object_t>(aClient, "/devices/water_level_001/pump", object_t(json));
+}
+
+// Simple Firebase setup
+#ifdef BENCH_PATHS
+// Cycle counts for the old snprintf/strftime path building vs. templates + cached clock.
+// Build with -DBENCH_PATHS; results are logged once at boot.
+void benchPaths() {
+  const int N = 1000;
+  char buf[120];
+  char dateStr[12], timeStr[10];
+  time_t now = 1757871331;
+  volatile size_t sink = 0;
+
+  uint32_t t0 = ESP.getCycleCount();
+  for (int i = 0; i < N; i++) {
+    snprintf(buf, sizeof(buf), "/smart_controls/relays/%d/state", 1 + i % 8);
+    sink += buf[24];
+  }
+  uint32_t t1 = ESP.getCycleCount();
+  for (int i = 0; i < N; i++) sink += relayPath.format(1 + i % 8)[24];
+  uint32_t t2 = ESP.getCycleCount();
+  for (int i = 0; i < N; i++) {
+    time_t t = now + i;
+    struct tm *timeinfo = localtime(&t);
+    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", timeinfo);
+    strftime(timeStr, sizeof(timeStr), "%H:%M:%S", timeinfo);
+    snprintf(buf, sizeof(buf), "%s/logs/%s/%s/status", doors[0].devicePath, dateStr, timeStr);
+    sink += buf[10];
+  }
+  uint32_t t3 = ESP.getCycleCount();
+  for (int i = 0; i < N; i++) {
+    wallClock.update(now + i);
+    sink += doors[0].logPath.format(wallClock.date(), wallClock.time(), "status")[10];
+  }
+  uint32_t t4 = ESP.getCycleCount();
+
+  LOG_I("⏱️ relay path: snprintf %lu cyc, template %lu cyc",
+        (unsigned long)((t1 - t0) / N), (unsigned long)((t2 - t1) / N));
+  LOG_I("⏱️ log path:   strftime %lu cyc, cached %lu cyc",
+        (unsigned long)((t3 - t2) / N), (unsigned long)((t4 - t3) / N));
+  (void)sink;
+}
+#endif
+
+#ifdef BENCH_EVENTS
+// Event bus cost: cycles per publish + dispatch with no-op subscribers, and the
+// publish -> delivery latency of the last event of a full-queue burst.
+// Build with -DBENCH_EVENTS; results are logged once at boot.
+volatile uint32_t benchSink = 0;
+void benchHandler(const Event &e) {
+  benchSink += e.value;
+}
+constexpr EventSub BENCH_SUBS[] = {
+  {EV_RELAY_CHANGED, 200, benchHandler},
+  {EV_RELAY_CHANGED, 150, benchHandler},
+  {EV_WATER_CHANGED, 150, benchHandler},
+  {EV_RELAY_CHANGED, 50, benchHandler},
+};
+void benchEvents() {
+  const int N = 1000;
+  EventBus<4, EVENT_QUEUE_SIZE> bus(BENCH_SUBS, eventClock);
+
+  uint32_t t0 = ESP.getCycleCount();
+  for (int i = 0; i < N; i++) {
+    bus.publish(EV_RELAY_CHANGED, 0, 1 + i % 8, i & 1);
+    bus.dispatch(1);
+  }
+  uint32_t t1 = ESP.getCycleCount();
+  for (int i = 0; i < EVENT_QUEUE_SIZE + 8; i++) bus.publish(EV_RELAY_CHANGED, 0, 1 + i % 8, i & 1);
+  while (bus.pending()) bus.dispatch(EVENT_DISPATCH_MAX);
+
+  const EventBusStats &st = bus.stats();
+  LOG_I("⏱️ event: %lu cyc per event (3 subscribers)", (unsigned long)((t1 - t0) / N));
+  LOG_I("⏱️ burst of %d: %lu dropped, max depth %u, max latency %lu us", EVENT_QUEUE_SIZE + 8,
+        (unsigned long)st.dropped, st.maxDepth, (unsigned long)st.maxLatencyUs);
+}
+#endif
+
+// Over-the-air updates, requested through <devicePath>/ota:
+//   {"target":"node","url":"http://host/update.shd","size":n,"crc":"<hex>"}   block delta, scripts/make_delta.py
+//   {"target":"mega","url":"http://host/mega.signed.bin","size":n,"crc":"<hex>"}  whole image, make_delta.py --mega-info
+// size and CRC32 describe the finished image (make_delta.py prints the request; for the Mega, the
+// application without its signature trailer). The image must be signed (signing.py of the ESP8266
+// core) with the private key matching OTA_PUBLIC_KEY in secrets.h; without that key every request is
+// refused. Connecting, the response head and the body each run one bounded step per loop pass with a
+// timeout; a dropped connection or a reset resumes with an HTTP Range request. Progress and errors
+// are published to <devicePath>/ota_status.
+// A Mega image goes page by page to its I2C bootloader (MegaBootProxy, FirmwareUpdate.h), which must
+// be answering at MEGA_BOOT_ADDR; nothing here puts the Mega into it. While it runs, the sketch at
+// 0x08 is offline and the reconcile resends relays and locks once it is back. The pages are hashed
+// as the bootloader confirms them and the signature is checked before the bootloader may start the
+// image. After a NodeMCU reset the download starts over, but pages already on the Mega are skipped.
+enum OtaState : uint8_t {
+  OTA_IDLE = 0,
+  OTA_CONNECT,
+  OTA_HEADERS,       // request sent, reading the response head
+  OTA_STREAM,
+  OTA_VERIFY,        // image staged, hashing it for the signature check
+  OTA_RETRY_WAIT,
+  OTA_BOOT_WAIT,     // Mega: waiting for its bootloader to answer
+  OTA_MEGA_START     // Mega: signature good, bootloader checking and starting the image
+};
+
+struct OtaJob {
+  char url[128];
+  uint32_t size;
+  uint32_t crc;
+  OtaState state;
+  uint8_t failures;   // consecutive, reset by progress
+  uint32_t offset;    // next download byte wanted; OTA_VERIFY: next byte to hash
+  uint32_t skip;      // bytes to drop when the server ignored the Range header
+  unsigned long since;
+  uint32_t signedSize; // bytes covered by the signature
+  uint32_t sigLen;
+  bool mega;           // image for the Mega's bootloader, not this board
+  uint16_t trailerFill; // Mega: signature trailer bytes received after the image
+};
+
+// Resume point of a NodeMCU update, kept in Preferences ("ota")
+struct __attribute__((packed)) OtaProgress {
+  uint32_t crc;       // image being applied
+  FwDeltaHeader header;
+  uint16_t nextBlock;
+  uint32_t streamOffset;
+  uint32_t crcSoFar;
+};
+
+// New image is staged where UpdaterClass would put it (right below the
+// filesystem); eboot copies it over the sketch on the next boot
+struct OtaFlash {
+  uint32_t start = 0;
+
+  bool readBase(uint32_t offset, uint8_t *buf, uint16_t len) {
+    return ESP.flashRead(offset, (uint32_t *)buf, (len + 3) & ~3);
+  }
+  bool writeBlock(uint16_t index, const uint8_t *data, uint16_t len) {
+    uint32_t addr = start + (uint32_t)index * FW_BLOCK_SIZE;
+    return ESP.flashEraseSector(addr / FLASH_SECTOR_SIZE) &&
+           ESP.flashWrite(addr, (const uint32_t *)data, (len + 3) & ~3);
+  }
+};
+
+OtaJob ota = {};
+OtaFlash otaFlash;
+uint8_t *otaBuffer = nullptr;  // one delta block, only while updating
+DeltaApplier<OtaFlash> *otaDelta = nullptr;
+MegaBootProxy<TwoWire> *megaProxy = nullptr; // page buffer at otaBuffer, trailer after it
+WiFiClient ota_client;
+WiFiClientSecure ota_ssl_client;
+WiFiClient *otaStreamClient = nullptr;  // ota_client or ota_ssl_client while connected
+HttpHead otaHead;
+BearSSL::HashSHA256 otaHash;
+#ifdef OTA_PUBLIC_KEY
+BearSSL::PublicKey otaSigningKey(OTA_PUBLIC_KEY);
+#endif
+unsigned long lastOtaCheck = 0;
+const unsigned long OTA_CHECK_INTERVAL = 60000;
+const unsigned long OTA_RETRY_MS = 30000;
+const unsigned long OTA_CONNECT_TIMEOUT_MS = 3000;  // DNS + TCP (+ TLS): the one blocking call
+const unsigned long OTA_RESPONSE_TIMEOUT_MS = 10000; // request sent -> end of the response head
+const unsigned long OTA_STALL_MS = 15000;            // no body bytes for this long
+const uint8_t OTA_MAX_FAILURES = 10;
+const uint8_t OTA_CHECKPOINT_BLOCKS = 8;      // progress saved every 32 KB
+const size_t OTA_CHUNK = 512;                 // download bytes per loop pass
+const unsigned long OTA_BOOT_WAIT_MS = 60000; // for the Mega's bootloader to show up
+uint32_t otaFailedCrc = 0;                    // not retried until the request changes
+uint16_t otaCheckpoint = 0;
+
+void otaReport(const char *state, const char *detail) {
+  if (!app.ready() || !firebaseConnected) return;
+  uint32_t done = ota.state == OTA_VERIFY ? ota.size
+                 : otaDelta                ? (uint32_t)otaDelta->nextBlock() * FW_BLOCK_SIZE
+                 : megaProxy               ? megaProxy->streamOffset()
+                                           : 0;
+  if (done > ota.size) done = ota.size;
+  char json[160];
+  snprintf(json, sizeof(json), "{\"state\":\"%s\",\"target\":\"%s\",\"crc\":\"%08lx\",\"progress\":%u,\"detail\":\"%s\"}",
+           state, ota.mega ? "mega" : "node", (unsigned long)ota.crc, ota.size ? (unsigned)((uint64_t)done * 100 / ota.size) : 0, detail);
+  char path[56];
+  snprintf(path, sizeof(path), "%s/ota_status", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+}
+
+void otaSaveProgress() {
+  if (!otaDelta || !otaDelta->headerKnown()) return;
+  OtaProgress p = {ota.crc, otaDelta->header(), otaDelta->nextBlock(), otaDelta->streamOffset(), otaDelta->crc()};
+  preferences.putBytes("ota", &p, sizeof(p));
+  otaCheckpoint = p.nextBlock;
+}
+
+void otaDisconnect() {
+  if (otaStreamClient) otaStreamClient->stop();
+  otaStreamClient = nullptr;
+}
+
+void otaRelease() {
+  otaDisconnect();
+  delete otaDelta;
+  otaDelta = nullptr;
+  delete megaProxy;
+  megaProxy = nullptr;
+  free(otaBuffer);
+  otaBuffer = nullptr;
+  ota.state = OTA_IDLE;
+}
+
+void otaFail(const char *why) {
+  LOG_E("❌ OTA failed: %s", why);
+  otaReport("failed", why);
+  otaFailedCrc = ota.crc;
+  otaRelease();
+}
+
+void otaSucceeded() {
+  preferences.putUInt("ota_done", ota.crc);
+  preferences.remove("ota");
+}
+
+// Connection dropped or a block did not check out: retry from the last good point
+void otaInterrupted(const char *why) {
+  otaDisconnect();
+  otaSaveProgress(); // kept for the next request even if this one gives up
+  if (++ota.failures > OTA_MAX_FAILURES) {
+    otaFail(why);
+    return;
+  }
+  LOG_W("⚠️ OTA interrupted (%s), retry %u in %lus", why, ota.failures, OTA_RETRY_MS / 1000);
+  ota.state = OTA_RETRY_WAIT;
+  ota.since = millis();
+  if (megaProxy) {
+    // Confirmed pages stay on the Mega; a half page and the trailer are fetched again
+    megaProxy->restart();
+    ota.offset = megaProxy->streamOffset();
+    ota.trailerFill = 0;
+    return;
+  }
+  ota.offset = otaDelta->streamOffset();
+  FwDeltaHeader h = otaDelta->header();
+  if (otaDelta->headerKnown()) otaDelta->resume(h, otaDelta->nextBlock(), ota.offset, otaDelta->crc());
+  else otaDelta->begin();
+}
+
+bool otaStartNode() {
+  // Staging area as UpdaterClass computes it: sector-rounded image right below the filesystem
+  uint32_t rounded = (ota.size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  uint32_t sketchEnd = (ESP.getSketchSize() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  uint32_t end = FS_PHYS_ADDR;
+  if (end < rounded || end - rounded < sketchEnd) {
+    otaFail("no_space");
+    return false;
+  }
+  otaFlash.start = end - rounded;
+  otaDelta = new DeltaApplier<OtaFlash>(otaFlash, otaBuffer);
+
+  OtaProgress p;
+  if (preferences.getBytes("ota", &p, sizeof(p)) == sizeof(p) && p.crc == ota.crc && p.header.newSize == ota.size) {
+    otaDelta->resume(p.header, p.nextBlock, p.streamOffset, p.crcSoFar);
+    ota.offset = p.streamOffset;
+    otaCheckpoint = p.nextBlock;
+    LOG_I("📦 OTA resumes at block %u/%u", p.nextBlock, p.header.blockCount);
+  } else {
+    preferences.remove("ota");
+    otaDelta->begin();
+    ota.offset = 0;
+    otaCheckpoint = 0;
+  }
+  ota.state = OTA_CONNECT;
+  return true;
+}
+
+void otaMegaPage(const uint8_t *data, uint16_t len, void *) { otaHash.add(data, len); }
+
+void otaStartMega() {
+  megaProxy = new MegaBootProxy<TwoWire>(Wire, otaBuffer, otaMegaPage);
+  ota.state = OTA_BOOT_WAIT;
+  ota.since = millis();
+}
+
+// Until the bootloader answers. It tells which page of this image it needs;
+// the download starts at 0 anyway, for the signature hash.
+void otaBootWait() {
+  FwStatus s = megaProxy->begin(ota.size, ota.crc);
+  if (s == FW_OK) {
+    LOG_I("📦 Mega bootloader answers, %u pages of this image already there", megaProxy->resumeAt());
+    otaHash.begin();
+    ota.offset = 0;
+    ota.trailerFill = 0;
+    otaCheckpoint = 0;
+    ota.state = OTA_CONNECT;
+    return;
+  }
+  if (s == FW_BAD_HEADER) otaFail(fwStatusName(s));
+  else if (millis() - ota.since > OTA_BOOT_WAIT_MS) otaFail(fwStatusName(FW_NO_BOOTLOADER));
+}
+
+// Look for a new update request
+void checkOtaRequest() {
+  if (ota.state != OTA_IDLE) return;
+  if (millis() - lastOtaCheck < OTA_CHECK_INTERVAL) return;
+  lastOtaCheck = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  char path[56];
+  snprintf(path, sizeof(path), "%s/ota", devicePath);
+  unsigned long start = millis();
+  String json = Database.get<String>(aClient, path);
+  if (!firebaseGetOk(start) || json.length() < 2 || json == "null") return;
+
+  const char *j = json.c_str();
+  long size;
+  char target[8], crc[12];
+  OtaJob job = {};
+  if (!jsonGetString(j, "url", job.url, sizeof(job.url)) || !jsonGetLong(j, "size", size) ||
+      !jsonGetString(j, "crc", crc, sizeof(crc)) || !jsonGetString(j, "target", target, sizeof(target)) || size <= 0) {
+    return;
+  }
+  job.size = size;
+  job.crc = strtoul(crc, nullptr, 16);
+  if (job.crc == otaFailedCrc || job.crc == preferences.getUInt("ota_done", 0)) return;
+  job.mega = strcmp(target, "mega") == 0;
+  ota = job;
+  if (!job.mega && strcmp(target, "node") != 0) {
+    otaFail("unsupported_target");
+    return;
+  }
+#ifndef OTA_PUBLIC_KEY
+  otaFail("no_signing_key");
+  return;
+#endif
+
+  otaBuffer = (uint8_t *)malloc(FW_BLOCK_SIZE);
+  if (!otaBuffer) {
+    LOG_W("⚠️ OTA postponed, no %u byte block free", FW_BLOCK_SIZE);
+    ota.state = OTA_IDLE;
+    return;
+  }
+  LOG_I("📦 OTA (%s): %lu bytes from %s", target, (unsigned long)ota.size, ota.url);
+  if (ota.mega) {
+    otaStartMega();
+    otaReport("waiting_bootloader", "");
+  } else if (otaStartNode()) {
+    otaReport("started", "");
+  }
+}
+
+// Open the connection and send the request. Only connect() can block, for at
+// most OTA_CONNECT_TIMEOUT_MS; the response is read by the next states.
+void otaConnect() {
+  bool tls;
+  char host[64];
+  uint16_t port;
+  const char *path;
+  if (!fwParseUrl(ota.url, tls, host, sizeof(host), port, path)) {
+    otaFail("bad_url");
+    return;
+  }
+  WiFiClient *client = &ota_client;
+  if (tls) {
+#ifdef OTA_TLS_FINGERPRINT
+    ota_ssl_client.setFingerprint(OTA_TLS_FINGERPRINT);
+#else
+    // The signature, not the transport, vouches for the image
+    ota_ssl_client.setInsecure();
+#endif
+    ota_ssl_client.setBufferSizes(1024, 512);
+    client = &ota_ssl_client;
+  }
+  client->setTimeout(OTA_CONNECT_TIMEOUT_MS);
+  if (!client->connect(host, port)) {
+    otaInterrupted("connect");
+    return;
+  }
+  client->setNoDelay(true);
+  // HTTP/1.0: no chunked body, the server closes after the last byte
+  client->printf("GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: smarthaus-ota\r\n", path, host);
+  if (ota.offset) client->printf("Range: bytes=%lu-\r\n", (unsigned long)ota.offset);
+  client->print("Connection: close\r\n\r\n");
+  otaStreamClient = client;
+  otaHead.begin();
+  ota.state = OTA_HEADERS;
+  ota.since = millis();
+}
+
+// Response head, whatever has arrived; the body starts in the same pass
+void otaHeaders() {
+  for (size_t n = 0; n < OTA_CHUNK && otaStreamClient->available(); n++) {
+    HttpHeadResult r = otaHead.push((char)otaStreamClient->read());
+    if (r == HTTP_HEAD_MORE) continue;
+    if (r == HTTP_HEAD_BAD) {
+      otaInterrupted("bad_response");
+      return;
+    }
+    int code = otaHead.status();
+    if (code == 206 && ota.offset && otaHead.rangeStart() == (int32_t)ota.offset) {
+      ota.skip = 0;
+    } else if (code == 200) {
+      ota.skip = ota.offset; // no range support: read through to the resume point
     } else {
-      sendI2CMessage("waterempty");
-      Serial.println("🚨 WATER EMPTY");
+      char why[24];
+      snprintf(why, sizeof(why), "http_%d", code);
+      otaInterrupted(why);
+      return;
     }
-    
-    // Update Firebase if available
-    if (app.ready() && firebaseConnected) {
-      String status = state ? "water_present" : "water_empty";
-      String tank_status = state ? "normal" : "alert";
-      
-      // Update water level status
-      Database.set<bool>(aClient, "/devices/water_level_001/water_level", state);
-      Database.set<String>(aClient, "/devices/water_level_001/status", status);
-      Database.set<String>(aClient, "/devices/water_level_001/tank_status", tank_status);
-      
-      Serial.printf("💾 Water level updated in Firebase: %s\n", status.c_str());
+    ota.state = OTA_STREAM;
+    ota.since = millis();
+    return;
+  }
+  if (millis() - ota.since > OTA_RESPONSE_TIMEOUT_MS) otaInterrupted("response_timeout");
+  else if (!otaStreamClient->connected() && !otaStreamClient->available()) otaInterrupted("disconnected");
+}
+
+// All blocks are in flash and match the image CRC: check the signature next
+void otaImageStaged() {
+  otaDisconnect();
+  const FwDeltaHeader &h = otaDelta->header();
+  if (h.newCrc != ota.crc || h.newSize != ota.size) {
+    preferences.remove("ota");
+    otaFail("image_mismatch");
+    return;
+  }
+  uint32_t sigLen = 0;
+  if (ota.size < 4 || !ESP.flashRead(otaFlash.start + ota.size - 4, (uint8_t *)&sigLen, 4) ||
+      !(ota.signedSize = fwSignedSize(ota.size, sigLen))) {
+    preferences.remove("ota");
+    otaFail("unsigned");
+    return;
+  }
+  ota.sigLen = sigLen;
+  ota.offset = 0;
+  otaHash.begin();
+  ota.state = OTA_VERIFY;
+}
+
+// One flash block into the hash per pass; then the signature decides
+void otaVerify() {
+  if (ota.offset < ota.signedSize) {
+    uint32_t n = ota.signedSize - ota.offset;
+    if (n > FW_BLOCK_SIZE) n = FW_BLOCK_SIZE;
+    if (!ESP.flashRead(otaFlash.start + ota.offset, otaBuffer, n)) {
+      otaFail(fwStatusName(FW_READ_FAILED));
+      return;
     }
+    otaHash.add(otaBuffer, n);
+    ota.offset += n;
+    return;
+  }
+  otaHash.end();
+  bool ok = false;
+#ifdef OTA_PUBLIC_KEY
+  BearSSL::SigningVerifier verifier(&otaSigningKey);
+  ok = ESP.flashRead(otaFlash.start + ota.signedSize, otaBuffer, ota.sigLen) &&
+       verifier.verify(&otaHash, otaBuffer, ota.sigLen);
+#endif
+  if (!ok) {
+    preferences.remove("ota");
+    otaFail("bad_signature");
+    return;
   }
+
+  eboot_command cmd;
+  cmd.action = ACTION_COPY_RAW;
+  cmd.args[0] = otaFlash.start;
+  cmd.args[1] = 0;
+  cmd.args[2] = ota.signedSize;
+  eboot_command_write(&cmd);
+  otaSucceeded();
+  LOG_I("✅ OTA verified and staged (%lu bytes downloaded for a %lu byte image), restarting",
+        (unsigned long)otaDelta->streamOffset(), (unsigned long)ota.size);
+  otaReport("restarting", "");
+  otaRelease();
+  drainLog();
+  ESP.restart();
+}
+
+// The whole Mega image is on its flash and the trailer is here: check the
+// signature over the hashed pages before the bootloader may start it
+void otaMegaLoaded() {
+  otaDisconnect();
+  uint8_t *trailer = otaBuffer + MEGA_BOOT_PAGE_MAX;
+  uint32_t sigLen = 0;
+  if (ota.trailerFill >= 4) memcpy(&sigLen, trailer + ota.trailerFill - 4, 4);
+  if (!sigLen || sigLen + 4 != ota.trailerFill) {
+    otaFail("unsigned");
+    return;
+  }
+  bool ok = false;
+#ifdef OTA_PUBLIC_KEY
+  otaHash.end();
+  BearSSL::SigningVerifier verifier(&otaSigningKey);
+  ok = verifier.verify(&otaHash, trailer, sigLen);
+#endif
+  if (!ok) {
+    otaFail("bad_signature");
+    return;
+  }
+  LOG_I("✅ Mega image signed and on its flash (%u pages skipped, %lu bytes on I2C), starting it",
+        megaProxy->pagesSkipped(), (unsigned long)megaProxy->bytesSent());
+  otaReport("starting", "");
+  ota.state = OTA_MEGA_START;
+}
+
+// Download bytes go to the proxy no faster than the Mega programs them; the
+// signature trailer after the image collects in otaBuffer
+void otaStreamMega(const uint8_t *buf, size_t n) {
+  size_t used = 0;
+  while (used < n && ota.offset < ota.size) {
+    size_t take = megaProxy->push(buf + used, n - used);
+    if (!take) break;
+    used += take;
+    ota.offset += take;
+  }
+  // Anything left over is trailer: signature, then its length
+  size_t room = FW_SIGNATURE_MAX + 4 - ota.trailerFill;
+  if (ota.offset >= ota.size && used < n) {
+    if (n - used > room) {
+      otaFail("unsigned");
+      return;
+    }
+    memcpy(otaBuffer + MEGA_BOOT_PAGE_MAX + ota.trailerFill, buf + used, n - used);
+    ota.trailerFill += n - used;
+  }
+}
+
+void otaStream() {
+  if (megaProxy) {
+    FwStatus s = megaProxy->poll();
+    if (s == FW_PENDING) return; // page still programming, the socket holds the rest
+    if (s != FW_OK) { // already resent MEGA_BOOT_RETRIES times
+      otaFail(fwStatusName(s));
+      return;
+    }
+  }
+  size_t avail = otaStreamClient->available();
+  if (avail == 0) {
+    if (megaProxy && megaProxy->loaded() && !otaStreamClient->connected()) otaMegaLoaded(); // end of the body
+    else if (!otaStreamClient->connected()) otaInterrupted("disconnected");
+    else if (millis() - ota.since > OTA_STALL_MS) otaInterrupted("stalled");
+    return;
+  }
+  ota.since = millis();
+  uint8_t buf[OTA_CHUNK];
+  size_t want = avail < sizeof(buf) ? avail : sizeof(buf);
+  if (megaProxy && ota.offset < ota.size) {
+    // Never read more than the page being filled takes
+    size_t room = megaProxy->room();
+    if (room < want) want = room;
+    if (!want) return;
+  }
+  if (ota.skip) {
+    size_t n = otaStreamClient->read(buf, want < ota.skip ? want : ota.skip);
+    ota.skip -= n;
+    return;
+  }
+
+  size_t n = otaStreamClient->read(buf, want);
+  if (megaProxy) {
+    otaStreamMega(buf, n);
+    if (ota.state != OTA_STREAM) return;
+    if (megaProxy->nextPage() >= otaCheckpoint + OTA_CHECKPOINT_BLOCKS * FW_BLOCK_SIZE / MEGA_BOOT_PAGE_MAX) {
+      ota.failures = 0;
+      otaCheckpoint = megaProxy->nextPage();
+      otaReport("running", "");
+    }
+    return;
+  }
+  FwStatus s = otaDelta->push(buf, n);
+  if (s == FW_DONE) {
+    otaImageStaged();
+  } else if (s == FW_BAD_BLOCK_CRC) {
+    otaInterrupted(fwStatusName(s));
+  } else if (s != FW_OK) {
+    preferences.remove("ota"); // the delta itself is unusable
+    otaFail(fwStatusName(s));
+  } else if (otaDelta->nextBlock() >= otaCheckpoint + OTA_CHECKPOINT_BLOCKS) {
+    ota.failures = 0;
+    otaSaveProgress();
+    otaReport("running", "");
+  }
+}
+
+// Download/verify state machine, one bounded step per loop pass
+void serviceOta() {
+  switch (ota.state) {
+    case OTA_IDLE:
+      return;
+
+    case OTA_CONNECT:
+      otaConnect();
+      return;
+
+    case OTA_HEADERS:
+      otaHeaders();
+      return;
+
+    case OTA_STREAM:
+      otaStream();
+      return;
+
+    case OTA_VERIFY:
+      otaVerify();
+      return;
+
+    case OTA_RETRY_WAIT:
+      if (millis() - ota.since >= OTA_RETRY_MS) ota.state = OTA_CONNECT;
+      return;
+
+    case OTA_BOOT_WAIT:
+      otaBootWait();
+      return;
+
+    case OTA_MEGA_START: {
+      FwStatus s = megaProxy->start();
+      if (s == FW_PENDING) return;
+      if (s != FW_DONE) {
+        otaFail(fwStatusName(s));
+        return;
+      }
+      otaSucceeded();
+      LOG_I("✅ Mega update done, bootloader started the new image");
+      otaReport("done", "");
+      otaRelease();
+      return;
+    }
+  }
+}
+
+// Input trace (see TRACE_DIR): segment seq lives in file seq % TRACE_SEGMENTS
+void tracePath(char *path, size_t size, uint32_t seq) {
+  snprintf(path, size, "%s/%u.bin", TRACE_DIR, (unsigned)(seq % TRACE_SEGMENTS));
+}
+
+// Sequence number in the header of a segment file; false if there is none
+bool traceFileSeq(File &f, uint32_t &seq) {
+  uint8_t head[sizeof(TraceSegmentHeader)];
+  return f && f.read(head, sizeof(head)) == sizeof(head) && traceSegmentHeader(head, sizeof(head), seq);
+}
+
+// Boot: number new segments after the newest one on flash
+void traceBegin() {
+  for (uint8_t i = 0; i < TRACE_SEGMENTS; i++) {
+    char path[20];
+    tracePath(path, sizeof(path), i);
+    if (!LittleFS.exists(path)) continue;
+    File f = LittleFS.open(path, "r");
+    uint32_t seq;
+    if (traceFileSeq(f, seq) && seq + 1 > traceSeq) traceSeq = seq + 1;
+    f.close();
+  }
+  traceReady = true;
+}
+
+// Append the buffered records; the first flush after boot, and one that would
+// overrun the segment, starts the next segment over the oldest file
+void traceFlush() {
+  static uint8_t chunk[TRACE_BUFFER_SIZE];
+  uint32_t baseMs;
+  uint16_t n = trace.take(chunk, baseMs);
+  if (!n || !traceReady) return;
+
+  char path[20];
+  File f;
+  if (!traceSegBytes || traceSegBytes + n > TRACE_SEGMENT_BYTES) {
+    if (traceSegBytes) traceSeq++;
+    uint8_t head[sizeof(TraceSegmentHeader) + TRACE_RECORD_MAX];
+    uint32_t epoch = timeService.valid() ? timeService.now(millis()) - (millis() - baseMs) / 1000 : 0;
+    uint8_t h = traceSegmentStart(head, traceSeq, baseMs, epoch);
+    tracePath(path, sizeof(path), traceSeq);
+    f = LittleFS.open(path, "w");
+    if (f) f.write(head, h);
+    traceSegBytes = h;
+  } else {
+    tracePath(path, sizeof(path), traceSeq);
+    f = LittleFS.open(path, "a");
+  }
+  if (!f || f.write(chunk, n) != n) {
+    LOG_W("⚠️ Trace write to %s failed, recording stopped", path);
+    traceReady = false;
+  }
+  traceSegBytes += n;
+  f.close();
+}
+
+// End of an upload: status to <devicePath>/trace_status, request cleared
+void traceUploadDone(const char *state, int code) {
+  LOG_I("🧾 Trace upload %s (%lu bytes)", state, (unsigned long)traceUploadBytes);
+  traceUploadUrl[0] = '\0';
+  if (!app.ready() || !firebaseConnected) return;
+  char json[128];
+  snprintf(json, sizeof(json), "{\"state\":\"%s\",\"http\":%d,\"bytes\":%lu,\"last_seq\":%lu,\"dropped\":%lu}",
+           state, code, (unsigned long)traceUploadBytes, (unsigned long)traceSeq, (unsigned long)trace.dropped());
+  char path[56];
+  snprintf(path, sizeof(path), "%s/trace_status", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+  snprintf(path, sizeof(path), "%s/trace/upload", devicePath);
+  Database.set<String>(aClient, path, String(""));
+}
+
+// POST one segment to <url>?seg=<seq>; segments already overwritten are skipped
+void traceUploadStep() {
+  if (ota.state != OTA_IDLE) return; // shares the OTA HTTP clients
+  if (traceUploadSeq > traceSeq) {
+    traceUploadDone("uploaded", HTTP_CODE_OK);
+    return;
+  }
+  uint32_t seq = traceUploadSeq++;
+  char path[20];
+  tracePath(path, sizeof(path), seq);
+  File f = LittleFS.open(path, "r");
+  uint32_t fileSeq;
+  if (!traceFileSeq(f, fileSeq) || fileSeq != seq) {
+    if (f) f.close();
+    return;
+  }
+  f.seek(0);
+
+  char url[112];
+  snprintf(url, sizeof(url), "%s%cseg=%lu", traceUploadUrl, strchr(traceUploadUrl, '?') ? '&' : '?',
+           (unsigned long)seq);
+  HTTPClient http;
+  if (strncmp(url, "https:", 6) == 0) {
+    ota_ssl_client.setInsecure();
+    ota_ssl_client.setBufferSizes(1024, 512);
+    http.begin(ota_ssl_client, url);
+  } else {
+    http.begin(ota_client, url);
+  }
+  http.addHeader("Content-Type", "application/octet-stream");
+  size_t size = f.size();
+  int code = http.sendRequest("POST", &f, size);
+  http.end();
+  f.close();
+  if (code < 200 || code >= 300) {
+    traceUploadDone("failed", code);
+    return;
+  }
+  traceUploadBytes += size;
+}
+
+// <devicePath>/trace = {"upload":"http://host:port/path"} sends the whole ring, oldest segment first
+void checkTraceRequest() {
+  if (millis() - lastTraceCheck < TRACE_CHECK_INTERVAL) return;
+  lastTraceCheck = millis();
+  if (!traceReady || traceUploadUrl[0] || !app.ready() || !firebaseConnected) return;
+
+  char path[56];
+  snprintf(path, sizeof(path), "%s/trace", devicePath);
+  unsigned long start = millis();
+  String json = Database.get<String>(aClient, path);
+  if (!firebaseGetOk(start) || json.length() < 2 || json == "null") return;
+  if (!jsonGetString(json.c_str(), "upload", traceUploadUrl, sizeof(traceUploadUrl))) traceUploadUrl[0] = '\0';
+  if (!traceUploadUrl[0]) return;
+
+  traceFlush();
+  lastTraceFlush = millis();
+  traceUploadSeq = traceSeq >= TRACE_SEGMENTS - 1 ? traceSeq - (TRACE_SEGMENTS - 1) : 0;
+  traceUploadBytes = 0;
+  LOG_I("🧾 Trace upload to %s", traceUploadUrl);
+}
+
+// Flush every 30 s or at half a buffer; during an upload, send the next segment instead
+void serviceTrace() {
+  if (traceUploadUrl[0]) {
+    traceUploadStep();
+    return;
+  }
+  if (trace.used() < TRACE_BUFFER_SIZE / 2 && millis() - lastTraceFlush < TRACE_FLUSH_INTERVAL) return;
+  lastTraceFlush = millis();
+  traceFlush();
+}
+
+// Name for the history, made safe to put in a JSON string
+void historyUserName(uint8_t door, uint16_t fingerId, char *out, size_t size) {
+  getFingerprintUserName(door, fingerId).toCharArray(out, size);
+  for (char *c = out; *c; c++) {
+    if (*c == '"' || *c == '\\' || (uint8_t)*c < 0x20) *c = '_';
+  }
+}
+
+typedef HistoryNameCache<8> HistoryPageNames; // on the stack of the request, about 220 bytes
+
+// One JSON line per record, written to the client as it is read from flash
+void emitHistoryLine(const AccessRecord &r, void *ctx) {
+  HistoryPageNames &names = *(HistoryPageNames *)ctx;
+  const char *user = (r.flags & HISTORY_GRANTED) ? names.name(r.door, r.fingerId) : "";
+  char line[128];
+  snprintf(line, sizeof(line), "{\"seq\":%lu,\"epoch\":%lu,\"door\":%u,\"granted\":%s,\"finger_id\":%u,\"user\":\"%s\"}\n",
+           (unsigned long)r.seq, (unsigned long)r.epoch, r.door, (r.flags & HISTORY_GRANTED) ? "true" : "false",
+           r.fingerId, user);
+  historyServer.sendContent(line);
+}
+
+// Same subnet as this device: a port forward from the router arrives from outside
+bool historyClientOnLan() {
+  uint32_t peer = historyServer.client().remoteIP();
+  uint32_t self = WiFi.localIP();
+  uint32_t mask = WiFi.subnetMask();
+  return peer && (peer & mask) == (self & mask);
+}
+
+// GET /history[?door=<n>][&user=<finger id>][&failed=1]
+//             [&day=YYYY-MM-DD|today][&limit=<n>][&from=<cursor>]
+// with header X-History-Token: <HISTORY_TOKEN>, from the local network only.
+// Records newest first as JSON lines, then {"next":<cursor>} (0 = no more)
+void handleHistoryRequest() {
+  String token = historyServer.header(HISTORY_HEADERS[0]);
+  if (!historyClientOnLan() || !historyTokenMatches(token.c_str(), token.length(), HISTORY_TOKEN)) {
+    historyServer.send(403, "text/plain", "forbidden\n");
+    return;
+  }
+  HistoryQuery q = {-1, -1, false, 0, 0, HISTORY_PAGE_DEFAULT};
+  bool ok = true;
+  if (historyServer.hasArg("door")) {
+    long door = historyServer.arg("door").toInt();
+    ok &= door >= 0 && door < doorCount;
+    q.door = door;
+  }
+  if (historyServer.hasArg("user")) q.fingerId = historyServer.arg("user").toInt();
+  q.failedOnly = historyServer.arg("failed") == "1";
+  if (historyServer.hasArg("day")) {
+    String day = historyServer.arg("day");
+    if (day == "today") {
+      ok &= timeService.valid();
+      q.day = historyDay(timeService.now(millis()), TIME_UTC_OFFSET_S);
+    } else {
+      ok &= historyDayFromDate(day.c_str(), q.day);
+    }
+  }
+  if (historyServer.hasArg("limit")) q.limit = constrain(historyServer.arg("limit").toInt(), 1, HISTORY_PAGE_MAX);
+  if (historyServer.hasArg("from")) q.from = strtoul(historyServer.arg("from").c_str(), nullptr, 10);
+  if (!ok || q.fingerId < -1) {
+    historyServer.send(400, "text/plain", "bad query\n");
+    return;
+  }
+
+  historyServer.chunkedResponseModeStart(200, "application/x-ndjson");
+  uint32_t start = millis();
+  HistoryPageNames names(historyUserName);
+  uint32_t next = history.query(q, emitHistoryLine, &names);
+  char line[32];
+  snprintf(line, sizeof(line), "{\"next\":%lu}\n", (unsigned long)next);
+  historyServer.sendContent(line);
+  historyServer.chunkedResponseFinalize();
+  LOG_D("📚 History page in %lu ms (%u name lookups), next %lu", millis() - start, names.lookupCount(),
+        (unsigned long)next);
+}
+
+// Boot: open the ring, rebuild the index, start the endpoint if a token is set
+void historyBegin() {
+  historyFile.f = LittleFS.open(HISTORY_FILE, LittleFS.exists(HISTORY_FILE) ? "r+" : "w+");
+  if (!historyFile.f) {
+    LOG_W("⚠️ Access history file could not be opened");
+    return;
+  }
+  unsigned long start = millis();
+  history.rebuild();
+  historyReady = true;
+  LOG_I("📚 Access history: %lu records up to #%lu, index rebuilt in %lu ms", (unsigned long)history.count(),
+        (unsigned long)history.newestSeq(), millis() - start);
+  if (!HISTORY_TOKEN[0]) return;
+  historyServer.on("/history", HTTP_GET, handleHistoryRequest);
+  historyServer.collectHeaders(HISTORY_HEADERS, 1);
+  historyServer.begin();
+  historyServing = true;
+}
+
+void serviceHistoryServer() {
+  if (historyServing) historyServer.handleClient();
 }
 
-// Simple Firebase setup
 void setupFirebase() {
   ssl_client.setInsecure();
+  ssl_client.setTimeout(FB_IO_TIMEOUT_MS);
+  stream_ssl_client.setInsecure();
+  stream_ssl_client.setBufferSizes(1024, 512);
   Firebase.initializeApp(aClient, app, getAuth(user_auth));
   app.getApp<RealtimeDatabase>(Database);
   Database.url(DATABASE_URL);
   firebaseConnected = false; // Will be set when first operation succeeds
 }
 
+// Work that must not wait for a sleep to end
+bool idleBusy() {
+  if (!wifiConnected || !app.ready()) return true; // (re)connecting or signing in
+  if (accessPipeline.pending() || events.pending() || buzzerActive || ota.state != OTA_IDLE || shLog.used()) return true;
+  if (journalCount && timeService.valid() && firebaseConnected) return true;
+  return FP_TOUCH_PIN >= 0 && millis() - lastTouchMs < FP_TOUCH_HOLD_MS;
+}
+
+uint32_t msUntil(unsigned long last, unsigned long interval) {
+  unsigned long since = millis() - last;
+  return since >= interval ? 0 : interval - since;
+}
+
+// Time to the next polled job; the 5-minute reports just run on a later wake
+uint32_t idleUntilNextMs() {
+  uint32_t next = msUntil(lastRelaysCheck, nodeConfig.relaysCheckMs);
+  uint32_t t = msUntil(lastDoorLockCheck, nodeConfig.doorLockCheckMs / doorCount);
+  if (t < next) next = t;
+  t = msUntil(lastReconcile, RECONCILE_INTERVAL);
+  if (t < next) next = t;
+  t = msUntil(lastMemSample, MEM_SAMPLE_INTERVAL);
+  if (t < next) next = t;
+  if (!floatDebouncer.settled() && next > FP_POLL_MS) next = FP_POLL_MS;
+  if (doorScheduler.polling() && next > FP_POLL_MS) next = FP_POLL_MS;
+  return next;
+}
+
+// End of a loop pass: sleep until the next job, a touch or a float edge
+void idleSleep() {
+  bool light = idleGovernor.mode() == IDLE_LIGHT;
+  if (light != idleLightSleep) {
+    idleLightSleep = light;
+    WiFi.setSleepMode(light ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP, WIFI_LISTEN_INTERVAL);
+  }
+  uint32_t ms = idleGovernor.plan(idleBusy(), idleUntilNextMs());
+  if (!ms) return;
+
+  // Level interrupts with wake-up enabled; the ISRs switch back to edges
+  attachInterrupt(digitalPinToInterrupt(FLOAT_PIN), floatPinISR, digitalRead(FLOAT_PIN) ? ONLOW_WE : ONHIGH_WE);
+#if FP_TOUCH_PIN >= 0
+  attachInterrupt(digitalPinToInterrupt(FP_TOUCH_PIN), touchISR, FP_TOUCH_ACTIVE == HIGH ? ONHIGH_WE : ONLOW_WE);
+#endif
+  idleWakeSource = WAKE_TIMER;
+  idleGovernor.sleeping(millis());
+  esp_delay(ms, []() { return idleWakeSource == WAKE_TIMER; }, ms);
+  idleGovernor.woke(millis(), (WakeSource)idleWakeSource);
+  attachInterrupt(digitalPinToInterrupt(FLOAT_PIN), floatPinISR, CHANGE);
+#if FP_TOUCH_PIN >= 0
+  attachInterrupt(digitalPinToInterrupt(FP_TOUCH_PIN), touchISR, FP_TOUCH_ACTIVE == HIGH ? RISING : FALLING);
+#endif
+}
+
+// Duty cycle, estimated draw and wake latency of the last window
+void reportPower() {
+  if (millis() - lastPowerReport < POWER_REPORT_INTERVAL) return;
+  lastPowerReport = millis();
+  if (!app.ready() || !firebaseConnected) return;
+
+  static const char *const MODE_NAMES[] = {"off", "modem", "light"};
+  const IdleStats &s = idleGovernor.stats();
+  uint16_t duty = idleGovernor.dutyPermille(millis());
+  uint16_t ma = idleGovernor.averageMa10(millis());
+  char json[288];
+  snprintf(json, sizeof(json),
+           "{\"mode\":\"%s\",\"duty_pct\":%u.%u,\"avg_ma\":%u.%u,\"sleeps\":%lu,\"wake_timer\":%lu,"
+           "\"wake_touch\":%lu,\"wake_float\":%lu,\"wake_ms_max\":%lu,\"wake_over_budget\":%lu,"
+           "\"touch_unlock_ms_max\":%lu}",
+           MODE_NAMES[idleGovernor.mode()], duty / 10, duty % 10, ma / 10, ma % 10, (unsigned long)s.sleeps,
+           (unsigned long)s.wakes[WAKE_TIMER], (unsigned long)s.wakes[WAKE_TOUCH], (unsigned long)s.wakes[WAKE_FLOAT],
+           (unsigned long)s.latencyMaxMs, (unsigned long)s.overBudget, (unsigned long)(touchUnlockMaxUs / 1000));
+  char path[56];
+  snprintf(path, sizeof(path), "%s/power", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+  idleGovernor.resetStats();
+  touchUnlockMaxUs = 0;
+}
+
+void reportTasks();
+
+void firebaseLoop() {
+  app.loop();
+}
+
+// Loop tasks in run order, each with the longest acceptable single call (us).
+// Network tasks get up to 1 s; the soft watchdog fires after ~3 s without a yield.
+const TaskSpec LOOP_TASKS[] = {
+  {"firebase", firebaseLoop, 100000},
+  {"time", serviceTime, 5000},
+  {"connection", checkConnection, 5000},
+  // Real-time relay monitoring
+  {"i2c_scan", checkI2CSlaves, 50000},
+  {"relays", fetchRelays, 1000000},
+  {"reconcile", reconcileSlaves, 50000},
+  {"door_lock", fetchDoorLock, 1000000},
+  {"stream", startFailedAttemptsStream, 1000000}, // Remote resets arrive over SSE
+  {"lockout", checkLockout, 1000000},
+  // Water level monitoring
+  {"water", checkWaterLevel, 1000000},
+  {"pump_stats", reportPumpStats, 1000000},
+  {"i2c_stats", reportI2CStats, 1000000},
+  {"fp_stats", reportFingerprintStats, 1000000},
+  {"memory", watchMemory, 1000000},
+  {"power", reportPower, 1000000},
+  {"tasks", reportTasks, 1000000},
+  {"events_stats", reportEvents, 1000000},
+  {"metrics", reportMetrics, 1000000},
+  {"log", drainLog, 5000},
+  // Runtime configuration
+  {"config", checkConfigUpdate, 1000000},
+  // Local automations
+  {"rules_update", checkRulesUpdate, 1000000},
+  {"rules", runRules, 20000},
+  // Background work of earlier scans
+  {"access", runAccessPipeline, 1000000},
+  {"journal", flushAccessJournal, 1000000},
+  // Firmware updates: request poll, then one chunk/block/page per pass (sector erase ~50 ms)
+  {"ota_check", checkOtaRequest, 1000000},
+  {"ota", serviceOta, 200000},
+  // Input trace: flush to flash, or send one segment of a requested upload (~1 s)
+  {"trace_check", checkTraceRequest, 1000000},
+  {"trace", serviceTrace, 2000000},
+  // Local access history queries (one page, streamed from flash)
+  {"http", serviceHistoryServer, 500000},
+  {"buzzer", serviceBuzzer, 1000},
+  // Fingerprint scanning, one door per pass
+  {"scan", scanNextDoor, 1000000},
+  // Consumers of what this pass published (relays, water, access)
+  {"events", dispatchEvents, 1000000},
+};
+const uint8_t LOOP_TASK_COUNT = sizeof(LOOP_TASKS) / sizeof(LOOP_TASKS[0]);
+
+// Loop supervisor; the running task is mirrored to RTC memory so a
+// watchdog reset can be attributed
+const uint32_t TASK_RTC_OFFSET = 52; // RTC user memory block, after the time record
+void persistTaskRecord(const TaskRecord &rec) {
+  ESP.rtcUserMemoryWrite(TASK_RTC_OFFSET, (uint32_t *)&rec, sizeof(rec));
+}
+uint32_t supervisorClock() {
+  return micros();
+}
+TaskSupervisor<LOOP_TASK_COUNT> supervisor(LOOP_TASKS, supervisorClock, persistTaskRecord);
+uint8_t crashedTask = TASK_NONE;
+bool resetReported = false;
+unsigned long lastTaskReport = 0;
+const unsigned long TASK_REPORT_INTERVAL = 300000; // 5 minutes
+
+// Publish task overruns, and once after boot the task a watchdog reset interrupted
+void reportTasks() {
+  uint8_t id;
+  uint32_t us;
+  if (supervisor.takeOverrun(id, us)) {
+    LOG_W("⏱️ Task %s took %lu ms", supervisor.name(id), (unsigned long)(us / 1000));
+  }
+
+  if (!app.ready() || !firebaseConnected) return;
+  char path[56];
+  char json[320];
+  if (!resetReported) {
+    resetReported = true;
+    const TaskRecord &rec = supervisor.record();
+    snprintf(json, sizeof(json),
+             "{\"reason\":\"%s\",\"task\":\"%s\",\"resets_in_task\":%u,"
+             "\"last_overrun\":\"%s\",\"last_overrun_us\":%lu}",
+             ESP.getResetReason().c_str(), supervisor.name(crashedTask), rec.resets,
+             supervisor.name(rec.lastOverrun), (unsigned long)rec.lastOverrunUs);
+    snprintf(path, sizeof(path), "%s/last_reset", devicePath);
+    Database.set<object_t>(aClient, path, object_t(json));
+  }
+
+  if (millis() - lastTaskReport < TASK_REPORT_INTERVAL) return;
+  lastTaskReport = millis();
+  // Tasks that went over budget, with their worst call
+  size_t n = snprintf(json, sizeof(json), "{");
+  for (uint8_t i = 0; i < LOOP_TASK_COUNT && n < sizeof(json) - 48; i++) {
+    const TaskStats &st = supervisor.stats(i);
+    if (!st.overruns) continue;
+    n += snprintf(json + n, sizeof(json) - n, "%s\"%s\":{\"overruns\":%lu,\"max_us\":%lu}",
+                  n > 1 ? "," : "", supervisor.name(i), (unsigned long)st.overruns, (unsigned long)st.maxUs);
+  }
+  snprintf(json + n, sizeof(json) - n, "}");
+  snprintf(path, sizeof(path), "%s/tasks", devicePath);
+  Database.set<object_t>(aClient, path, object_t(json));
+}
+
 void setup() {
-  Serial.begin(57600);
-  Serial.println("ESP8266 Simple Fingerprint Control");
-  Serial.printf("Free heap: %d bytes\n", ESP.getFreeHeap());
+  // Front door sensor: UART0 moved to GPIO13/15
+  Serial.begin(FP_BAUD);
+  Serial.swap();
+#if LOG_SINK == LOG_SINK_SERIAL1
+  Serial1.begin(115200);
+#else
+  shLog.setMode(LOG_KEEP_NEWEST);
+#endif
+  LOG_I("ESP8266 Simple Fingerprint Control");
+  LOG_I("Free heap: %d bytes", ESP.getFreeHeap());
 
   Wire.begin(D2, D1);
+  LOG_I("🔌 I2C slaves found: %d", i2cBus.discover());
   
   // Initialize water level sensor pin
   pinMode(FLOAT_PIN, INPUT_PULLUP);
   lastFloatState = (digitalRead(FLOAT_PIN) == LOW);
-  Serial.printf("💧 Water sensor initial: %s\n", lastFloatState ? "PRESENT" : "EMPTY");
+  floatDebouncer.begin(lastFloatState, millis());
+  attachInterrupt(digitalPinToInterrupt(FLOAT_PIN), floatPinISR, CHANGE);
+  LOG_I("💧 Water sensor initial: %s", lastFloatState ? "PRESENT" : "EMPTY");
+#if FP_TOUCH_PIN >= 0
+  pinMode(FP_TOUCH_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(FP_TOUCH_PIN), touchISR, FP_TOUCH_ACTIVE == HIGH ? RISING : FALLING);
+#endif
+  idleGovernor.begin(millis());
+  rules.setInput(IN_FLOAT, lastFloatState);
+  rules.setInput(IN_DOOR_LOCKED, doors[0].isDoorLocked);
   
   // Initialize buzzer pin (active low - HIGH = off)
   pinMode(BUZZER_PIN, OUTPUT);
   digitalWrite(BUZZER_PIN, HIGH);
   
-  if (finger.verifyPassword()) {
-    Serial.println("Fingerprint sensor OK");
+  // Which task was running if the last reset was a watchdog or exception
+  TaskRecord prevTasks;
+  ESP.rtcUserMemoryRead(TASK_RTC_OFFSET, (uint32_t *)&prevTasks, sizeof(prevTasks));
+  uint32_t resetReason = ESP.getResetInfoPtr()->reason;
+  bool abnormal = resetReason == REASON_WDT_RST || resetReason == REASON_SOFT_WDT_RST ||
+                  resetReason == REASON_EXCEPTION_RST;
+  crashedTask = supervisor.begin(prevTasks, abnormal);
+  trace.add(TR_BOOT, resetReason, crashedTask, millis());
+  trace.add(TR_FLOAT, 1, lastFloatState, millis()); // debouncer seed, for a replay
+  if (crashedTask != TASK_NONE) {
+    LOG_E("💥 %s inside task %s", ESP.getResetReason().c_str(), supervisor.name(crashedTask));
   }
   
   preferences.begin("fingerprints", false);
+  loadConfig();
+  if (doorCount > 1) backFpSerial.begin(FP_BAUD);
+  for (uint8_t i = 0; i < doorCount; i++) {
+    if (doors[i].finger.verifyPassword()) {
+      LOG_I("Door %u fingerprint sensor OK (%s)", i, doors[i].link.backendName());
+    } else {
+      LOG_W("⚠️ Door %u fingerprint sensor not found (%s)", i, doors[i].link.backendName());
+    }
+    restoreLockoutState(i);
+  }
+  rules.setInput(IN_FAILED, doors[0].lockout.failures());
+
+  if (LittleFS.begin()) {
+    loadRulesFromFlash();
+    traceBegin();
+    historyBegin();
+  } else {
+    LOG_W("⚠️ LittleFS mount failed - no local rules");
+  }
+
+  logFlush();
   setupWiFi();
+  logFlush();
   
-  // Configure time for logging
-  if (wifiConnected) {
-    configTime(8 * 3600, 0, "pool.ntp.org", "time.nist.gov"); // UTC+8 (adjust timezone as needed)
-    Serial.println("⏰ Time configured for logging");
-  }
+  // Time for logging: resume from RTC memory, then let serviceTime() keep SNTP going
+  settimeofday_cb(onTimeSync);
+  restoreTime();
+  requestTimeSync();
   
   setupFirebase();
+
+#ifdef BENCH_PATHS
+  benchPaths();
+#endif
+#ifdef BENCH_EVENTS
+  benchEvents();
+#endif
   
-  Serial.println("Setup complete");
+  LOG_I("Setup complete");
+  logFlush();
 }
 
 void loop() {
-  ESP.wdtFeed();
-  app.loop();
-  
-  // Simple connection check
-  if (WiFi.status() == WL_CONNECTED) {
-    wifiConnected = true;
-    if (app.ready()) {
-      firebaseConnected = true;
-    }
-  } else {
-    wifiConnected = false;
-    firebaseConnected = false;
-  }
-  
-  // Real-time relay monitoring
-  fetchRelays();
-  fetchDoorLock();
-  checkFailedAttempts(); // Check for remote reset of failed attempts
-  
-  // Water level monitoring
-  checkWaterLevel();
-  
-  // Only scan if door is locked AND system is not locked due to failed attempts
-  if (isDoorLocked && !systemLocked) {
-    getFingerprintID();
-  } else if (systemLocked) {
-    // Show lockout message periodically
-    static unsigned long lastLockoutMessage = 0;
-    if (millis() - lastLockoutMessage > 10000) { // Every 10 seconds
-      Serial.println("🔒 SYSTEM LOCKED - Reset failed_attempts in Firebase to unlock");
-      lastLockoutMessage = millis();
-    }
+  uint32_t passStart = micros();
+  for (uint8_t i = 0; i < LOOP_TASK_COUNT; i++) {
+    ESP.wdtFeed();
+    supervisor.run(i);
   }
-}
\ No newline at end of file
+  metrics.observe(NH_LOOP_US, micros() - passStart);
+  idleSleep();
+}
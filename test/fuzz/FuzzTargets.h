@@ -0,0 +1,169 @@
+/***************************************************
+  FuzzTargets - parsers that take bytes from outside
+  the board, as fuzz targets
+  - fuzzSlaveCommand: I2C packets (parseSlaveCommand)
+  - fuzzSimResult: SIM800L responses (simResult)
+  - fuzzJsonScan: Firebase JSON (JsonScan.h)
+  - fuzzRules: rule text from Firebase
+    (RulesEngine::load, then run on fuzzed inputs)
+  Each copies the input to a buffer of exactly its
+  size, so ASan sees any read past the end, and
+  abort()s when a result breaks an invariant.
+
+  Built two ways: as libFuzzer targets
+  (test/fuzz/fuzz_*.cpp) and by the native test
+  test_fuzz_corpus, which replays the seed corpora
+  and a fixed number of mutations.
+ ****************************************************/
+#ifndef SMARTHAUS_FUZZ_TARGETS_H
+#define SMARTHAUS_FUZZ_TARGETS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SlaveCommand.h>
+#include <JsonScan.h>
+#include <RulesEngine.h>
+
+#define FUZZ_CHECK(c) do { if (!(c)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); abort(); } } while (0)
+
+// Exactly size bytes, optionally NUL-terminated (the parsers that take C strings)
+struct FuzzInput {
+  FuzzInput(const uint8_t *data, size_t size, bool terminate) : len(size) {
+    buf = (char *)malloc((size + terminate) ? size + terminate : 1);
+    if (size) memcpy(buf, data, size);
+    if (terminate) buf[size] = '\0';
+  }
+  ~FuzzInput() { free(buf); }
+  char *buf;
+  size_t len;
+};
+
+inline int fuzzSlaveCommand(const uint8_t *data, size_t size) {
+  FuzzInput in(data, size, false);
+  for (uint8_t doors = 1; doors <= 3; doors++) {
+    SlaveCommand cmd;
+    uint8_t kind = parseSlaveCommand(in.buf, in.len, doors, cmd);
+    FUZZ_CHECK(kind == cmd.kind && kind <= SC_CONFIG);
+    switch (kind) {
+      case SC_LOCK:
+      case SC_UNLOCK:
+      case SC_ALERT:
+        FUZZ_CHECK(cmd.door < doors);
+        break;
+      case SC_RELAY:
+        FUZZ_CHECK(cmd.id >= 1);
+        break;
+      case SC_CONFIG:
+        // Key and value point into the packet
+        FUZZ_CHECK(cmd.key >= in.buf && cmd.key + cmd.keyLen <= in.buf + in.len && cmd.keyLen);
+        if (cmd.value) FUZZ_CHECK(cmd.value >= in.buf && cmd.value + cmd.valueLen <= in.buf + in.len);
+        break;
+      case SC_EMPTY:
+        for (size_t i = 0; i < in.len; i++) FUZZ_CHECK(scSpace(in.buf[i]));
+        break;
+    }
+    SlaveCommand again;
+    FUZZ_CHECK(parseSlaveCommand(in.buf, in.len, doors, again) == kind && !memcmp(&again, &cmd, sizeof(cmd)));
+  }
+  return 0;
+}
+
+inline int fuzzSimResult(const uint8_t *data, size_t size) {
+  if (size > 256) return 0; // the prefix check is quadratic; answers are short
+  FuzzInput in(data, size, false);
+  SimResult r = simResult(in.buf, in.len);
+  FUZZ_CHECK(r <= SIM_ERROR);
+  // SmsSession re-checks as bytes arrive: once a prefix holds a result code,
+  // more bytes can only turn OK into ERROR, never back to pending
+  for (size_t cut = 0; cut < in.len; cut++) {
+    SimResult early = simResult(in.buf, cut);
+    if (early == SIM_ERROR) FUZZ_CHECK(r == SIM_ERROR);
+    if (early == SIM_OK) FUZZ_CHECK(r != SIM_PENDING);
+  }
+  return 0;
+}
+
+inline int fuzzJsonScan(const uint8_t *data, size_t size) {
+  FuzzInput in(data, size, true);
+  const char *end = in.buf + in.len;
+  static const char *const KEYS[] = {"url", "size", "crc", "target", "state", "upload", "relays_check_ms", "phone_number"};
+  for (const char *key : KEYS) {
+    const char *v = jsonFind(in.buf, key);
+    FUZZ_CHECK(!v || (v >= in.buf && v <= end));
+    long n;
+    bool b;
+    char s[16];
+    jsonGetLong(in.buf, key, n);
+    jsonGetBool(in.buf, key, b);
+    if (jsonGetString(in.buf, key, s, sizeof(s))) FUZZ_CHECK(strlen(s) < sizeof(s));
+  }
+
+  // The relay walk of checkRelays(): an array by ID or an object by key. Every
+  // step must move forward and stay inside the text.
+  const char *p = in.buf;
+  const char *value, *valueEnd, *last;
+  size_t steps = 0;
+  if (*p == '[') {
+    p++;
+    for (last = p; jsonNextElement(p, value, valueEnd); last = p) {
+      FUZZ_CHECK(p > last && value <= valueEnd && valueEnd <= end && p <= end);
+      FUZZ_CHECK(++steps <= in.len);
+      bool state;
+      if (*value == '{') jsonGetBool(value, "state", state);
+    }
+  } else {
+    char key[8];
+    for (last = p; jsonNextMember(p, key, sizeof(key), value, valueEnd); last = p) {
+      FUZZ_CHECK(p > last && value <= valueEnd && valueEnd <= end && p <= end);
+      FUZZ_CHECK(strlen(key) < sizeof(key) && ++steps <= in.len);
+      bool state;
+      if (*value == '{') jsonGetBool(value, "state", state);
+    }
+  }
+  const char *skipped = jsonSkipValue(in.buf);
+  FUZZ_CHECK(skipped >= in.buf && skipped <= end);
+  return 0;
+}
+
+inline void fuzzRuleAction(uint8_t type, uint8_t arg, const char *text) {
+  FUZZ_CHECK(type <= ACT_SEND);
+  if (type == ACT_RELAY_ON || type == ACT_RELAY_OFF) FUZZ_CHECK(arg >= 1 && arg <= RULES_MAX_RELAYS);
+  if (type == ACT_SEND) {
+    SlaveCommand cmd;
+    FUZZ_CHECK(text);
+    uint8_t kind = parseSlaveCommand(text, strlen(text), RULES_MAX_DOORS, cmd);
+    FUZZ_CHECK(kind == SC_LOCK || kind == SC_UNLOCK || kind == SC_ALERT || kind == SC_RELAY_MASK ||
+               (kind == SC_RELAY && cmd.id <= RULES_MAX_RELAYS));
+  }
+}
+
+static uint16_t fuzzRuleErrors;
+
+inline void fuzzRuleError(uint16_t lineNo, const char *msg) {
+  FUZZ_CHECK(lineNo >= 1 && msg && *msg);
+  fuzzRuleErrors++;
+}
+
+inline int fuzzRules(const uint8_t *data, size_t size) {
+  // The first bytes (up to a NUL) are the program, the rest drive the inputs
+  size_t textLen = 0;
+  while (textLen < size && data[textLen]) textLen++;
+  FuzzInput text(data, textLen, true);
+
+  static RulesEngine rules(fuzzRuleAction);
+  for (uint8_t i = 0; i < IN_COUNT; i++) rules.setInput(i, -1);
+  fuzzRuleErrors = 0;
+  uint8_t rejected = rules.load(text.buf, fuzzRuleError);
+  FUZZ_CHECK(rules.count() <= RULES_MAX_RULES && rules.codeBytes() <= RULES_CODE_SIZE);
+  FUZZ_CHECK(rejected == (uint8_t)fuzzRuleErrors);
+  rules.run();
+  for (size_t i = textLen + 1; i + 2 < size; i += 3) {
+    rules.setInput(data[i] % IN_COUNT, (int16_t)(data[i + 1] | data[i + 2] << 8));
+    FUZZ_CHECK(rules.run() <= rules.count());
+  }
+  return 0;
+}
+
+#endif // SMARTHAUS_FUZZ_TARGETS_H
@@ -0,0 +1,6 @@
+// libFuzzer entry for fuzzRules(), see FuzzTargets.h and the README
+#include "FuzzTargets.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  return fuzzRules(data, size);
+}
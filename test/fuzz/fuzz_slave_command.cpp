@@ -0,0 +1,6 @@
+// libFuzzer entry for fuzzSlaveCommand(), see FuzzTargets.h and the README
+#include "FuzzTargets.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  return fuzzSlaveCommand(data, size);
+}
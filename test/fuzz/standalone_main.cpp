@@ -0,0 +1,30 @@
+// Runs a fuzz_*.cpp target on the files named on the command line, for
+// compilers without libFuzzer and to replay a crash-* file under a debugger:
+//   g++ -g -fsanitize=address,undefined -Ilib/SmartHaus/src
+//     test/fuzz/fuzz_rules.cpp test/fuzz/standalone_main.cpp -o fuzz_rules
+//   ./fuzz_rules test/fuzz/corpus/rules/*
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (!f) {
+      fprintf(stderr, "cannot open %s\n", argv[i]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(size ? size : 1);
+    size_t got = fread(data, 1, size, f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, got);
+    free(data);
+    printf("%s: ok\n", argv[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+// AccessHistory endpoint helpers: the header token check and the per-page
+// name cache that keeps a history page to one lookup per user. Then insert
+// cost and query time with 50k records on a simulated flash.
+#include <unity.h>
+#include <AccessHistory.h>
+#include <chrono>
+#include <stdio.h>
+
+static int lookups;
+
+static void fakeLookup(uint8_t door, uint16_t fingerId, char *out, size_t size) {
+  lookups++;
+  snprintf(out, size, "user-%u-%u", door, fingerId);
+}
+
+static void longLookup(uint8_t, uint16_t, char *out, size_t size) {
+  lookups++;
+  for (size_t i = 0; i < size; i++) out[i] = 'x'; // no NUL: the cache must add it
+}
+
+void setUp() { lookups = 0; }
+void tearDown() {}
+
+static bool matches(const char *given, const char *secret) {
+  return historyTokenMatches(given, strlen(given), secret);
+}
+
+void test_token_equal_matches() {
+  TEST_ASSERT_TRUE(matches("s3cret-token", "s3cret-token"));
+}
+
+void test_token_mismatch() {
+  TEST_ASSERT_FALSE(matches("s3cret-tokeN", "s3cret-token"));
+  TEST_ASSERT_FALSE(matches("x3cret-token", "s3cret-token"));
+  TEST_ASSERT_FALSE(matches("", "s3cret-token"));
+}
+
+void test_token_prefix_and_longer_rejected() {
+  TEST_ASSERT_FALSE(matches("s3cret", "s3cret-token"));
+  TEST_ASSERT_FALSE(matches("s3cret-token2", "s3cret-token"));
+  // The length given is what counts, not a NUL inside it
+  TEST_ASSERT_FALSE(historyTokenMatches("s3cret-token\0", 13, "s3cret-token"));
+  TEST_ASSERT_TRUE(historyTokenMatches("s3cret-token-and-more", 12, "s3cret-token"));
+}
+
+void test_token_empty_secret_matches_nothing() {
+  TEST_ASSERT_FALSE(matches("", ""));
+  TEST_ASSERT_FALSE(matches("anything", ""));
+}
+
+void test_cache_repeated_user_looked_up_once() {
+  HistoryNameCache<4> names(fakeLookup);
+  for (int i = 0; i < 20; i++) {
+    TEST_ASSERT_EQUAL_STRING("user-0-3", names.name(0, 3));
+    TEST_ASSERT_EQUAL_STRING("user-1-3", names.name(1, 3)); // same finger, other door
+  }
+  TEST_ASSERT_EQUAL(2, lookups);
+  TEST_ASSERT_EQUAL_UINT16(2, names.lookupCount());
+}
+
+void test_cache_replaces_past_capacity() {
+  HistoryNameCache<2> names(fakeLookup);
+  names.name(0, 1);
+  names.name(0, 2);
+  TEST_ASSERT_EQUAL_STRING("user-0-3", names.name(0, 3)); // replaces 1
+  TEST_ASSERT_EQUAL(3, lookups);
+  TEST_ASSERT_EQUAL_STRING("user-0-2", names.name(0, 2));
+  TEST_ASSERT_EQUAL(3, lookups);
+  TEST_ASSERT_EQUAL_STRING("user-0-1", names.name(0, 1)); // evicted: read again
+  TEST_ASSERT_EQUAL(4, lookups);
+}
+
+void test_cache_truncates_long_name() {
+  HistoryNameCache<2> names(longLookup);
+  const char *n = names.name(0, 7);
+  TEST_ASSERT_EQUAL(HISTORY_NAME_MAX - 1, strlen(n));
+}
+
+// Flash stand-in: a byte array that grows as it is written, like the file
+// on LittleFS, and counts record reads
+struct SimFlash {
+  static const uint32_t BYTES = 65536 * sizeof(AccessRecord);
+  uint8_t data[BYTES];
+  uint32_t size = 0;
+  uint32_t reads = 0;
+
+  size_t read(uint32_t offset, void *buf, size_t len) {
+    reads++;
+    if (offset >= size) return 0;
+    if (len > size - offset) len = size - offset;
+    memcpy(buf, data + offset, len);
+    return len;
+  }
+  bool write(uint32_t offset, const void *buf, size_t len) {
+    if (offset + len > BYTES) return false;
+    memcpy(data + offset, buf, len);
+    if (offset + len > size) size = offset + len;
+    return true;
+  }
+};
+
+const uint32_t BENCH_RECORDS = 50000;
+const int32_t BENCH_UTC_OFFSET = 8 * 3600;
+const uint32_t BENCH_START = 1767225600UL; // 2026-01-01 00:00 UTC
+typedef AccessHistory<SimFlash, 65536> BenchHistory; // room for all 50k
+static SimFlash flash;
+
+// Matches in the store, newest first, without the index
+static uint8_t referencePage(const HistoryQuery &q, uint32_t newest, uint32_t *out) {
+  uint8_t n = 0;
+  for (uint32_t seq = newest; seq && n < q.limit; seq--) {
+    AccessRecord r;
+    memcpy(&r, flash.data + (seq - 1) * sizeof(r), sizeof(r));
+    bool granted = r.flags & HISTORY_GRANTED;
+    if (q.door >= 0 && r.door != q.door) continue;
+    if (q.failedOnly && granted) continue;
+    if (q.fingerId >= 0 && (!granted || r.fingerId != q.fingerId)) continue;
+    if (q.day && historyDay(r.epoch, BENCH_UTC_OFFSET) != q.day) continue;
+    out[n++] = seq;
+  }
+  return n;
+}
+
+struct Page {
+  uint32_t seq[50];
+  uint8_t n;
+};
+static void collect(const AccessRecord &r, void *ctx) {
+  Page &p = *(Page *)ctx;
+  p.seq[p.n++] = r.seq;
+}
+
+// Time one page; checks it against the reference and returns the flash reads
+static uint32_t timedQuery(BenchHistory &h, const HistoryQuery &q, const char *label) {
+  Page page;
+  page.n = 0;
+  flash.reads = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  h.query(q, collect, &page);
+  auto t1 = std::chrono::steady_clock::now();
+  uint32_t want[50];
+  uint8_t n = referencePage(q, h.newestSeq(), want);
+  TEST_ASSERT_EQUAL(n, page.n);
+  TEST_ASSERT_EQUAL_MEMORY(want, page.seq, n * sizeof(uint32_t));
+  char line[112];
+  snprintf(line, sizeof(line), "%s: %u records, %lu reads, %.1f us", label, page.n, (unsigned long)flash.reads,
+           std::chrono::duration<double, std::micro>(t1 - t0).count());
+  TEST_MESSAGE(line);
+  return flash.reads;
+}
+
+// 50k scans over about 80 days: 24 users on two doors, one scan in 20 failed.
+// The firmware ring keeps 8192 of them; query cost does not depend on the size.
+void test_benchmark_50k_records() {
+  flash.size = 0;
+  BenchHistory h(flash, BENCH_UTC_OFFSET);
+  h.rebuild();
+  uint32_t rng = 12345;
+  uint32_t epoch = BENCH_START;
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_RECORDS; i++) {
+    rng = rng * 1664525UL + 1013904223UL;
+    epoch += 60 + (rng >> 8) % 150;
+    bool granted = (rng >> 20) % 20 != 0;
+    TEST_ASSERT_TRUE(h.add((rng >> 16) & 1, granted, 1 + (rng >> 24) % 12, epoch));
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS, h.count());
+  char line[112];
+  snprintf(line, sizeof(line), "insert: %.0f ns/record (%lu records)",
+           std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_RECORDS, (unsigned long)BENCH_RECORDS);
+  TEST_MESSAGE(line);
+
+  // Index rebuild at boot reads the whole file in 16-record chunks
+  BenchHistory booted(flash, BENCH_UTC_OFFSET);
+  flash.reads = 0;
+  t0 = std::chrono::steady_clock::now();
+  booted.rebuild();
+  t1 = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL_UINT32(h.newestSeq(), booted.newestSeq());
+  snprintf(line, sizeof(line), "rebuild: %.2f ms, %lu reads",
+           std::chrono::duration<double, std::milli>(t1 - t0).count(), (unsigned long)flash.reads);
+  TEST_MESSAGE(line);
+
+  // Chained and indexed queries read about one record per result
+  uint16_t today = historyDay(epoch, BENCH_UTC_OFFSET);
+  HistoryQuery failures = {-1, -1, true, 0, 0, 20};
+  TEST_ASSERT_EQUAL_UINT32(20, timedQuery(booted, failures, "last 20 failures"));
+  HistoryQuery user = {1, 7, false, 0, 0, 20};
+  TEST_ASSERT_EQUAL_UINT32(20, timedQuery(booted, user, "last 20 of one user"));
+  HistoryQuery todayPage = {-1, -1, false, today, 0, 50};
+  TEST_ASSERT_EQUAL_UINT32(50, timedQuery(booted, todayPage, "today, first page"));
+  HistoryQuery dayAgo = {-1, -1, false, (uint16_t)(today - 1), 0, 20};
+  TEST_ASSERT_EQUAL_UINT32(20, timedQuery(booted, dayAgo, "yesterday, first page"));
+  // A plain filter scans, bounded per page
+  HistoryQuery door = {1, -1, false, 0, 0, 20};
+  TEST_ASSERT_LESS_OR_EQUAL(HISTORY_SCAN_MAX, timedQuery(booted, door, "door 1, scan"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_token_equal_matches);
+  RUN_TEST(test_token_mismatch);
+  RUN_TEST(test_token_prefix_and_longer_rejected);
+  RUN_TEST(test_token_empty_secret_matches_nothing);
+  RUN_TEST(test_cache_repeated_user_looked_up_once);
+  RUN_TEST(test_cache_replaces_past_capacity);
+  RUN_TEST(test_cache_truncates_long_name);
+  RUN_TEST(test_benchmark_50k_records);
+  return UNITY_END();
+}
@@ -0,0 +1,257 @@
+// AccessPipeline in a simulated loop on a virtual clock: finger-to-unlock
+// latency with the bookkeeping pipelined against running it inside the scan,
+// the match time carried to the log, the lock poll held off while a door's
+// isLocked write is queued, and a full queue.
+#include <unity.h>
+#include <AccessPipeline.h>
+#include <EventBus.h>
+#include <stdio.h>
+
+// Costs on the NodeMCU: sensor capture + search, the I2C unlock, one
+// Firebase call and a Preferences or LittleFS access
+const uint32_t MATCH_US = 300000;
+const uint32_t NO_FINGER_US = 30000; // getImage() with nothing on the glass
+const uint32_t I2C_US = 2000;
+const uint32_t FIREBASE_US = 400000;
+const uint32_t OTHER_US = 1000;      // the rest of a loop pass
+const uint32_t POLL_PERIOD_US = 1000000;
+const uint32_t STAGE_COST_US[STAGE_COUNT] = {FIREBASE_US, 15000, FIREBASE_US, 15000, 5000, FIREBASE_US};
+const uint32_t ALL_STAGES_US = 3 * FIREBASE_US + 35000;
+const uint8_t DOORS = 2;
+
+static uint32_t nowUs;
+static uint32_t simClock() { return nowUs; }
+static uint64_t monotonicMs() { return nowUs / 1000; }
+
+static bool cloudLocked[DOORS]; // isLocked in the simulated Firebase
+static uint64_t loggedAtMs[8];
+static uint8_t logged;
+
+static void simStage(uint8_t stage, AccessJob &job) {
+  nowUs += STAGE_COST_US[stage];
+  if (stage == STAGE_DOOR_STATE && job.doorChanged) cloudLocked[job.door] = !job.granted;
+  if (stage == STAGE_LOG && logged < 8) loggedAtMs[logged++] = job.atMs;
+}
+
+typedef AccessPipeline<4> Pipeline;
+static Pipeline *pipeline;
+
+// onAccessBookkeeping() of the firmware
+static void bookkeeping(const Event &e) {
+  bool granted = e.type == EV_ACCESS_GRANTED;
+  pipeline->queue(e.source, granted, granted || e.value, e.id, monotonicMs() - (nowUs - e.atUs) / 1000);
+}
+static const EventSub SUBS[] = {
+  {EV_ACCESS_GRANTED, 60, bookkeeping},
+  {EV_ACCESS_DENIED, 60, bookkeeping},
+};
+
+// The firmware loop, reduced to the tasks that matter here, in LOOP_TASKS
+// order: door_lock, access, scan, events
+struct Loop {
+  Pipeline jobs;
+  EventBus<2, 32> bus;
+  bool locked[DOORS];
+  uint32_t fingerAt[DOORS]; // 0 = no finger
+  uint32_t latencyUs[DOORS];
+  uint32_t maxLatencyUs;
+  uint8_t nextScan, nextPoll;
+  uint32_t lastPoll;
+  bool pollGuard;           // skip the poll for a door with a write queued
+  bool inlineBookkeeping;   // every stage inside the scan, before the next one
+  uint8_t dispatchPerPass;
+
+  Loop() : jobs(simStage, simClock), bus(SUBS, simClock), nextScan(0), nextPoll(0), lastPoll(0),
+           pollGuard(true), inlineBookkeeping(false), dispatchPerPass(8) {
+    pipeline = &jobs;
+    for (uint8_t i = 0; i < DOORS; i++) {
+      locked[i] = true;
+      fingerAt[i] = 0;
+      latencyUs[i] = 0;
+    }
+    maxLatencyUs = 0;
+  }
+
+  void poll() {
+    if (nowUs - lastPoll < POLL_PERIOD_US) return;
+    lastPoll = nowUs;
+    uint8_t i = nextPoll;
+    nextPoll = (nextPoll + 1) % DOORS;
+    if (pollGuard && jobs.lockWritePending(i)) return;
+    nowUs += FIREBASE_US;
+    locked[i] = cloudLocked[i];
+  }
+
+  void scan() {
+    uint8_t i = nextScan;
+    nextScan = (nextScan + 1) % DOORS;
+    if (!locked[i]) return;
+    if (!fingerAt[i] || fingerAt[i] > nowUs) {
+      nowUs += NO_FINGER_US;
+      return;
+    }
+    nowUs += MATCH_US;
+    uint32_t matchedAt = nowUs;
+    nowUs += I2C_US;
+    locked[i] = false;
+    latencyUs[i] = nowUs - fingerAt[i];
+    if (latencyUs[i] > maxLatencyUs) maxLatencyUs = latencyUs[i];
+    fingerAt[i] = 0;
+    if (inlineBookkeeping) {
+      AccessJob job = {i, true, true, 5, matchedAt / 1000, 0, "unknown"};
+      for (uint8_t s = 0; s < STAGE_COUNT; s++) simStage(s, job);
+      return;
+    }
+    jobs.lockChanged(i);
+    if (!bus.publish(EV_ACCESS_GRANTED, i, 5, 1, matchedAt)) {
+      jobs.countDropped();
+      jobs.lockChangeLost(i);
+    }
+  }
+
+  void pass() {
+    nowUs += OTHER_US;
+    poll();
+    AccessStep step;
+    jobs.step(step);
+    scan();
+    bus.dispatch(dispatchPerPass);
+  }
+
+  void runUntil(uint32_t us) {
+    while (nowUs < us) pass();
+  }
+};
+
+void setUp() {
+  nowUs = 1000000;
+  logged = 0;
+  for (uint8_t i = 0; i < DOORS; i++) cloudLocked[i] = true;
+}
+void tearDown() {}
+
+static void report(const char *label, const Loop &loop) {
+  char line[112];
+  snprintf(line, sizeof(line), "%s: door 0 %lu ms, door 1 %lu ms to unlock", label,
+           (unsigned long)(loop.latencyUs[0] / 1000), (unsigned long)(loop.latencyUs[1] / 1000));
+  TEST_MESSAGE(line);
+}
+
+// Idle loop: the finger waits for its door's turn, the match and the I2C
+// write, nothing else
+void test_idle_unlock_is_match_plus_i2c() {
+  Loop loop;
+  loop.lastPoll = nowUs; // poll not due
+  loop.fingerAt[0] = nowUs;
+  loop.pass();
+  TEST_ASSERT_FALSE(loop.locked[0]);
+  TEST_ASSERT_EQUAL_UINT32(OTHER_US + MATCH_US + I2C_US, loop.latencyUs[0]);
+  TEST_ASSERT_EQUAL(1, loop.jobs.pending());
+}
+
+// Second door scanned while the first one's bookkeeping runs. Pipelined, it
+// waits for at most one stage; run inside the scan, for all six.
+void test_second_door_waits_one_stage() {
+  uint32_t start = nowUs;
+  Loop piped;
+  piped.lastPoll = start;
+  piped.fingerAt[0] = start;
+  piped.fingerAt[1] = start + 400000;
+  piped.runUntil(start + 10000000);
+  report("pipelined", piped);
+
+  nowUs = start;
+  cloudLocked[0] = cloudLocked[1] = true;
+  Loop inlined;
+  inlined.lastPoll = start;
+  inlined.inlineBookkeeping = true;
+  inlined.fingerAt[0] = start;
+  inlined.fingerAt[1] = start + 400000;
+  inlined.runUntil(start + 10000000);
+  report("in the scan", inlined);
+
+  uint32_t bound = OTHER_US + FIREBASE_US + MATCH_US + I2C_US;
+  TEST_ASSERT_FALSE(piped.locked[0] || piped.locked[1]);
+  TEST_ASSERT_LESS_OR_EQUAL(bound, piped.maxLatencyUs);
+  TEST_ASSERT_GREATER_THAN(ALL_STAGES_US, inlined.latencyUs[1]);
+  TEST_ASSERT_EQUAL(4, logged); // both doors reach the log in each run
+}
+
+// The job is queued passes after the match when the bus is backed up; the log
+// still gets the match time
+void test_job_keeps_match_time() {
+  Loop loop;
+  loop.lastPoll = nowUs;
+  loop.dispatchPerPass = 0; // bus held back
+  loop.fingerAt[0] = nowUs;
+  loop.pass();
+  uint64_t matchMs = (nowUs - I2C_US) / 1000;
+  for (int i = 0; i < 3; i++) loop.pass();
+  TEST_ASSERT_EQUAL(0, loop.jobs.pending());
+  loop.dispatchPerPass = 8;
+  loop.runUntil(nowUs + 5000000);
+  TEST_ASSERT_EQUAL(1, logged);
+  TEST_ASSERT_TRUE(monotonicMs() - matchMs > 4000);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)matchMs, (uint32_t)loggedAtMs[0]);
+}
+
+// Firebase still says locked until the door stage writes it, and the poll
+// runs before the access task. A poll in that window must not relock the door
+// the scan just opened.
+static void unlockThenPoll(Loop &loop) {
+  loop.lastPoll = nowUs;
+  loop.fingerAt[0] = nowUs;
+  loop.pass(); // scan unlocks, poll not due
+  TEST_ASSERT_FALSE(loop.locked[0]);
+  loop.lastPoll = nowUs - POLL_PERIOD_US;
+  loop.pass(); // poll of door 0, then its door stage
+}
+
+void test_lock_poll_waits_for_door_write() {
+  Loop loop;
+  unlockThenPoll(loop);
+  TEST_ASSERT_FALSE(loop.locked[0]);
+  TEST_ASSERT_FALSE(loop.jobs.lockWritePending(0));
+  TEST_ASSERT_FALSE(cloudLocked[0]);
+  loop.lastPoll = nowUs - POLL_PERIOD_US;
+  loop.nextPoll = 0;
+  loop.pass(); // polled now: agrees with the scan
+  TEST_ASSERT_FALSE(loop.locked[0]);
+
+  // Without the guard the same window relocks the door
+  cloudLocked[0] = true;
+  Loop unguarded;
+  unguarded.pollGuard = false;
+  unlockThenPoll(unguarded);
+  TEST_ASSERT_TRUE(unguarded.locked[0]);
+}
+
+// A full queue drops the job and does not leave the poll blocked
+void test_full_queue_drops_job() {
+  Pipeline jobs(simStage, simClock);
+  pipeline = &jobs;
+  for (uint8_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(jobs.queue(1, false, false, 0, i));
+  jobs.lockChanged(0);
+  TEST_ASSERT_FALSE(jobs.queue(0, true, true, 5, 9));
+  TEST_ASSERT_EQUAL_UINT32(1, jobs.dropped());
+  TEST_ASSERT_FALSE(jobs.lockWritePending(0));
+
+  // Each step runs one stage of the oldest job
+  AccessStep step;
+  for (uint8_t s = 0; s < STAGE_COUNT; s++) {
+    TEST_ASSERT_TRUE(jobs.step(step));
+    TEST_ASSERT_EQUAL(s, step.stage);
+    TEST_ASSERT_EQUAL_UINT32(STAGE_COST_US[s], step.us);
+  }
+  TEST_ASSERT_EQUAL(3, jobs.pending());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_idle_unlock_is_match_plus_i2c);
+  RUN_TEST(test_second_door_waits_one_stage);
+  RUN_TEST(test_job_keeps_match_time);
+  RUN_TEST(test_lock_poll_waits_for_door_write);
+  RUN_TEST(test_full_queue_drops_job);
+  return UNITY_END();
+}
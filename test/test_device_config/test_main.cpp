@@ -0,0 +1,114 @@
+// DeviceConfig: round trip, migration from older schemas, newer blobs left
+// read-only, corrupt blobs falling back to defaults
+#include <unity.h>
+#include <DeviceConfig.h>
+
+// Layouts as the v1 firmware stored them
+struct __attribute__((packed)) NodeConfigV1 {
+  uint16_t relaysCheckMs;
+  uint16_t doorLockCheckMs;
+  uint8_t maxRelayId;
+  char deviceId[24];
+};
+
+struct __attribute__((packed)) MegaConfigV1 {
+  uint8_t relayBasePin;
+  uint8_t maxRelays;
+  uint8_t relayActiveLow;
+  char phoneNumber[20];
+};
+
+// A future v3 that appends a field
+struct __attribute__((packed)) NodeConfigV3 {
+  NodeConfig v2;
+  uint16_t futureField;
+};
+
+static uint8_t blob[sizeof(ConfigHeader) + 255];
+
+void setUp() { memset(blob, 0xFF, sizeof(blob)); }
+void tearDown() {}
+
+void test_round_trip() {
+  NodeConfig in = NODE_CONFIG_DEFAULTS;
+  in.relaysCheckMs = 2500;
+  strcpy(in.deviceId, "door_a");
+  size_t n = configEncode(in, NODE_CONFIG_VERSION, blob, sizeof(blob));
+  TEST_ASSERT_EQUAL(sizeof(ConfigHeader) + sizeof(NodeConfig), n);
+  NodeConfig out;
+  TEST_ASSERT_EQUAL(CONFIG_OK, configDecode(blob, n, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL_MEMORY(&in, &out, sizeof(in));
+}
+
+void test_encode_needs_room() {
+  NodeConfig in = NODE_CONFIG_DEFAULTS;
+  TEST_ASSERT_EQUAL(0, configEncode(in, NODE_CONFIG_VERSION, blob, sizeof(ConfigHeader) + sizeof(in) - 1));
+}
+
+void test_v1_node_blob_migrates_with_defaults_for_new_fields() {
+  NodeConfigV1 v1 = {3000, 2000, 12, "legacy_door"};
+  size_t n = configEncode(v1, 1, blob, sizeof(blob));
+  NodeConfig out;
+  TEST_ASSERT_EQUAL(CONFIG_MIGRATED, configDecode(blob, n, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(3000, out.relaysCheckMs);
+  TEST_ASSERT_EQUAL(12, out.maxRelayId);
+  TEST_ASSERT_EQUAL_STRING("legacy_door", out.deviceId);
+  TEST_ASSERT_EQUAL(NODE_CONFIG_DEFAULTS.doorCount, out.doorCount);
+  TEST_ASSERT_EQUAL_STRING(NODE_CONFIG_DEFAULTS.backDeviceId, out.backDeviceId);
+}
+
+void test_v1_mega_blob_gets_sms_defaults() {
+  MegaConfigV1 v1 = {30, 8, 0, "+15550100"};
+  size_t n = configEncode(v1, 1, blob, sizeof(blob));
+  MegaConfig out;
+  TEST_ASSERT_EQUAL(CONFIG_MIGRATED, configDecode(blob, n, MEGA_CONFIG_VERSION, out, MEGA_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(30, out.relayBasePin);
+  TEST_ASSERT_EQUAL_STRING("+15550100", out.phoneNumber);
+  TEST_ASSERT_EQUAL_STRING("", out.extraPhone[0]);
+  TEST_ASSERT_EQUAL(MEGA_CONFIG_DEFAULTS.smsWindowS, out.smsWindowS);
+  TEST_ASSERT_EQUAL(MEGA_CONFIG_DEFAULTS.smsGapS, out.smsGapS);
+}
+
+void test_newer_blob_is_read_only() {
+  NodeConfigV3 v3;
+  v3.v2 = NODE_CONFIG_DEFAULTS;
+  v3.v2.doorCount = 2;
+  v3.futureField = 0xBEEF;
+  size_t n = configEncode(v3, NODE_CONFIG_VERSION + 1, blob, sizeof(blob));
+  NodeConfig out;
+  TEST_ASSERT_EQUAL(CONFIG_NEWER, configDecode(blob, n, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(2, out.doorCount);
+  TEST_ASSERT_EQUAL_STRING("newer (read-only)", configStatusName(CONFIG_NEWER));
+}
+
+void test_corrupt_blobs_fall_back_to_defaults() {
+  NodeConfig in = NODE_CONFIG_DEFAULTS;
+  in.maxRelayId = 3;
+  size_t n = configEncode(in, NODE_CONFIG_VERSION, blob, sizeof(blob));
+  NodeConfig out;
+
+  blob[sizeof(ConfigHeader) + 2] ^= 0x01; // payload bit flip
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, n, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(NODE_CONFIG_DEFAULTS.maxRelayId, out.maxRelayId);
+  blob[sizeof(ConfigHeader) + 2] ^= 0x01;
+
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, n - 1, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, 3, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  blob[0] ^= 0xFF; // magic
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, n, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+
+  memset(blob, 0xFF, sizeof(blob)); // erased EEPROM / empty Preferences key
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, sizeof(blob), NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+  TEST_ASSERT_EQUAL(CONFIG_DEFAULTS, configDecode(blob, 0, NODE_CONFIG_VERSION, out, NODE_CONFIG_DEFAULTS));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_encode_needs_room);
+  RUN_TEST(test_v1_node_blob_migrates_with_defaults_for_new_fields);
+  RUN_TEST(test_v1_mega_blob_gets_sms_defaults);
+  RUN_TEST(test_newer_blob_is_read_only);
+  RUN_TEST(test_corrupt_blobs_fall_back_to_defaults);
+  return UNITY_END();
+}
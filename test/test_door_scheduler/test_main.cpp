@@ -0,0 +1,259 @@
+// DoorScheduler: turn order, the per-door decision and the touch line, then
+// two scripted sensors in a simulated loop showing that scan-to-unlock
+// latency and the loop pass hold steady when a second door is added.
+#include <unity.h>
+#include <DoorScheduler.h>
+#include <stdio.h>
+
+// Costs on the NodeMCU: a read with no finger, capture + search, the I2C unlock
+const uint32_t NO_FINGER_US = 30000;
+const uint32_t MATCH_US = 300000;
+const uint32_t I2C_US = 2000;
+const uint32_t OTHER_US = 5000;      // the rest of a loop pass
+const uint32_t RELOCK_US = 2000000;  // the Mega relocks after the unlock pulse
+const uint32_t HOLD_US = 1500000;    // finger left on the glass
+const uint8_t DOORS = 2;
+
+static uint32_t nowUs;
+static DoorScanState states[DOORS];
+static bool touchedNow[DOORS];
+static uint8_t touchAsks;
+
+static DoorScanState fakeState(uint8_t door) { return states[door]; }
+static bool fakeTouched(uint8_t door) {
+  touchAsks++;
+  return touchedNow[door];
+}
+
+typedef DoorScheduler<DOORS> Scheduler;
+
+void setUp() {
+  nowUs = 0;
+  touchAsks = 0;
+  for (uint8_t i = 0; i < DOORS; i++) {
+    states[i] = {true, false, false};
+    touchedNow[i] = false;
+  }
+}
+void tearDown() {}
+
+void test_turns_one_door_per_pass() {
+  Scheduler sched(fakeState, fakeTouched);
+  uint8_t door;
+  sched.next(door);
+  TEST_ASSERT_EQUAL(0, door); // one door until told otherwise
+  sched.next(door);
+  TEST_ASSERT_EQUAL(0, door);
+
+  sched.setDoorCount(2);
+  uint8_t order[4];
+  for (int i = 0; i < 4; i++) sched.next(order[i]);
+  const uint8_t want[4] = {0, 1, 0, 1};
+  TEST_ASSERT_EQUAL_MEMORY(want, order, 4);
+
+  sched.setDoorCount(7); // out of range: one door
+  TEST_ASSERT_EQUAL(1, sched.doorCount());
+  sched.setDoorCount(0);
+  TEST_ASSERT_EQUAL(1, sched.doorCount());
+}
+
+void test_decision_per_door() {
+  Scheduler sched(fakeState, fakeTouched);
+  sched.setDoorCount(2);
+  uint8_t door;
+  states[0] = {false, false, false}; // open
+  states[1] = {true, true, false};   // locked out
+  TEST_ASSERT_EQUAL(SCAN_IDLE, sched.next(door));
+  TEST_ASSERT_EQUAL(SCAN_LOCKOUT, sched.next(door));
+  TEST_ASSERT_EQUAL(1, door);
+  TEST_ASSERT_FALSE(sched.polling());
+
+  states[1] = {true, false, false};
+  TEST_ASSERT_TRUE(sched.polling());
+  sched.next(door);
+  TEST_ASSERT_EQUAL(SCAN_READ, sched.next(door));
+
+  // Touch line: read only with a finger on it, and asked only when a read is due
+  states[0] = {true, false, true};
+  states[1] = {false, false, false};
+  TEST_ASSERT_FALSE(sched.polling());
+  TEST_ASSERT_EQUAL(SCAN_IDLE, sched.next(door));
+  TEST_ASSERT_EQUAL(1, touchAsks);
+  TEST_ASSERT_EQUAL(SCAN_IDLE, sched.next(door));
+  TEST_ASSERT_EQUAL(1, touchAsks);
+  touchedNow[0] = true;
+  TEST_ASSERT_EQUAL(SCAN_READ, sched.next(door));
+  states[0].lockedOut = true;
+  sched.next(door);
+  TEST_ASSERT_EQUAL(SCAN_LOCKOUT, sched.next(door));
+  TEST_ASSERT_EQUAL(2, touchAsks);
+}
+
+// A scripted sensor: fingers put on at given times, each held HOLD_US
+struct Finger {
+  uint32_t onUs;
+  bool known;
+};
+
+struct Sensor {
+  const Finger *script;
+  uint8_t len;
+  uint8_t pos;
+  uint32_t unlockedAt;  // 0 = locked
+  uint32_t maxLatencyUs, totalLatencyUs;
+  uint8_t unlocks, denials;
+
+  const Finger *finger() const {
+    if (pos < len && script[pos].onUs <= nowUs && nowUs < script[pos].onUs + HOLD_US) return &script[pos];
+    return nullptr;
+  }
+  void expire() {
+    while (pos < len && nowUs >= script[pos].onUs + HOLD_US) pos++;
+  }
+};
+
+static Sensor sensors[DOORS];
+
+// The firmware's scanNextDoor() and getFingerprintID() over the sensors
+struct Loop {
+  Scheduler sched;
+  uint32_t maxPassUs;
+
+  explicit Loop(uint8_t doors) : sched(fakeState, fakeTouched), maxPassUs(0) { sched.setDoorCount(doors); }
+
+  void pass() {
+    uint32_t start = nowUs;
+    nowUs += OTHER_US;
+    for (uint8_t i = 0; i < sched.doorCount(); i++) {
+      Sensor &s = sensors[i];
+      if (s.unlockedAt && nowUs - s.unlockedAt >= RELOCK_US) s.unlockedAt = 0;
+      s.expire();
+      states[i].locked = !s.unlockedAt;
+      touchedNow[i] = s.finger() != nullptr;
+    }
+    uint8_t door;
+    if (sched.next(door) == SCAN_READ) read(door);
+    if (nowUs - start > maxPassUs) maxPassUs = nowUs - start;
+  }
+
+  void read(uint8_t door) {
+    Sensor &s = sensors[door];
+    const Finger *f = s.finger();
+    if (!f) {
+      nowUs += NO_FINGER_US;
+      return;
+    }
+    uint32_t onUs = f->onUs;
+    nowUs += MATCH_US;
+    s.pos++; // one scan per finger
+    if (!f->known) {
+      s.denials++;
+      return;
+    }
+    nowUs += I2C_US;
+    s.unlockedAt = nowUs;
+    uint32_t latency = nowUs - onUs;
+    if (latency > s.maxLatencyUs) s.maxLatencyUs = latency;
+    s.totalLatencyUs += latency;
+    s.unlocks++;
+  }
+
+  void runUntil(uint32_t us) {
+    while (nowUs < us) pass();
+  }
+};
+
+// Front door: a finger every 8 s or so, one in five unknown
+static Finger frontScript[64];
+// Back door: out of step with the front, some of them at the same moment
+static Finger backScript[64];
+
+static void makeScripts() {
+  uint32_t rng = 2024;
+  uint32_t t = 500000;
+  for (int i = 0; i < 64; i++) {
+    rng = rng * 1664525UL + 1013904223UL;
+    t += 6000000 + (rng >> 8) % 4000000;
+    frontScript[i] = {t, (rng >> 24) % 5 != 0};
+  }
+  for (int i = 0; i < 64; i++) {
+    rng = rng * 1664525UL + 1013904223UL;
+    // every fourth one lands on a front finger
+    uint32_t at = i % 4 == 0 ? frontScript[i].onUs : frontScript[i].onUs + 700000 + (rng >> 8) % 2000000;
+    backScript[i] = {at, (rng >> 24) % 5 != 0};
+  }
+}
+
+static void resetSensors() {
+  sensors[0] = {frontScript, 64, 0, 0, 0, 0, 0, 0};
+  sensors[1] = {backScript, 64, 0, 0, 0, 0, 0, 0};
+  for (uint8_t i = 0; i < DOORS; i++) states[i] = {true, false, false};
+}
+
+static void report(const char *label, const Loop &loop, const Sensor &s) {
+  char line[112];
+  snprintf(line, sizeof(line), "%s: %u unlocks, mean %lu ms, worst %lu ms, longest pass %lu ms", label, s.unlocks,
+           (unsigned long)(s.totalLatencyUs / s.unlocks / 1000), (unsigned long)(s.maxLatencyUs / 1000),
+           (unsigned long)(loop.maxPassUs / 1000));
+  TEST_MESSAGE(line);
+}
+
+// The front door alone, then with the back door served by the same loop
+void test_latency_holds_with_second_door() {
+  makeScripts();
+  uint32_t end = backScript[63].onUs + 10000000;
+
+  resetSensors();
+  nowUs = 0;
+  Loop one(1);
+  one.runUntil(end);
+  Sensor alone = sensors[0];
+  report("front alone", one, alone);
+
+  resetSensors();
+  nowUs = 0;
+  Loop two(2);
+  two.runUntil(end);
+  report("front, two doors", two, sensors[0]);
+  report("back, two doors", two, sensors[1]);
+
+  // Every known finger opened its door
+  TEST_ASSERT_EQUAL(64, alone.unlocks + alone.denials);
+  TEST_ASSERT_EQUAL(64, sensors[0].unlocks + sensors[0].denials);
+  TEST_ASSERT_EQUAL(64, sensors[1].unlocks + sensors[1].denials);
+  // A pass is one sensor read with one door or two
+  TEST_ASSERT_EQUAL_UINT32(one.maxPassUs, two.maxPassUs);
+  TEST_ASSERT_EQUAL_UINT32(OTHER_US + MATCH_US + I2C_US, two.maxPassUs);
+  // A finger waits at most for one read of the other door: a match when both
+  // doors are scanned at the same moment, an empty read otherwise
+  uint32_t worstAlone = alone.maxLatencyUs;
+  TEST_ASSERT_LESS_OR_EQUAL(worstAlone + OTHER_US + MATCH_US + I2C_US, sensors[0].maxLatencyUs);
+  TEST_ASSERT_LESS_OR_EQUAL(worstAlone + OTHER_US + MATCH_US + I2C_US, sensors[1].maxLatencyUs);
+  uint32_t meanAlone = alone.totalLatencyUs / alone.unlocks;
+  TEST_ASSERT_LESS_OR_EQUAL(meanAlone + OTHER_US + NO_FINGER_US + MATCH_US / 4, sensors[0].totalLatencyUs / sensors[0].unlocks);
+}
+
+// Front door with a touch line: while nobody touches it, the back sensor is
+// read every other pass and the front costs nothing
+void test_touch_line_door_costs_nothing_idle() {
+  makeScripts();
+  resetSensors();
+  states[0].touchLine = true;
+  sensors[0].len = 0; // nobody at the front
+  nowUs = 0;
+  Loop two(2);
+  uint32_t end = backScript[63].onUs + 10000000;
+  two.runUntil(end);
+  report("back, front on touch line", two, sensors[1]);
+  TEST_ASSERT_EQUAL(64, sensors[1].unlocks + sensors[1].denials);
+  TEST_ASSERT_LESS_OR_EQUAL(OTHER_US * 2 + NO_FINGER_US + MATCH_US + I2C_US, sensors[1].maxLatencyUs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_turns_one_door_per_pass);
+  RUN_TEST(test_decision_per_door);
+  RUN_TEST(test_latency_holds_with_second_door);
+  RUN_TEST(test_touch_line_door_costs_nothing_idle);
+  return UNITY_END();
+}
@@ -0,0 +1,256 @@
+// EventBus: priority order, urgent subscribers of every queued event before
+// the rest, a full queue, bounded dispatch, the event time and the latency/depth
+// stats, plus the cost per event and the queue latency of a burst
+#include <unity.h>
+#include <EventBus.h>
+#include <chrono>
+#include <stdio.h>
+
+static uint32_t clockNow;
+static uint32_t lastUrgentUs;
+static char calls[64];
+static uint8_t ncalls;
+
+static uint32_t fakeClock() { return clockNow; }
+
+static void note(char c) {
+  if (ncalls < sizeof(calls) - 1) calls[ncalls++] = c;
+  calls[ncalls] = '\0';
+}
+
+// Upper case: urgent (door actuator, relays); lower case: cloud work
+static void doorActuator(const Event &) { note('D'); }
+static void relayDriver(const Event &) { note('R'); }
+static void cloudLog(const Event &) {
+  note('c');
+  clockNow += 1000;
+}
+static void historyWrite(const Event &) { note('h'); }
+static void cloudRelay(const Event &) { note('r'); }
+
+static constexpr EventSub SUBS[] = {
+  {EV_ACCESS_GRANTED, 200, doorActuator},
+  {EV_RELAY_CHANGED, 150, relayDriver},
+  {EV_ACCESS_GRANTED, 50, cloudLog},
+  {EV_ACCESS_GRANTED, 40, historyWrite},
+  {EV_RELAY_CHANGED, 10, cloudRelay},
+};
+static_assert(eventSubsSorted(SUBS, sizeof(SUBS) / sizeof(SUBS[0])), "SUBS must be sorted");
+
+static constexpr EventSub UNSORTED[] = {
+  {EV_ACCESS_GRANTED, 10, cloudLog},
+  {EV_ACCESS_GRANTED, 200, doorActuator},
+};
+static_assert(!eventSubsSorted(UNSORTED, 2), "order check must catch this");
+
+typedef EventBus<5, 4> Bus;
+
+void setUp() {
+  clockNow = 0;
+  lastUrgentUs = 0;
+  ncalls = 0;
+  calls[0] = '\0';
+}
+void tearDown() {}
+
+void test_single_event_runs_subscribers_by_priority() {
+  Bus bus(SUBS, fakeClock);
+  TEST_ASSERT_TRUE(bus.publish(EV_ACCESS_GRANTED, 0, 3, 0));
+  TEST_ASSERT_EQUAL(1, bus.dispatch(4));
+  TEST_ASSERT_EQUAL_STRING("Dch", calls);
+  TEST_ASSERT_EQUAL(0, bus.pending());
+  TEST_ASSERT_EQUAL_UINT32(3, bus.stats().delivered);
+}
+
+void test_urgent_work_of_all_events_goes_first() {
+  Bus bus(SUBS, fakeClock);
+  bus.publish(EV_ACCESS_GRANTED, 0, 3, 0);
+  bus.publish(EV_RELAY_CHANGED, 0, 4, 1);
+  bus.publish(EV_ACCESS_GRANTED, 1, 7, 0);
+  // One event finished per call: the actuators of all three still run now
+  TEST_ASSERT_EQUAL(1, bus.dispatch(1));
+  TEST_ASSERT_EQUAL_STRING("DRDch", calls);
+  TEST_ASSERT_EQUAL(2, bus.pending());
+  // Already-run urgent subscribers are not called again
+  TEST_ASSERT_EQUAL(2, bus.dispatch(4));
+  TEST_ASSERT_EQUAL_STRING("DRDchrch", calls);
+}
+
+void test_full_queue_drops_new_events() {
+  Bus bus(SUBS, fakeClock);
+  for (int i = 0; i < 4; i++) TEST_ASSERT_TRUE(bus.publish(EV_WATER_CHANGED, 0, 0, i & 1));
+  TEST_ASSERT_FALSE(bus.publish(EV_ACCESS_GRANTED, 0, 1, 0));
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().dropped);
+  TEST_ASSERT_EQUAL_UINT32(4, bus.stats().published);
+  TEST_ASSERT_EQUAL(4, bus.stats().maxDepth);
+  TEST_ASSERT_EQUAL(4, bus.dispatch(10)); // nobody subscribes to water
+  TEST_ASSERT_EQUAL_STRING("", calls);
+  TEST_ASSERT_TRUE(bus.publish(EV_ACCESS_GRANTED, 0, 1, 0));
+}
+
+void test_ring_wraps() {
+  Bus bus(SUBS, fakeClock);
+  for (int round = 0; round < 5; round++) {
+    TEST_ASSERT_TRUE(bus.publish(EV_RELAY_CHANGED, 0, round, 1));
+    TEST_ASSERT_TRUE(bus.publish(EV_RELAY_CHANGED, 0, round, 0));
+    TEST_ASSERT_TRUE(bus.publish(EV_RELAY_CHANGED, 0, round, 1));
+    TEST_ASSERT_EQUAL(3, bus.dispatch(3));
+  }
+  TEST_ASSERT_EQUAL_UINT32(30, bus.stats().delivered);
+}
+
+void test_latency_and_reset_peaks() {
+  Bus bus(SUBS, fakeClock);
+  clockNow = 100;
+  bus.publish(EV_ACCESS_GRANTED, 0, 3, 0);
+  bus.publish(EV_ACCESS_GRANTED, 0, 4, 0);
+  clockNow = 600;
+  bus.dispatch(2);
+  // Second event: published at 100, done after two cloudLog calls (2000 us)
+  TEST_ASSERT_EQUAL_UINT32(2500, bus.stats().maxLatencyUs);
+  TEST_ASSERT_EQUAL(2, bus.stats().maxDepth);
+  bus.publish(EV_RELAY_CHANGED, 0, 1, 1);
+  bus.resetPeaks();
+  TEST_ASSERT_EQUAL_UINT32(0, bus.stats().maxLatencyUs);
+  TEST_ASSERT_EQUAL(1, bus.stats().maxDepth);
+}
+
+// A producer that saw the event earlier passes its time; latency counts from it
+static uint32_t seenAtUs;
+static void seenAt(const Event &e) { seenAtUs = e.atUs; }
+static const EventSub SEEN[] = {
+  {EV_ACCESS_GRANTED, 10, seenAt},
+};
+
+void test_publish_with_event_time() {
+  EventBus<1, 4> bus(SEEN, fakeClock);
+  clockNow = 300000;
+  bus.publish(EV_ACCESS_GRANTED, 0, 3, 0, 1000); // matched at 1 ms, published at 300 ms
+  clockNow = 301000;
+  bus.dispatch(1);
+  TEST_ASSERT_EQUAL_UINT32(1000, seenAtUs);
+  TEST_ASSERT_EQUAL_UINT32(300000, bus.stats().maxLatencyUs);
+  bus.publish(EV_ACCESS_GRANTED, 0, 3, 0); // no time given: now
+  bus.dispatch(1);
+  TEST_ASSERT_EQUAL_UINT32(301000, seenAtUs);
+}
+
+typedef EventBus<1, 4> ChainBus;
+static ChainBus *chainBus;
+
+// Each denial publishes a follow-up until value 2
+static void republish(const Event &e) {
+  note('p');
+  if (e.value < 2) chainBus->publish(EV_ACCESS_DENIED, 0, 0, e.value + 1);
+}
+static const EventSub CHAIN[] = {
+  {EV_ACCESS_DENIED, 10, republish},
+};
+
+void test_publish_from_subscriber_is_queued() {
+  ChainBus bus(CHAIN, fakeClock);
+  chainBus = &bus;
+  bus.publish(EV_ACCESS_DENIED, 0, 0, 0);
+  TEST_ASSERT_EQUAL(1, bus.dispatch(1));
+  TEST_ASSERT_EQUAL_STRING("p", calls);
+  TEST_ASSERT_EQUAL(1, bus.pending()); // runs on the next pass, not nested
+  TEST_ASSERT_EQUAL(2, bus.dispatch(4));
+  TEST_ASSERT_EQUAL_STRING("ppp", calls);
+  TEST_ASSERT_EQUAL(0, bus.pending());
+}
+
+// Firmware-like table and queue: 32 entries, 8 events finished per loop pass
+static volatile uint32_t benchSink;
+static void benchHandler(const Event &e) { benchSink += e.value; }
+static void benchUrgent(const Event &e) {
+  benchSink += e.value;
+  clockNow += 20; // Mega relay write
+  lastUrgentUs = clockNow;
+}
+static void benchCloud(const Event &e) {
+  benchSink += e.value;
+  clockNow += 5000; // Firebase write
+}
+static constexpr EventSub BENCH_SUBS[] = {
+  {EV_RELAY_CHANGED, 200, benchUrgent},
+  {EV_ACCESS_GRANTED, 200, benchUrgent},
+  {EV_RELAY_CHANGED, 150, benchHandler},
+  {EV_WATER_CHANGED, 150, benchHandler},
+  {EV_ACCESS_GRANTED, 50, benchCloud},
+  {EV_RELAY_CHANGED, 50, benchCloud},
+};
+static_assert(eventSubsSorted(BENCH_SUBS, sizeof(BENCH_SUBS) / sizeof(BENCH_SUBS[0])), "BENCH_SUBS must be sorted");
+typedef EventBus<6, 32> BenchBus;
+const uint8_t BENCH_DISPATCH_MAX = 8;
+
+void test_benchmark_dispatch_cost() {
+  BenchBus bus(BENCH_SUBS, fakeClock);
+  const uint32_t ROUNDS = 20000;
+  char line[96];
+
+  // One event at a time: publish + dispatch of a relay change (3 subscribers)
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    bus.publish(EV_RELAY_CHANGED, 0, 1 + i % 8, i & 1);
+    bus.dispatch(1);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  double singleNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / ROUNDS;
+  TEST_ASSERT_EQUAL_UINT32(3 * ROUNDS, bus.stats().delivered);
+  snprintf(line, sizeof(line), "single event: %.0f ns/event, 3 subscribers", singleNs);
+  TEST_MESSAGE(line);
+
+  // Full-queue bursts of mixed types, drained 8 per pass
+  const uint32_t BURSTS = ROUNDS / 32;
+  uint32_t delivered = bus.stats().delivered;
+  t0 = std::chrono::steady_clock::now();
+  for (uint32_t b = 0; b < BURSTS; b++) {
+    for (uint8_t i = 0; i < 32; i++) bus.publish(i % 3 == 0 ? EV_WATER_CHANGED : EV_RELAY_CHANGED, 0, i, i & 1);
+    while (bus.pending()) bus.dispatch(BENCH_DISPATCH_MAX);
+  }
+  t1 = std::chrono::steady_clock::now();
+  double burstNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / (BURSTS * 32);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.stats().dropped);
+  TEST_ASSERT_EQUAL_UINT32(BURSTS * (11 * 1 + 21 * 3), bus.stats().delivered - delivered);
+  snprintf(line, sizeof(line), "32-event burst: %.0f ns/event, drained %u per pass", burstNs, BENCH_DISPATCH_MAX);
+  TEST_MESSAGE(line);
+}
+
+// Queue latency on the simulated clock: a burst of relay changes (Firebase
+// write each) with loop passes 10 ms apart. The relay writes all happen in the
+// first pass; the cloud work spreads over the following ones.
+void test_burst_latency() {
+  BenchBus bus(BENCH_SUBS, fakeClock);
+  const uint8_t BURST = 32;
+  for (uint8_t i = 0; i < BURST; i++) bus.publish(EV_RELAY_CHANGED, 0, 1 + i % 16, i & 1);
+  TEST_ASSERT_EQUAL(BURST, bus.stats().maxDepth);
+  uint8_t passes = 0;
+  while (bus.pending()) {
+    bus.dispatch(BENCH_DISPATCH_MAX);
+    passes++;
+    clockNow += 10000;
+  }
+  TEST_ASSERT_EQUAL(BURST / BENCH_DISPATCH_MAX, passes);
+  // 32 relay writes (20 us each) before the first Firebase write
+  TEST_ASSERT_EQUAL_UINT32(BURST * 20, lastUrgentUs);
+  // Last event: all relay writes, 32 cloud writes and three 10 ms gaps
+  TEST_ASSERT_EQUAL_UINT32(BURST * 20 + BURST * 5000 + 3 * 10000, bus.stats().maxLatencyUs);
+  char line[96];
+  snprintf(line, sizeof(line), "burst of %u: relays done after %lu us, last event after %lu us", BURST,
+           (unsigned long)lastUrgentUs, (unsigned long)bus.stats().maxLatencyUs);
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_event_runs_subscribers_by_priority);
+  RUN_TEST(test_urgent_work_of_all_events_goes_first);
+  RUN_TEST(test_full_queue_drops_new_events);
+  RUN_TEST(test_ring_wraps);
+  RUN_TEST(test_latency_and_reset_peaks);
+  RUN_TEST(test_publish_with_event_time);
+  RUN_TEST(test_publish_from_subscriber_is_queued);
+  RUN_TEST(test_benchmark_dispatch_cost);
+  RUN_TEST(test_burst_latency);
+  return UNITY_END();
+}
@@ -0,0 +1,137 @@
+// FingerprintFramer: command packets leave in one write, replies are
+// checked and timed, timeouts and corrupt replies are counted
+#include <unity.h>
+#include <FingerprintLink.h>
+#include <string.h>
+
+// EF 01 | address FF FF FF FF | type | length (payload + 2) | payload | sum
+static uint8_t packet(uint8_t *out, uint8_t type, const uint8_t *payload, uint8_t n) {
+  const uint8_t head[] = {0xEF, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, type, 0, (uint8_t)(n + 2)};
+  memcpy(out, head, sizeof(head));
+  memcpy(out + 9, payload, n);
+  uint16_t sum = type + n + 2;
+  for (uint8_t i = 0; i < n; i++) sum += payload[i];
+  out[9 + n] = sum >> 8;
+  out[10 + n] = sum & 0xFF;
+  return 11 + n;
+}
+
+static const uint8_t GEN_IMG[] = {0x01};
+static const uint8_t ACK_OK[] = {0x00};
+
+static FingerprintFramer framer;
+
+void setUp() { framer = FingerprintFramer(); }
+void tearDown() {}
+
+static void sendCommand(uint32_t nowUs) {
+  uint8_t pkt[16];
+  uint8_t n = packet(pkt, 0x01, GEN_IMG, sizeof(GEN_IMG));
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t ready = framer.pushTx(pkt[i]);
+    TEST_ASSERT_EQUAL(i + 1 == n ? n : 0, ready);
+  }
+  TEST_ASSERT_EQUAL_MEMORY(pkt, framer.txBuffer(), n);
+  TEST_ASSERT_TRUE(framer.lastTxWasCommand());
+  framer.commandSent(nowUs);
+}
+
+static void receive(const uint8_t *p, uint8_t n, uint32_t nowUs) {
+  for (uint8_t i = 0; i < n; i++) framer.pushRx(p[i], nowUs);
+}
+
+void test_command_goes_out_in_one_write() {
+  sendCommand(1000);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().commands);
+}
+
+void test_non_packet_bytes_pass_through() {
+  TEST_ASSERT_EQUAL(1, framer.pushTx(0x55));
+  TEST_ASSERT_EQUAL_HEX8(0x55, framer.txBuffer()[0]);
+  TEST_ASSERT_FALSE(framer.lastTxWasCommand());
+  framer.pushTx(0xEF);
+  TEST_ASSERT_EQUAL(2, framer.pushTx(0x02)); // EF not followed by 01
+}
+
+void test_reply_is_timed() {
+  sendCommand(1000);
+  uint8_t ack[16];
+  uint8_t n = packet(ack, 0x07, ACK_OK, sizeof(ACK_OK));
+  receive(ack, n, 4500);
+  const FingerprintLinkStats &st = framer.linkStats();
+  TEST_ASSERT_EQUAL_UINT32(1, st.replies);
+  TEST_ASSERT_EQUAL_UINT32(3500, st.rttLastUs);
+  TEST_ASSERT_EQUAL_UINT32(3500, framer.averageRttUs());
+  TEST_ASSERT_EQUAL(0, framer.errorRate());
+}
+
+void test_noise_before_reply_is_skipped() {
+  sendCommand(0);
+  const uint8_t noise[] = {0x00, 0xFF, 0x13};
+  receive(noise, sizeof(noise), 10);
+  uint8_t ack[16];
+  receive(ack, packet(ack, 0x07, ACK_OK, sizeof(ACK_OK)), 20);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().replies);
+  TEST_ASSERT_EQUAL_UINT32(0, framer.linkStats().badPackets);
+}
+
+void test_corrupt_reply_counts_as_error() {
+  sendCommand(0);
+  uint8_t ack[16];
+  uint8_t n = packet(ack, 0x07, ACK_OK, sizeof(ACK_OK));
+  ack[9] ^= 0x01; // payload bit flip
+  receive(ack, n, 100);
+  TEST_ASSERT_EQUAL_UINT32(0, framer.linkStats().replies);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().badPackets);
+  TEST_ASSERT_EQUAL(100, framer.errorRate());
+
+  // The framer resynchronises on the next packet
+  n = packet(ack, 0x07, ACK_OK, sizeof(ACK_OK));
+  receive(ack, n, 200);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().replies);
+}
+
+void test_unanswered_command_times_out() {
+  sendCommand(0);
+  framer.checkTimeout(FP_REPLY_TIMEOUT_US);
+  TEST_ASSERT_EQUAL_UINT32(0, framer.linkStats().timeouts);
+  framer.checkTimeout(FP_REPLY_TIMEOUT_US + 1);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().timeouts);
+  // A late reply is counted but not timed
+  uint8_t ack[16];
+  receive(ack, packet(ack, 0x07, ACK_OK, sizeof(ACK_OK)), FP_REPLY_TIMEOUT_US + 10);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().replies);
+  TEST_ASSERT_EQUAL_UINT32(0, framer.linkStats().rttTotalUs);
+}
+
+void test_large_data_packet() {
+  uint8_t payload[80];
+  for (uint8_t i = 0; i < sizeof(payload); i++) payload[i] = i * 7;
+  uint8_t pkt[FP_PACKET_MAX];
+  uint8_t n = packet(pkt, 0x02, payload, sizeof(payload));
+  uint8_t ready = 0;
+  for (uint8_t i = 0; i < n; i++) ready = framer.pushTx(pkt[i]);
+  TEST_ASSERT_EQUAL(n, ready);
+  TEST_ASSERT_FALSE(framer.lastTxWasCommand());
+  receive(pkt, n, 0);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().replies);
+}
+
+void test_short_length_field_is_rejected() {
+  const uint8_t bad[] = {0xEF, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x00, 0x01};
+  receive(bad, sizeof(bad), 0);
+  TEST_ASSERT_EQUAL_UINT32(1, framer.linkStats().badPackets);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_command_goes_out_in_one_write);
+  RUN_TEST(test_non_packet_bytes_pass_through);
+  RUN_TEST(test_reply_is_timed);
+  RUN_TEST(test_noise_before_reply_is_skipped);
+  RUN_TEST(test_corrupt_reply_counts_as_error);
+  RUN_TEST(test_unanswered_command_times_out);
+  RUN_TEST(test_large_data_packet);
+  RUN_TEST(test_short_length_field_is_rejected);
+  return UNITY_END();
+}
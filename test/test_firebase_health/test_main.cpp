@@ -0,0 +1,268 @@
+// FirebaseHealth + RetryBackoff: the phases of scripts/fault_scenarios.json
+// (the rtdb_proxy.py soak test) replayed on virtual time against the read
+// gate and backoff that firebaseGetOk()/checkConnection() use
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <FirebaseHealth.h>
+#include <JsonScan.h>
+
+// As in main.cpp
+static const RetryBackoffConfig BACKOFF = {2000, 60000};
+static const uint32_t POLL_MS = 1500;       // NODE_CONFIG_DEFAULTS.relaysCheckMs
+static const uint32_t IO_TIMEOUT_MS = 5000; // FB_IO_TIMEOUT_MS
+static const uint32_t RELAYS_BODY = 80;     // bytes of a /smart_controls/relays answer
+static const int TRANSPORT_ERROR = -1;      // any FirebaseClient TCP/TLS/timeout code
+
+struct Phase {
+  char name[24];
+  long durationS;
+  long latencyMs, bandwidthBps, tlsStallS, errorStatus, errorPct, dropPct;
+  bool tokenExpired, truncate;
+};
+
+struct PhaseResult {
+  uint32_t attempts, ok, failed;
+  uint32_t maxDelayMs;
+  uint32_t firstOkMs;  // from the phase start, UINT32_MAX if none
+  uint32_t outageMs;   // reported by the first success of the phase
+};
+
+static Phase phases[32];
+static int phaseCount;
+static uint32_t rng = 12345;
+
+static uint32_t nextRandom() {
+  rng = rng * 1103515245u + 12345u;
+  return rng >> 1;
+}
+
+static bool chance(long pct) { return pct > 0 && (long)(nextRandom() % 100) < pct; }
+
+static std::string scenarioPath() {
+  std::string here = __FILE__; // .../test/test_firebase_health/test_main.cpp
+  for (int i = 0; i < 3; i++) here = here.substr(0, here.find_last_of('/') == std::string::npos ? 0 : here.find_last_of('/'));
+  return (here.empty() ? std::string(".") : here) + "/scripts/fault_scenarios.json";
+}
+
+static long rateToPct(const char *obj, const char *key) {
+  const char *v = jsonFind(obj, key);
+  return v ? (long)(strtod(v, nullptr) * 100 + 0.5) : 0;
+}
+
+static void loadScenario() {
+  std::string path = scenarioPath();
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) TEST_FAIL_MESSAGE(("cannot open " + path).c_str());
+  std::string text;
+  char chunk[512];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) text.append(chunk, n);
+  fclose(f);
+
+  const char *p = jsonFind(text.c_str(), "phases");
+  TEST_ASSERT_TRUE(p && *p == '[');
+  p++;
+  const char *value, *end;
+  phaseCount = 0;
+  while (phaseCount < 32 && jsonNextElement(p, value, end)) {
+    std::string obj(value, end - value); // jsonFind must not run into the next phase
+    const char *o = obj.c_str();
+    Phase &ph = phases[phaseCount++];
+    ph = Phase();
+    TEST_ASSERT_TRUE(jsonGetString(o, "name", ph.name, sizeof(ph.name)));
+    TEST_ASSERT_TRUE(jsonGetLong(o, "duration_s", ph.durationS));
+    jsonGetLong(o, "latency_ms", ph.latencyMs);
+    jsonGetLong(o, "bandwidth_bps", ph.bandwidthBps);
+    jsonGetLong(o, "tls_stall_s", ph.tlsStallS);
+    ph.errorStatus = 503;
+    jsonGetLong(o, "error_status", ph.errorStatus);
+    jsonGetBool(o, "token_expired", ph.tokenExpired);
+    jsonGetBool(o, "truncate", ph.truncate);
+    ph.errorPct = rateToPct(o, "error_rate");
+    ph.dropPct = rateToPct(o, "drop_rate");
+  }
+}
+
+// What one relay poll sees during a phase, as rtdb_proxy.py injects it:
+// the FirebaseClient code and how long the read blocked
+static int requestOutcome(const Phase &ph, uint32_t &costMs) {
+  costMs = 0;
+  if (chance(ph.dropPct)) return TRANSPORT_ERROR; // closed without an answer
+  if (ph.tlsStallS) {
+    // Worst case: every request opens a new connection. The stalled handshake
+    // outlasts the socket timeout.
+    costMs = IO_TIMEOUT_MS;
+    if ((uint32_t)ph.tlsStallS * 1000 >= IO_TIMEOUT_MS) return TRANSPORT_ERROR;
+  }
+  costMs += ph.latencyMs;
+  if (costMs >= IO_TIMEOUT_MS) {
+    costMs = IO_TIMEOUT_MS;
+    return TRANSPORT_ERROR;
+  }
+  if (ph.tokenExpired) return 401;
+  if (chance(ph.errorPct)) return (int)ph.errorStatus;
+  if (ph.bandwidthBps) costMs += RELAYS_BODY * 1000 / ph.bandwidthBps;
+  if (ph.truncate) return TRANSPORT_ERROR; // half a body, then the socket closes
+  return 0;
+}
+
+static bool faulty(const Phase &ph) {
+  return ph.tlsStallS || ph.tokenExpired || ph.truncate || ph.errorPct || ph.dropPct ||
+         ph.latencyMs >= (long)IO_TIMEOUT_MS;
+}
+
+static bool alwaysFails(const Phase &ph) {
+  return ph.tokenExpired || ph.truncate || ph.errorPct >= 100 || ph.dropPct >= 100 ||
+         (uint32_t)ph.tlsStallS * 1000 >= IO_TIMEOUT_MS;
+}
+
+// Most attempts a phase of always-failing reads can see: the waits without
+// jitter (2, 4, 8 ... 60 s) are the shortest the backoff allows
+static uint32_t maxFailingAttempts(uint32_t durationMs, uint32_t costMs) {
+  uint32_t attempts = 1, t = costMs, wait = BACKOFF.minMs;
+  while (t + wait <= durationMs) {
+    t += wait + costMs;
+    attempts++;
+    wait = wait * 2 > BACKOFF.maxMs ? BACKOFF.maxMs : wait * 2;
+  }
+  return attempts + 1; // one more may have been due when the phase began
+}
+
+static FirebaseHealth health(BACKOFF);
+static PhaseResult results[32];
+
+// The loop: checkConnection() gates on mayConnect(), a due relay poll reads
+static void runScenario() {
+  uint32_t now = 1000;
+  uint32_t lastPoll = 0;
+  bool connected = false;
+  for (int i = 0; i < phaseCount; i++) {
+    const Phase &ph = phases[i];
+    PhaseResult &r = results[i];
+    r = PhaseResult();
+    r.firstOkMs = UINT32_MAX;
+    uint32_t start = now, end = now + ph.durationS * 1000;
+    while (now < end) {
+      if (health.mayConnect(now)) connected = true;
+      if (connected && now - lastPoll >= POLL_MS) {
+        lastPoll = now;
+        uint32_t cost;
+        int code = requestOutcome(ph, cost);
+        now += cost;
+        r.attempts++;
+        if (health.readDone(code, now, nextRandom()) == FB_READ_OK) {
+          r.ok++;
+          if (r.firstOkMs == UINT32_MAX) {
+            r.firstOkMs = now - start;
+            r.outageMs = health.takeOutage();
+          }
+        } else {
+          r.failed++;
+          connected = false;
+          uint32_t d = health.backoff().delayMs();
+          if (d > r.maxDelayMs) r.maxDelayMs = d;
+        }
+      }
+      now += 100;
+    }
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_scenario_loads() {
+  loadScenario();
+  TEST_ASSERT_GREATER_THAN(4, phaseCount);
+  TEST_ASSERT_EQUAL_STRING("baseline", phases[0].name);
+  runScenario();
+}
+
+void test_clean_phases_never_back_off() {
+  for (int i = 0; i < phaseCount; i++) {
+    if (faulty(phases[i])) continue;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, results[i].failed, phases[i].name);
+    // Slow or thin links still poll at close to the configured rate
+    TEST_ASSERT_GREATER_THAN_MESSAGE(phases[i].durationS * 1000 / (POLL_MS + IO_TIMEOUT_MS), results[i].ok,
+                                     phases[i].name);
+  }
+}
+
+void test_failing_phases_are_rate_limited() {
+  int checked = 0;
+  for (int i = 0; i < phaseCount; i++) {
+    const Phase &ph = phases[i];
+    if (!alwaysFails(ph)) continue;
+    checked++;
+    uint32_t cost = ph.tlsStallS ? IO_TIMEOUT_MS : ph.latencyMs;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, results[i].ok, ph.name);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(maxFailingAttempts(ph.durationS * 1000, cost), results[i].attempts, ph.name);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(BACKOFF.maxMs + BACKOFF.maxMs / 4, results[i].maxDelayMs, ph.name);
+  }
+  TEST_ASSERT_GREATER_THAN(0, checked);
+}
+
+void test_partial_faults_keep_some_reads_going() {
+  for (int i = 0; i < phaseCount; i++) {
+    const Phase &ph = phases[i];
+    if (!(ph.errorPct || ph.dropPct) || alwaysFails(ph)) continue;
+    TEST_ASSERT_GREATER_THAN_MESSAGE(0, results[i].ok, ph.name);
+    TEST_ASSERT_GREATER_THAN_MESSAGE(0, results[i].failed, ph.name);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(BACKOFF.maxMs + BACKOFF.maxMs / 4, results[i].maxDelayMs, ph.name);
+  }
+}
+
+void test_recovery_after_each_fault() {
+  for (int i = 1; i < phaseCount; i++) {
+    if (!alwaysFails(phases[i - 1]) || faulty(phases[i])) continue;
+    // At worst one full backoff wait, then the next poll
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(BACKOFF.maxMs + BACKOFF.maxMs / 4 + POLL_MS + 100, results[i].firstOkMs,
+                                      phases[i].name);
+    // The outage spans the failing phase up to the read that ended it
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(phases[i - 1].durationS * 1000 - IO_TIMEOUT_MS - BACKOFF.maxMs,
+                                         results[i].outageMs, phases[i].name);
+  }
+  TEST_ASSERT_EQUAL(0, health.backoff().failures());
+  TEST_ASSERT_GREATER_THAN(0, health.reads(FB_READ_AUTH));
+  TEST_ASSERT_GREATER_THAN(0, health.reads(FB_READ_SERVER));
+  TEST_ASSERT_GREATER_THAN(0, health.reads(FB_READ_TRANSPORT));
+}
+
+void test_read_kinds() {
+  TEST_ASSERT_EQUAL(FB_READ_OK, firebaseReadKind(0));
+  TEST_ASSERT_EQUAL(FB_READ_TRANSPORT, firebaseReadKind(-118));
+  TEST_ASSERT_EQUAL(FB_READ_AUTH, firebaseReadKind(401));
+  TEST_ASSERT_EQUAL(FB_READ_AUTH, firebaseReadKind(403));
+  TEST_ASSERT_EQUAL(FB_READ_SERVER, firebaseReadKind(503));
+  TEST_ASSERT_EQUAL(FB_READ_OTHER, firebaseReadKind(404));
+}
+
+void test_backoff_doubles_with_bounded_jitter() {
+  RetryBackoff b(BACKOFF);
+  uint32_t expect[] = {2000, 4000, 8000, 16000, 32000, 60000, 60000};
+  uint32_t t = 0;
+  for (uint32_t e : expect) {
+    b.fail(t, 0xFFFFFFFFUL);
+    TEST_ASSERT_GREATER_OR_EQUAL(e, b.delayMs());
+    TEST_ASSERT_LESS_OR_EQUAL(e + e / 4, b.delayMs());
+    TEST_ASSERT_FALSE(b.ready(t + e - 1));
+    t += b.delayMs();
+    TEST_ASSERT_TRUE(b.ready(t));
+  }
+  TEST_ASSERT_EQUAL_UINT32(t, b.succeed(t)); // first failure was at 0
+  TEST_ASSERT_TRUE(b.ready(t));
+  TEST_ASSERT_EQUAL_UINT32(0, b.succeed(t + 1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_scenario_loads);
+  RUN_TEST(test_clean_phases_never_back_off);
+  RUN_TEST(test_failing_phases_are_rate_limited);
+  RUN_TEST(test_partial_faults_keep_some_reads_going);
+  RUN_TEST(test_recovery_after_each_fault);
+  RUN_TEST(test_read_kinds);
+  RUN_TEST(test_backoff_doubles_with_bounded_jitter);
+  return UNITY_END();
+}
@@ -0,0 +1,508 @@
+// FirmwareUpdate: download URL parsing, the byte-at-a-time response head
+// parser, the signature trailer, a DeltaApplier round trip with its size
+// against the full image, and the Mega update proxy against a simulated
+// bootloader on a simulated I2C bus: page CRCs, resends and resuming
+#include <unity.h>
+#include <FirmwareUpdate.h>
+#include <stdio.h>
+
+void setUp() {}
+void tearDown() {}
+
+static HttpHeadResult feed(HttpHead &h, const char *s, size_t &used) {
+  HttpHeadResult r = HTTP_HEAD_MORE;
+  for (used = 0; s[used] && r == HTTP_HEAD_MORE; used++) r = h.push(s[used]);
+  return r;
+}
+
+void test_url_parsing() {
+  bool tls;
+  char host[32];
+  uint16_t port;
+  const char *path;
+  TEST_ASSERT_TRUE(fwParseUrl("http://192.168.1.5:8000/fw/update.shd", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(tls);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.5", host);
+  TEST_ASSERT_EQUAL(8000, port);
+  TEST_ASSERT_EQUAL_STRING("/fw/update.shd", path);
+
+  TEST_ASSERT_TRUE(fwParseUrl("https://example.com", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_TRUE(tls);
+  TEST_ASSERT_EQUAL(443, port);
+  TEST_ASSERT_EQUAL_STRING("/", path);
+
+  TEST_ASSERT_FALSE(fwParseUrl("ftp://example.com/x", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(fwParseUrl("http:///x", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(fwParseUrl("http://h:99999/x", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(fwParseUrl("http://h:/x", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(fwParseUrl("http://h:80x/", tls, host, sizeof(host), port, path));
+  TEST_ASSERT_FALSE(fwParseUrl("http://a-host-name-longer-than-the-buffer-we-have.example/x", tls, host,
+                               sizeof(host), port, path));
+}
+
+void test_head_partial_content() {
+  HttpHead h;
+  h.begin();
+  const char *resp = "HTTP/1.1 206 Partial Content\r\nServer: x\r\n"
+                     "content-range: bytes 32768-99999/100000\r\n\r\nBODY";
+  size_t used;
+  TEST_ASSERT_EQUAL(HTTP_HEAD_DONE, feed(h, resp, used));
+  TEST_ASSERT_EQUAL_STRING("BODY", resp + used);
+  TEST_ASSERT_EQUAL(206, h.status());
+  TEST_ASSERT_EQUAL(32768, h.rangeStart());
+}
+
+void test_head_arrives_in_pieces() {
+  HttpHead h;
+  h.begin();
+  size_t used;
+  TEST_ASSERT_EQUAL(HTTP_HEAD_MORE, feed(h, "HTTP/1.0 2", used));
+  TEST_ASSERT_EQUAL(HTTP_HEAD_MORE, feed(h, "00 OK\n", used));
+  TEST_ASSERT_EQUAL(HTTP_HEAD_MORE, feed(h, "X-Long: ", used));
+  for (int i = 0; i < 20; i++) TEST_ASSERT_EQUAL(HTTP_HEAD_MORE, feed(h, "0123456789", used));
+  TEST_ASSERT_EQUAL(HTTP_HEAD_DONE, feed(h, "\n\n", used));
+  TEST_ASSERT_EQUAL(200, h.status());
+  TEST_ASSERT_EQUAL(-1, h.rangeStart());
+}
+
+void test_head_rejects_non_http() {
+  HttpHead h;
+  h.begin();
+  size_t used;
+  TEST_ASSERT_EQUAL(HTTP_HEAD_BAD, feed(h, "SSH-2.0-OpenSSH\r\n", used));
+  h.begin();
+  TEST_ASSERT_EQUAL(HTTP_HEAD_BAD, feed(h, "HTTP/1.1 2x0 OK\r\n", used));
+  h.begin();
+  TEST_ASSERT_EQUAL(HTTP_HEAD_DONE, feed(h, "HTTP/1.1 416 Range Not Satisfiable\r\n\r\n", used));
+  TEST_ASSERT_EQUAL(416, h.status());
+}
+
+void test_signature_trailer() {
+  TEST_ASSERT_EQUAL_UINT32(100000 - 256 - 4, fwSignedSize(100000, 256));
+  TEST_ASSERT_EQUAL_UINT32(0, fwSignedSize(100000, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, fwSignedSize(100000, FW_SIGNATURE_MAX + 1));
+  TEST_ASSERT_EQUAL_UINT32(0, fwSignedSize(200, 256));
+  TEST_ASSERT_EQUAL_UINT32(0, fwSignedSize(260, 256));
+}
+
+// Delta round trip ------------------------------------------------------
+
+struct RamFlash {
+  const uint8_t *base;
+  uint32_t baseSize;
+  uint8_t out[3 * FW_BLOCK_SIZE];
+
+  bool readBase(uint32_t offset, uint8_t *buf, uint16_t len) {
+    if (offset + len > baseSize) return false;
+    memcpy(buf, base + offset, len);
+    return true;
+  }
+  bool writeBlock(uint16_t index, const uint8_t *data, uint16_t len) {
+    memcpy(out + (uint32_t)index * FW_BLOCK_SIZE, data, len);
+    return true;
+  }
+};
+
+static uint8_t base[2 * FW_BLOCK_SIZE];
+static uint8_t image[2 * FW_BLOCK_SIZE + 100];
+static uint8_t block[FW_BLOCK_SIZE] __attribute__((aligned(4)));
+
+static size_t put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+  return 4;
+}
+
+void test_delta_round_trip() {
+  // New image: old block 1, a block of 0xA5, 100 bytes of 0x5A
+  for (size_t i = 0; i < sizeof(base); i++) base[i] = (uint8_t)(i * 7);
+  memcpy(image, base + FW_BLOCK_SIZE, FW_BLOCK_SIZE);
+  memset(image + FW_BLOCK_SIZE, 0xA5, FW_BLOCK_SIZE);
+  memset(image + 2 * FW_BLOCK_SIZE, 0x5A, 100);
+
+  uint8_t d[128];
+  FwDeltaHeader h = {FW_DELTA_MAGIC, sizeof(image), fwCrc32(0, image, sizeof(image)), sizeof(base),
+                     FW_BLOCK_SIZE, 3};
+  size_t n = 0;
+  memcpy(d, &h, sizeof(h));
+  n += sizeof(h);
+  d[n++] = FW_OP_COPY;
+  d[n++] = 1;
+  d[n++] = 0;
+  n += put32(d + n, fwCrc32(0, image, FW_BLOCK_SIZE));
+  // 4096 = 31 runs of 130 + one of 66
+  d[n++] = FW_OP_RLE;
+  d[n++] = 64;
+  d[n++] = 0;
+  n += put32(d + n, fwCrc32(0, image + FW_BLOCK_SIZE, FW_BLOCK_SIZE));
+  for (int i = 0; i < 31; i++) {
+    d[n++] = 0xFF;
+    d[n++] = 0xA5;
+  }
+  d[n++] = 0x80 + 66 - 3;
+  d[n++] = 0xA5;
+  d[n++] = FW_OP_RLE;
+  d[n++] = 2;
+  d[n++] = 0;
+  n += put32(d + n, fwCrc32(0, image + 2 * FW_BLOCK_SIZE, 100));
+  d[n++] = 0x80 + 100 - 3;
+  d[n++] = 0x5A;
+
+  RamFlash flash = {base, sizeof(base), {}};
+  DeltaApplier<RamFlash> applier(flash, block);
+  applier.begin();
+  // In two pieces, cut inside the RLE block
+  TEST_ASSERT_EQUAL(FW_OK, applier.push(d, 40));
+  TEST_ASSERT_EQUAL(FW_DONE, applier.push(d + 40, n - 40));
+  TEST_ASSERT_EQUAL_MEMORY(image, flash.out, sizeof(image));
+  TEST_ASSERT_EQUAL_HEX32(h.newCrc, applier.crc());
+  // One moved block, one repeated byte, a short tail: the delta is a few
+  // dozen bytes for an 8 KB image
+  char line[96];
+  snprintf(line, sizeof(line), "delta %u bytes for a %u byte image", (unsigned)n, (unsigned)sizeof(image));
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL(sizeof(h) + 7 + (7 + 64) + (7 + 2), n); // COPY, RLE of 32 runs, RLE of one run
+  TEST_ASSERT_LESS_THAN(sizeof(image) / 50, n);
+
+  // Interrupted after 60 bytes and resumed from the saved point: nothing
+  // before it is downloaded again
+  RamFlash again = {base, sizeof(base), {}};
+  DeltaApplier<RamFlash> first(again, block);
+  first.begin();
+  TEST_ASSERT_EQUAL(FW_OK, first.push(d, 60));
+  FwDeltaHeader saved = first.header();
+  uint16_t nextBlock = first.nextBlock();
+  uint32_t offset = first.streamOffset();
+  uint32_t crcSoFar = first.crc();
+  TEST_ASSERT_TRUE(offset <= 60);
+  DeltaApplier<RamFlash> resumed(again, block);
+  resumed.resume(saved, nextBlock, offset, crcSoFar);
+  TEST_ASSERT_EQUAL(FW_DONE, resumed.push(d + offset, n - offset));
+  TEST_ASSERT_EQUAL_MEMORY(image, again.out, sizeof(image));
+
+  // A corrupted block CRC stops the update
+  d[sizeof(h) + 3] ^= 1;
+  applier.begin();
+  TEST_ASSERT_EQUAL(FW_BAD_BLOCK_CRC, applier.push(d, n));
+  TEST_ASSERT_EQUAL_STRING("bad_block_crc", fwStatusName(FW_BAD_BLOCK_CRC));
+}
+
+// Mega update proxy --------------------------------------------------------
+
+// The bootloader as specified in FirmwareUpdate.h: page buffer in RAM,
+// image identity and page counter in "EEPROM", NACKs while programming
+struct SimBootloader {
+  static const uint16_t PAGE = 256;
+  uint8_t flash[64 * PAGE];
+  uint8_t pageBuf[PAGE];
+  uint32_t imageSize, imageCrc; // EEPROM
+  uint16_t nextPage;            // EEPROM
+  uint8_t state;
+  bool present;                 // in the bootloader and on the bus
+  uint8_t busy;                 // transactions NACKed while a page is programmed
+  bool started;
+  uint32_t dFrames;
+  uint32_t corruptFrom, corruptTo; // 'D' frames hit by line noise, [from, to)
+  uint16_t pagesWritten;
+
+  void powerOn() {
+    memset(flash, 0xFF, sizeof(flash));
+    imageSize = imageCrc = 0;
+    nextPage = 0;
+    pagesWritten = 0;
+    present = true;
+    corruptFrom = corruptTo = 0;
+    dFrames = 0;
+    reset();
+  }
+  // A reset keeps flash and EEPROM, loses the page buffer
+  void reset() {
+    memset(pageBuf, 0xFF, sizeof(pageBuf));
+    state = MEGA_BOOT_IDLE;
+    busy = 0;
+    started = false;
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  }
+
+  bool receive(uint8_t *d, uint8_t n) {
+    if (busy) {
+      busy--;
+      return false;
+    }
+    switch (d[0]) {
+      case 'B':
+        if (get32(d + 1) != imageSize || get32(d + 5) != imageCrc) {
+          imageSize = get32(d + 1);
+          imageCrc = get32(d + 5);
+          nextPage = 0;
+        }
+        state = MEGA_BOOT_LOADING;
+        return true;
+      case 'S':
+        return true;
+      case 'D': {
+        uint16_t page = d[1] | d[2] << 8;
+        if (dFrames >= corruptFrom && dFrames < corruptTo) d[5] ^= 0x10;
+        dFrames++;
+        if (n == 5 + d[4] && page == nextPage && d[3] + d[4] <= PAGE) memcpy(pageBuf + d[3], d + 5, d[4]);
+        return true;
+      }
+      case 'W': {
+        uint16_t page = d[1] | d[2] << 8;
+        uint16_t crc = d[3] | d[4] << 8;
+        if (page != nextPage) return true;
+        if (fwCrc16(pageBuf, PAGE) != crc) {
+          state = MEGA_BOOT_PAGE_CRC;
+          return true;
+        }
+        memcpy(flash + (uint32_t)page * PAGE, pageBuf, PAGE);
+        memset(pageBuf, 0xFF, sizeof(pageBuf));
+        nextPage++;
+        pagesWritten++;
+        state = MEGA_BOOT_LOADING;
+        busy = 3; // ~4.5 ms erase + write
+        return true;
+      }
+      case 'X':
+        if (get32(d + 1) <= sizeof(flash) && fwCrc32(0, flash, get32(d + 1)) == get32(d + 5)) {
+          state = MEGA_BOOT_STARTING;
+          started = true;
+        } else {
+          state = MEGA_BOOT_IMAGE_CRC;
+        }
+        return true;
+    }
+    return false;
+  }
+
+  MegaBootStatus status() const {
+    MegaBootStatus st = {MEGA_BOOT_MAGIC, 1, PAGE, nextPage, state, 0};
+    st.crc = megaBootCrc(st);
+    return st;
+  }
+};
+
+// TwoWire master API over the bootloader; counts every byte on the wire
+struct SimBus {
+  SimBootloader *boot;
+  uint8_t addr;
+  uint8_t tx[32];
+  uint8_t txLen;
+  uint8_t rx[sizeof(MegaBootStatus)];
+  uint8_t rxLen, rxPos;
+  uint32_t wireBytes;
+
+  void beginTransmission(uint8_t a) {
+    addr = a;
+    txLen = 0;
+  }
+  size_t write(uint8_t b) {
+    if (txLen == sizeof(tx)) return 0;
+    tx[txLen++] = b;
+    return 1;
+  }
+  uint8_t endTransmission() {
+    wireBytes += 1 + txLen;
+    if (addr != MEGA_BOOT_ADDR || !boot->present) return 2;
+    return boot->receive(tx, txLen) ? 0 : 2;
+  }
+  uint8_t requestFrom(uint8_t a, uint8_t n) {
+    rxLen = rxPos = 0;
+    wireBytes += 1;
+    if (a != MEGA_BOOT_ADDR || !boot->present || boot->busy || n != sizeof(MegaBootStatus)) return 0;
+    MegaBootStatus st = boot->status();
+    memcpy(rx, &st, sizeof(st));
+    rxLen = sizeof(st);
+    wireBytes += rxLen;
+    return rxLen;
+  }
+  int available() { return rxLen - rxPos; }
+  int read() { return rxPos < rxLen ? rx[rxPos++] : -1; }
+};
+
+typedef MegaBootProxy<SimBus> Proxy;
+
+static SimBootloader megaBoot;
+static SimBus megaBus;
+static uint8_t megaImage[40 * SimBootloader::PAGE + 100]; // 10340 bytes, last page partial
+static uint8_t proxyPage[MEGA_BOOT_PAGE_MAX];
+
+// The caller's view of the image: every accepted page in order
+struct Accepted {
+  uint32_t bytes;
+  uint32_t crc;
+};
+static void onPage(const uint8_t *data, uint16_t len, void *ctx) {
+  Accepted &a = *(Accepted *)ctx;
+  a.crc = fwCrc32(a.crc, data, len);
+  a.bytes += len;
+}
+
+static void megaSetUp() {
+  for (size_t i = 0; i < sizeof(megaImage); i++) megaImage[i] = (uint8_t)(i * 31 + (i >> 8));
+  megaBoot.powerOn();
+  megaBus = {};
+  megaBus.boot = &megaBoot;
+}
+
+// The firmware's download loop: 512 bytes per pass at most, never more
+// than the proxy takes; stops at stopAt (interruption) or when finished
+static FwStatus download(Proxy &px, uint32_t stopAt = 0xFFFFFFFFUL, void (*eachPass)(uint32_t pass) = nullptr) {
+  uint32_t off = px.streamOffset();
+  for (uint32_t pass = 0; pass < 100000; pass++) {
+    if (eachPass) eachPass(pass);
+    FwStatus s = px.poll();
+    if (s != FW_OK && s != FW_PENDING) return s;
+    if (s == FW_PENDING) continue;
+    if (px.loaded()) {
+      s = px.start();
+      if (s != FW_PENDING) return s;
+      continue;
+    }
+    if (off >= stopAt) return FW_PENDING;
+    uint32_t n = sizeof(megaImage) - off;
+    if (n > 512) n = 512;
+    if (n > stopAt - off) n = stopAt - off;
+    off += px.push(megaImage + off, n);
+  }
+  return FW_PENDING;
+}
+
+static void reportWire(const char *label) {
+  char line[112];
+  snprintf(line, sizeof(line), "%s: %lu bytes on I2C for a %u byte image (%.2fx), %u page writes", label,
+           (unsigned long)megaBus.wireBytes, (unsigned)sizeof(megaImage),
+           (double)megaBus.wireBytes / sizeof(megaImage), megaBoot.pagesWritten);
+  TEST_MESSAGE(line);
+}
+
+void test_mega_proxy_streams_image() {
+  megaSetUp();
+  uint32_t crc = fwCrc32(0, megaImage, sizeof(megaImage));
+  Accepted seen = {0, 0};
+  Proxy px(megaBus, proxyPage, onPage, &seen);
+  TEST_ASSERT_EQUAL(FW_OK, px.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_DONE, download(px));
+  reportWire("clean");
+
+  TEST_ASSERT_TRUE(megaBoot.started);
+  TEST_ASSERT_EQUAL_MEMORY(megaImage, megaBoot.flash, sizeof(megaImage));
+  TEST_ASSERT_EQUAL(41, megaBoot.pagesWritten);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(megaImage), seen.bytes);
+  TEST_ASSERT_EQUAL_HEX32(crc, seen.crc);
+  // Framing and the status polls while a page is programmed: under half again
+  TEST_ASSERT_LESS_THAN(sizeof(megaImage) * 3 / 2, megaBus.wireBytes);
+
+  // The image CRC the bootloader checks is the one from the request
+  megaSetUp();
+  Proxy wrong(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, wrong.begin(sizeof(megaImage), crc ^ 1));
+  TEST_ASSERT_EQUAL(FW_BAD_IMAGE_CRC, download(wrong));
+  TEST_ASSERT_FALSE(megaBoot.started);
+}
+
+// Line noise on one 'D' frame: that page fails its CRC and is sent again
+void test_mega_proxy_resends_bad_page() {
+  megaSetUp();
+  megaBoot.corruptFrom = 100; // page 9
+  megaBoot.corruptTo = 101;
+  uint32_t crc = fwCrc32(0, megaImage, sizeof(megaImage));
+  Proxy px(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, px.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_DONE, download(px));
+  reportWire("one bad page");
+  TEST_ASSERT_EQUAL_MEMORY(megaImage, megaBoot.flash, sizeof(megaImage));
+  TEST_ASSERT_EQUAL(41, megaBoot.pagesWritten);
+  TEST_ASSERT_EQUAL_UINT32(42 * 11, megaBoot.dFrames); // 11 'D' frames a page, one page twice
+
+  // A page that never gets through gives up after MEGA_BOOT_RETRIES resends
+  megaSetUp();
+  megaBoot.corruptFrom = 100;
+  megaBoot.corruptTo = 100000;
+  Proxy noisy(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, noisy.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_BAD_BLOCK_CRC, download(noisy));
+  TEST_ASSERT_EQUAL(9, noisy.nextPage());
+  TEST_ASSERT_FALSE(megaBoot.started);
+}
+
+// Interruptions on either side of the proxy
+static void bootloaderResetAt(uint32_t pass) {
+  if (pass == 300) megaBoot.reset(); // page buffer lost mid-page
+}
+
+void test_mega_proxy_resumes() {
+  uint32_t crc = fwCrc32(0, megaImage, sizeof(megaImage));
+
+  // Download drops mid-page: the half page is dropped and fetched again
+  megaSetUp();
+  Accepted seen = {0, 0};
+  Proxy px(megaBus, proxyPage, onPage, &seen);
+  TEST_ASSERT_EQUAL(FW_OK, px.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_PENDING, download(px, 15 * 256 + 100));
+  px.restart();
+  TEST_ASSERT_EQUAL_UINT32(15 * 256, px.streamOffset());
+  TEST_ASSERT_EQUAL(FW_DONE, download(px));
+  TEST_ASSERT_EQUAL(41, megaBoot.pagesWritten);
+  TEST_ASSERT_EQUAL_HEX32(crc, seen.crc);
+
+  // NodeMCU reset after 20 pages: a new proxy learns from the bootloader
+  // where it stopped; the download starts over for the caller's hash, the
+  // Mega only gets the 21 pages it does not have
+  megaSetUp();
+  {
+    Proxy before(megaBus, proxyPage);
+    TEST_ASSERT_EQUAL(FW_OK, before.begin(sizeof(megaImage), crc));
+    TEST_ASSERT_EQUAL(FW_PENDING, download(before, 20 * 256 + 50));
+  }
+  uint32_t wireBefore = megaBus.wireBytes;
+  Accepted after = {0, 0};
+  Proxy again(megaBus, proxyPage, onPage, &after);
+  TEST_ASSERT_EQUAL(FW_OK, again.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_DONE, download(again));
+  reportWire("NodeMCU reset at page 20");
+  TEST_ASSERT_EQUAL(20, again.pagesSkipped());
+  TEST_ASSERT_EQUAL(41, megaBoot.pagesWritten);
+  TEST_ASSERT_EQUAL_MEMORY(megaImage, megaBoot.flash, sizeof(megaImage));
+  TEST_ASSERT_EQUAL_HEX32(crc, after.crc);
+  TEST_ASSERT_LESS_THAN(wireBefore + 2 * 256, megaBus.wireBytes - wireBefore);
+  TEST_ASSERT_LESS_THAN(sizeof(megaImage) * 3 / 2 + 256, megaBus.wireBytes);
+
+  // A different image does not reuse the counter
+  Proxy other(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, other.begin(sizeof(megaImage), crc ^ 0x100));
+  TEST_ASSERT_EQUAL(0, megaBoot.nextPage);
+
+  // Bootloader reset mid-page: it answers without the page, which is sent again
+  megaSetUp();
+  Proxy reset(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, reset.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_DONE, download(reset, 0xFFFFFFFFUL, bootloaderResetAt));
+  TEST_ASSERT_EQUAL_MEMORY(megaImage, megaBoot.flash, sizeof(megaImage));
+
+  // Gone from the bus: the proxy gives up instead of waiting forever
+  megaSetUp();
+  Proxy gone(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_OK, gone.begin(sizeof(megaImage), crc));
+  TEST_ASSERT_EQUAL(FW_PENDING, download(gone, 5 * 256 + 10));
+  megaBoot.present = false;
+  TEST_ASSERT_EQUAL(FW_NO_BOOTLOADER, download(gone));
+  Proxy absent(megaBus, proxyPage);
+  TEST_ASSERT_EQUAL(FW_NO_BOOTLOADER, absent.begin(sizeof(megaImage), crc));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_url_parsing);
+  RUN_TEST(test_head_partial_content);
+  RUN_TEST(test_head_arrives_in_pieces);
+  RUN_TEST(test_head_rejects_non_http);
+  RUN_TEST(test_signature_trailer);
+  RUN_TEST(test_delta_round_trip);
+  RUN_TEST(test_mega_proxy_streams_image);
+  RUN_TEST(test_mega_proxy_resends_bad_page);
+  RUN_TEST(test_mega_proxy_resumes);
+  return UNITY_END();
+}
@@ -0,0 +1,131 @@
+// Fuzz targets (test/fuzz/FuzzTargets.h) without libFuzzer: every seed of
+// test/fuzz/corpus plus a fixed set of mutations of them. A broken invariant
+// aborts the run; the libFuzzer builds in the README search much further.
+#include <unity.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include "../fuzz/FuzzTargets.h"
+
+typedef int (*FuzzFn)(const uint8_t *data, size_t size);
+typedef std::vector<uint8_t> Bytes;
+
+static const int MUTATIONS_PER_SEED = 300;
+static uint32_t rng;
+
+static uint32_t nextRandom() {
+  rng = rng * 1103515245u + 12345u;
+  return rng >> 1;
+}
+
+static std::string corpusDir(const char *name) {
+  std::string here = __FILE__; // .../test/test_fuzz_corpus/test_main.cpp
+  for (int i = 0; i < 2; i++) here = here.substr(0, here.find_last_of('/') == std::string::npos ? 0 : here.find_last_of('/'));
+  return (here.empty() ? std::string(".") : here) + "/fuzz/corpus/" + name;
+}
+
+static std::vector<Bytes> loadCorpus(const char *name) {
+  std::vector<Bytes> seeds;
+  std::string dir = corpusDir(name);
+  DIR *d = opendir(dir.c_str());
+  if (!d) return seeds;
+  while (dirent *e = readdir(d)) {
+    if (e->d_name[0] == '.') continue;
+    FILE *f = fopen((dir + "/" + e->d_name).c_str(), "rb");
+    if (!f) continue;
+    Bytes b;
+    int c;
+    while ((c = fgetc(f)) != EOF) b.push_back((uint8_t)c);
+    fclose(f);
+    seeds.push_back(b);
+  }
+  closedir(d);
+  return seeds;
+}
+
+// Byte flips, inserts, deletes, truncation and splices of another seed: the
+// cheap half of what libFuzzer does, enough to leave the happy paths
+static Bytes mutate(const Bytes &seed, const std::vector<Bytes> &all) {
+  Bytes b = seed;
+  int edits = 1 + nextRandom() % 4;
+  for (int i = 0; i < edits; i++) {
+    size_t at = b.empty() ? 0 : nextRandom() % b.size();
+    switch (nextRandom() % 6) {
+      case 0:
+        if (!b.empty()) b[at] ^= (uint8_t)(1 << (nextRandom() % 8));
+        break;
+      case 1:
+        if (!b.empty()) b[at] = (uint8_t)nextRandom();
+        break;
+      case 2:
+        b.insert(b.begin() + at, (uint8_t)"{}[]\":,-01\n \\"[nextRandom() % 13]);
+        break;
+      case 3:
+        if (!b.empty()) b.erase(b.begin() + at);
+        break;
+      case 4:
+        b.resize(at);
+        break;
+      case 5: {
+        const Bytes &other = all[nextRandom() % all.size()];
+        size_t from = other.empty() ? 0 : nextRandom() % other.size();
+        b.insert(b.begin() + at, other.begin() + from, other.end());
+        break;
+      }
+    }
+  }
+  return b;
+}
+
+static void replay(const char *name, FuzzFn fn) {
+  std::vector<Bytes> seeds = loadCorpus(name);
+  TEST_ASSERT_TRUE_MESSAGE(!seeds.empty(), ("no seeds in " + corpusDir(name)).c_str());
+  rng = 2024;
+  fn(nullptr, 0);
+  for (const Bytes &s : seeds) {
+    fn(s.data(), s.size());
+    for (int i = 0; i < MUTATIONS_PER_SEED; i++) {
+      Bytes m = mutate(s, seeds);
+      fn(m.data(), m.size());
+    }
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_slave_command_corpus() { replay("slave_command", fuzzSlaveCommand); }
+void test_sim_result_corpus() { replay("sim_result", fuzzSimResult); }
+void test_json_scan_corpus() { replay("json_scan", fuzzJsonScan); }
+void test_rules_corpus() { replay("rules", fuzzRules); }
+
+// The seeds exercise what they are named after, not just the error paths
+void test_seeds_reach_the_accepting_paths() {
+  SlaveCommand cmd;
+  TEST_ASSERT_EQUAL(SC_RELAY_MASK, parseSlaveCommand("rm:00ff:0013", 12, 2, cmd));
+  TEST_ASSERT_EQUAL(SC_CONFIG, parseSlaveCommand("cfg:sms_window_s=30", 19, 2, cmd));
+
+  RulesEngine rules(fuzzRuleAction);
+  for (const Bytes &s : loadCorpus("rules")) {
+    std::string text(s.begin(), s.end());
+    text = text.substr(0, text.find('\0'));
+    uint8_t rejected = rules.load(text.c_str());
+    if (text.find("cfg:save") != std::string::npos) {
+      TEST_ASSERT_EQUAL(3, rejected);
+    } else {
+      TEST_ASSERT_EQUAL_MESSAGE(0, rejected, rules.lastError());
+      TEST_ASSERT_GREATER_THAN(0, rules.count());
+    }
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slave_command_corpus);
+  RUN_TEST(test_sim_result_corpus);
+  RUN_TEST(test_json_scan_corpus);
+  RUN_TEST(test_rules_corpus);
+  RUN_TEST(test_seeds_reach_the_accepting_paths);
+  return UNITY_END();
+}
@@ -0,0 +1,366 @@
+// I2CBusManager: discovery, relay routing, batched flush, failure accounting
+// and readback reconciliation against a scripted bus; rule actions against a
+// model of the Mega, and how long the readback takes to converge after the
+// Mega resets
+#include <unity.h>
+#include <I2CBusManager.h>
+#include <RulesEngine.h>
+#include <SlaveCommand.h>
+#include <new>
+#include <string>
+#include <vector>
+
+// TwoWire master API; a slave "answers" if its address is in present
+struct FakeBus {
+  bool present[128] = {};
+  std::vector<std::string> sent[128];
+  uint8_t addr = 0;
+  std::string frame;
+  std::vector<uint8_t> reply;
+  size_t replyPos = 0;
+
+  void beginTransmission(uint8_t a) {
+    addr = a;
+    frame.clear();
+  }
+  size_t write(const uint8_t *p, size_t n) {
+    frame.append((const char *)p, n);
+    return n;
+  }
+  uint8_t endTransmission() {
+    if (!present[addr]) return 2; // address NACK
+    if (!frame.empty()) sent[addr].push_back(frame);
+    return 0;
+  }
+  uint8_t requestFrom(uint8_t a, uint8_t n) {
+    replyPos = 0;
+    if (!present[a]) reply.clear();
+    return reply.size() < n ? (uint8_t)reply.size() : n;
+  }
+  int available() { return (int)(reply.size() - replyPos); }
+  int read() { return replyPos < reply.size() ? reply[replyPos++] : -1; }
+};
+
+static FakeBus bus;
+static I2CBusManager<FakeBus> *mgr;
+
+void setUp() {
+  bus = FakeBus();
+  static uint8_t storage[sizeof(I2CBusManager<FakeBus>)];
+  mgr = new (storage) I2CBusManager<FakeBus>(bus);
+}
+
+void tearDown() {}
+
+static SlaveStatus status(uint16_t boot, uint16_t mask, uint16_t known) {
+  SlaveStatus st = {};
+  st.magic = SLAVE_STATUS_MAGIC;
+  st.version = SLAVE_STATUS_VERSION;
+  st.bootCount = boot;
+  st.relayMask = mask;
+  st.relayKnown = known;
+  st.crc = slaveStatusCrc(st);
+  return st;
+}
+
+void test_route_fixed_per_slot() {
+  uint8_t slot, ch;
+  TEST_ASSERT_TRUE(I2CBusManager<FakeBus>::route(1, slot, ch));
+  TEST_ASSERT_EQUAL(0, slot);
+  TEST_ASSERT_EQUAL(1, ch);
+  TEST_ASSERT_TRUE(I2CBusManager<FakeBus>::route(17, slot, ch));
+  TEST_ASSERT_EQUAL(1, slot);
+  TEST_ASSERT_EQUAL(1, ch);
+  TEST_ASSERT_TRUE(I2CBusManager<FakeBus>::route(I2C_MAX_RELAYS, slot, ch));
+  TEST_ASSERT_EQUAL(I2C_MAX_SLAVES - 1, slot);
+  TEST_ASSERT_EQUAL(16, ch);
+  TEST_ASSERT_FALSE(I2CBusManager<FakeBus>::route(0, slot, ch));
+  TEST_ASSERT_FALSE(I2CBusManager<FakeBus>::route(I2C_MAX_RELAYS + 1, slot, ch));
+}
+
+void test_discover_and_batch_per_slave() {
+  bus.present[0x08] = bus.present[0x09] = true;
+  TEST_ASSERT_EQUAL(2, mgr->discover());
+  TEST_ASSERT_TRUE(mgr->isPresent(0));
+  TEST_ASSERT_FALSE(mgr->isPresent(2));
+
+  mgr->setRelay(1, true);
+  mgr->setRelay(3, true);
+  mgr->setRelay(3, false);
+  mgr->setRelay(18, true);
+  mgr->setRelay(40, true); // slot 2 is absent: stays queued
+  TEST_ASSERT_EQUAL(0, mgr->flush());
+  TEST_ASSERT_EQUAL(1, bus.sent[0x08].size());
+  TEST_ASSERT_EQUAL_STRING("rm:0005:0001", bus.sent[0x08][0].c_str());
+  TEST_ASSERT_EQUAL_STRING("rm:0002:0002", bus.sent[0x09][0].c_str());
+  TEST_ASSERT_EQUAL(0, bus.sent[0x0A].size());
+
+  TEST_ASSERT_EQUAL(0, mgr->flush()); // nothing pending
+  TEST_ASSERT_EQUAL(1, bus.sent[0x08].size());
+}
+
+void test_failures_take_slave_offline_and_resync_on_return() {
+  bus.present[0x08] = true;
+  mgr->discover();
+  mgr->setRelay(2, true);
+  mgr->flush();
+  bus.present[0x08] = false;
+  for (uint8_t i = 0; i < I2C_OFFLINE_AFTER; i++) {
+    mgr->setRelay(5, i & 1);
+    TEST_ASSERT_EQUAL(1, mgr->flush());
+  }
+  TEST_ASSERT_FALSE(mgr->isPresent(0));
+  TEST_ASSERT_EQUAL(0, mgr->flush()); // offline: not retried every pass
+  TEST_ASSERT_EQUAL_UINT32(I2C_OFFLINE_AFTER, mgr->stats(0).failures);
+
+  bus.present[0x08] = true;
+  mgr->discover();
+  mgr->flush();
+  // Everything known is resent, not just the last change
+  TEST_ASSERT_EQUAL_STRING("rm:0012:0002", bus.sent[0x08].back().c_str());
+  TEST_ASSERT_EQUAL(I2C_OFFLINE_AFTER * 100 / (I2C_OFFLINE_AFTER + 2), mgr->errorRate(0));
+}
+
+void test_read_status_rejects_corrupt_frames() {
+  bus.present[0x08] = true;
+  SlaveStatus st = status(1, 0, 0);
+  bus.reply.assign((uint8_t *)&st, (uint8_t *)&st + sizeof(st));
+  SlaveStatus got;
+  TEST_ASSERT_TRUE(mgr->readStatus(0, got));
+  TEST_ASSERT_EQUAL(1, got.bootCount);
+
+  bus.reply[3] ^= 0x40;
+  TEST_ASSERT_FALSE(mgr->readStatus(0, got));
+  bus.reply.resize(sizeof(st) - 1);
+  TEST_ASSERT_FALSE(mgr->readStatus(0, got));
+  TEST_ASSERT_EQUAL_UINT32(2, mgr->stats(0).failures);
+}
+
+void test_reconcile_requeues_diverged_channels_only() {
+  bus.present[0x08] = true;
+  mgr->discover();
+  mgr->setRelay(1, true);
+  mgr->setRelay(2, true);
+  mgr->flush();
+  TEST_ASSERT_FALSE(mgr->reconcile(0, status(7, 0x0003, 0x0003)));
+
+  // Channel 2 dropped on the slave (relay board glitch)
+  TEST_ASSERT_FALSE(mgr->reconcile(0, status(7, 0x0001, 0x0003)));
+  mgr->flush();
+  TEST_ASSERT_EQUAL_STRING("rm:0002:0002", bus.sent[0x08].back().c_str());
+  TEST_ASSERT_EQUAL_UINT32(1, mgr->stats(0).repairedBits);
+
+  // New boot counter: the whole known state goes out again
+  TEST_ASSERT_TRUE(mgr->reconcile(0, status(8, 0, 0)));
+  mgr->flush();
+  TEST_ASSERT_EQUAL_STRING("rm:0003:0003", bus.sent[0x08].back().c_str());
+  TEST_ASSERT_EQUAL(1, mgr->stats(0).reboots);
+}
+
+// Main Mega as the NodeMCU sees it: applies relay commands, answers the
+// status readback, and NACKs everything while it boots
+struct MegaBus {
+  uint32_t now = 0;
+  uint32_t bootedAt = 0;    // answers from here on
+  uint16_t bootCount = 1;
+  uint16_t relays = 0, known = 0;
+  uint8_t addr = 0;
+  std::string frame;
+  SlaveStatus reply;
+  uint8_t replyPos = sizeof(SlaveStatus);
+  uint32_t writes = 0;
+
+  bool up() const { return (int32_t)(now - bootedAt) >= 0; }
+  void reset(uint32_t bootMs) {
+    relays = known = 0;
+    bootCount++;
+    bootedAt = now + bootMs;
+  }
+  void beginTransmission(uint8_t a) {
+    addr = a;
+    frame.clear();
+  }
+  size_t write(const uint8_t *p, size_t n) {
+    frame.append((const char *)p, n);
+    return n;
+  }
+  uint8_t endTransmission() {
+    if (addr != 0x08 || !up()) return 2;
+    if (frame.empty()) return 0;
+    writes++;
+    SlaveCommand cmd;
+    switch (parseSlaveCommand(frame.data(), frame.size(), 2, cmd)) {
+      case SC_RELAY:
+        known |= 1U << (cmd.id - 1);
+        relays = cmd.on ? relays | (1U << (cmd.id - 1)) : relays & ~(1U << (cmd.id - 1));
+        break;
+      case SC_RELAY_MASK:
+        known |= cmd.mask;
+        relays = (relays & ~cmd.mask) | (cmd.values & cmd.mask);
+        break;
+    }
+    return 0;
+  }
+  uint8_t requestFrom(uint8_t a, uint8_t n) {
+    if (a != 0x08 || !up()) {
+      replyPos = sizeof(SlaveStatus);
+      return 0;
+    }
+    reply = status(bootCount, relays, known);
+    replyPos = 0;
+    return n < sizeof(SlaveStatus) ? n : sizeof(SlaveStatus);
+  }
+  int available() { return sizeof(SlaveStatus) - replyPos; }
+  int read() { return replyPos < sizeof(SlaveStatus) ? ((uint8_t *)&reply)[replyPos++] : -1; }
+};
+
+static MegaBus mega;
+static I2CBusManager<MegaBus> *megaMgr;
+
+// What runRuleAction() does with the bus manager
+static void applyRule(uint8_t type, uint8_t arg, const char *text) {
+  RuleTarget t = ruleTarget(type, arg, text);
+  TEST_ASSERT_EQUAL(RT_RELAYS, t.kind);
+  for (uint8_t id = 1; id <= RULES_MAX_RELAYS; id++) {
+    if (t.mask & (1U << (id - 1))) megaMgr->setRelay(id, t.values & (1U << (id - 1)));
+  }
+  megaMgr->flush();
+}
+
+// One reconcile pass of the firmware (reconcileSlaves)
+static void reconcilePass() {
+  SlaveStatus st;
+  if (megaMgr->isPresent(0) && megaMgr->readStatus(0, st)) megaMgr->reconcile(0, st);
+  megaMgr->flush();
+}
+
+static I2CBusManager<MegaBus> &newMegaMgr() {
+  mega = MegaBus();
+  static uint8_t storage[sizeof(I2CBusManager<MegaBus>)];
+  megaMgr = new (storage) I2CBusManager<MegaBus>(mega);
+  megaMgr->discover();
+  return *megaMgr;
+}
+
+void test_rule_target_decodes_every_spelling() {
+  RuleTarget t = ruleTarget(ACT_RELAY_ON, 5, nullptr);
+  TEST_ASSERT_EQUAL(RT_RELAYS, t.kind);
+  TEST_ASSERT_EQUAL_HEX16(0x0010, t.mask);
+  TEST_ASSERT_EQUAL_HEX16(0x0010, t.values);
+  t = ruleTarget(ACT_SEND, 0, "3:0");
+  TEST_ASSERT_EQUAL_HEX16(0x0004, t.mask);
+  TEST_ASSERT_EQUAL_HEX16(0x0000, t.values);
+  t = ruleTarget(ACT_SEND, 0, "rm:0006:000F");
+  TEST_ASSERT_EQUAL_HEX16(0x0006, t.mask);
+  TEST_ASSERT_EQUAL_HEX16(0x0006, t.values); // bits outside the mask are not set
+  t = ruleTarget(ACT_UNLOCK, 0, nullptr);
+  TEST_ASSERT_EQUAL(RT_DOOR, t.kind);
+  TEST_ASSERT_EQUAL(0, t.door);
+  TEST_ASSERT_FALSE(t.locked);
+  t = ruleTarget(ACT_SEND, 0, "lock:1");
+  TEST_ASSERT_EQUAL(RT_DOOR, t.kind);
+  TEST_ASSERT_EQUAL(1, t.door);
+  TEST_ASSERT_TRUE(t.locked);
+  TEST_ASSERT_EQUAL(RT_NONE, ruleTarget(ACT_SEND, 0, "alert").kind);
+}
+
+// A rule switches relays; the next readback agrees, so nothing is queued
+void test_rule_relay_survives_reconcile() {
+  I2CBusManager<MegaBus> &m = newMegaMgr();
+  m.setRelay(2, true); // state from Firebase before the rule fires
+  m.setRelay(5, false);
+  m.flush();
+  reconcilePass();
+
+  RulesEngine engine(applyRule);
+  TEST_ASSERT_EQUAL(0, engine.load("float == 0 -> relay 5 on\nfloat == 0 -> send rm:0006:0004\n"));
+  engine.setInput(IN_FLOAT, 0);
+  TEST_ASSERT_EQUAL(2, engine.run());
+  TEST_ASSERT_EQUAL_HEX16(0x0014, mega.relays);
+
+  uint32_t writes = mega.writes;
+  for (int pass = 0; pass < 3; pass++) reconcilePass();
+  TEST_ASSERT_EQUAL_UINT32(writes, mega.writes);
+  TEST_ASSERT_EQUAL_UINT32(0, m.stats(0).repairedBits);
+  TEST_ASSERT_EQUAL_HEX16(0x0014, mega.relays);
+
+  // What a raw send did before: the readback disagrees and the next pass undoes it
+  m.send(0, "2:1");
+  reconcilePass();
+  TEST_ASSERT_EQUAL_UINT32(1, m.stats(0).repairedBits);
+  TEST_ASSERT_EQUAL_HEX16(0x0014, mega.relays);
+}
+
+// Relays change every 700 ms while the NodeMCU reconciles every 2 s; the Mega
+// resets at resetAt and takes bootMs to boot. Returns the time from the reset
+// until the readback matches what the NodeMCU wants, and the reconcile passes
+// in between.
+static uint32_t convergeAfterReset(uint32_t resetAt, uint32_t bootMs, uint8_t &passes) {
+  const uint32_t RECONCILE_MS = 2000, STEP_MS = 10;
+  I2CBusManager<MegaBus> &m = newMegaMgr();
+  uint32_t lastReconcile = 0, convergedAt = 0;
+  uint16_t everSet = 0; // channels the NodeMCU has set: all of them must be back
+  uint32_t rng = 7;
+  passes = 0;
+  for (mega.now = 0; mega.now < resetAt + 20000; mega.now += STEP_MS) {
+    if (mega.now % 700 == 0) {
+      rng = rng * 1664525UL + 1013904223UL;
+      uint8_t id = 1 + (rng >> 24) % 16;
+      m.setRelay(id, (rng >> 16) & 1);
+      everSet |= 1U << (id - 1);
+      m.flush();
+    }
+    if (mega.now == resetAt) mega.reset(bootMs);
+    bool reset = mega.now >= resetAt;
+    if (mega.now - lastReconcile >= RECONCILE_MS) {
+      lastReconcile = mega.now;
+      reconcilePass();
+      if (reset && !convergedAt) passes++;
+    }
+    if (reset && !convergedAt && mega.up() && (mega.known & everSet) == everSet &&
+        ((mega.relays ^ m.desiredMask(0)) & everSet) == 0) {
+      convergedAt = mega.now;
+    }
+  }
+  TEST_ASSERT_EQUAL(1, m.stats(0).reboots);
+  TEST_ASSERT_TRUE(m.isPresent(0));
+  TEST_ASSERT_NOT_EQUAL(0, convergedAt);
+  TEST_ASSERT_EQUAL_HEX16(everSet, mega.known);
+  TEST_ASSERT_EQUAL_HEX16(m.desiredMask(0), mega.relays);
+  return convergedAt - resetAt;
+}
+
+// Reset at every 10 ms offset of the 2 s reconcile period: convergence takes
+// the boot plus at most one period, and the pass that sees the new boot counter
+void test_mega_reset_converges() {
+  const uint32_t BOOT_MS = 1500;
+  uint32_t worstMs = 0, totalMs = 0;
+  uint8_t worstPasses = 0;
+  uint16_t runs = 0;
+  for (uint32_t offset = 0; offset < 2000; offset += 10, runs++) {
+    uint8_t passes;
+    uint32_t ms = convergeAfterReset(30000 + offset, BOOT_MS, passes);
+    totalMs += ms;
+    if (ms > worstMs) worstMs = ms;
+    if (passes > worstPasses) worstPasses = passes;
+  }
+  char line[112];
+  snprintf(line, sizeof(line), "Mega reset, %u offsets: converged after %lu ms on average, worst %lu ms / %u passes",
+           runs, (unsigned long)(totalMs / runs), (unsigned long)worstMs, worstPasses);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL(BOOT_MS + 2000, worstMs);
+  TEST_ASSERT_LESS_OR_EQUAL(2, worstPasses);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_route_fixed_per_slot);
+  RUN_TEST(test_discover_and_batch_per_slave);
+  RUN_TEST(test_failures_take_slave_offline_and_resync_on_return);
+  RUN_TEST(test_read_status_rejects_corrupt_frames);
+  RUN_TEST(test_reconcile_requeues_diverged_channels_only);
+  RUN_TEST(test_rule_target_decodes_every_spelling);
+  RUN_TEST(test_rule_relay_survives_reconcile);
+  RUN_TEST(test_mega_reset_converges);
+  return UNITY_END();
+}
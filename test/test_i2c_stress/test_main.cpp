@@ -0,0 +1,300 @@
+// I2C stress test on the host: the I2cStressMix of examples/i2c_stress
+// against a model of the Mega's receive path (SlaveFramer, parseSlaveCommand,
+// rxstats and relay bookkeeping as in mega_slave.ino), over a bus that can
+// drop, corrupt or merge transmissions
+#include <unity.h>
+#include <I2cStressMix.h>
+#include <SlaveCommand.h>
+
+static const uint8_t RELAYS = 8;          // STRESS_RELAYS
+static const uint32_t STEP_COMMANDS = 1000;
+static const uint8_t MAX_DOORS = 2;
+
+// The slave: receiveEvent(), endPacket(), processPacket() and buildStatus()
+// of mega_slave.ino without the hardware
+struct MegaModel {
+  SlaveFramer<128> framer;
+  SlaveRxStats rx = {SLAVE_RX_MAGIC, 0, SLAVE_RX_HASH_INIT, 0, 0, 0, 0, 0, 0};
+  bool relayInitialized[17] = {};
+  bool relayState[17] = {};
+  uint8_t maxRelays = 16;
+  bool replyRx = false;
+  bool endOnTransmission = true;  // false: a slave that only ends packets at '\n'
+
+  void receive(const char *bytes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      if (framer.push(bytes[i])) endPacket();
+    }
+    if (endOnTransmission && framer.pending()) endPacket();
+    rx.isrCount++;
+  }
+
+  void endPacket() {
+    const char *packet = framer.packet();
+    if (!packet) rx.overflows++;
+    else processPacket(packet, framer.length());
+    framer.next();
+  }
+
+  void relay(uint16_t id, bool on) {
+    if (id < 1 || id > maxRelays) return;
+    relayInitialized[id] = true;
+    relayState[id] = on;
+  }
+
+  void processPacket(const char *packet, size_t len) {
+    SlaveCommand cmd;
+    uint8_t kind = parseSlaveCommand(packet, len, MAX_DOORS, cmd);
+    if (kind == SC_EMPTY) return;
+    if (kind == SC_RX_STATS) {
+      replyRx = true;
+      return;
+    }
+    if (kind == SC_RX_RESET) {
+      rx.packets = rx.bad = rx.overflows = 0;
+      rx.isrCount = rx.isrTotalUs = rx.isrMaxUs = 0;
+      rx.hash = SLAVE_RX_HASH_INIT;
+      return;
+    }
+    while (len && (packet[len - 1] == '\n' || packet[len - 1] == '\r')) len--;
+    rx.packets++;
+    rx.hash = slaveRxHash(rx.hash, packet, len);
+    switch (kind) {
+      case SC_RELAY_MASK:
+        for (uint8_t ch = 1; ch <= 16; ch++) {
+          uint16_t bit = 1U << (ch - 1);
+          if (cmd.mask & bit) relay(ch, (cmd.values & bit) != 0);
+        }
+        break;
+      case SC_RELAY:
+        if (cmd.id <= maxRelays) relay(cmd.id, cmd.on);
+        break;
+      case SC_BAD:
+        rx.bad++;
+        break;
+      default:
+        break; // doors, pump, config: not in the relay state
+    }
+  }
+
+  // A read without "rxstats" selected gets the status frame: no rx stats
+  bool readRxStats(SlaveRxStats &out) {
+    if (!replyRx) return false;
+    replyRx = false;
+    rx.crc = slaveRxCrc(rx);
+    out = rx;
+    return true;
+  }
+
+  SlaveStatus readStatus() {
+    SlaveStatus st = {};
+    st.magic = SLAVE_STATUS_MAGIC;
+    st.version = SLAVE_STATUS_VERSION;
+    for (uint8_t id = 1; id <= 16; id++) {
+      if (relayState[id]) st.relayMask |= 1U << (id - 1);
+      if (relayInitialized[id]) st.relayKnown |= 1U << (id - 1);
+    }
+    st.crc = slaveStatusCrc(st);
+    return st;
+  }
+};
+
+// What can go wrong between the master's endTransmission() and receiveEvent()
+struct Bus {
+  uint32_t every = 0;       // 0 = clean, else the fault hits every n-th transmission
+  enum Fault { NONE, DROP, NACK, CORRUPT, SPLIT } fault = NONE;
+  uint32_t n = 0;
+
+  // Returns false for a NACK
+  bool transmit(MegaModel &slave, const char *msg, size_t len) {
+    if (!every || ++n % every) {
+      slave.receive(msg, len);
+      return true;
+    }
+    char copy[32];
+    memcpy(copy, msg, len);
+    switch (fault) {
+      case DROP:
+        return true;  // ACKed, never reached the handler
+      case NACK:
+        return false;
+      case CORRUPT:
+        copy[len / 2] ^= 0x04;
+        slave.receive(copy, len);
+        return true;
+      case SPLIT:
+        // Two receive interrupts for one transmission
+        slave.receive(copy, len / 2);
+        slave.receive(copy + len / 2, len - len / 2);
+        return true;
+      default:
+        slave.receive(msg, len);
+        return true;
+    }
+  }
+};
+
+static void control(MegaModel &slave, const char *cmd) { slave.receive(cmd, strlen(cmd)); }
+
+struct StepOutcome {
+  bool readback, rxOk, relaysOk;
+  uint32_t nacks;
+  SlaveRxStats rx;
+};
+
+// runStep() and the readback of i2c_stress.ino, on virtual time
+static StepOutcome runStep(I2cStressMix &mix, MegaModel &slave, Bus &bus) {
+  StepOutcome out = {false, false, false, 0, {}};
+  mix.reset();
+  control(slave, "rxreset");
+  for (uint32_t i = 0; i < STEP_COMMANDS;) {
+    char msg[32];
+    uint8_t count;
+    size_t len = mix.next(msg, sizeof(msg), i + 1 == STEP_COMMANDS, count);
+    TEST_ASSERT_LESS_THAN(sizeof(msg), len);
+    if (!bus.transmit(slave, msg, len)) {
+      out.nacks++;
+      mix.undo();
+    }
+    i += count;
+  }
+  control(slave, "rxstats");
+  if (!slave.readRxStats(out.rx)) return out; // "Readback failed" on the board
+  out.readback = true;
+  TEST_ASSERT_EQUAL_UINT8(out.rx.crc, slaveRxCrc(out.rx));
+  SlaveStatus st = slave.readStatus();
+  TEST_ASSERT_TRUE(slaveStatusValid(st));
+  out.rxOk = mix.rxOk(out.rx);
+  out.relaysOk = mix.relaysOk(st);
+  return out;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_clean_bus_matches_the_model_every_step() {
+  I2cStressMix mix(RELAYS, 0x2545F491);
+  MegaModel slave;
+  Bus bus;
+  for (int step = 0; step < 8; step++) {
+    StepOutcome o = runStep(mix, slave, bus);
+    TEST_ASSERT_TRUE(o.readback);
+    TEST_ASSERT_TRUE(o.rxOk);
+    TEST_ASSERT_TRUE(o.relaysOk);
+    TEST_ASSERT_EQUAL_UINT32(STEP_COMMANDS, o.rx.packets);
+    TEST_ASSERT_GREATER_THAN(0, o.rx.bad); // the mix does send malformed packets
+    TEST_ASSERT_EQUAL_UINT32(0, o.rx.overflows);
+  }
+}
+
+void test_refused_transmissions_stay_out_of_the_model() {
+  I2cStressMix mix(RELAYS, 7);
+  MegaModel slave;
+  Bus bus;
+  bus.fault = Bus::NACK;
+  bus.every = 13;
+  StepOutcome o = runStep(mix, slave, bus);
+  TEST_ASSERT_TRUE(o.readback);
+  TEST_ASSERT_GREATER_THAN(0, o.nacks);
+  TEST_ASSERT_TRUE(o.rxOk);
+  TEST_ASSERT_TRUE(o.relaysOk);
+  TEST_ASSERT_LESS_THAN(STEP_COMMANDS, o.rx.packets);
+}
+
+void test_silent_drops_are_counted() {
+  I2cStressMix mix(RELAYS, 7);
+  MegaModel slave;
+  Bus bus;
+  bus.fault = Bus::DROP;
+  bus.every = 50;
+  StepOutcome o = runStep(mix, slave, bus);
+  TEST_ASSERT_FALSE(o.rxOk);
+  uint32_t dropped = mix.model().packets - o.rx.packets;
+  TEST_ASSERT_GREATER_OR_EQUAL(STEP_COMMANDS / 60, dropped);
+  TEST_ASSERT_LESS_OR_EQUAL(2 * STEP_COMMANDS / 50 + 1, dropped);
+}
+
+// Same packet count, different bytes: only the hash can tell
+void test_corruption_shows_in_the_hash() {
+  I2cStressMix mix(RELAYS, 11);
+  MegaModel slave;
+  Bus bus;
+  bus.fault = Bus::CORRUPT;
+  bus.every = 97;
+  StepOutcome o = runStep(mix, slave, bus);
+  TEST_ASSERT_FALSE(o.rxOk);
+  TEST_ASSERT_NOT_EQUAL(mix.model().hash, o.rx.hash);
+}
+
+// A transmission split over two receive interrupts becomes two packets
+void test_split_transmissions_show_as_extra_packets() {
+  I2cStressMix mix(RELAYS, 3);
+  MegaModel slave;
+  Bus bus;
+  bus.fault = Bus::SPLIT;
+  bus.every = 25;
+  StepOutcome o = runStep(mix, slave, bus);
+  TEST_ASSERT_FALSE(o.rxOk);
+  TEST_ASSERT_GREATER_THAN(mix.model().packets, o.rx.packets);
+}
+
+// A slave that waits for '\n' glues unterminated transmissions to the next
+// one ("1:12:0"): the regression the end-of-transmission rule prevents. Even
+// the unterminated "rxreset" and "rxstats" get glued, so the readback fails.
+void test_merged_packets_are_caught() {
+  I2cStressMix mix(RELAYS, 5);
+  MegaModel slave;
+  slave.endOnTransmission = false;
+  Bus bus;
+  StepOutcome o = runStep(mix, slave, bus);
+  TEST_ASSERT_FALSE(o.readback);
+  TEST_ASSERT_FALSE(o.rxOk);
+  TEST_ASSERT_LESS_THAN(mix.model().packets, slave.rx.packets);
+}
+
+void test_framer_drops_an_overlong_packet_whole() {
+  SlaveFramer<8> f;
+  const char *msg = "1:1\n12345678901:1\n2:0";
+  uint8_t packets = 0, overflows = 0;
+  for (const char *p = msg; *p; p++) {
+    if (!f.push(*p)) continue;
+    if (f.packet()) packets++;
+    else overflows++;
+    f.next();
+  }
+  TEST_ASSERT_TRUE(f.pending());
+  TEST_ASSERT_EQUAL_STRING("2:0", f.packet());
+  TEST_ASSERT_EQUAL_UINT8(1, packets);
+  TEST_ASSERT_EQUAL_UINT8(1, overflows);
+  TEST_ASSERT_EQUAL(7, (int)SlaveFramer<8>::MAX_LEN);
+}
+
+void test_mix_is_deterministic_and_fits_the_wire_buffer() {
+  I2cStressMix a(RELAYS, 42), b(RELAYS, 42);
+  uint32_t pairs = 0;
+  for (int i = 0; i < 5000; i++) {
+    char ma[32], mb[32];
+    uint8_t ca, cb;
+    size_t la = a.next(ma, sizeof(ma), false, ca);
+    size_t lb = b.next(mb, sizeof(mb), false, cb);
+    TEST_ASSERT_EQUAL(la, lb);
+    TEST_ASSERT_EQUAL_MEMORY(ma, mb, la);
+    TEST_ASSERT_LESS_OR_EQUAL(31, la); // AVR Wire buffer: 32 bytes
+    if (ca == 2) pairs++;
+  }
+  TEST_ASSERT_GREATER_THAN(0, pairs);
+  TEST_ASSERT_EQUAL_UINT32(a.model().hash, b.model().hash);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_bus_matches_the_model_every_step);
+  RUN_TEST(test_refused_transmissions_stay_out_of_the_model);
+  RUN_TEST(test_silent_drops_are_counted);
+  RUN_TEST(test_corruption_shows_in_the_hash);
+  RUN_TEST(test_split_transmissions_show_as_extra_packets);
+  RUN_TEST(test_merged_packets_are_caught);
+  RUN_TEST(test_framer_drops_an_overlong_packet_whole);
+  RUN_TEST(test_mix_is_deterministic_and_fits_the_wire_buffer);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// IdleGovernor: sleep planning, time accounting per mode, the duty cycle and
+// current model, and stepping the mode down/up on wake latency
+#include <unity.h>
+#include <IdleGovernor.h>
+
+// As in main.cpp: light sleep allowed, 20..1000 ms sleeps, 150 ms wake budget
+static const IdleConfig CFG = {IDLE_LIGHT, 20, 1000, 150, 20, {200, 150, 12}};
+
+void setUp() {}
+void tearDown() {}
+
+void test_plan_sleeps_until_next_job_within_limits() {
+  IdleGovernor g(CFG);
+  g.begin(0);
+  TEST_ASSERT_EQUAL_UINT32(0, g.plan(true, 500));      // work pending
+  TEST_ASSERT_EQUAL_UINT32(0, g.plan(false, 19));      // not worth a transition
+  TEST_ASSERT_EQUAL_UINT32(20, g.plan(false, 20));
+  TEST_ASSERT_EQUAL_UINT32(500, g.plan(false, 500));
+  TEST_ASSERT_EQUAL_UINT32(1000, g.plan(false, 60000)); // capped
+}
+
+void test_off_never_sleeps() {
+  IdleConfig off = CFG;
+  off.mode = IDLE_OFF;
+  IdleGovernor g(off);
+  g.begin(0);
+  TEST_ASSERT_EQUAL_UINT32(0, g.plan(false, 60000));
+}
+
+void test_time_is_accounted_per_mode() {
+  IdleGovernor g(CFG);
+  g.begin(1000);
+  // 100 ms awake, 900 ms light sleep, woken by the float
+  g.sleeping(1100);
+  TEST_ASSERT_TRUE(g.isAsleep());
+  g.woke(2000, WAKE_FLOAT);
+  TEST_ASSERT_FALSE(g.isAsleep());
+  TEST_ASSERT_EQUAL_UINT32(100, g.stats().awakeMs);
+  TEST_ASSERT_EQUAL_UINT32(900, g.stats().lightMs);
+  TEST_ASSERT_EQUAL_UINT32(0, g.stats().modemMs);
+  TEST_ASSERT_EQUAL_UINT32(1, g.stats().sleeps);
+  TEST_ASSERT_EQUAL_UINT32(1, g.stats().wakes[WAKE_FLOAT]);
+  TEST_ASSERT_EQUAL_UINT32(0, g.stats().wakes[WAKE_TIMER]);
+  TEST_ASSERT_EQUAL(100, g.dutyPermille(2000));
+  // (100 * 200 + 900 * 12) / 1000 = 30.8 -> 3.0 mA
+  TEST_ASSERT_EQUAL(30, g.averageMa10(2000));
+}
+
+void test_empty_window_reports_fully_awake() {
+  IdleGovernor g(CFG);
+  g.begin(500);
+  TEST_ASSERT_EQUAL(1000, g.dutyPermille(500));
+  TEST_ASSERT_EQUAL(200, g.averageMa10(500));
+}
+
+void test_slow_wake_steps_mode_down_and_recovers() {
+  IdleGovernor g(CFG);
+  g.begin(0);
+  TEST_ASSERT_EQUAL(IDLE_LIGHT, g.mode());
+  g.wakeLatency(150); // on budget
+  TEST_ASSERT_EQUAL(IDLE_LIGHT, g.mode());
+  g.wakeLatency(151);
+  TEST_ASSERT_EQUAL(IDLE_MODEM, g.mode());
+  g.wakeLatency(400);
+  TEST_ASSERT_EQUAL(IDLE_OFF, g.mode());
+  g.wakeLatency(400);
+  TEST_ASSERT_EQUAL(IDLE_OFF, g.mode());
+  TEST_ASSERT_EQUAL_UINT32(3, g.stats().overBudget);
+  TEST_ASSERT_EQUAL_UINT32(400, g.stats().latencyMaxMs);
+
+  for (int i = 0; i < 19; i++) g.wakeLatency(10);
+  TEST_ASSERT_EQUAL(IDLE_OFF, g.mode());
+  g.wakeLatency(10);
+  TEST_ASSERT_EQUAL(IDLE_MODEM, g.mode());
+  // A slow sample restarts the run of good ones
+  for (int i = 0; i < 19; i++) g.wakeLatency(10);
+  g.wakeLatency(200);
+  TEST_ASSERT_EQUAL(IDLE_OFF, g.mode());
+  for (int i = 0; i < 40; i++) g.wakeLatency(10);
+  TEST_ASSERT_EQUAL(IDLE_LIGHT, g.mode()); // never deeper than configured
+  for (int i = 0; i < 40; i++) g.wakeLatency(10);
+  TEST_ASSERT_EQUAL(IDLE_LIGHT, g.mode());
+}
+
+void test_sleep_uses_mode_at_sleep_time() {
+  IdleGovernor g(CFG);
+  g.begin(0);
+  g.wakeLatency(500); // down to modem
+  g.sleeping(0);
+  g.woke(300, WAKE_TOUCH);
+  TEST_ASSERT_EQUAL_UINT32(300, g.stats().modemMs);
+  TEST_ASSERT_EQUAL_UINT32(0, g.stats().lightMs);
+}
+
+void test_reset_starts_new_window_across_wrap() {
+  IdleGovernor g(CFG);
+  g.begin(0xFFFFFF00UL);
+  g.sleeping(0xFFFFFF80UL);
+  g.woke(0x00000080UL, WAKE_TIMER); // millis() wrapped while asleep
+  TEST_ASSERT_EQUAL_UINT32(0x80, g.stats().awakeMs);
+  TEST_ASSERT_EQUAL_UINT32(0x100, g.stats().lightMs);
+  g.resetStats();
+  TEST_ASSERT_EQUAL_UINT32(0, g.stats().sleeps);
+  g.sleeping(0x100);
+  g.woke(0x200, WAKE_TIMER);
+  TEST_ASSERT_EQUAL(333, g.dutyPermille(0x200)); // 0x80 awake, 0x100 asleep
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_plan_sleeps_until_next_job_within_limits);
+  RUN_TEST(test_off_never_sleeps);
+  RUN_TEST(test_time_is_accounted_per_mode);
+  RUN_TEST(test_empty_window_reports_fully_awake);
+  RUN_TEST(test_slow_wake_steps_mode_down_and_recovers);
+  RUN_TEST(test_sleep_uses_mode_at_sleep_time);
+  RUN_TEST(test_reset_starts_new_window_across_wrap);
+  return UNITY_END();
+}
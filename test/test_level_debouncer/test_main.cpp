@@ -0,0 +1,108 @@
+// LevelDebouncer: integrator, asymmetric thresholds and minimum dwell
+#include <unity.h>
+#include <LevelDebouncer.h>
+
+// NodeMCU float sensor settings
+static const LevelDebouncer::Config CFG = {300, 1500, 3000};
+
+void setUp() {}
+void tearDown() {}
+
+void test_begin_seeds_state() {
+  LevelDebouncer d(CFG);
+  d.begin(true, 1000);
+  TEST_ASSERT_TRUE(d.state());
+  TEST_ASSERT_TRUE(d.settled());
+  TEST_ASSERT_FALSE(d.update(5000));
+  TEST_ASSERT_TRUE(d.state());
+}
+
+void test_asserts_after_net_time_at_level() {
+  LevelDebouncer d(CFG);
+  d.begin(false, 0);
+  TEST_ASSERT_FALSE(d.update(10000)); // the loop keeps polling while quiet
+  d.onEdge(true, 10000);
+  TEST_ASSERT_FALSE(d.update(10299));
+  TEST_ASSERT_TRUE(d.update(10300));
+  TEST_ASSERT_TRUE(d.state());
+  TEST_ASSERT_EQUAL_UINT32(1, d.changeCount());
+}
+
+void test_release_is_slower_than_assert() {
+  LevelDebouncer d(CFG);
+  d.begin(true, 0);
+  d.update(10000);
+  d.onEdge(false, 10000);
+  TEST_ASSERT_FALSE(d.update(11000));
+  TEST_ASSERT_TRUE(d.state());
+  TEST_ASSERT_TRUE(d.update(11500));
+  TEST_ASSERT_FALSE(d.state());
+}
+
+void test_slosh_cancels_out() {
+  LevelDebouncer d(CFG);
+  d.begin(false, 0);
+  uint32_t t = 10000;
+  d.update(t);
+  // 100 ms wet / 100 ms dry for ten seconds never reaches assertMs net
+  for (int i = 0; i < 50; i++) {
+    d.onEdge(true, t);
+    t += 100;
+    d.onEdge(false, t);
+    t += 100;
+    TEST_ASSERT_FALSE(d.update(t));
+  }
+  TEST_ASSERT_FALSE(d.state());
+  TEST_ASSERT_EQUAL_UINT32(100, d.edgeCount());
+  TEST_ASSERT_EQUAL_UINT32(0, d.changeCount());
+}
+
+void test_min_dwell_holds_new_state() {
+  LevelDebouncer d({100, 100, 3000});
+  d.begin(false, 0);
+  d.update(10000);
+  d.onEdge(true, 10000);
+  TEST_ASSERT_TRUE(d.update(10100));
+  d.onEdge(false, 10200);
+  // Integrator is back at zero long before the dwell is over
+  TEST_ASSERT_FALSE(d.update(10500));
+  TEST_ASSERT_FALSE(d.update(13000));
+  TEST_ASSERT_TRUE(d.state());
+  TEST_ASSERT_TRUE(d.update(13100));
+  TEST_ASSERT_FALSE(d.state());
+}
+
+void test_poll_feeds_edges() {
+  // Mega water sensor settings, polled every loop
+  LevelDebouncer d({500, 200, 1000});
+  d.begin(false, 0);
+  bool changed = false;
+  uint32_t t = 5000;
+  for (; t < 5600 && !changed; t += 10) changed = d.poll(true, t);
+  TEST_ASSERT_TRUE(changed);
+  TEST_ASSERT_TRUE(d.state());
+  TEST_ASSERT_UINT32_WITHIN(10, 5500, t - 10);
+  TEST_ASSERT_EQUAL_UINT32(1, d.edgeCount());
+}
+
+void test_millis_wrap() {
+  LevelDebouncer d(CFG);
+  uint32_t t = 0xFFFFFF00UL;
+  d.begin(false, t);
+  d.update(t + 100);
+  d.onEdge(true, t + 100);
+  TEST_ASSERT_TRUE(d.update(t + 400)); // crosses 0
+  TEST_ASSERT_TRUE(d.state());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_seeds_state);
+  RUN_TEST(test_asserts_after_net_time_at_level);
+  RUN_TEST(test_release_is_slower_than_assert);
+  RUN_TEST(test_slosh_cancels_out);
+  RUN_TEST(test_min_dwell_holds_new_state);
+  RUN_TEST(test_poll_feeds_edges);
+  RUN_TEST(test_millis_wrap);
+  return UNITY_END();
+}
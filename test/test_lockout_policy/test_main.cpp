@@ -0,0 +1,126 @@
+// LockoutPolicy: sliding window, exponential backoff, decay and snapshots
+#include <unity.h>
+#include <LockoutPolicy.h>
+
+// NodeMCU settings: 3 failures in 5 min -> 30 s, doubling up to 1 h, level
+// reset after a clean day
+static const LockoutConfig CFG = {3, 300, 30, 3600, 86400};
+
+void setUp() {}
+void tearDown() {}
+
+static bool failTimes(LockoutPolicy &p, uint32_t &t, uint8_t n) {
+  bool started = false;
+  for (uint8_t i = 0; i < n; i++) started = p.recordFailure(t++);
+  return started;
+}
+
+void test_third_failure_in_window_locks() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 1000;
+  TEST_ASSERT_FALSE(failTimes(p, t, 2));
+  TEST_ASSERT_FALSE(p.isLocked());
+  TEST_ASSERT_TRUE(p.recordFailure(t));
+  TEST_ASSERT_TRUE(p.isLocked());
+  TEST_ASSERT_EQUAL_UINT32(30, p.remainingS(t));
+}
+
+void test_failures_outside_window_do_not_add_up() {
+  LockoutPolicy p(CFG);
+  p.recordFailure(0);
+  p.recordFailure(100);
+  TEST_ASSERT_FALSE(p.recordFailure(400)); // window restarted at 400
+  TEST_ASSERT_EQUAL(1, p.failures());
+  TEST_ASSERT_FALSE(p.isLocked());
+}
+
+void test_lockout_expires_and_doubles() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 0;
+  failTimes(p, t, 3);
+  uint32_t lockedAt = t - 1;
+  TEST_ASSERT_FALSE(p.tick(lockedAt + 29));
+  TEST_ASSERT_TRUE(p.tick(lockedAt + 30));
+  TEST_ASSERT_FALSE(p.isLocked());
+  TEST_ASSERT_EQUAL(0, p.failures());
+  TEST_ASSERT_EQUAL(1, p.level());
+
+  t += 40;
+  failTimes(p, t, 3);
+  TEST_ASSERT_EQUAL_UINT32(60, p.remainingS(t - 1));
+  TEST_ASSERT_EQUAL(2, p.level());
+}
+
+void test_backoff_is_capped() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 0;
+  for (uint8_t round = 0; round < 12; round++) {
+    failTimes(p, t, 3);
+    uint32_t lockS = p.remainingS(t - 1);
+    TEST_ASSERT_LESS_OR_EQUAL(3600, lockS);
+    t += lockS;
+    TEST_ASSERT_TRUE(p.tick(t));
+  }
+  failTimes(p, t, 3);
+  TEST_ASSERT_EQUAL_UINT32(3600, p.remainingS(t - 1));
+}
+
+void test_success_and_clean_period_reset_level() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 0;
+  failTimes(p, t, 3);
+  p.tick(t + 100);
+  TEST_ASSERT_EQUAL(1, p.level());
+  p.recordSuccess(t + 101);
+  TEST_ASSERT_EQUAL(0, p.level());
+
+  t = 10000;
+  failTimes(p, t, 3);
+  p.tick(t + 100);
+  TEST_ASSERT_EQUAL(1, p.level());
+  p.tick(t + 86400);
+  TEST_ASSERT_EQUAL(0, p.level());
+}
+
+void test_remote_override() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 0;
+  failTimes(p, t, 3);
+  p.setFailures(0, t);
+  TEST_ASSERT_FALSE(p.isLocked());
+  TEST_ASSERT_EQUAL(0, p.level());
+  p.setFailures(5, t);
+  TEST_ASSERT_TRUE(p.isLocked());
+  TEST_ASSERT_EQUAL_UINT32(30, p.remainingS(t));
+}
+
+void test_snapshot_resumes_lockout_across_reboot() {
+  LockoutPolicy p(CFG);
+  uint32_t t = 5000;
+  failTimes(p, t, 3);
+  LockoutSnapshot snap = p.snapshot(t + 10);
+
+  LockoutPolicy q(CFG);
+  q.restore(snap, 7); // uptime restarts near zero
+  TEST_ASSERT_TRUE(q.isLocked());
+  TEST_ASSERT_EQUAL_UINT32(p.remainingS(t + 10), q.remainingS(7));
+  TEST_ASSERT_EQUAL(p.level(), q.level());
+  TEST_ASSERT_EQUAL(p.failures(), q.failures());
+
+  snap.version = LOCKOUT_SNAPSHOT_VERSION + 1;
+  LockoutPolicy r(CFG);
+  r.restore(snap, 7);
+  TEST_ASSERT_FALSE(r.isLocked());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_third_failure_in_window_locks);
+  RUN_TEST(test_failures_outside_window_do_not_add_up);
+  RUN_TEST(test_lockout_expires_and_doubles);
+  RUN_TEST(test_backoff_is_capped);
+  RUN_TEST(test_success_and_clean_period_reset_level);
+  RUN_TEST(test_remote_override);
+  RUN_TEST(test_snapshot_resumes_lockout_across_reboot);
+  return UNITY_END();
+}
@@ -0,0 +1,172 @@
+// Metrics: log2 histogram buckets, take() windows, the I2C frame transfer of
+// a block, the JSON snapshot and the overhead of one update
+#include <unity.h>
+#include <Metrics.h>
+#include <chrono>
+#include <stdio.h>
+
+static const uint8_t SHIFTS[2] = {0, 4};
+typedef Metrics<2, 1, 2> TestMetrics;
+static const char *const C_NAMES[] = {"rx", "bad"};
+static const char *const G_NAMES[] = {"free"};
+static const char *const H_NAMES[] = {"lat", "loop"};
+static const MetricsNames NAMES = {C_NAMES, G_NAMES, H_NAMES, SHIFTS};
+
+void setUp() {}
+void tearDown() {}
+
+void test_bit_length() {
+  TEST_ASSERT_EQUAL(0, metricBitLength(0));
+  TEST_ASSERT_EQUAL(1, metricBitLength(1));
+  TEST_ASSERT_EQUAL(2, metricBitLength(2));
+  TEST_ASSERT_EQUAL(2, metricBitLength(3));
+  TEST_ASSERT_EQUAL(9, metricBitLength(256));
+  TEST_ASSERT_EQUAL(16, metricBitLength(0xFFFF));
+  TEST_ASSERT_EQUAL(17, metricBitLength(0x10000));
+  TEST_ASSERT_EQUAL(32, metricBitLength(0xFFFFFFFFUL));
+}
+
+void test_histogram_buckets_with_shift() {
+  TestMetrics m(SHIFTS);
+  m.observe(1, 0);
+  m.observe(1, 15);      // below 1 << 4: bucket 0
+  m.observe(1, 16);      // bucket 1
+  m.observe(1, 47);      // 47 >> 4 = 2: bucket 2
+  m.observe(1, 1UL << 18); // 1 << (14 + 4): bucket 15
+  m.observe(1, 0xFFFFFFFFUL); // clamped into bucket 15
+  TestMetrics::Block b;
+  m.take(b);
+  TEST_ASSERT_EQUAL_UINT32(2, b.hist[1].bucket[0]);
+  TEST_ASSERT_EQUAL_UINT32(1, b.hist[1].bucket[1]);
+  TEST_ASSERT_EQUAL_UINT32(1, b.hist[1].bucket[2]);
+  TEST_ASSERT_EQUAL_UINT32(2, b.hist[1].bucket[15]);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFUL, b.hist[1].max);
+  TEST_ASSERT_EQUAL_UINT32(0, b.hist[0].max);
+}
+
+void test_take_starts_new_histogram_window_only() {
+  TestMetrics m(SHIFTS);
+  m.inc(0);
+  m.inc(0, 4);
+  m.set(0, -12);
+  m.observe(0, 5);
+  TestMetrics::Block b;
+  m.take(b);
+  TEST_ASSERT_EQUAL_UINT32(5, b.counter[0]);
+  TEST_ASSERT_EQUAL(-12, b.gauge[0]);
+  TEST_ASSERT_EQUAL_UINT32(1, b.hist[0].bucket[3]);
+
+  m.inc(0);
+  m.take(b);
+  TEST_ASSERT_EQUAL_UINT32(6, b.counter[0]);  // counters run since boot
+  TEST_ASSERT_EQUAL(-12, b.gauge[0]);          // gauges keep their level
+  TEST_ASSERT_EQUAL_UINT32(0, b.hist[0].bucket[3]);
+  TEST_ASSERT_EQUAL_UINT32(0, b.hist[0].max);
+  TEST_ASSERT_EQUAL_UINT32(6, m.counter(0));
+}
+
+void test_block_travels_in_frames() {
+  MegaMetrics mega(MEGA_METRIC_SHIFTS);
+  for (uint32_t i = 0; i < 300; i++) mega.inc(MC_I2C_RX);
+  mega.inc(MC_SMS_FAILED, 2);
+  mega.set(MG_SRAM_FREE, 2100);
+  for (uint32_t us = 10; us < 50000; us *= 3) mega.observe(MH_LOOP_US, us);
+  MegaMetrics::Block sent, got;
+  mega.take(sent);
+  memset(&got, 0xAA, sizeof(got));
+
+  const uint16_t total = sizeof(MegaMetrics::Block);
+  TEST_ASSERT_EQUAL(sizeof(MetricsFrame), 32); // one AVR Wire buffer
+  uint16_t frames = 0;
+  for (uint16_t off = 0; off < total; off += METRICS_FRAME_DATA) {
+    MetricsFrame f;
+    metricsFrame(&sent, total, MEGA_METRICS_LAYOUT, off, f);
+    TEST_ASSERT_TRUE(metricsFrameApply(f, MEGA_METRICS_LAYOUT, off, &got, total));
+    frames++;
+  }
+  TEST_ASSERT_EQUAL((total + METRICS_FRAME_DATA - 1) / METRICS_FRAME_DATA, frames);
+  TEST_ASSERT_EQUAL_MEMORY(&sent, &got, total);
+}
+
+void test_bad_frames_are_rejected() {
+  MegaMetrics mega(MEGA_METRIC_SHIFTS);
+  MegaMetrics::Block sent, got;
+  mega.take(sent);
+  const uint16_t total = sizeof(sent);
+  MetricsFrame f;
+  metricsFrame(&sent, total, MEGA_METRICS_LAYOUT, 24, f);
+  TEST_ASSERT_FALSE(metricsFrameApply(f, MEGA_METRICS_LAYOUT, 0, &got, total));      // wrong piece
+  TEST_ASSERT_FALSE(metricsFrameApply(f, MEGA_METRICS_LAYOUT + 1, 24, &got, total)); // other layout
+  TEST_ASSERT_FALSE(metricsFrameApply(f, MEGA_METRICS_LAYOUT, 24, &got, total + 4)); // other size
+  f.data[3] ^= 1;
+  TEST_ASSERT_FALSE(metricsFrameApply(f, MEGA_METRICS_LAYOUT, 24, &got, total));     // CRC
+
+  metricsFrame(&sent, total, MEGA_METRICS_LAYOUT, total, f); // past the end
+  TEST_ASSERT_EQUAL(0, f.len);
+  TEST_ASSERT_FALSE(metricsFrameApply(f, MEGA_METRICS_LAYOUT, total, &got, total));
+}
+
+void test_json_snapshot() {
+  TestMetrics m(SHIFTS);
+  m.inc(0, 7);
+  m.set(0, 2100);
+  m.observe(1, 20);
+  m.observe(1, 100);
+  TestMetrics::Block b;
+  m.take(b);
+  char out[160];
+  size_t n = metricsJson(out, sizeof(out), b, NAMES);
+  // The empty "lat" histogram is left out, "loop" trimmed after bucket 3
+  TEST_ASSERT_EQUAL_STRING("{\"c\":{\"rx\":7,\"bad\":0},\"g\":{\"free\":2100},"
+                           "\"h\":{\"loop\":{\"s\":4,\"max\":100,\"b\":[0,1,0,1]}}}", out);
+  TEST_ASSERT_EQUAL(strlen(out), n);
+  TEST_ASSERT_EQUAL(0, metricsJson(out, n, b, NAMES)); // one byte short
+  TEST_ASSERT_EQUAL(n, metricsJson(out, n + 1, b, NAMES));
+}
+
+template <typename F>
+static double nsPerUpdate(uint32_t updates, F update) {
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < updates; i++) update(i);
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / updates;
+}
+
+// Host cost of inc()/set()/observe() on the Mega's block, each with its IRQ
+// guard (a no-op here). The numbers are for comparing builds on one machine;
+// the bound only catches an update that stopped being O(1).
+void test_update_overhead_ns() {
+  MegaMetrics mega(MEGA_METRIC_SHIFTS);
+  const uint32_t UPDATES = 1000000;
+  char line[96];
+
+  double incNs = nsPerUpdate(UPDATES, [&](uint32_t) { mega.inc(MC_I2C_RX); });
+  double setNs = nsPerUpdate(UPDATES, [&](uint32_t i) { mega.set(MG_SRAM_FREE, (int32_t)i); });
+  double observeNs = nsPerUpdate(UPDATES, [&](uint32_t i) { mega.observe(MH_LOOP_US, i * 2654435761UL); });
+
+  MegaMetrics::Block b;
+  mega.take(b);
+  TEST_ASSERT_EQUAL_UINT32(UPDATES, b.counter[MC_I2C_RX]);
+  TEST_ASSERT_EQUAL((int32_t)(UPDATES - 1), b.gauge[MG_SRAM_FREE]);
+  uint32_t observed = 0;
+  for (uint8_t k = 0; k < METRIC_BUCKETS; k++) observed += b.hist[MH_LOOP_US].bucket[k];
+  TEST_ASSERT_EQUAL_UINT32(UPDATES, observed);
+
+  snprintf(line, sizeof(line), "inc: %.1f ns, set: %.1f ns, observe: %.1f ns per update", incNs, setNs, observeNs);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN(1000.0, incNs);
+  TEST_ASSERT_LESS_THAN(1000.0, setNs);
+  TEST_ASSERT_LESS_THAN(1000.0, observeNs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bit_length);
+  RUN_TEST(test_histogram_buckets_with_shift);
+  RUN_TEST(test_take_starts_new_histogram_window_only);
+  RUN_TEST(test_block_travels_in_frames);
+  RUN_TEST(test_bad_frames_are_rejected);
+  RUN_TEST(test_json_snapshot);
+  RUN_TEST(test_update_overhead_ns);
+  return UNITY_END();
+}
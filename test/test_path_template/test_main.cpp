@@ -0,0 +1,100 @@
+// PathTemplate / PathBuffer and ClockFormatter: the text must match what
+// snprintf and strftime produce, including truncation at the buffer size
+#include <unity.h>
+#include <PathTemplate.h>
+#include <ClockFormatter.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char RELAY_PREFIX[] PROGMEM = "/smart_controls/relays/";
+static const char RELAY_SUFFIX[] PROGMEM = "/state";
+static const PathTemplate RELAY_STATE = PATH_TEMPLATE(RELAY_PREFIX, RELAY_SUFFIX);
+
+void setUp() {}
+void tearDown() {}
+
+void test_format_id_matches_snprintf() {
+  PathBuffer<48> path(RELAY_STATE);
+  const uint32_t ids[] = {0, 1, 9, 10, 16, 12345, 4294967295UL};
+  for (uint32_t id : ids) {
+    char want[48];
+    snprintf(want, sizeof(want), "/smart_controls/relays/%lu/state", (unsigned long)id);
+    TEST_ASSERT_EQUAL_STRING(want, path.format(id));
+  }
+}
+
+void test_format_segment_and_rebind() {
+  static const char DOOR_PREFIX[] = "/smart_controls/relays/";
+  static const char DOOR_SUFFIX[] = "/isLocked";
+  static const PathTemplate DOOR = PATH_TEMPLATE(DOOR_PREFIX, DOOR_SUFFIX);
+  PathBuffer<48> path(RELAY_STATE);
+  TEST_ASSERT_EQUAL_STRING("/smart_controls/relays/door_2/state", path.format("door_2"));
+  path.bind(DOOR);
+  TEST_ASSERT_EQUAL_STRING("/smart_controls/relays/door_2/isLocked", path.format("door_2"));
+}
+
+void test_runtime_prefix_and_leaf() {
+  PathBuffer<64> log;
+  log.bindRuntime("/devices/fingerprint_door_001", "/logs/");
+  TEST_ASSERT_EQUAL_STRING("/devices/fingerprint_door_001/logs/2026-10-18/12:00:01/name",
+                           log.format("2026-10-18", "12:00:01", "name"));
+  TEST_ASSERT_EQUAL_STRING("/devices/fingerprint_door_001/logs/2026-10-18/12:00:01/fingerId", log.leaf("fingerId"));
+  TEST_ASSERT_EQUAL_STRING("/devices/fingerprint_door_001/logs/2026-10-18/12:00:01/fingerId", log.c_str());
+}
+
+void test_truncates_like_snprintf() {
+  PathBuffer<20> path(RELAY_STATE); // prefix alone is 23 characters
+  TEST_ASSERT_EQUAL_STRING("/smart_controls/rel", path.format(7));
+  PathBuffer<28> tight(RELAY_STATE);
+  TEST_ASSERT_EQUAL_STRING("/smart_controls/relays/1234", tight.format(123456));
+
+  PathBuffer<16> rt;
+  rt.bindRuntime("/devices/a_very_long_device_id", "/logs/");
+  TEST_ASSERT_EQUAL(15, strlen(rt.format("x", "y", "z")));
+}
+
+void test_clock_matches_strftime_across_days() {
+  ClockFormatter clock;
+  srand(1);
+  time_t t = 1760745600; // 2025-10-18 00:00:00 UTC
+  for (int i = 0; i < 20000; i++) {
+    t += rand() % 900; // steps of up to 15 min cross many midnights
+    clock.update(t);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char want[20];
+    strftime(want, sizeof(want), "%Y-%m-%d %H:%M:%S", &tm);
+    TEST_ASSERT_EQUAL_STRING(want, clock.stamp());
+    TEST_ASSERT_EQUAL_STRING_LEN(want, clock.date(), 10);
+    TEST_ASSERT_EQUAL_STRING(want + 11, clock.time());
+    TEST_ASSERT_EQUAL_UINT32(tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec, clock.secondOfDay());
+  }
+}
+
+void test_clock_same_second_is_free() {
+  ClockFormatter clock;
+  TEST_ASSERT_TRUE(clock.update(1760745600));
+  TEST_ASSERT_FALSE(clock.update(1760745600));
+  TEST_ASSERT_TRUE(clock.update(1760745599)); // clock stepped back a day boundary
+  TEST_ASSERT_EQUAL_STRING("2025-10-17 23:59:59", clock.stamp());
+}
+
+void test_clock_before_sync() {
+  ClockFormatter clock; // time(nullptr) is seconds since boot until SNTP answers
+  clock.update(5);
+  TEST_ASSERT_EQUAL_STRING("1970-01-01 00:00:05", clock.stamp());
+}
+
+int main() {
+  setenv("TZ", "UTC0", 1); // the NodeMCU runs configTime() with a fixed offset
+  tzset();
+  UNITY_BEGIN();
+  RUN_TEST(test_format_id_matches_snprintf);
+  RUN_TEST(test_format_segment_and_rebind);
+  RUN_TEST(test_runtime_prefix_and_leaf);
+  RUN_TEST(test_truncates_like_snprintf);
+  RUN_TEST(test_clock_matches_strftime_across_days);
+  RUN_TEST(test_clock_same_second_is_free);
+  RUN_TEST(test_clock_before_sync);
+  return UNITY_END();
+}
@@ -0,0 +1,210 @@
+// PumpController against a simulated tank: a pump that fills it, household
+// use that drains it and the float that reports it empty. Checks the cycling
+// limits, the cool-down, both faults and the runtime/energy counters.
+#include <unity.h>
+#include <PumpController.h>
+
+// Rules of the Mega sketch: min on 30 s, min off 60 s, max on 15 min,
+// cool-down 10 min, no-effect fault after 30 min, 370 W pump
+static const PumpRules RULES = {30, 60, 900, 600, 1800, 370};
+const uint32_t STEP_MS = 100; // loop pass
+
+struct Tank {
+  float level;       // percent
+  float fillPerS;    // pump running on a wet supply
+  float drainPerS;
+  float floatAt;     // float switch height: below it the tank reports empty
+  bool supplyWet;
+
+  bool empty() const { return level < floatAt; }
+  void step(bool pumping, uint32_t ms) {
+    level += ((pumping && supplyWet ? fillPerS : 0) - drainPerS) * ms / 1000.0f;
+    if (level < 0) level = 0;
+    if (level > 100) level = 100;
+  }
+};
+
+// On/off run lengths seen by the simulation, in ms
+struct Runs {
+  uint32_t shortestOn, shortestOff, longestOn;
+  uint32_t onMs, starts;
+  uint32_t lastChange;
+  bool on, seenOff;
+  float minLevel, maxLevel;
+};
+
+struct Sim {
+  PumpController pump;
+  Tank tank;
+  Runs runs;
+  uint32_t now;
+
+  Sim(const PumpRules &rules, const Tank &t) : pump(rules), tank(t), now(1000) {
+    pump.begin(now);
+    runs = {0xFFFFFFFFUL, 0xFFFFFFFFUL, 0, 0, 0, now, false, false, t.level, t.level};
+  }
+
+  // The NodeMCU requests water while its float reports the tank empty
+  void run(uint32_t ms) {
+    for (uint32_t end = now + ms; now != end; now += STEP_MS) {
+      bool empty = tank.empty();
+      bool on = pump.update({empty, tank.supplyWet, empty}, now);
+      if (on != runs.on) {
+        uint32_t len = now - runs.lastChange;
+        if (runs.on) {
+          if (len < runs.shortestOn) runs.shortestOn = len;
+          if (len > runs.longestOn) runs.longestOn = len;
+        } else if (runs.seenOff) {
+          if (len < runs.shortestOff) runs.shortestOff = len;
+        }
+        if (!runs.on) runs.starts++;
+        if (runs.on) runs.seenOff = true;
+        runs.on = on;
+        runs.lastChange = now;
+      }
+      if (on) runs.onMs += STEP_MS;
+      tank.step(on, STEP_MS);
+      if (tank.level < runs.minLevel) runs.minLevel = tank.level;
+      if (tank.level > runs.maxLevel) runs.maxLevel = tank.level;
+    }
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+// A fast pump and a float in the middle: without the minimums it would
+// chatter at the float. Six hours of use.
+void test_cycling_respects_min_on_and_off() {
+  Sim sim(RULES, {60, 1.0f, 0.05f, 50, true});
+  sim.run(6 * 3600000UL);
+
+  TEST_ASSERT_GREATER_THAN(5, sim.runs.starts);
+  TEST_ASSERT_EQUAL_UINT32(sim.runs.starts, sim.pump.report().starts);
+  TEST_ASSERT_GREATER_OR_EQUAL(RULES.minOnS * 1000UL, sim.runs.shortestOn);
+  TEST_ASSERT_GREATER_OR_EQUAL(RULES.minOffS * 1000UL, sim.runs.shortestOff);
+  TEST_ASSERT_LESS_THAN(RULES.maxOnS * 1000UL, sim.runs.longestOn);
+  // Level held around the float: the 30 s minimum run overfills by 30 %
+  TEST_ASSERT_GREATER_THAN(45.0f, sim.runs.minLevel);
+  TEST_ASSERT_LESS_THAN(85.0f, sim.runs.maxLevel);
+  TEST_ASSERT_EQUAL(0, sim.pump.report().cooldowns);
+  TEST_ASSERT_EQUAL(0, sim.pump.report().dryFaults);
+  TEST_ASSERT_EQUAL(0, sim.pump.report().disagreeFaults);
+}
+
+// Demand above what the pump delivers: runs hit max on, rest for the
+// cool-down and then min off, and start again
+void test_max_on_forces_cooldown() {
+  PumpRules rules = RULES;
+  rules.disagreeS = 60000; // keep the no-effect fault out of this one
+  Sim sim(rules, {10, 0.10f, 0.11f, 50, true});
+  sim.run(3600000UL);
+
+  PumpReport r = sim.pump.report();
+  TEST_ASSERT_EQUAL(3, r.starts); // at 0, 26 and 52 min
+  TEST_ASSERT_EQUAL(2, r.cooldowns);
+  TEST_ASSERT_EQUAL_UINT32(rules.maxOnS * 1000UL, sim.runs.longestOn);
+  TEST_ASSERT_EQUAL_UINT32(rules.maxOnS * 1000UL, sim.runs.shortestOn);
+  TEST_ASSERT_EQUAL_UINT32((rules.cooldownS + rules.minOffS) * 1000UL, sim.runs.shortestOff);
+  TEST_ASSERT_TRUE(sim.pump.output());
+  TEST_ASSERT_LESS_THAN(10.0f, sim.tank.level);
+}
+
+// Supply runs dry mid-run: the pump stops at once, ignoring min on, and
+// waits for the supply and then min off before starting again
+void test_dry_supply_faults_and_recovers() {
+  Sim sim(RULES, {40, 0.2f, 0.02f, 50, true});
+  sim.run(10000);
+  TEST_ASSERT_TRUE(sim.pump.output());
+  sim.tank.supplyWet = false;
+  sim.run(STEP_MS);
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DRY, sim.pump.currentState());
+  TEST_ASSERT_FALSE(sim.pump.output());
+  TEST_ASSERT_EQUAL(1, sim.pump.report().dryFaults);
+  sim.run(120000);
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DRY, sim.pump.currentState());
+
+  sim.tank.supplyWet = true;
+  sim.run(STEP_MS);
+  TEST_ASSERT_EQUAL(PUMP_OFF, sim.pump.currentState());
+  sim.run(RULES.minOffS * 1000UL - STEP_MS);
+  TEST_ASSERT_FALSE(sim.pump.output());
+  sim.run(STEP_MS);
+  TEST_ASSERT_TRUE(sim.pump.output());
+  TEST_ASSERT_EQUAL(2, sim.pump.report().starts);
+
+  // Requested while the supply is already dry: straight to the fault
+  PumpController idle(RULES);
+  idle.begin(0);
+  TEST_ASSERT_FALSE(idle.update({true, false, true}, 100));
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DRY, idle.currentState());
+}
+
+// Pump runs but the float never rises (broken pipe): fault after disagreeS of
+// running, and it clears once the request drops
+void test_sensor_disagreement_faults() {
+  PumpRules rules = RULES;
+  rules.maxOnS = 3600; // one long run, no cool-down in between
+  Sim sim(rules, {20, 0, 0, 50, true});
+  sim.run(rules.disagreeS * 1000UL); // last pass 100 ms short of it
+  TEST_ASSERT_TRUE(sim.pump.output());
+  sim.run(STEP_MS);
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DISAGREE, sim.pump.currentState());
+  TEST_ASSERT_EQUAL(1, sim.pump.report().disagreeFaults);
+  sim.run(600000);
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DISAGREE, sim.pump.currentState()); // still requested
+
+  sim.tank.level = 70; // refilled by hand: the float reports water, request drops
+  sim.run(STEP_MS);
+  TEST_ASSERT_EQUAL(PUMP_OFF, sim.pump.currentState());
+
+  // The no-effect time counts across cool-downs
+  rules = RULES;
+  Sim slow(rules, {20, 0, 0, 50, true});
+  slow.run((rules.maxOnS + rules.cooldownS) * 1000UL + STEP_MS);
+  TEST_ASSERT_EQUAL(1, slow.pump.report().cooldowns);
+  // Second run: 1800 s without effect and max on are reached together; the fault wins
+  slow.run((rules.minOffS + rules.maxOnS) * 1000UL);
+  TEST_ASSERT_EQUAL(PUMP_FAULT_DISAGREE, slow.pump.currentState());
+  TEST_ASSERT_EQUAL(1, slow.pump.report().cooldowns);
+}
+
+// Runtime in whole seconds and energy from the nameplate power
+void test_runtime_and_energy_counters() {
+  PumpRules rules = RULES;
+  rules.maxOnS = 7200;
+  rules.disagreeS = 60000;
+  PumpController pump(rules);
+  pump.begin(0);
+  uint32_t now = 0;
+  pump.update({true, true, true}, now);
+  for (uint32_t i = 0; i < 5400000UL / STEP_MS; i++) pump.update({true, true, true}, now += STEP_MS);
+  PumpReport r = pump.report();
+  TEST_ASSERT_EQUAL_UINT32(5400, r.runtimeS);
+  TEST_ASSERT_EQUAL_UINT32(555, r.energyWh); // 1.5 h at 370 W
+
+  // Stops after min on; the counters keep their totals while off
+  pump.update({false, true, false}, now += STEP_MS);
+  TEST_ASSERT_FALSE(pump.output());
+  for (int i = 0; i < 100; i++) pump.update({false, true, false}, now += 1000);
+  r = pump.report();
+  TEST_ASSERT_EQUAL_UINT32(5400, r.runtimeS);
+  TEST_ASSERT_EQUAL(1, r.starts);
+
+  // The simulation agrees with its own on-time
+  Sim sim(RULES, {60, 1.0f, 0.05f, 50, true});
+  sim.run(3 * 3600000UL);
+  r = sim.pump.report();
+  TEST_ASSERT_UINT32_WITHIN(1, sim.runs.onMs / 1000, r.runtimeS);
+  TEST_ASSERT_EQUAL_UINT32(r.runtimeS * 370UL / 3600UL, r.energyWh);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_cycling_respects_min_on_and_off);
+  RUN_TEST(test_max_on_forces_cooldown);
+  RUN_TEST(test_dry_supply_faults_and_recovers);
+  RUN_TEST(test_sensor_disagreement_faults);
+  RUN_TEST(test_runtime_and_energy_counters);
+  return UNITY_END();
+}
@@ -0,0 +1,118 @@
+// RingLog: line framing, both full-ring modes, non-blocking drain across the
+// wrap, copyTail() and compile-time level filtering
+#define LOG_LEVEL LOG_LEVEL_WARN
+#define LOG_LINE_MAX 32
+#include <unity.h>
+#include <RingLog.h>
+#include <string>
+
+LOG_DEFINE();
+
+// Sink with a FIFO of room bytes, like a UART; room may exceed the ring
+struct Sink {
+  std::string text;
+  int room = 1 << 20;
+  int availableForWrite() { return room; }
+  size_t write(const uint8_t *p, size_t n) {
+    text.append((const char *)p, n);
+    room -= (int)n;
+    return n;
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_line_has_tag_and_newline() {
+  RingLog<128> log;
+  log.write(LOG_LEVEL_INFO, "relay %d %s", 3, "on");
+  log.write(LOG_LEVEL_ERROR, "already ends\n");
+  Sink out;
+  log.drain(out);
+  TEST_ASSERT_EQUAL_STRING("I relay 3 on\nE already ends\n", out.text.c_str());
+  TEST_ASSERT_EQUAL_UINT32(2, log.written());
+}
+
+void test_long_line_is_truncated() {
+  RingLog<128> log;
+  log.write(LOG_LEVEL_WARN, "%s", "0123456789012345678901234567890123456789");
+  char tail[128];
+  size_t n = log.copyTail(tail, sizeof(tail));
+  TEST_ASSERT_LESS_OR_EQUAL(LOG_LINE_MAX, n);
+  TEST_ASSERT_EQUAL('W', tail[0]);
+  TEST_ASSERT_EQUAL('\n', tail[n - 1]);
+}
+
+void test_drop_newest_when_full() {
+  RingLog<64> log;
+  for (int i = 0; i < 10; i++) log.write(LOG_LEVEL_INFO, "line %02d", i); // 10 bytes each
+  TEST_ASSERT_EQUAL(60, log.used());
+  TEST_ASSERT_EQUAL_UINT32(4, log.dropped());
+  Sink out;
+  log.drain(out);
+  TEST_ASSERT_EQUAL_STRING("I line 00\nI line 01\nI line 02\nI line 03\nI line 04\nI line 05\n", out.text.c_str());
+}
+
+void test_keep_newest_discards_whole_lines() {
+  RingLog<64> log;
+  log.setMode(LOG_KEEP_NEWEST);
+  for (int i = 0; i < 10; i++) log.write(LOG_LEVEL_INFO, "line %02d", i);
+  char tail[64];
+  log.copyTail(tail, sizeof(tail));
+  TEST_ASSERT_EQUAL_STRING("I line 04\nI line 05\nI line 06\nI line 07\nI line 08\nI line 09\n", tail);
+  TEST_ASSERT_EQUAL_UINT32(4, log.dropped());
+}
+
+void test_drain_never_exceeds_room_and_survives_wrap() {
+  RingLog<64> log;
+  Sink out;
+  std::string want;
+  for (int i = 0; i < 40; i++) {
+    log.write(LOG_LEVEL_INFO, "n%d", i);
+    want += "I n" + std::to_string(i) + "\n";
+    int room = (i % 4) * 5; // 0 = UART busy
+    out.room = room;
+    size_t before = out.text.size();
+    log.drain(out);
+    TEST_ASSERT_LESS_OR_EQUAL(room, (int)(out.text.size() - before));
+  }
+  out.room = 1 << 20;
+  log.drain(out);
+  TEST_ASSERT_EQUAL_UINT32(0, log.dropped());
+  TEST_ASSERT_EQUAL_STRING(want.c_str(), out.text.c_str());
+  TEST_ASSERT_EQUAL(0, log.used());
+}
+
+void test_copy_tail_is_bounded_and_keeps_data() {
+  RingLog<64> log;
+  log.write(LOG_LEVEL_INFO, "abc");
+  log.write(LOG_LEVEL_INFO, "def");
+  char small[6];
+  TEST_ASSERT_EQUAL(5, log.copyTail(small, sizeof(small)));
+  TEST_ASSERT_EQUAL_STRING(" def\n", small);
+  TEST_ASSERT_EQUAL(12, log.used());
+}
+
+void test_disabled_levels_compile_out() {
+  Sink out;
+  shLog.drain(out);
+  int evaluated = 0;
+  LOG_I("info %d", ++evaluated);
+  LOG_D("debug %d", ++evaluated);
+  LOG_W("warn %d", ++evaluated);
+  shLog.drain(out);
+  TEST_ASSERT_EQUAL(1, evaluated); // arguments of removed levels are not evaluated
+  TEST_ASSERT_EQUAL_STRING("W warn 1\n", out.text.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_line_has_tag_and_newline);
+  RUN_TEST(test_long_line_is_truncated);
+  RUN_TEST(test_drop_newest_when_full);
+  RUN_TEST(test_keep_newest_discards_whole_lines);
+  RUN_TEST(test_drain_never_exceeds_room_and_survives_wrap);
+  RUN_TEST(test_copy_tail_is_bounded_and_keeps_data);
+  RUN_TEST(test_disabled_levels_compile_out);
+  return UNITY_END();
+}
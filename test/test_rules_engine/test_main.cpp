@@ -0,0 +1,155 @@
+// RulesEngine: compiler checks, edge-triggered actions and the cost of one
+// input change with 100+ rules loaded
+#include <unity.h>
+#include <RulesEngine.h>
+#include <chrono>
+#include <stdio.h>
+
+static uint16_t fired;
+static uint8_t lastType, lastArg;
+static char lastText[24];
+
+static void onAction(uint8_t type, uint8_t arg, const char *text) {
+  fired++;
+  lastType = type;
+  lastArg = arg;
+  snprintf(lastText, sizeof(lastText), "%s", text ? text : "");
+}
+
+static RulesEngine rules(onAction);
+
+void setUp() {
+  rules.clear();
+  for (uint8_t i = 0; i < IN_COUNT; i++) rules.setInput(i, -1);
+  rules.run();
+  fired = 0;
+}
+
+void tearDown() {}
+
+void test_fires_on_rising_edge_only() {
+  TEST_ASSERT_TRUE(rules.addRule("float == 0 && hour >= 6 -> relay 3 on"));
+  rules.setInput(IN_HOUR, 7);
+  rules.setInput(IN_FLOAT, 1);
+  rules.run();
+  TEST_ASSERT_EQUAL(0, fired);
+  rules.setInput(IN_FLOAT, 0);
+  rules.run();
+  TEST_ASSERT_EQUAL(1, fired);
+  TEST_ASSERT_EQUAL(ACT_RELAY_ON, lastType);
+  TEST_ASSERT_EQUAL(3, lastArg);
+  rules.setInput(IN_HOUR, 8); // still true: no new edge
+  rules.run();
+  TEST_ASSERT_EQUAL(1, fired);
+}
+
+void test_only_dependent_rules_run() {
+  TEST_ASSERT_TRUE(rules.addRule("float == 0 -> relay 1 on"));
+  TEST_ASSERT_TRUE(rules.addRule("failed >= 3 -> send alert"));
+  TEST_ASSERT_TRUE(rules.addRule("!door_locked && relay1 -> relay 2 off"));
+  rules.run();
+  rules.setInput(IN_FAILED, 3);
+  TEST_ASSERT_EQUAL(1, rules.run());
+  TEST_ASSERT_EQUAL(ACT_SEND, lastType);
+  TEST_ASSERT_EQUAL_STRING("alert", lastText);
+  rules.setInput(IN_RELAY_FIRST, 1);
+  TEST_ASSERT_EQUAL(1, rules.run());
+  TEST_ASSERT_EQUAL(0, rules.run()); // nothing dirty
+}
+
+void test_rejects_constant_condition() {
+  TEST_ASSERT_FALSE(rules.addRule("1 -> relay 1 on"));
+  TEST_ASSERT_EQUAL_STRING("condition reads no input", rules.lastError());
+  TEST_ASSERT_FALSE(rules.addRule("(0 == 0) -> lock"));
+  TEST_ASSERT_EQUAL(0, rules.count());
+  TEST_ASSERT_EQUAL(0, rules.codeBytes());
+}
+
+void test_send_is_limited_to_door_and_relay_commands() {
+  const char *ok[] = {"failed>=1 -> send lock", "failed>=1 -> send unlock:1", "failed>=1 -> send alert:0",
+                      "failed>=1 -> send 4:1", "failed>=1 -> send rm:0f:05"};
+  const char *bad[] = {"failed>=1 -> send bootload", "failed>=1 -> send cfg:save",
+                       "failed>=1 -> send rxreset", "failed>=1 -> send metrics:0",
+                       "failed>=1 -> send waterempty", "failed>=1 -> send lock:7", "failed>=1 -> send 17:1"};
+  for (const char *r : ok) TEST_ASSERT_TRUE_MESSAGE(rules.addRule(r), r);
+  for (const char *r : bad) {
+    TEST_ASSERT_FALSE_MESSAGE(rules.addRule(r), r);
+    TEST_ASSERT_EQUAL_STRING("command not allowed", rules.lastError());
+  }
+  TEST_ASSERT_EQUAL(5, rules.count());
+}
+
+void test_syntax_errors() {
+  TEST_ASSERT_FALSE(rules.addRule("float == -> relay 1 on"));
+  TEST_ASSERT_FALSE(rules.addRule("float == 1 relay 1 on"));
+  TEST_ASSERT_FALSE(rules.addRule("float == 1 -> relay 17 on"));
+  TEST_ASSERT_FALSE(rules.addRule("nosuch == 1 -> lock"));
+  TEST_ASSERT_FALSE(rules.addRule("((((((((((((((((((float)))))))))))))))))) -> lock"));
+  TEST_ASSERT_TRUE(rules.addRule("# comment"));
+  TEST_ASSERT_EQUAL(0, rules.count());
+}
+
+// 120 rules (most of RULES_CODE_SIZE): one per (relay, hour) plus a few on the shared inputs.
+// A relay change touches a handful of rules, an hour change touches most.
+static void loadBenchmarkRules() {
+  static char program[120 * 64];
+  size_t n = 0;
+  for (uint8_t i = 0; i < 112; i++) {
+    uint8_t relay = i % 16 + 1;
+    n += snprintf(program + n, sizeof(program) - n, "relay%u && hour == %u -> relay %u %s\n", relay, i % 24,
+                  (relay % 16) + 1, i & 1 ? "on" : "off");
+  }
+  for (uint8_t i = 0; i < 8; i++) {
+    n += snprintf(program + n, sizeof(program) - n, "float == 0 && failed >= %u || !door_locked -> send alert:%u\n",
+                  i, i & 1);
+  }
+  TEST_ASSERT_EQUAL(0, rules.load(program));
+  TEST_ASSERT_EQUAL(120, rules.count());
+}
+
+static double nsPerEvent(uint8_t in, uint32_t events, uint32_t &evaluated) {
+  evaluated = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < events; i++) {
+    rules.setInput(in, in == IN_HOUR ? (i + 1) % 24 : i & 1); // every event is a change
+    evaluated += rules.run();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / events;
+}
+
+void test_benchmark_120_rules() {
+  loadBenchmarkRules();
+  rules.setInput(IN_HOUR, 0);
+  rules.setInput(IN_FLOAT, 1);
+  rules.setInput(IN_FAILED, 0);
+  rules.setInput(IN_DOOR_LOCKED, 1);
+  rules.run();
+  const uint32_t EVENTS = 100000;
+  uint32_t evaluated;
+  char line[96];
+
+  double relayNs = nsPerEvent(IN_RELAY_FIRST + 4, EVENTS, evaluated);
+  TEST_ASSERT_EQUAL_UINT32(7 * EVENTS, evaluated); // relay5 is read by 7 rules
+  snprintf(line, sizeof(line), "relay change: %.0f ns/event, 7 of 120 rules", relayNs);
+  TEST_MESSAGE(line);
+
+  double hourNs = nsPerEvent(IN_HOUR, EVENTS, evaluated);
+  TEST_ASSERT_EQUAL_UINT32(112 * EVENTS, evaluated);
+  snprintf(line, sizeof(line), "hour change: %.0f ns/event, 112 of 120 rules", hourNs);
+  TEST_MESSAGE(line);
+
+  // Incremental evaluation: a narrow input costs a fraction of a wide one
+  TEST_ASSERT_LESS_THAN(hourNs, relayNs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fires_on_rising_edge_only);
+  RUN_TEST(test_only_dependent_rules_run);
+  RUN_TEST(test_rejects_constant_condition);
+  RUN_TEST(test_send_is_limited_to_door_and_relay_commands);
+  RUN_TEST(test_syntax_errors);
+  RUN_TEST(test_benchmark_120_rules);
+  return UNITY_END();
+}
@@ -0,0 +1,101 @@
+// SlaveStatus / SlaveRxStats: wire layout, CRC and the receive hash
+#include <unity.h>
+#include <SlaveStatus.h>
+#include <string.h>
+
+void setUp() {}
+void tearDown() {}
+
+static SlaveStatus sample() {
+  SlaveStatus st;
+  memset(&st, 0, sizeof(st));
+  st.magic = SLAVE_STATUS_MAGIC;
+  st.version = SLAVE_STATUS_VERSION;
+  st.bootCount = 513;
+  st.relayMask = 0x8001;
+  st.relayKnown = 0x8003;
+  st.flags = SLAVE_FLAG_WATER_WET | SLAVE_FLAG_UNLOCK_RELAY2;
+  st.crc = slaveStatusCrc(st);
+  return st;
+}
+
+void test_frames_fit_one_avr_wire_buffer() {
+  TEST_ASSERT_EQUAL(11, sizeof(SlaveStatus));
+  TEST_ASSERT_LESS_OR_EQUAL(32, sizeof(SlaveRxStats));
+}
+
+void test_little_endian_layout() {
+  SlaveStatus st = sample();
+  const uint8_t *p = (const uint8_t *)&st;
+  TEST_ASSERT_EQUAL_HEX8(SLAVE_STATUS_MAGIC, p[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x01, p[2]); // bootCount 0x0201
+  TEST_ASSERT_EQUAL_HEX8(0x02, p[3]);
+  TEST_ASSERT_EQUAL_HEX8(0x01, p[4]); // relayMask 0x8001
+  TEST_ASSERT_EQUAL_HEX8(0x80, p[5]);
+  TEST_ASSERT_EQUAL_HEX8(st.crc, p[sizeof(st) - 1]);
+}
+
+void test_valid_frame_and_every_single_bit_flip() {
+  SlaveStatus st = sample();
+  TEST_ASSERT_TRUE(slaveStatusValid(st));
+  uint8_t *p = (uint8_t *)&st;
+  for (size_t i = 0; i < sizeof(st); i++) {
+    for (uint8_t b = 0; b < 8; b++) {
+      p[i] ^= 1 << b;
+      TEST_ASSERT_FALSE(slaveStatusValid(st));
+      p[i] ^= 1 << b;
+    }
+  }
+}
+
+void test_wrong_version_is_invalid() {
+  SlaveStatus st = sample();
+  st.version = SLAVE_STATUS_VERSION + 1;
+  st.crc = slaveStatusCrc(st);
+  TEST_ASSERT_FALSE(slaveStatusValid(st));
+}
+
+void test_idle_bus_reads_invalid() {
+  SlaveStatus st;
+  memset(&st, 0xFF, sizeof(st)); // no slave: SDA stays high
+  TEST_ASSERT_FALSE(slaveStatusValid(st));
+  memset(&st, 0, sizeof(st));
+  TEST_ASSERT_FALSE(slaveStatusValid(st));
+}
+
+static uint32_t hashOf(const char *const *packets, size_t n) {
+  uint32_t h = SLAVE_RX_HASH_INIT;
+  for (size_t i = 0; i < n; i++) h = slaveRxHash(h, packets[i], strlen(packets[i]));
+  return h;
+}
+
+void test_rx_hash_is_order_and_boundary_sensitive() {
+  const char *a[] = {"1:1", "2:0"};
+  const char *b[] = {"2:0", "1:1"};
+  const char *merged[] = {"1:12:0"};
+  const char *dropped[] = {"1:1"};
+  TEST_ASSERT_TRUE(hashOf(a, 2) != hashOf(b, 2));
+  TEST_ASSERT_TRUE(hashOf(a, 2) != hashOf(merged, 1));
+  TEST_ASSERT_TRUE(hashOf(a, 2) != hashOf(dropped, 1));
+  TEST_ASSERT_EQUAL_HEX32(hashOf(a, 2), hashOf(a, 2));
+}
+
+void test_rx_stats_crc() {
+  SlaveRxStats rx = {SLAVE_RX_MAGIC, 1000, 0x12345678, 3, 0, 1000, 52000, 90, 0};
+  rx.crc = slaveRxCrc(rx);
+  uint8_t crc = rx.crc;
+  rx.packets--;
+  TEST_ASSERT_TRUE(slaveRxCrc(rx) != crc);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_fit_one_avr_wire_buffer);
+  RUN_TEST(test_little_endian_layout);
+  RUN_TEST(test_valid_frame_and_every_single_bit_flip);
+  RUN_TEST(test_wrong_version_is_invalid);
+  RUN_TEST(test_idle_bus_reads_invalid);
+  RUN_TEST(test_rx_hash_is_order_and_boundary_sensitive);
+  RUN_TEST(test_rx_stats_crc);
+  return UNITY_END();
+}
@@ -0,0 +1,196 @@
+// SmsSession: per-recipient outcome, result timeout as a failure, one retry,
+// recipients copied at start; SmsAggregator digest batching
+#include <unity.h>
+#include <string>
+#include <vector>
+#include <SmsAggregator.h>
+
+// Scripted SIM800L: answers every AT+CMGS with a prompt and every Ctrl+Z with
+// the next reply of the script ("" = silence)
+struct FakeModem {
+  std::string in;              // from the session
+  std::string out;             // to the session
+  std::vector<std::string> replies;
+  size_t reply = 0;
+  bool prompt = true;
+  std::vector<std::string> dialled;
+  int escapes = 0;
+
+  void print(const char *s) {
+    in += s;
+    size_t at = in.find("AT+CMGS=\"");
+    size_t end = at == std::string::npos ? at : in.find("\"\r\n", at + 9);
+    if (end != std::string::npos) {
+      dialled.push_back(in.substr(at + 9, end - at - 9));
+      in.clear();
+      if (prompt) out += "\r\n> ";
+    }
+  }
+  void write(uint8_t c) {
+    if (c == 27) escapes++;
+    if (c != 26) return;
+    in.clear();
+    out += reply < replies.size() ? replies[reply++] : std::string();
+  }
+  int available() { return (int)out.size(); }
+  int read() {
+    if (out.empty()) return -1;
+    int c = (uint8_t)out[0];
+    out.erase(0, 1);
+    return c;
+  }
+};
+
+struct Outcome {
+  uint8_t recipient;
+  bool sent;
+  uint32_t ms;
+};
+static std::vector<Outcome> outcomes;
+
+static void onResult(uint8_t recipient, bool sent, uint32_t ms) { outcomes.push_back({recipient, sent, ms}); }
+
+// Step every 100 ms until idle; returns the time it ended
+static uint32_t runSession(SmsSession<FakeModem> &s, uint32_t now) {
+  while (s.step(now)) {
+    now += 100;
+    TEST_ASSERT_LESS_THAN(600000, now);
+  }
+  return now;
+}
+
+void setUp() { outcomes.clear(); }
+void tearDown() {}
+
+void test_sends_to_every_recipient_and_skips_empty_ones() {
+  FakeModem modem;
+  modem.replies = {"\r\n+CMGS: 1\r\n\r\nOK\r\n", "\r\n+CMGS: 2\r\n\r\nOK\r\n"};
+  SmsSession<FakeModem> s(modem, onResult);
+  const char *to[3] = {"+4911", "", "+4933"};
+  TEST_ASSERT_TRUE(s.start("water", to, 3, 0));
+  TEST_ASSERT_FALSE(s.start("again", to, 3, 0)); // busy
+  runSession(s, 0);
+  TEST_ASSERT_EQUAL(2, (int)outcomes.size());
+  TEST_ASSERT_EQUAL_UINT8(0, outcomes[0].recipient);
+  TEST_ASSERT_EQUAL_UINT8(2, outcomes[1].recipient);
+  TEST_ASSERT_TRUE(outcomes[0].sent && outcomes[1].sent);
+  TEST_ASSERT_EQUAL(2, (int)modem.dialled.size());
+  TEST_ASSERT_EQUAL_STRING("+4933", modem.dialled[1].c_str());
+  TEST_ASSERT_EQUAL(0, modem.escapes);
+}
+
+// No answer within RESULT_MS used to count as sent
+void test_result_timeout_is_a_failure_after_one_retry() {
+  FakeModem modem;
+  modem.replies = {"", ""};
+  SmsSession<FakeModem> s(modem, onResult);
+  const char *to[1] = {"+4911"};
+  s.start("alert", to, 1, 0);
+  uint32_t end = runSession(s, 0);
+  TEST_ASSERT_EQUAL(1, (int)outcomes.size());
+  TEST_ASSERT_FALSE(outcomes[0].sent);
+  TEST_ASSERT_EQUAL(2, (int)modem.dialled.size()); // tried twice
+  TEST_ASSERT_EQUAL(2, modem.escapes);
+  uint32_t least = 2 * SmsSession<FakeModem>::RESULT_MS + SmsSession<FakeModem>::RETRY_MS;
+  TEST_ASSERT_GREATER_OR_EQUAL(least, outcomes[0].ms);
+  TEST_ASSERT_LESS_OR_EQUAL(least + 1000, end);
+}
+
+void test_retry_after_a_timeout_can_still_succeed() {
+  FakeModem modem;
+  modem.replies = {"", "\r\n+CMGS: 7\r\n"};
+  SmsSession<FakeModem> s(modem, onResult);
+  const char *to[2] = {"+4911", "+4922"};
+  modem.replies.push_back("\r\nOK\r\n");
+  s.start("alert", to, 2, 0);
+  runSession(s, 0);
+  TEST_ASSERT_EQUAL(2, (int)outcomes.size());
+  TEST_ASSERT_TRUE(outcomes[0].sent);
+  TEST_ASSERT_TRUE(outcomes[1].sent);
+  TEST_ASSERT_EQUAL(3, (int)modem.dialled.size());
+  TEST_ASSERT_EQUAL_STRING("+4911", modem.dialled[1].c_str());
+}
+
+void test_error_and_missing_prompt_fail_after_the_retry() {
+  FakeModem modem;
+  modem.replies = {"\r\n+CMS ERROR: 500\r\n", "\r\nERROR\r\n"};
+  SmsSession<FakeModem> s(modem, onResult);
+  const char *to[1] = {"+4911"};
+  s.start("alert", to, 1, 0);
+  runSession(s, 0);
+  TEST_ASSERT_EQUAL(1, (int)outcomes.size());
+  TEST_ASSERT_FALSE(outcomes[0].sent);
+  TEST_ASSERT_EQUAL(2, (int)modem.dialled.size());
+
+  outcomes.clear();
+  FakeModem mute;
+  mute.prompt = false;
+  SmsSession<FakeModem> s2(mute, onResult);
+  s2.start("alert", to, 1, 0);
+  runSession(s2, 0);
+  TEST_ASSERT_EQUAL(1, (int)outcomes.size());
+  TEST_ASSERT_FALSE(outcomes[0].sent);
+  TEST_ASSERT_EQUAL(2, (int)mute.dialled.size());
+}
+
+// The sketch passes pointers into megaConfig, which "cfg:phone=" rewrites from
+// the I2C interrupt while a digest is going out
+void test_recipients_are_copied_at_start() {
+  FakeModem modem;
+  modem.replies = {"OK", "OK"};
+  SmsSession<FakeModem> s(modem, onResult);
+  char phone[SMS_NUMBER_MAX] = "+4911";
+  char phone2[SMS_NUMBER_MAX] = "+4922";
+  const char *to[2] = {phone, phone2};
+  s.start("alert", to, 2, 0);
+  s.step(0);
+  strcpy(phone2, "+4999");
+  phone[0] = '\0';
+  runSession(s, 100);
+  TEST_ASSERT_EQUAL(2, (int)modem.dialled.size());
+  TEST_ASSERT_EQUAL_STRING("+4911", modem.dialled[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("+4922", modem.dialled[1].c_str());
+}
+
+void test_overlong_number_is_cut_not_overrun() {
+  FakeModem modem;
+  modem.replies = {"OK"};
+  SmsSession<FakeModem> s(modem, onResult);
+  const char *to[1] = {"+49123456789012345678901234"};
+  s.start("alert", to, 1, 0);
+  runSession(s, 0);
+  TEST_ASSERT_EQUAL(SMS_NUMBER_MAX - 1, (int)modem.dialled[0].size());
+}
+
+static int describe(char *out, size_t size, uint8_t kind, uint8_t source) {
+  return snprintf(out, size, "alert %u/%u", kind, source);
+}
+
+void test_digest_batches_and_latches() {
+  SmsAggregator<4> agg({15000, 120000}, describe);
+  TEST_ASSERT_EQUAL(SMS_RAISED, agg.raise(0, 1, 1000));
+  TEST_ASSERT_EQUAL(SMS_MERGED, agg.raise(0, 1, 2000));
+  TEST_ASSERT_EQUAL(SMS_RAISED, agg.raise(1, 0, 3000));
+  TEST_ASSERT_FALSE(agg.due(15999));
+  TEST_ASSERT_TRUE(agg.due(16000));
+  char text[SMS_TEXT_MAX + 1];
+  TEST_ASSERT_EQUAL_UINT8(2, agg.digest(text, sizeof(text), 16000));
+  TEST_ASSERT_EQUAL_STRING("alert 0/1 (x2)\nalert 1/0", text);
+  TEST_ASSERT_EQUAL(SMS_SUPPRESSED, agg.raise(0, 1, 20000));
+  TEST_ASSERT_TRUE(agg.clear(0, 1));
+  TEST_ASSERT_EQUAL(SMS_RAISED, agg.raise(0, 1, 21000));
+  TEST_ASSERT_FALSE(agg.due(16000 + 120000 - 1)); // min gap from the last digest
+  TEST_ASSERT_TRUE(agg.due(16000 + 120000));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sends_to_every_recipient_and_skips_empty_ones);
+  RUN_TEST(test_result_timeout_is_a_failure_after_one_retry);
+  RUN_TEST(test_retry_after_a_timeout_can_still_succeed);
+  RUN_TEST(test_error_and_missing_prompt_fail_after_the_retry);
+  RUN_TEST(test_recipients_are_copied_at_start);
+  RUN_TEST(test_overlong_number_is_cut_not_overrun);
+  RUN_TEST(test_digest_batches_and_latches);
+  return UNITY_END();
+}
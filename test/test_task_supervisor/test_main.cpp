@@ -0,0 +1,218 @@
+// TaskSupervisor: budget overruns, crash attribution through the persisted
+// record, and the STEP_* resumable step macros
+#include <unity.h>
+#include <TaskSupervisor.h>
+
+static uint32_t clockNow;
+static uint32_t taskCost[3];
+static TaskRecord persisted;
+static TaskRecord seenInTask;
+static int persists;
+
+static uint32_t fakeClock() { return clockNow; }
+static void persist(const TaskRecord &rec) {
+  persisted = rec;
+  persists++;
+}
+
+static void fast() { clockNow += taskCost[0]; }
+static void slow() {
+  seenInTask = persisted; // what a watchdog reset now would leave behind
+  clockNow += taskCost[1];
+}
+static void idle() { clockNow += taskCost[2]; }
+
+static const TaskSpec TASKS[] = {
+  {"fast", fast, 100},
+  {"slow", slow, 1000},
+  {"idle", idle, 50},
+};
+
+static const TaskRecord NO_RECORD = {0, 0, 0, 0, 0};
+
+void setUp() {
+  clockNow = 0;
+  taskCost[0] = 10;
+  taskCost[1] = 500;
+  taskCost[2] = 5;
+  persisted = NO_RECORD;
+  seenInTask = NO_RECORD;
+  persists = 0;
+}
+void tearDown() {}
+
+void test_first_boot_starts_clean_record() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  TEST_ASSERT_EQUAL(TASK_NONE, sup.begin(NO_RECORD));
+  TEST_ASSERT_EQUAL_HEX32(TASK_RECORD_MAGIC, persisted.magic);
+  TEST_ASSERT_EQUAL(TASK_NONE, persisted.current);
+  TEST_ASSERT_EQUAL(TASK_NONE, persisted.lastOverrun);
+  TEST_ASSERT_EQUAL(0, persisted.resets);
+}
+
+void test_running_task_is_persisted_and_cleared() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  sup.run(1);
+  TEST_ASSERT_EQUAL(1, seenInTask.current);
+  TEST_ASSERT_EQUAL(TASK_NONE, persisted.current);
+  TEST_ASSERT_EQUAL(3, persists); // begin, before, after
+}
+
+void test_reset_inside_task_names_it() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  sup.run(1);
+  TaskRecord atReset = seenInTask;
+
+  TaskSupervisor<3> next(TASKS, fakeClock, persist);
+  TEST_ASSERT_EQUAL(1, next.begin(atReset));
+  TEST_ASSERT_EQUAL_STRING("slow", next.name(1));
+  TEST_ASSERT_EQUAL(1, next.record().resets);
+  TEST_ASSERT_EQUAL(TASK_NONE, persisted.current);
+
+  // A restart the firmware asked for is not a crash
+  TaskSupervisor<3> clean(TASKS, fakeClock, persist);
+  TEST_ASSERT_EQUAL(TASK_NONE, clean.begin(atReset, false));
+  TEST_ASSERT_EQUAL(0, clean.record().resets);
+}
+
+void test_reset_between_tasks_is_not_attributed() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  sup.runAll();
+  TaskSupervisor<3> next(TASKS, fakeClock, persist);
+  TEST_ASSERT_EQUAL(TASK_NONE, next.begin(persisted));
+  TEST_ASSERT_EQUAL_STRING("none", next.name(TASK_NONE));
+}
+
+void test_overrun_is_counted_and_reported_once() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  sup.runAll();
+  uint8_t id;
+  uint32_t us;
+  TEST_ASSERT_FALSE(sup.takeOverrun(id, us));
+
+  taskCost[2] = 80; // over its 50 us
+  sup.runAll();
+  sup.runAll();
+  TEST_ASSERT_TRUE(sup.takeOverrun(id, us));
+  TEST_ASSERT_EQUAL(2, id);
+  TEST_ASSERT_EQUAL_UINT32(80, us);
+  TEST_ASSERT_FALSE(sup.takeOverrun(id, us));
+
+  TEST_ASSERT_EQUAL_UINT32(3, sup.stats(2).runs);
+  TEST_ASSERT_EQUAL_UINT32(2, sup.stats(2).overruns);
+  TEST_ASSERT_EQUAL_UINT32(80, sup.stats(2).maxUs);
+  TEST_ASSERT_EQUAL_UINT32(0, sup.stats(1).overruns);
+  TEST_ASSERT_EQUAL(2, persisted.lastOverrun);
+}
+
+void test_budget_is_inclusive() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  taskCost[1] = 1000;
+  sup.run(1);
+  TEST_ASSERT_EQUAL_UINT32(0, sup.stats(1).overruns);
+}
+
+void test_overrun_survives_clock_wrap() {
+  TaskSupervisor<3> sup(TASKS, fakeClock, persist);
+  sup.begin(NO_RECORD);
+  clockNow = 0xFFFFFFF0UL;
+  sup.run(0);
+  TEST_ASSERT_EQUAL_UINT32(10, sup.stats(0).maxUs);
+  TEST_ASSERT_EQUAL_UINT32(0, sup.stats(0).overruns);
+}
+
+// STEP_* ---------------------------------------------------------------
+
+static StepTask beepTask;
+static int beep;
+static int buzzerOnCount;
+static bool buzzer;
+
+static bool beepStep(uint32_t now) {
+  STEP_BEGIN(beepTask);
+  for (beep = 0; beep < 3; beep++) {
+    buzzer = true;
+    buzzerOnCount++;
+    STEP_WAIT_MS(beepTask, now, 200);
+    buzzer = false;
+    STEP_WAIT_MS(beepTask, now, 100);
+  }
+  STEP_END(beepTask);
+}
+
+void test_step_waits_resume_where_they_left() {
+  STEP_RESET(beepTask);
+  buzzerOnCount = 0;
+  uint32_t now = 1000;
+  TEST_ASSERT_FALSE(beepStep(now));
+  TEST_ASSERT_TRUE(buzzer);
+  TEST_ASSERT_FALSE(beepStep(now + 199));
+  TEST_ASSERT_TRUE(buzzer);
+  now += 200;
+  TEST_ASSERT_FALSE(beepStep(now));
+  TEST_ASSERT_FALSE(buzzer);
+
+  int calls = 0;
+  bool done = false;
+  while (!done && calls < 100) {
+    now += 50;
+    done = beepStep(now);
+    calls++;
+  }
+  TEST_ASSERT_TRUE(done);
+  TEST_ASSERT_EQUAL(3, buzzerOnCount);
+  TEST_ASSERT_EQUAL(0, beepTask.pc);
+  // Finished: the next call starts over
+  TEST_ASSERT_FALSE(beepStep(now));
+  TEST_ASSERT_EQUAL(4, buzzerOnCount);
+}
+
+static StepTask condTask;
+static bool ready;
+static int yields;
+
+static bool condStep() {
+  STEP_BEGIN(condTask);
+  STEP_WAIT_UNTIL(condTask, ready);
+  STEP_YIELD(condTask);
+  yields++;
+  if (yields > 1) STEP_EXIT(condTask);
+  STEP_YIELD(condTask);
+  STEP_END(condTask);
+}
+
+void test_step_wait_until_yield_and_exit() {
+  STEP_RESET(condTask);
+  ready = false;
+  yields = 0;
+  TEST_ASSERT_FALSE(condStep());
+  TEST_ASSERT_FALSE(condStep());
+  ready = true;
+  TEST_ASSERT_FALSE(condStep()); // condition met, then yields
+  TEST_ASSERT_FALSE(condStep()); // past the yield, yields again
+  TEST_ASSERT_TRUE(condStep());
+  TEST_ASSERT_EQUAL(1, yields);
+  TEST_ASSERT_FALSE(condStep());
+  TEST_ASSERT_TRUE(condStep()); // STEP_EXIT on the second pass
+  TEST_ASSERT_EQUAL(2, yields);
+  TEST_ASSERT_EQUAL(0, condTask.pc);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_boot_starts_clean_record);
+  RUN_TEST(test_running_task_is_persisted_and_cleared);
+  RUN_TEST(test_reset_inside_task_names_it);
+  RUN_TEST(test_reset_between_tasks_is_not_attributed);
+  RUN_TEST(test_overrun_is_counted_and_reported_once);
+  RUN_TEST(test_budget_is_inclusive);
+  RUN_TEST(test_overrun_survives_clock_wrap);
+  RUN_TEST(test_step_waits_resume_where_they_left);
+  RUN_TEST(test_step_wait_until_yield_and_exit);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// TimeService: 64-bit monotonic time across the millis() wrap, drift from
+// two syncs, the SNTP retry schedule and the RTC record
+#include <unity.h>
+#include <TimeService.h>
+
+static const TimeServiceConfig CFG = {3600, 15, 600};
+static const uint64_t EPOCH0_MS = 1760745600000ULL; // 2025-10-18 00:00:00 UTC
+
+void setUp() {}
+void tearDown() {}
+
+void test_monotonic_across_millis_wrap() {
+  TimeService ts(CFG);
+  uint64_t prev = 0;
+  uint64_t virt = 0;
+  // 60 days in one-day steps: millis() wraps after 49.7
+  for (int day = 0; day <= 60; day++) {
+    uint32_t millisNow = (uint32_t)virt;
+    uint64_t mono = ts.monotonicMs(millisNow);
+    TEST_ASSERT_TRUE(mono >= prev);
+    TEST_ASSERT_TRUE(mono == virt);
+    prev = mono;
+    virt += 86400000ULL;
+  }
+}
+
+void test_stale_sample_does_not_count_as_wrap() {
+  TimeService ts(CFG);
+  ts.monotonicMs(5000);
+  // A millis() value read before the last call (e.g. in an ISR) is older, not 49 days newer
+  TEST_ASSERT_TRUE(ts.monotonicMs(4000) == 5000);
+  TEST_ASSERT_TRUE(ts.monotonicMs(6000) == 6000);
+}
+
+void test_wall_clock_across_wrap() {
+  TimeService ts(CFG);
+  ts.monotonicMs(0);
+  ts.synced(EPOCH0_MS, 1000);
+  uint32_t m = 1000;
+  for (int i = 0; i < 50; i++) { // 50 days
+    m += 86400000UL;
+    ts.monotonicMs(m);
+  }
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)(EPOCH0_MS / 1000) + 50 * 86400, ts.now(m));
+}
+
+void test_event_before_sync_gets_real_timestamp() {
+  TimeService ts(CFG);
+  uint64_t scanAt = ts.monotonicMs(2000);
+  TEST_ASSERT_EQUAL_UINT32(0, ts.epochAt(scanAt));
+  TEST_ASSERT_FALSE(ts.valid());
+  ts.synced(EPOCH0_MS + 60000, 62000); // a minute later
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)(EPOCH0_MS / 1000), ts.epochAt(scanAt));
+}
+
+void test_drift_from_two_syncs() {
+  TimeService ts(CFG);
+  ts.synced(EPOCH0_MS, 0);
+  // Crystal 100 ppm slow: one real hour shows up as 3599.64 s of millis()
+  uint32_t m = 3599640;
+  ts.synced(EPOCH0_MS + 3600000, m);
+  TEST_ASSERT_INT_WITHIN(1, 100, ts.driftPpm());
+  // The next hour is extrapolated with the drift
+  uint32_t m2 = m + 3599640;
+  TEST_ASSERT_TRUE(ts.epochMs(m2) >= EPOCH0_MS + 7200000 - 2);
+  TEST_ASSERT_TRUE(ts.epochMs(m2) <= EPOCH0_MS + 7200000 + 2);
+}
+
+void test_clock_step_is_not_drift() {
+  TimeService ts(CFG);
+  ts.synced(EPOCH0_MS, 0);
+  ts.synced(EPOCH0_MS + 3600000 + 30000, 3600000); // 30 s jump
+  TEST_ASSERT_EQUAL(0, ts.driftPpm());
+  ts.synced(EPOCH0_MS, 1000); // syncs too close together are ignored for drift
+  TEST_ASSERT_EQUAL(0, ts.driftPpm());
+}
+
+void test_retry_doubles_until_answer() {
+  TimeService ts(CFG);
+  uint32_t m = 0;
+  TEST_ASSERT_TRUE(ts.shouldRequestSync(m));
+  const uint16_t waits[] = {15, 30, 60, 120, 240, 480, 600, 600};
+  for (uint16_t w : waits) {
+    TEST_ASSERT_FALSE(ts.shouldRequestSync(m + w * 1000UL - 1));
+    m += w * 1000UL;
+    TEST_ASSERT_TRUE(ts.shouldRequestSync(m));
+  }
+  ts.synced(EPOCH0_MS, m + 100);
+  TEST_ASSERT_FALSE(ts.shouldRequestSync(m + 100 + 3599999));
+  TEST_ASSERT_TRUE(ts.shouldRequestSync(m + 100 + 3600000));
+  // Unanswered resync falls back to the short retry
+  TEST_ASSERT_TRUE(ts.shouldRequestSync(m + 100 + 3600000 + 15000));
+}
+
+void test_rtc_record_round_trip() {
+  TimeService ts(CFG);
+  ts.synced(EPOCH0_MS, 0);
+  ts.synced(EPOCH0_MS + 3600000, 3599640);
+  TimeRtcRecord rec = ts.save(4000000);
+
+  TimeService after(CFG);
+  TEST_ASSERT_TRUE(after.restore(rec));
+  TEST_ASSERT_EQUAL(TIME_ESTIMATED, after.quality());
+  TEST_ASSERT_EQUAL(ts.driftPpm(), after.driftPpm());
+  TEST_ASSERT_EQUAL_UINT32(ts.now(4000000), after.now(0));
+
+  rec.epoch ^= 1;
+  TEST_ASSERT_FALSE(TimeService(CFG).restore(rec));
+  TimeService unset(CFG);
+  TEST_ASSERT_FALSE(TimeService(CFG).restore(unset.save(1000)));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_monotonic_across_millis_wrap);
+  RUN_TEST(test_stale_sample_does_not_count_as_wrap);
+  RUN_TEST(test_wall_clock_across_wrap);
+  RUN_TEST(test_event_before_sync_gets_real_timestamp);
+  RUN_TEST(test_drift_from_two_syncs);
+  RUN_TEST(test_clock_step_is_not_drift);
+  RUN_TEST(test_retry_doubles_until_answer);
+  RUN_TEST(test_rtc_record_round_trip);
+  return UNITY_END();
+}
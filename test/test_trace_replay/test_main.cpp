@@ -0,0 +1,226 @@
+// TraceReplay: traces recorded the way main.cpp records the float sensor
+// (edges from the ISR, TR_FLOAT from checkWaterLevel, 30 s flushes into
+// segments) replayed through FloatReplay on virtual time
+#include <unity.h>
+#include <vector>
+#include <TraceReplay.h>
+
+// As in main.cpp
+static const LevelDebouncer::Config CFG = {300, 1500, 3000};
+static const uint32_t FLUSH_MS = 30000;     // TRACE_FLUSH_INTERVAL
+static const uint32_t LOOP_MAX_MS = 100;    // FP_POLL_MS: idle limit while the float is unsettled
+static const uint16_t TICK_MS = 100;
+static const uint16_t TOLERANCE_MS = 2 * LOOP_MAX_MS;
+
+typedef std::vector<uint8_t> Segment;
+
+static uint32_t rng;
+
+static uint32_t nextRandom() {
+  rng = rng * 1103515245u + 12345u;
+  return rng >> 1;
+}
+
+// The board: float ISR, loop passes at a jittered pace, flushes into segments
+struct Board {
+  LevelDebouncer deb{CFG};
+  TraceBuffer<512> trace;
+  std::vector<Segment> segments;
+  uint32_t seq = 0;
+  uint32_t now = 0;
+  uint32_t lastFlush = 0;
+  bool raw = false;
+  bool last = false;
+  uint32_t changes = 0;
+
+  void boot(bool level, uint32_t ms) {
+    now = lastFlush = ms;
+    raw = last = level;
+    deb.begin(level, ms);
+    trace.add(TR_BOOT, 0, 0xFF, ms);
+    trace.add(TR_FLOAT, 1, level, ms);
+  }
+
+  void edge(bool level) {
+    if (level == raw) return;
+    raw = level;
+    deb.onEdge(level, now);
+    trace.add(TR_FLOAT_EDGE, level, 0, now);
+  }
+
+  void loopPass() {
+    deb.update(now);
+    if (deb.state() != last) {
+      last = deb.state();
+      trace.add(TR_FLOAT, 0, last, now);
+      changes++;
+    }
+    if (now - lastFlush >= FLUSH_MS) flush();
+  }
+
+  // Raw level from level(t), loop passes 1..LOOP_MAX_MS apart
+  template <typename Level>
+  void run(uint32_t untilMs, Level level) {
+    while (now < untilMs) {
+      uint32_t next = now + 1 + nextRandom() % LOOP_MAX_MS;
+      for (; now < next; now++) edge(level(now));
+      loopPass();
+    }
+  }
+
+  void flush() {
+    uint8_t chunk[512];
+    uint32_t baseMs;
+    uint16_t n = trace.take(chunk, baseMs);
+    Segment s(sizeof(TraceSegmentHeader) + TRACE_RECORD_MAX);
+    s.resize(traceSegmentStart(s.data(), seq++, baseMs, 0));
+    s.insert(s.end(), chunk, chunk + n);
+    segments.push_back(s);
+    lastFlush = now;
+  }
+};
+
+static FloatReplay replayAll(const std::vector<Segment> &segments) {
+  FloatReplay fr(CFG, TOLERANCE_MS);
+  for (const Segment &s : segments) {
+    TraceReader reader(s.data(), s.size());
+    TEST_ASSERT_TRUE(reader.ok());
+    traceReplay(reader, fr, TICK_MS);
+    TEST_ASSERT_FALSE(reader.truncated());
+  }
+  fr.finish();
+  return fr;
+}
+
+// Sloshing: bursts of edges around each real level change
+static bool sloshing(uint32_t t) {
+  bool wet = (t / 20000) % 2;
+  uint32_t into = t % 20000;
+  if (into < 600) return ((into / 37) % 2) ? !wet : wet;
+  return wet;
+}
+
+void setUp() { rng = 99; }
+void tearDown() {}
+
+void test_replay_matches_every_recorded_change() {
+  Board b;
+  b.boot(false, 1000);
+  b.run(400000, sloshing);
+  b.flush();
+  TEST_ASSERT_GREATER_THAN(10, b.changes);
+  TEST_ASSERT_GREATER_THAN(5, b.segments.size());
+
+  FloatReplay fr = replayAll(b.segments);
+  TEST_ASSERT_EQUAL_UINT32(b.changes, fr.matched());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.missed());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.extra());
+  TEST_ASSERT_LESS_OR_EQUAL(TOLERANCE_MS, fr.maxSkewMs());
+}
+
+void test_short_blips_replay_as_no_change() {
+  Board b;
+  b.boot(true, 0);
+  // 100 ms dry blips every 2 s: the integrator never reaches zero
+  b.run(120000, [](uint32_t t) { return t % 2000 >= 100; });
+  b.flush();
+  TEST_ASSERT_EQUAL_UINT32(0, b.changes);
+  FloatReplay fr = replayAll(b.segments);
+  TEST_ASSERT_EQUAL_UINT32(0, fr.matched());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.extra());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.missed());
+}
+
+// The replay is only worth something if it notices when the board and the
+// debouncer disagree: drop the raw edges of one segment
+void test_lost_edges_show_up_as_mismatches() {
+  Board b;
+  b.boot(false, 0);
+  b.run(200000, sloshing);
+  b.flush();
+
+  std::vector<Segment> tampered;
+  for (size_t i = 0; i < b.segments.size(); i++) {
+    const Segment &s = b.segments[i];
+    if (i != 2) {
+      tampered.push_back(s);
+      continue;
+    }
+    // Re-encode segment 2 without its TR_FLOAT_EDGE records
+    TraceReader reader(s.data(), s.size());
+    TraceRecord r;
+    reader.next(r); // TR_SYNC
+    Segment out(sizeof(TraceSegmentHeader) + TRACE_RECORD_MAX);
+    out.resize(traceSegmentStart(out.data(), reader.seq(), r.ms, 0));
+    uint32_t last = r.ms;
+    while (reader.next(r)) {
+      if (r.type == TR_FLOAT_EDGE) continue;
+      uint8_t rec[TRACE_RECORD_MAX];
+      out.insert(out.end(), rec, rec + traceEncode(rec, r.type, r.ms - last, r.arg, r.value));
+      last = r.ms;
+    }
+    tampered.push_back(out);
+  }
+
+  FloatReplay fr = replayAll(tampered);
+  TEST_ASSERT_GREATER_THAN(0, fr.missed());
+  TEST_ASSERT_LESS_THAN(b.changes, fr.matched());
+}
+
+void test_reboot_reseeds_from_the_boot_record() {
+  Board first;
+  first.boot(false, 0);
+  first.run(100000, sloshing);
+  first.flush();
+
+  // Reset with water present: millis() starts again, the seed says wet
+  Board second;
+  second.seq = first.seq;
+  second.boot(true, 50);
+  second.run(100000, [](uint32_t t) { return t < 40000 || t > 70000; });
+  second.flush();
+
+  std::vector<Segment> all = first.segments;
+  all.insert(all.end(), second.segments.begin(), second.segments.end());
+  FloatReplay fr = replayAll(all);
+  TEST_ASSERT_EQUAL_UINT32(first.changes + second.changes, fr.matched());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.missed());
+  TEST_ASSERT_EQUAL_UINT32(0, fr.extra());
+}
+
+void test_driver_ticks_between_records() {
+  struct Counter {
+    uint32_t ticks = 0, records = 0, last = 0;
+    bool seen = false;
+    void tick(uint32_t ms) { ticks++; last = ms; }
+    void record(const TraceRecord &r) {
+      if (!seen) last = r.ms;
+      records++;
+      seen = true;
+    }
+    bool started() const { return seen; }
+    uint32_t lastTickMs() const { return last; }
+  } c;
+  uint8_t seg[64];
+  size_t n = traceSegmentStart(seg, 0, 1000, 0);
+  n += traceEncode(seg + n, TR_FLOAT_EDGE, 0, 1, 0);      // 1000
+  n += traceEncode(seg + n, TR_FLOAT_EDGE, 1000, 0, 0);   // 2000
+  for (int i = 0; i < 10; i++) {
+    n += traceEncode(seg + n, TR_FLOAT_EDGE, 30, i & 1, 0); // 2030 .. 2300
+  }
+  TraceReader reader(seg, n);
+  TEST_ASSERT_EQUAL_UINT32(13, traceReplay(reader, c, 100));
+  TEST_ASSERT_EQUAL_UINT32(13, c.records);
+  TEST_ASSERT_EQUAL_UINT32(12, c.ticks); // 1100 .. 2200: dense records still tick
+  TEST_ASSERT_EQUAL_UINT32(2200, c.last);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_matches_every_recorded_change);
+  RUN_TEST(test_short_blips_replay_as_no_change);
+  RUN_TEST(test_lost_edges_show_up_as_mismatches);
+  RUN_TEST(test_reboot_reseeds_from_the_boot_record);
+  RUN_TEST(test_driver_ticks_between_records);
+  return UNITY_END();
+}